@@ -20,7 +20,8 @@ class Blob {
  public:
   Blob()
        : data_(), diff_(), num_(0), channels_(0), height_(0), width_(0),
-       count_(0), capacity_(0) {}
+       count_(0), capacity_(0), shape_generation_(0),
+       host_policy_(HOST_DEFAULT), host_node_(-1) {}
   explicit Blob(const int num, const int channels, const int height,
     const int width);
   /**
@@ -45,6 +46,12 @@ class Blob {
   inline int height() const { return height_; }
   inline int width() const { return width_; }
   inline int count() const { return count_; }
+  /**
+   * @brief A counter that Reshape advances whenever it changes the shape, so
+   *        that a Net can tell which layers' inputs changed shape since they
+   *        were last reshaped.
+   */
+  inline uint64_t shape_generation() const { return shape_generation_; }
   inline int offset(const int n, const int c = 0, const int h = 0,
       const int w = 0) const {
     CHECK_GE(n, 0);
@@ -125,6 +132,38 @@ class Blob {
    * shared_ptr calls its destructor when reset with the "=" operator.
    */
   void ShareDiff(const Blob& other);
+  /**
+   * @brief Make the data and diff of this Blob views of the count() elements
+   *        of the data and diff of Blob other starting at offset, so that a
+   *        layer writing this Blob writes that slice of other in place.
+   *
+   * The view lasts until a Reshape beyond count() reallocates this Blob, or
+   * EndView.
+   */
+  void ViewOf(const Blob& other, const int offset);
+  /// @brief Make only the data a view, as in ViewOf.
+  void ViewDataOf(const Blob& other, const int offset);
+  /// @brief Make only the diff a view, as in ViewOf.
+  void ViewDiffOf(const Blob& other, const int offset);
+  /// @brief Whether both data and diff are views of other at offset.
+  bool IsViewOf(const Blob& other, const int offset) const;
+  /// @brief Whether the data or the diff is a view of another Blob.
+  bool is_view() const;
+  /**
+   * @brief Give a view its own memory again, keeping its data (but not its
+   *        diff). Only the data or the diff that is a view is reallocated.
+   */
+  void EndView();
+
+  /**
+   * @brief Place the host memory of the data and diff by policy (see
+   *        HostMemoryPolicy), now and whenever Reshape reallocates them.
+   *        node is the NUMA node of HOST_BIND.
+   *
+   * Memory already allocated moves; views are left to the Blob they view.
+   */
+  void set_host_policy(HostMemoryPolicy policy, int node = -1);
+  inline HostMemoryPolicy host_policy() const { return host_policy_; }
 
  protected:
   shared_ptr<SyncedMemory> data_;
@@ -135,6 +174,9 @@ class Blob {
   int width_;
   int count_;
   int capacity_;
+  uint64_t shape_generation_;
+  HostMemoryPolicy host_policy_;
+  int host_node_;
 
   DISABLE_COPY_AND_ASSIGN(Blob);
 };  // class Blob
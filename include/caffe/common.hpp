@@ -4,6 +4,7 @@
 #include <boost/shared_ptr.hpp>
 #include <gflags/gflags.h>
 #include <glog/logging.h>
+#include <stdint.h>
 
 #include <cmath>
 #include <fstream>  // NOLINT(readability/streams)
@@ -89,17 +90,21 @@ using std::vector;
 // Currently it initializes google flags and google logging.
 void GlobalInit(int* pargc, char*** pargv);
 
-// A singleton class to hold common caffe stuff, such as the handler that
-// caffe is going to use for cublas, curand, etc.
+// Parses a list of ids and ranges of ids such as "0-3,8", the format of the
+// CPU and NUMA node lists of Linux.
+vector<int> ParseIdList(const string& list);
+
+// A class to hold common caffe stuff, such as the handler that caffe is going
+// to use for cublas, curand, etc. Each thread has its own instance, and so its
+// own mode, phase and random numbers, starting in CPU mode, in the TRAIN phase
+// and with a random seed: set them in every thread that runs a net. The seeds
+// and the cublas and curand handles are created when first used, so that an
+// instance is cheap for a thread that uses none of them.
 class Caffe {
  public:
   ~Caffe();
-  inline static Caffe& Get() {
-    if (!singleton_.get()) {
-      singleton_.reset(new Caffe());
-    }
-    return *singleton_;
-  }
+  // Returns the instance of the calling thread.
+  static Caffe& Get();
   enum Brew { CPU, GPU };
   enum Phase { TRAIN, TEST };
 
@@ -118,6 +123,19 @@ class Caffe {
     shared_ptr<Generator> generator_;
   };
 
+  // Makes the calling thread use the instance of another thread while it
+  // lives, as the threads of a parallel region do to run layers for the
+  // thread that started it. They must not change its state concurrently.
+  class Borrow {
+   public:
+    explicit Borrow(Caffe* caffe);
+    ~Borrow();
+   private:
+    Caffe* own_;
+
+    DISABLE_COPY_AND_ASSIGN(Borrow);
+  };
+
   // Getters for boost rng, curand, and cublas handles
   inline static RNG& rng_stream() {
     if (!Get().random_generator_) {
@@ -125,11 +143,29 @@ class Caffe {
     }
     return *(Get().random_generator_);
   }
-#ifndef CPU_ONLY
-  inline static cublasHandle_t cublas_handle() { return Get().cublas_handle_; }
-  inline static curandGenerator_t curand_generator() {
-    return Get().curand_generator_;
+  // The seed of the counter-based Philox streams (see util/philox.hpp) that
+  // the caffe_philox_* fills draw from.
+  static uint64_t philox_seed();
+  // Reserves the next n values of the Philox stream and returns the offset of
+  // the first. Offsets stay multiples of 4, the size of a Philox block, so
+  // the values of one reservation can be generated block by block in
+  // parallel. It is not thread safe: reserve on one thread, and split the
+  // generation of the values across threads.
+  inline static uint64_t philox_offset(const uint64_t n) {
+    const uint64_t offset = Get().philox_offset_;
+    Get().philox_offset_ += (n + 3) / 4 * 4;
+    return offset;
+  }
+  // The offset of the next reservation, and setting it, so that values can
+  // be drawn again (as by the layers Net recomputes).
+  inline static uint64_t philox_position() { return Get().philox_offset_; }
+  inline static void set_philox_position(const uint64_t offset) {
+    Get().philox_offset_ = offset;
   }
+#ifndef CPU_ONLY
+  // NULL if the handle could not be created.
+  static cublasHandle_t cublas_handle();
+  static curandGenerator_t curand_generator();
 #endif
 
   // Returns the mode: running on CPU or GPU.
@@ -144,7 +180,7 @@ class Caffe {
   inline static void set_mode(Brew mode) { Get().mode_ = mode; }
   // Sets the phase.
   inline static void set_phase(Phase phase) { Get().phase_ = phase; }
-  // Sets the random seed of both boost and curand
+  // Sets the random seed of boost, curand and the Philox stream
   static void set_random_seed(const unsigned int seed);
   // Sets the device. Since we have cublas and curand stuff, set device also
   // requires us to reset those values.
@@ -152,16 +188,59 @@ class Caffe {
   // Prints the current GPU status.
   static void DeviceQuery();
 
+  // Statistics of the host memory cache behind CaffeMallocHost (see
+  // syncedmem.hpp). Sizes are those of the size classes, or whole pages for
+  // memory placed by a HostMemoryPolicy.
+  struct HostMemoryStats {
+    size_t live_bytes;     // allocated and not yet freed
+    size_t peak_bytes;     // the maximum of live_bytes
+    size_t cached_bytes;   // freed and kept for reuse
+    uint64_t allocations;  // calls to CaffeMallocHost
+    uint64_t cache_hits;   // allocations served from the cache
+  };
+  // These, like the cache, are thread safe, and are defined with it in
+  // syncedmem.cpp.
+  static HostMemoryStats host_memory_stats();
+  // Sets how many freed bytes the cache may keep, 1 GB by default; 0 turns
+  // the caching off. Shrinking the limit releases blocks to the system.
+  static void set_host_memory_cache_limit(const size_t bytes);
+  // Advises transparent huge pages for blocks of 2 MB and more, aligning
+  // them to 2 MB. Off by default.
+  static void set_host_huge_pages(const bool huge_pages);
+  // Returns all cached blocks to the system.
+  static void ReleaseHostMemoryCache();
+
+  // Restricts the calling thread, and the threads it starts afterwards (such
+  // as the OpenMP workers), to the given CPUs. Returns false where that is
+  // not supported (it is on Linux) or the CPUs are not available.
+  static bool PinThread(const vector<int>& cpus);
+  // The CPUs that the prefetch threads of the data layers pin themselves to
+  // when they start; by default they are not pinned.
+  inline static const vector<int>& prefetch_cpus() {
+    return Get().prefetch_cpus_;
+  }
+  inline static void set_prefetch_cpus(const vector<int>& cpus) {
+    Get().prefetch_cpus_ = cpus;
+  }
+
  protected:
 #ifndef CPU_ONLY
+  // Destroys the handles, to be created again when next used.
+  void ResetHandles();
+
+  bool cublas_created_;
   cublasHandle_t cublas_handle_;
+  bool curand_created_;
   curandGenerator_t curand_generator_;
 #endif
   shared_ptr<RNG> random_generator_;
+  bool philox_seeded_;
+  uint64_t philox_seed_;
+  uint64_t philox_offset_;
+  vector<int> prefetch_cpus_;
 
   Brew mode_;
   Phase phase_;
-  static shared_ptr<Caffe> singleton_;
 
  private:
   // The private constructor to avoid duplicate instantiation.
@@ -35,6 +35,11 @@ class ArgMaxLayer : public Layer<Dtype> {
    *     the number @f$ K @f$ of maximal items to output.
    *   - out_max_val (\b optional bool, default false).
    *     if set, output a vector of pairs (max_ind, max_val) for each image.
+   *   - axis (\b optional int).
+   *     if set, take the argmax along this axis for every position of the
+   *     other axes, e.g. per-pixel label maps for axis 1. The output then
+   *     has top_k entries along the axis, holding max_val if out_max_val
+   *     is set and max_ind otherwise.
    */
   explicit ArgMaxLayer(const LayerParameter& param)
       : Layer<Dtype>(param) {}
@@ -56,7 +61,8 @@ class ArgMaxLayer : public Layer<Dtype> {
    *      the inputs @f$ x @f$
    * @param top output Blob vector (length 1)
    *   -# @f$ (N \times 1 \times K \times 1) @f$ or, if out_max_val
-   *      @f$ (N \times 2 \times K \times 1) @f$
+   *      @f$ (N \times 2 \times K \times 1) @f$, or, for axis 1,
+   *      @f$ (N \times K \times H \times W) @f$
    *      the computed outputs @f$
    *       y_n = \arg\max\limits_i x_{ni}
    *      @f$ (for @f$ K = 1 @f$).
@@ -70,6 +76,8 @@ class ArgMaxLayer : public Layer<Dtype> {
   }
   bool out_max_val_;
   size_t top_k_;
+  bool has_axis_;
+  int axis_;
 };
 
 
@@ -144,6 +152,10 @@ class BNLayer : public Layer<Dtype> {
 /**
  * @brief Takes at least two Blob%s and concatenates them along either the num
  *        or channel dimension, outputting the result.
+ *
+ * When each bottom is a contiguous slice of the top, the bottoms are made
+ * views of their slices (see Blob::ViewOf) and nothing is copied, unless the
+ * top is written in place by the next layer.
  */
 template <typename Dtype>
 class ConcatLayer : public Layer<Dtype> {
@@ -160,6 +172,10 @@ class ConcatLayer : public Layer<Dtype> {
   }
   virtual inline int MinBottomBlobs() const { return 2; }
   virtual inline int ExactNumTopBlobs() const { return 1; }
+  virtual inline bool BottomSharesTop(const int bottom_index,
+      const int top_index) const {
+    return concat_dim_ == 0 || num_ == 1;
+  }
   virtual inline DiagonalAffineMap<Dtype> coord_map() {
     return DiagonalAffineMap<Dtype>::identity(2);
   }
@@ -213,6 +229,10 @@ class ConcatLayer : public Layer<Dtype> {
   virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
 
+  /// Copies the data of bottom to top at offset.
+  void CopySlice(const Blob<Dtype>* bottom, Blob<Dtype>* top,
+      const int offset);
+
   Blob<Dtype> col_bob_;
   int count_;
   int num_;
@@ -287,6 +307,10 @@ class FlattenLayer : public Layer<Dtype> {
   }
   virtual inline int ExactNumBottomBlobs() const { return 1; }
   virtual inline int ExactNumTopBlobs() const { return 1; }
+  virtual inline bool TopSharesBottom(const int top_index,
+      const int bottom_index) const {
+    return true;
+  }
 
  protected:
   /**
@@ -361,6 +385,9 @@ class InnerProductLayer : public Layer<Dtype> {
 /**
  * @brief Normalizes the input to have 0-mean and/or unit (1) variance.
  *
+ * The moments of each group (an image, or a channel of an image) are taken in
+ * one pass and the group normalized in a second, in parallel over the groups.
+ *
  * TODO(dox): thorough documentation for Forward, Backward, and proto params.
  */
 template <typename Dtype>
@@ -390,10 +417,11 @@ class MVNLayer : public Layer<Dtype> {
   virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
 
-  Blob<Dtype> mean_, variance_, temp_;
-
-  /// sum_multiplier is used to carry out sum using BLAS
-  Blob<Dtype> sum_multiplier_;
+  /// The number of groups normalized separately and the size of each.
+  int num_, dim_;
+  /// The mean and the standard deviation (plus eps) of each group in the last
+  /// Forward, which Backward reuses.
+  Blob<Dtype> mean_, std_;
 };
 
 /**
@@ -512,6 +540,10 @@ class SplitLayer : public Layer<Dtype> {
   }
   virtual inline int ExactNumBottomBlobs() const { return 1; }
   virtual inline int MinTopBlobs() const { return 1; }
+  virtual inline bool TopSharesBottom(const int top_index,
+      const int bottom_index) const {
+    return true;
+  }
   virtual inline DiagonalAffineMap<Dtype> coord_map() {
     return DiagonalAffineMap<Dtype>::identity(2);
   }
@@ -74,6 +74,9 @@ class BasePrefetchingDataLayer :
   virtual void JoinPrefetchThread();
   // The thread's function
   virtual void InternalThreadEntry() {}
+  // Forward restarts the prefetch thread, seeding its transformer from the
+  // Caffe random stream.
+  virtual inline bool DrawsRandom() const { return true; }
 
  protected:
   Blob<Dtype> prefetch_data_;
@@ -107,7 +107,10 @@ class DataTransformer {
   TransformationParameter param_;
 
 
-  shared_ptr<Caffe::RNG> rng_;
+  // Rand draws value rand_index_ of the Philox stream of rand_seed_.
+  bool has_rand_;
+  uint64_t rand_seed_;
+  uint64_t rand_index_;
   Caffe::Phase phase_;
   Blob<Dtype> data_mean_;
   vector<Dtype> mean_values_;
@@ -0,0 +1,96 @@
+#ifndef CAFFE_FEATURE_CACHE_HPP_
+#define CAFFE_FEATURE_CACHE_HPP_
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/dataset.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+/**
+ * @brief Stores the blobs computed from an input under a hash of the input,
+ *        so that Net can skip the layers that computed them the next time it
+ *        sees the input (see Net::set_feature_cache).
+ *
+ * The cache lives in memory, up to a number of bytes, or in a leveldb or
+ * lmdb, which keeps it across runs. It stores whole batches, or single items
+ * of them (their slices along num), so that a batch of items seen before in
+ * other batches is found too.
+ */
+template <typename Dtype>
+class FeatureCache {
+ public:
+  /// @brief A cache in memory of at most max_bytes.
+  explicit FeatureCache(const size_t max_bytes);
+  /// @brief A cache in the leveldb or lmdb at source, created if missing.
+  FeatureCache(const string& source, const DataParameter_DB backend);
+  ~FeatureCache();
+
+  /// @brief The hash of the shapes and data of blobs, starting from seed.
+  static uint64_t Hash(const vector<Blob<Dtype>*>& blobs, uint64_t seed);
+  /// @brief The hash of item n of blobs, starting from seed.
+  static uint64_t HashItem(const vector<Blob<Dtype>*>& blobs, const int item,
+      uint64_t seed);
+  /// @brief The hash of the bytes of str, starting from seed.
+  static uint64_t HashString(const string& str, uint64_t seed);
+
+  /**
+   * @brief Reshapes blobs and copies the data stored under key into them.
+   *
+   * Fails on an entry that is truncated, or was written for another number
+   * of blobs or in another precision.
+   *
+   * @return whether anything was stored under key
+   */
+  bool Get(const uint64_t key, const vector<Blob<Dtype>*>& blobs);
+  /**
+   * @brief Reshapes blobs to keys.size() items and copies the item stored
+   *        under each key into them, if every key is stored.
+   *
+   * Every key counts as a hit or a miss.
+   */
+  bool GetItems(const vector<uint64_t>& keys,
+      const vector<Blob<Dtype>*>& blobs);
+  /// @brief Stores the shapes and data of blobs under key, unless the cache
+  ///        is full or already holds key.
+  void Put(const uint64_t key, const vector<Blob<Dtype>*>& blobs);
+  /// @brief Stores item n of blobs under keys[n] as Put does.
+  void PutItems(const vector<uint64_t>& keys,
+      const vector<Blob<Dtype>*>& blobs);
+
+  int hits() const { return hits_; }
+  int misses() const { return misses_; }
+  /// @brief The number of batches and items stored.
+  int size() const { return keys_.size(); }
+
+ protected:
+  // Copies the entry under key into blobs, whole if item < 0, or else into
+  // that item of num.
+  void Read(const uint64_t key, const vector<Blob<Dtype>*>& blobs,
+      const int item, const int num);
+  // Stores blobs under key, whole if item < 0, or else that item of them.
+  // Put and PutItems commit what it puts in the dataset.
+  void Write(const uint64_t key, const vector<Blob<Dtype>*>& blobs,
+      const int item);
+
+  size_t max_bytes_;
+  size_t bytes_;
+  std::set<uint64_t> keys_;
+  // The entries in memory, or the dataset holding them.
+  map<uint64_t, string> entries_;
+  shared_ptr<Dataset<string, string> > dataset_;
+  int hits_;
+  int misses_;
+
+  DISABLE_COPY_AND_ASSIGN(FeatureCache);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_FEATURE_CACHE_HPP_
@@ -26,7 +26,9 @@ class Thread {
  */
 class InternalThread {
  public:
-  InternalThread() : thread_(NULL) {}
+  InternalThread()
+      : thread_(NULL), thread_mode_(Caffe::CPU), thread_phase_(Caffe::TRAIN),
+      thread_device_(-1) {}
   virtual ~InternalThread();
 
   /** Returns true if the thread was successfully started. **/
@@ -43,6 +45,17 @@ class InternalThread {
   virtual void InternalThreadEntry() {}
 
   caffe::Thread* thread_;
+
+ private:
+  /* Gives the thread the mode, phase and device of the thread that started it
+      (each thread has its own, see Caffe), pins it to the
+      Caffe::prefetch_cpus() of that thread, and runs InternalThreadEntry. */
+  void InternalThreadMain();
+
+  Caffe::Brew thread_mode_;
+  Caffe::Phase thread_phase_;
+  int thread_device_;
+  vector<int> thread_cpus_;
 };
 
 }  // namespace caffe
@@ -36,7 +36,7 @@ class Layer {
    * layer.
    */
   explicit Layer(const LayerParameter& param)
-    : layer_param_(param) {
+    : layer_param_(param), net_(NULL) {
       // The only thing we do is to copy blobs if there are any.
       if (layer_param_.blobs_size() > 0) {
         blobs_.resize(layer_param_.blobs_size());
@@ -275,6 +275,60 @@ class Layer {
     return true;
   }
 
+  /**
+   * @brief Return whether top blob top_index may share the memory of bottom
+   *        blob bottom_index, by sharing its data or being a view of it.
+   *
+   * Net uses this (and BottomSharesTop) to keep shared memory alive as long as
+   * all the blobs using it when share_activations lets blobs reuse memory.
+   */
+  virtual inline bool TopSharesBottom(const int top_index,
+      const int bottom_index) const {
+    return false;
+  }
+
+  /**
+   * @brief Return whether bottom blob bottom_index may be made a view of top
+   *        blob top_index.
+   */
+  virtual inline bool BottomSharesTop(const int bottom_index,
+      const int top_index) const {
+    return false;
+  }
+
+  /**
+   * @brief Return whether Forward draws from the random number streams of
+   *        Caffe (or restarts a thread that does).
+   *
+   * When Net runs independent layers at once (parallel_branches), the layers
+   * that do still run in order, so that they draw the same values.
+   */
+  virtual inline bool DrawsRandom() const { return false; }
+
+  /**
+   * @brief Return whether Forward, run again on the same bottoms, writes the
+   *        same tops, so that Net may recompute them (LayerParameter
+   *        recompute).
+   *
+   * Net replays the Philox streams of the first run, so layers drawing
+   * random numbers from anything else cannot be recomputed.
+   */
+  virtual inline bool CanRecompute() const { return !DrawsRandom(); }
+
+  /**
+   * @brief Clears what the layer accumulates over forward passes, such as
+   *        the matrix of ConfusionMatrixLayer. Solver::Test calls it before
+   *        every test pass; by default there is nothing to clear.
+   */
+  virtual void ResetState() {}
+
+  /**
+   * @brief Logs what the layer accumulated since ResetState(). Solver::Test
+   *        and the caffe test tool call it after the last forward pass of a
+   *        test; by default there is nothing to report.
+   */
+  virtual void ReportState() {}
+
   /**
    * @brief Specifies whether the layer should compute gradients w.r.t. a
    *        parameter at a particular index given by param_id.
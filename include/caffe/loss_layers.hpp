@@ -1,6 +1,8 @@
 #ifndef CAFFE_LOSS_LAYERS_HPP_
 #define CAFFE_LOSS_LAYERS_HPP_
 
+#include <stdint.h>
+
 #include <string>
 #include <utility>
 #include <vector>
@@ -171,6 +173,105 @@ class EltwiseAccuracyLayer : public Layer<Dtype> {
 
 };
 
+/**
+ * @brief Accumulates the confusion matrix of a pixel-wise one-of-many
+ *        classification task over successive forward passes, and outputs
+ *        the intersection over union (IoU) metrics of segmentation.
+ *
+ * The C x C matrix counts the pixels of every (true label, predicted label)
+ * pair in 64 bits. It keeps accumulating until ResetState(), which
+ * Solver::Test calls before every test pass. Pixels whose label or
+ * prediction is not a class (nor the ignore_label) are not counted either,
+ * and are reported by skipped().
+ *
+ * The outputs are the metrics of the whole matrix, not of the last batch, so
+ * the means over the passes that Solver::Test and the caffe test tool log are
+ * not IoUs. The layer logs the metrics of the test pass in ReportState(),
+ * which both call after their last forward pass.
+ */
+template <typename Dtype>
+class ConfusionMatrixLayer : public Layer<Dtype> {
+ public:
+  /**
+   * @param param provides ConfusionMatrixParameter confusion_matrix_param,
+   *     with ConfusionMatrixLayer options:
+   *   - num_classes (\b optional, default the channels of bottom[0]).
+   *     The number of classes @f$ C @f$, required if bottom[0] holds labels.
+   *   - ignore_label (\b optional).
+   *     Pixels with this label are not counted.
+   */
+  explicit ConfusionMatrixLayer(const LayerParameter& param)
+      : Layer<Dtype>(param) {}
+  virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+
+  virtual inline LayerParameter_LayerType type() const {
+    return LayerParameter_LayerType_CONFUSION_MATRIX;
+  }
+
+  virtual inline int ExactNumBottomBlobs() const { return 2; }
+  virtual inline int MinTopBlobs() const { return 1; }
+  virtual inline int MaxTopBlobs() const { return 3; }
+
+  /// @brief Clears the confusion matrix.
+  virtual void ResetState();
+  /// @brief Logs the metrics of the confusion matrix.
+  virtual void ReportState();
+  /// @brief The confusion matrix, row-major with the true label as the row.
+  const vector<int64_t>& confusion() const { return confusion_; }
+  /// @brief The pixels not counted since ResetState() because their label
+  ///        or prediction lies outside [0, C).
+  int64_t skipped() const { return skipped_; }
+
+ protected:
+  /**
+   * @param bottom input Blob vector (length 2)
+   *   -# @f$ (N \times C \times H \times W) @f$
+   *      the predictions @f$ x @f$, the label of each pixel being the
+   *      channel of its largest score; or @f$ (N \times 1 \times H \times W)
+   *      @f$ predicted labels, e.g. from ArgMaxLayer along axis 1
+   *   -# @f$ (N \times 1 \times H \times W) @f$
+   *      the labels @f$ l @f$, an integer-valued Blob with values
+   *      @f$ l_n \in [0, 1, 2, ..., C - 1] @f$
+   * @param top output Blob vector (length 1 to 3)
+   *   -# @f$ (1 \times 1 \times 1 \times 1) @f$
+   *      the mean IoU over the classes seen so far
+   *   -# @f$ (1 \times 1 \times 1 \times 1) @f$
+   *      the IoU weighted by the frequency of each class
+   *   -# @f$ (1 \times C \times 1 \times 1) @f$
+   *      the IoU of each class, all of the matrix accumulated since
+   *      ResetState()
+   */
+  virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+
+  /// @brief Not implemented -- ConfusionMatrixLayer cannot be used as a loss.
+  virtual void Backward_cpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
+    for (int i = 0; i < propagate_down.size(); ++i) {
+      if (propagate_down[i]) { NOT_IMPLEMENTED; }
+    }
+  }
+
+  /// @brief Computes the mean, frequency weighted and per-class IoU of the
+  ///        matrix, in the order of the tops.
+  void ComputeMetrics(vector<double>* metrics) const;
+
+  int num_classes_;
+  /// Whether bottom[0] holds predicted labels rather than scores.
+  bool predicted_labels_;
+  /// Whether to ignore instances with a certain label.
+  bool has_ignore_label_;
+  /// The label indicating that an instance should be ignored.
+  int ignore_label_;
+  /// The accumulated confusion matrix.
+  vector<int64_t> confusion_;
+  /// The number of pixels out of range since ResetState().
+  int64_t skipped_;
+};
+
 /**
  * @brief An interface for Layer%s that take two Blob%s as input -- usually
  *        (1) predictions and (2) ground-truth labels -- and output a
@@ -784,8 +885,7 @@ template <typename Dtype>
 class SoftmaxWithLossLayer : public LossLayer<Dtype> {
  public:
   explicit SoftmaxWithLossLayer(const LayerParameter& param)
-      : LossLayer<Dtype>(param),
-        softmax_layer_(new SoftmaxLayer<Dtype>(param)) {}
+      : LossLayer<Dtype>(param) {}
   virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top);
   virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
@@ -837,14 +937,9 @@ class SoftmaxWithLossLayer : public LossLayer<Dtype> {
   virtual void Backward_cpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
 
-  /// The internal SoftmaxLayer used to map predictions to a distribution.
-  shared_ptr<SoftmaxLayer<Dtype> > softmax_layer_;
-  /// prob stores the output probability predictions from the SoftmaxLayer.
+  /// prob stores the softmax of the predictions, computed together with the
+  /// loss and reused by Backward.
   Blob<Dtype> prob_;
-  /// bottom vector holder used in call to the underlying SoftmaxLayer::Forward
-  vector<Blob<Dtype>*> softmax_bottom_vec_;
-  /// top vector holder used in call to the underlying SoftmaxLayer::Forward
-  vector<Blob<Dtype>*> softmax_top_vec_;
   /// Whether to ignore instances with a certain label.
   bool has_ignore_label_;
   /// The label indicating that an instance should be ignored.
@@ -911,8 +1006,7 @@ template <typename Dtype>
 class RedSoftmaxWithLossLayer : public LossLayer<Dtype> {
  public:
   explicit RedSoftmaxWithLossLayer(const LayerParameter& param)
-      : LossLayer<Dtype>(param),
-        softmax_layer_(new SoftmaxLayer<Dtype>(param)) {}
+      : LossLayer<Dtype>(param) {}
   virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top);
   virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
@@ -935,14 +1029,9 @@ class RedSoftmaxWithLossLayer : public LossLayer<Dtype> {
   virtual void Backward_cpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
 
-  /// The internal SoftmaxLayer used to map predictions to a distribution.
-  shared_ptr<SoftmaxLayer<Dtype> > softmax_layer_;
-  /// prob stores the output probability predictions from the SoftmaxLayer.
+  /// prob stores the softmax of the predictions, computed together with the
+  /// loss and reused by Backward.
   Blob<Dtype> prob_;
-  /// bottom vector holder used in call to the underlying SoftmaxLayer::Forward
-  vector<Blob<Dtype>*> softmax_bottom_vec_;
-  /// top vector holder used in call to the underlying SoftmaxLayer::Forward
-  vector<Blob<Dtype>*> softmax_top_vec_;
   /// Whether to ignore instances with a certain label.
   bool has_ignore_label_;
   /// The label indicating that an instance should be ignored.
@@ -9,6 +9,7 @@
 
 #include "caffe/blob.hpp"
 #include "caffe/common.hpp"
+#include "caffe/feature_cache.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/proto/caffe.pb.h"
 
@@ -25,6 +26,18 @@ class Net {
  public:
   explicit Net(const NetParameter& param);
   explicit Net(const string& param_file);
+  /**
+   * @brief Create a replica of net, to run it from another thread with one
+   *        copy of the weights.
+   *
+   * The replica is made from the param net was made from, in the phase of
+   * net whatever the phase of the calling thread, and shares the parameters
+   * of net; it has its own blobs, and its layers their own scratch. Replicas
+   * can run forward at the same time, each from one thread (set the mode and
+   * phase of each thread, see Caffe), as long as nothing updates the
+   * parameters meanwhile.
+   */
+  Net(const NetParameter& param, const Net* net);
   virtual ~Net() {}
 
   /// @brief Initialize a network with a NetParameter.
@@ -85,6 +98,25 @@ class Net {
   /// @brief Updates the network weights based on the diff values computed.
   void Update();
 
+  /**
+   * @brief Have Forward cache the outputs of the frozen prefix of the net,
+   *        computing them once per distinct input; or stop, with NULL.
+   *
+   * The frozen prefix is the layers at the start of the net that need no
+   * backward, learn nothing (blobs_lr 0), draw no random numbers and have no
+   * loss, along with the data layers among them. Forward runs the data
+   * layers, and looks their outputs up in the cache, together with the
+   * weights of the prefix when first run; on a hit it runs only the layers
+   * after the prefix. It pays off when the data repeats exactly, that is
+   * without random mirroring or cropping. The outputs are stored item by
+   * item, so that shuffled batches hit too, unless the prefix mixes the
+   * items of a batch (as BN does, or by changing the batch size); then
+   * only batches that repeat whole hit.
+   */
+  void set_feature_cache(shared_ptr<FeatureCache<Dtype> > cache);
+  /// @brief The number of layers in the frozen prefix of the net.
+  inline int num_frozen_layers() const { return num_frozen_layers_; }
+
   /**
    * @brief For an already initialized net, implicitly copies (i.e., using no
    *        additional memory) the pre-trained layers from another Net.
@@ -140,7 +172,39 @@ class Net {
   inline vector<Blob<Dtype>*>& output_blobs() { return net_output_blobs_; }
   inline vector<int>& input_blob_indices() { return net_input_blob_indices_; }
   inline vector<int>& output_blob_indices() { return net_output_blob_indices_; }
+  /// @brief returns the BN layers folded away, mapped to their new layers
+  inline const map<string, string>& folded_bn_layers() {
+    return folded_bn_layers_;
+  }
+  /// @brief returns the RELU layers fused away, mapped to their new layers
+  inline const map<string, string>& fused_relu_layers() {
+    return fused_relu_layers_;
+  }
+  /// @brief returns the buffers that the data of blobs share, with
+  ///        share_activations or recompute
+  inline const vector<shared_ptr<Blob<Dtype> > >& activation_buffers() {
+    return activation_buffers_;
+  }
+  /// @brief returns the buffers that the diffs of blobs share, with
+  ///        share_diffs
+  inline const vector<shared_ptr<Blob<Dtype> > >& diff_buffers() {
+    return diff_buffers_;
+  }
+  /// @brief returns the waves of layers that run at the same time with
+  ///        parallel_branches, in the order they run forward
+  inline const vector<vector<int> >& layer_waves() const {
+    return layer_waves_;
+  }
+  /// @brief returns how many times Forward and Reshape reshaped each layer
+  ///        since Init; Forward only does when a shape changed
+  inline const vector<int>& layer_reshapes() const { return layer_reshapes_; }
   bool has_blob(const string& blob_name);
+  /**
+   * @brief Whether a layer takes blob as both a bottom and a top, writing it
+   *        in place. Layers that make blobs views of each other check this,
+   *        and it is true while the net is still being set up.
+   */
+  bool HasInPlaceConsumer(const Blob<Dtype>* blob) const;
   const shared_ptr<Blob<Dtype> > blob_by_name(const string& blob_name);
   bool has_layer(const string& layer_name);
   const shared_ptr<Layer<Dtype> > layer_by_name(const string& layer_name);
@@ -157,6 +221,27 @@ class Net {
   /// @brief return whether NetState state meets NetStateRule rule
   static bool StateMeetsRule(const NetState& state, const NetStateRule& rule,
       const string& layer_name);
+  /**
+   * @brief Fold each INFERENCE mode BN layer into the CONVOLUTION or
+   *        INNER_PRODUCT layer that solely feeds it.
+   *
+   * The producing layer takes over the BN top and gains a bias term. If the
+   * layers carry their blobs, the BN scale and shift are folded into the
+   * weights and bias; folded_layers, if given, maps the name of each removed
+   * BN layer to the layer it was folded into.
+   */
+  static void FoldBatchNorm(const NetParameter& param,
+      NetParameter* param_folded, map<string, string>* folded_layers = NULL);
+  /**
+   * @brief Fuse each RELU layer into the CONVOLUTION, INNER_PRODUCT or
+   *        ELTWISE (SUM or MAX) layer that solely feeds it.
+   *
+   * The producing layer takes over the ReLU top and applies the ReLU to its
+   * output itself, through its fused_relu_param. fused_layers, if given, maps
+   * the name of each removed RELU layer to the layer it was fused into.
+   */
+  static void FuseReLU(const NetParameter& param, NetParameter* param_fused,
+      map<string, string>* fused_layers = NULL);
 
  protected:
   // Helpers for Init.
@@ -172,6 +257,75 @@ class Net {
   void AppendParam(const NetParameter& param, const int layer_id,
                    const int param_id);
 
+  /**
+   * @brief Group the blobs that layers may make share memory
+   *        (Layer::TopSharesBottom and Layer::BottomSharesTop), giving the
+   *        root of the group of each blob, and at each root the first layer
+   *        writing and the last layer using any blob of its group.
+   */
+  void GroupBlobs(vector<int>* group, vector<int>* first,
+      vector<int>* last) const;
+  /**
+   * @brief Assign the groups at roots to buffers, so that groups alive at the
+   *        same time never share one, and return the number of buffers.
+   */
+  int PlanBuffers(const vector<int>& roots, const vector<int>& first,
+      const vector<int>& last, vector<int>* blob_buffers) const;
+  /// @brief Plan the buffers of share_activations, share_diffs and recompute.
+  void PlanActivations(const NetParameter& param);
+  /**
+   * @brief Plan the activations dropped by the recompute layers.
+   *
+   * The dropped blobs used by one layer form a segment, which Backward
+   * recomputes at once when it needs one of its blobs. The blobs of a segment
+   * have buffers of their own, and segments share them.
+   */
+  void PlanRecompute(const NetParameter& param, const vector<int>& group,
+      const vector<int>& first, const vector<int>& last,
+      const vector<bool>& keep);
+  /// @brief Size the shared buffers for the current shapes of their blobs,
+  ///        and make the blobs views of them.
+  void ShareBuffers();
+  /// @brief Whether a top of a layer is no longer a view of its buffer, as
+  ///        after a Reshape beyond the size of the view.
+  bool LeftBuffers(const int layer_id) const;
+  /// @brief Recompute the dropped blobs used by a layer if they were lost.
+  void RecomputeDropped(const int layer_id);
+  /// @brief Run the layers of a segment forward again.
+  void Recompute(const int segment);
+  /// @brief Record that a layer wrote the buffers of its segment.
+  void WroteSegment(const int layer_id);
+  /// @brief Whether a bottom or top of a layer changed shape since the layer
+  ///        was last reshaped.
+  bool ShapeChanged(const int layer_id) const;
+  /// @brief Record the shapes a layer was reshaped for.
+  void ReshapedLayer(const int layer_id);
+  /**
+   * @brief Group the layers into waves for parallel_branches: each layer
+   *        goes in the wave after the last of the layers it has to follow.
+   *
+   * A layer follows the last layer that wrote the memory of its bottoms, and
+   * the layers that used the memory of its tops since it was last written,
+   * where blobs sharing memory (Layer::TopSharesBottom) count as the same
+   * memory. Layers sharing parameters, and layers that draw random numbers
+   * (Layer::DrawsRandom), also keep their order.
+   */
+  void PlanWaves();
+  /// @brief Whether Forward and Backward run the waves of layers.
+  bool RunsWaves() const;
+  /// @brief Run the layers of a wave at the same time, forward (storing
+  ///        their losses) or backward.
+  void RunWave(const vector<int>& wave, vector<Dtype>* losses);
+  /// @brief Reshape a layer if needed and run it forward.
+  Dtype ForwardLayer(const int layer_id);
+  /// @brief Find the frozen prefix, its inputs from the data layers and the
+  ///        outputs the rest of the net uses.
+  void PlanFrozenPrefix();
+  /// @brief Run the data layers of the frozen prefix, and the rest of it
+  ///        unless the feature cache holds its outputs.
+  Dtype ForwardFrozen();
+  /// @brief Run a layer backward if it needs to.
+  void BackwardLayer(const int layer_id);
   /// @brief Helper for displaying debug info in Forward.
   void ForwardDebugInfo(const int layer_id);
   /// @brief Helper for displaying debug info in Backward.
@@ -224,6 +378,50 @@ class Net {
   size_t memory_used_;
   /// Whether to compute and display debug info for the net.
   bool debug_info_;
+  /// The phase the layers were filtered for.
+  Phase phase_;
+  /// The BN layers folded away by fold_batch_norm, mapped to the layer each
+  /// was folded into; CopyTrainedLayersFrom folds their weights.
+  map<string, string> folded_bn_layers_;
+  /// The RELU layers fused away by fuse_relu, mapped to the layer each was
+  /// fused into.
+  map<string, string> fused_relu_layers_;
+  /// Whether the net is only run forward, its blobs sharing memory.
+  bool share_activations_;
+  /// The buffers shared by the data of blobs (share_activations or recompute)
+  /// and by their diffs (share_diffs), and the buffers of each blob, or -1.
+  vector<shared_ptr<Blob<Dtype> > > activation_buffers_;
+  vector<int> blob_activation_buffers_;
+  vector<shared_ptr<Blob<Dtype> > > diff_buffers_;
+  vector<int> blob_diff_buffers_;
+  /// The segment of each dropped blob, or -1, and the layers and the number
+  /// of buffers of each segment.
+  vector<int> blob_segments_;
+  vector<vector<int> > segment_layers_;
+  vector<int> segment_sizes_;
+  /// The segment whose blob each buffer holds, and the Philox position of
+  /// each layer in the last Forward.
+  vector<int> buffer_segments_;
+  vector<uint64_t> layer_philox_positions_;
+  /// The shape generations of the bottoms and then the tops of each layer
+  /// when it was last reshaped.
+  vector<vector<uint64_t> > layer_shape_generations_;
+  /// The number of times each layer was reshaped.
+  vector<int> layer_reshapes_;
+  /// The waves of layers that parallel_branches runs at once.
+  vector<vector<int> > layer_waves_;
+  /// The layers of the frozen prefix, the blobs it reads from the data layers
+  /// and the blobs the rest of the net reads from it.
+  int num_frozen_layers_;
+  vector<Blob<Dtype>*> frozen_inputs_;
+  vector<Blob<Dtype>*> frozen_outputs_;
+  /// Whether the frozen prefix computes every item from its own inputs.
+  bool frozen_per_item_;
+  /// The cache of the frozen outputs, and the hash of the frozen weights once
+  /// computed.
+  shared_ptr<FeatureCache<Dtype> > feature_cache_;
+  bool frozen_params_hashed_;
+  uint64_t frozen_params_hash_;
 
   DISABLE_COPY_AND_ASSIGN(Net);
 };
@@ -179,6 +179,9 @@ class DropoutLayer : public NeuronLayer<Dtype> {
   virtual inline LayerParameter_LayerType type() const {
     return LayerParameter_LayerType_DROPOUT;
   }
+  virtual inline bool DrawsRandom() const { return true; }
+  // The mask is drawn from the Philox streams.
+  virtual inline bool CanRecompute() const { return true; }
 
  protected:
   /**
@@ -207,7 +210,11 @@ class DropoutLayer : public NeuronLayer<Dtype> {
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
 
   /// when divided by UINT_MAX, the randomly generated values @f$u\sim U(0,1)@f$
+  /// (GPU only)
   Blob<unsigned int> rand_vec_;
+  /// the CPU mask, one bit per input: bit i % 32 of word i / 32 is set if
+  /// input i is kept
+  Blob<unsigned int> mask_;
   /// the probability @f$ p @f$ of dropping any input
   Dtype threshold_;
   /// the scale for undropped inputs at train time @f$ 1 / (1 - p) @f$
@@ -216,7 +223,8 @@ class DropoutLayer : public NeuronLayer<Dtype> {
 };
 
 /**
- * Dropout in channel direction
+ * Dropout in channel direction: every channel of every image is dropped or
+ * kept as a whole, following a single @f$ u \sim U(0, 1) @f$ per channel.
  */
 template <typename Dtype>
 class DropoutChannelLayer : public NeuronLayer<Dtype> {
@@ -229,8 +237,11 @@ class DropoutChannelLayer : public NeuronLayer<Dtype> {
       const vector<Blob<Dtype>*>& top);
 
   virtual inline LayerParameter_LayerType type() const {
-    return LayerParameter_LayerType_DROPOUT;
+    return LayerParameter_LayerType_DROPOUT_CHANNEL;
   }
+  virtual inline bool DrawsRandom() const { return true; }
+  // The mask is drawn from the Philox streams.
+  virtual inline bool CanRecompute() const { return true; }
 
  protected:
   virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
@@ -242,12 +253,8 @@ class DropoutChannelLayer : public NeuronLayer<Dtype> {
   virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
 
-  int N_, C_, H_, W_;
-
-  Blob<Dtype> rand_mat_; // (N, C, H, W) 
-  Blob<Dtype> rand_vec_; // (N, C, 1, 1)
-
-  Blob<Dtype> spatial_sum_multiplier_; // (1, 1, H, W)
+  /// the uniform draw of each channel (N, C, 1, 1); channel is kept if > p
+  Blob<Dtype> rand_vec_;
 
   /// the probability @f$ p @f$ of dropping any input
   Dtype threshold_;
@@ -21,31 +21,64 @@ namespace caffe {
 // are constantly accessing them the memory pages almost always stays in
 // the physical memory (assuming we have large enough memory installed), and
 // does not seem to create a memory bottleneck here.
+//
+// The memory comes from a process-wide cache: sizes are rounded up to size
+// classes a quarter of a power of two apart, blocks are 64-byte aligned, and
+// freed blocks are kept per class for the next allocation of that class
+// instead of going back to the system, up to a limit on the cached bytes.
+// Blobs that grow and shrink with variable-size inputs then reuse their
+// blocks rather than mapping and faulting in fresh pages every time. See
+// Caffe::host_memory_stats and the setters next to it.
 
-inline void CaffeMallocHost(void** ptr, size_t size) {
-  *ptr = malloc(size);
-  CHECK(*ptr) << "host allocation of size " << size << " failed";
-}
+// Where host memory is placed on a machine with several NUMA nodes. Except
+// for HOST_DEFAULT, the memory is fresh pages rather than cached blocks; on a
+// machine with a single node the placements are all HOST_DEFAULT.
+enum HostMemoryPolicy {
+  // From the cache, wherever its blocks were first touched.
+  HOST_DEFAULT,
+  // On the node of the thread that first touches each page.
+  HOST_LOCAL,
+  // Spread page by page over all nodes, for memory that threads on every
+  // node read, such as parameters.
+  HOST_INTERLEAVE,
+  // On one given node.
+  HOST_BIND,
+  // Page-locked, for fast copies to the GPU. cudaMallocHost in GPU builds,
+  // and HOST_LOCAL in CPU-only builds.
+  HOST_PINNED
+};
 
-inline void CaffeFreeHost(void* ptr) {
-  free(ptr);
-}
+// Allocates at least size bytes. The same size and policy have to be passed
+// to CaffeFreeHost. node is the node of HOST_BIND.
+void CaffeMallocHost(void** ptr, size_t size,
+    HostMemoryPolicy policy = HOST_DEFAULT, int node = -1);
+void CaffeFreeHost(void* ptr, size_t size,
+    HostMemoryPolicy policy = HOST_DEFAULT);
 
 
 /**
  * @brief Manages memory allocation and synchronization between the host (CPU)
  *        and device (GPU).
  *
+ * A SyncedMemory can also be a view of size bytes at an offset into a parent
+ * SyncedMemory: it then allocates nothing, and its data, head and
+ * synchronization are those of the parent.
+ *
  * TODO(dox): more thorough description.
  */
 class SyncedMemory {
  public:
   SyncedMemory()
       : cpu_ptr_(NULL), gpu_ptr_(NULL), size_(0), head_(UNINITIALIZED),
-        own_cpu_data_(false) {}
-  explicit SyncedMemory(size_t size)
+        own_cpu_data_(false), offset_(0), host_policy_(HOST_DEFAULT),
+        host_node_(-1) {}
+  explicit SyncedMemory(size_t size,
+      HostMemoryPolicy host_policy = HOST_DEFAULT, int host_node = -1)
       : cpu_ptr_(NULL), gpu_ptr_(NULL), size_(size), head_(UNINITIALIZED),
-        own_cpu_data_(false) {}
+        own_cpu_data_(false), offset_(0), host_policy_(host_policy),
+        host_node_(host_node) {}
+  SyncedMemory(const shared_ptr<SyncedMemory>& parent, size_t offset,
+      size_t size);
   ~SyncedMemory();
   const void* cpu_data();
   void set_cpu_data(void* data);
@@ -53,8 +86,19 @@ class SyncedMemory {
   void* mutable_cpu_data();
   void* mutable_gpu_data();
   enum SyncedHead { UNINITIALIZED, HEAD_AT_CPU, HEAD_AT_GPU, SYNCED };
-  SyncedHead head() { return head_; }
+  SyncedHead head() { return parent_ ? parent_->head() : head_; }
   size_t size() { return size_; }
+  /// @brief The SyncedMemory this is a view of, or NULL.
+  const shared_ptr<SyncedMemory>& parent() const { return parent_; }
+  /// @brief The offset in bytes of a view into its parent.
+  size_t offset() const { return offset_; }
+  HostMemoryPolicy host_policy() const { return host_policy_; }
+  /**
+   * @brief Place the host memory by policy (see HostMemoryPolicy), moving
+   *        the data if it is already allocated. node is the node of
+   *        HOST_BIND. Not for views.
+   */
+  void set_host_policy(HostMemoryPolicy policy, int node = -1);
 
  private:
   void to_cpu();
@@ -64,6 +108,10 @@ class SyncedMemory {
   size_t size_;
   SyncedHead head_;
   bool own_cpu_data_;
+  shared_ptr<SyncedMemory> parent_;
+  size_t offset_;
+  HostMemoryPolicy host_policy_;
+  int host_node_;
 
   DISABLE_COPY_AND_ASSIGN(SyncedMemory);
 };  // class SyncedMemory
@@ -0,0 +1,106 @@
+#ifndef CAFFE_TILED_NET_HPP_
+#define CAFFE_TILED_NET_HPP_
+
+#include <string>
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/net.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Runs a fully convolutional Net over inputs too large to run at once,
+ *        in overlapping tiles that fit a memory budget.
+ *
+ * The geometry of the net comes from the coord_map of its layers and the
+ * kernels of its convolution, pooling and deconvolution layers: the scale
+ * and offset of the output relative to the input, the receptive field of an
+ * output, and the alignment that keeps the pooling grids of the tiles on
+ * those of the whole input. Tiles overlap by enough to cover the receptive
+ * field where the budget allows, and their outputs are blended with a
+ * feathering window that gives no weight to the outputs that see past the
+ * edge of their tile. With overlap to spare, the result is that of running
+ * the whole input at once.
+ */
+template <typename Dtype>
+class TiledNet {
+ public:
+  /**
+   * @param net a fully convolutional net with one input blob, which TiledNet
+   *        reshapes to run the tiles
+   * @param output the name of the blob to blend, or empty for the first
+   *        output blob of the net
+   */
+  explicit TiledNet(Net<Dtype>* net, const string& output = "");
+
+  /**
+   * @brief Sets the bytes the blobs of a batch of tiles may take, with the
+   *        scratch of their layers, 512 MB by default.
+   *
+   * The scratch is estimated for convolution, deconvolution, pooling,
+   * eltwise and LRN layers; other scratch, such as the workspaces of cuDNN,
+   * and the blended output are not counted, so leave headroom for them.
+   */
+  void set_memory_budget(const size_t bytes) { memory_budget_ = bytes; }
+  /// @brief Sets the size of the tiles, or 0 to fit them to the budget.
+  void set_tile_size(const int tile_size) { tile_size_ = tile_size; }
+  /// @brief Sets the overlap of the tiles in input pixels, or -1 to cover
+  ///        the receptive field.
+  void set_overlap(const int overlap) { overlap_ = overlap; }
+
+  /**
+   * @brief Runs the net over image (1 x C x H x W), writing the blended
+   *        output blob to output.
+   */
+  void Forward(const Blob<Dtype>& image, Blob<Dtype>* output);
+
+  /// @brief The output pixels per input pixel along height and width.
+  Dtype scale(const int axis) const { return scale_[axis]; }
+  /// @brief The receptive field of an output pixel, in input pixels.
+  int receptive_field(const int axis) const { return field_[axis]; }
+  /// @brief The multiple of input pixels the tiles start at.
+  int alignment(const int axis) const { return align_[axis]; }
+  /// @brief The size of the tiles, and their overlap, of the last Forward.
+  int tile_size(const int axis) const { return tile_[axis]; }
+  int overlap(const int axis) const { return tile_overlap_[axis]; }
+  /// @brief The number of tiles run at once by the last Forward.
+  int tiles_per_batch() const { return tiles_per_batch_; }
+
+ protected:
+  /// @brief Computes the geometry of the net from its layers.
+  void InitGeometry();
+  /// @brief The bytes of the blobs and layer scratch of the net reshaped to
+  ///        num x h x w inputs.
+  size_t ReshapeNet(const int num, const int height, const int width);
+  /// @brief The input pixels of the tiles along one axis.
+  void TileOrigins(const int axis, const int size, vector<int>* origins);
+  /// @brief The weights of the outputs of a tile along one axis, falling to
+  ///        zero towards the tiles it overlaps.
+  void FeatherWeights(const int axis, const vector<int>& origins,
+      const int tile, const int tile_output, vector<vector<Dtype> >* weights);
+
+  Net<Dtype>* net_;
+  Blob<Dtype>* input_;
+  Blob<Dtype>* output_;
+  size_t memory_budget_;
+  int tile_size_;
+  int overlap_;
+  // output = scale_ * input + offset_ along height and width.
+  Dtype scale_[2];
+  Dtype offset_[2];
+  int field_[2];
+  int align_[2];
+  // The outputs at each edge of a tile that see past the edge.
+  int margin_[2];
+  int tile_[2];
+  int tile_overlap_[2];
+  int tiles_per_batch_;
+
+  DISABLE_COPY_AND_ASSIGN(TiledNet);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_TILED_NET_HPP_
@@ -0,0 +1,120 @@
+#ifndef CAFFE_UTIL_FAST_MATH_H_
+#define CAFFE_UTIL_FAST_MATH_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace caffe {
+
+// Elementwise math for the CPU neuron layers and caffe_exp, caffe_log,
+// caffe_powx, caffe_tanh and caffe_sigmoid. The float versions are
+// branch-free polynomial approximations after Cephes, so that loops over them
+// vectorize, within about 1e-7 relative of libm for normal float results;
+// results below the smallest normal float flush to zero, and NaN and
+// infinities come out as from libm. The double versions call libm.
+
+inline float fast_as_float(const int32_t i) {
+  float f;
+  memcpy(&f, &i, sizeof(f));
+  return f;
+}
+
+inline int32_t fast_as_int(const float f) {
+  int32_t i;
+  memcpy(&i, &f, sizeof(i));
+  return i;
+}
+
+// exp(x) = 2^n * exp(r), with n = round(x / log(2)) and |r| <= log(2) / 2.
+// 2^n is applied in two factors, as n reaches 128 just below log(FLT_MAX),
+// above which exp overflows to inf.
+inline float fast_exp(const float x_in) {
+  const float x =
+      std::min(std::max(x_in, -88.3762626647949f), 88.7228391116729996f);
+  const float t = x * 1.44269504088896341f + 0.5f;
+  // floor(t) without a call, so that the loop still vectorizes.
+  float n = static_cast<float>(static_cast<int32_t>(t));
+  n -= n > t;
+  // log(2) in two parts, so that r is exact.
+  const float r = x - n * 0.693359375f + n * 2.12194440e-4f;
+  float p = 1.9875691500E-4f;
+  p = p * r + 1.3981999507E-3f;
+  p = p * r + 8.3334519073E-3f;
+  p = p * r + 4.1665795894E-2f;
+  p = p * r + 1.6666665459E-1f;
+  p = p * r + 5.0000001201E-1f;
+  p = p * r * r + r + 1.f;
+  const int32_t k = static_cast<int32_t>(n);
+  const int32_t k_high = k > 0;
+  const float y = p * fast_as_float((k - k_high + 127) << 23)
+      * fast_as_float((k_high + 127) << 23);
+  return x_in > 88.7228391116729996f ? std::numeric_limits<float>::infinity()
+      : (x_in != x_in ? x_in : y);
+}
+
+// log(x) = e * log(2) + log(m), with m in [sqrt(1/2), sqrt(2)). NaN for
+// x < 0 or NaN, -inf for x == 0 and inf for inf; denormal x count as the
+// smallest normal float.
+inline float fast_log(const float x) {
+  const float x_pos = std::max(x, std::numeric_limits<float>::min());
+  const int32_t bits = fast_as_int(x_pos);
+  float e = static_cast<float>((bits >> 23) - 126);
+  float m = fast_as_float((bits & 0x007fffff) | 0x3f000000);
+  const bool small = m < 0.707106781186547524f;
+  e -= small;
+  m = m + (small ? m : 0.f) - 1.f;
+  const float z = m * m;
+  float p = 7.0376836292E-2f;
+  p = p * m - 1.1514610310E-1f;
+  p = p * m + 1.1676998740E-1f;
+  p = p * m - 1.2420140846E-1f;
+  p = p * m + 1.4249322787E-1f;
+  p = p * m - 1.6668057665E-1f;
+  p = p * m + 2.0000714765E-1f;
+  p = p * m - 2.4999993993E-1f;
+  p = p * m + 3.3333331174E-1f;
+  float y = p * m * z - e * 2.12194440e-4f - 0.5f * z;
+  y = m + y + e * 0.693359375f;
+  y = x == 0 ? -std::numeric_limits<float>::infinity() : y;
+  y = x > std::numeric_limits<float>::max() || x != x ? x : y;
+  return x < 0 ? std::numeric_limits<float>::quiet_NaN() : y;
+}
+
+// tanh(x) by a polynomial for |x| < 0.625, and 1 - 2 / (exp(2|x|) + 1) with
+// the sign of x above.
+inline float fast_tanh(const float x) {
+  const float z = x * x;
+  float p = -5.70498872745E-3f;
+  p = p * z + 2.06390887954E-2f;
+  p = p * z - 5.37397155531E-2f;
+  p = p * z + 1.33314422036E-1f;
+  p = p * z - 3.33332819422E-1f;
+  const float small = x + x * z * p;
+  const float large = 1.f - 2.f / (fast_exp(2.f * std::fabs(x)) + 1.f);
+  return std::fabs(x) < 0.625f ? small : (x < 0 ? -large : large);
+}
+
+inline float fast_sigmoid(const float x) {
+  return 1.f / (1.f + fast_exp(-x));
+}
+
+// a^b for a > 0, with a relative error that grows with |b * log(a)|.
+inline float fast_pow(const float a, const float b) {
+  return fast_exp(b * fast_log(a));
+}
+
+inline double fast_exp(const double x) { return std::exp(x); }
+inline double fast_log(const double x) { return std::log(x); }
+inline double fast_tanh(const double x) { return std::tanh(x); }
+inline double fast_sigmoid(const double x) { return 1. / (1. + std::exp(-x)); }
+inline double fast_pow(const double a, const double b) {
+  return std::pow(a, b);
+}
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_FAST_MATH_H_
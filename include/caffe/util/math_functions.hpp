@@ -85,12 +85,61 @@ void caffe_rng_bernoulli(const int n, const Dtype p, int* r);
 template <typename Dtype>
 void caffe_rng_bernoulli(const int n, const Dtype p, unsigned int* r);
 
+// Counter-based counterparts of the caffe_rng_* fills. r[i] is computed from
+// value offset + i of the Philox stream of seed only, so the fills run in
+// parallel and a stream split into several fills, e.g. one per thread, gives
+// the same values as a single fill. offset must be a multiple of 4.
+template <typename Dtype>
+void caffe_philox_uniform(const int n, const Dtype a, const Dtype b,
+    const uint64_t seed, const uint64_t offset, Dtype* r);
+
+// Takes two stream values per pair of outputs (Box-Muller).
+template <typename Dtype>
+void caffe_philox_gaussian(const int n, const Dtype mu, const Dtype sigma,
+    const uint64_t seed, const uint64_t offset, Dtype* r);
+
+template <typename Dtype>
+void caffe_philox_bernoulli(const int n, const Dtype p, const uint64_t seed,
+    const uint64_t offset, int* r);
+
+// The same on the next n values of the stream of Caffe::philox_seed().
+template <typename Dtype>
+void caffe_philox_uniform(const int n, const Dtype a, const Dtype b, Dtype* r);
+
+template <typename Dtype>
+void caffe_philox_gaussian(const int n, const Dtype mu, const Dtype sigma,
+    Dtype* r);
+
+template <typename Dtype>
+void caffe_philox_bernoulli(const int n, const Dtype p, int* r);
+
 template <typename Dtype>
 void caffe_exp(const int n, const Dtype* a, Dtype* y);
 
+template <typename Dtype>
+void caffe_log(const int n, const Dtype* a, Dtype* y);
+
 template <typename Dtype>
 void caffe_abs(const int n, const Dtype* a, Dtype* y);
 
+template <typename Dtype>
+void caffe_tanh(const int n, const Dtype* a, Dtype* y);
+
+// y = 1 / (1 + exp(-a))
+template <typename Dtype>
+void caffe_sigmoid(const int n, const Dtype* a, Dtype* y);
+
+// In place ReLU, y = max(y, 0) + negative_slope * min(y, 0), for the layers
+// that apply a fused ReLU to their output.
+template <typename Dtype>
+void caffe_cpu_relu(const int n, const Dtype negative_slope, Dtype* y);
+
+// The ReLU gradient in place given the ReLU output y: dy is scaled by
+// negative_slope where y <= 0.
+template <typename Dtype>
+void caffe_cpu_relu_backward(const int n, const Dtype negative_slope,
+    const Dtype* y, Dtype* dy);
+
 template <typename Dtype>
 Dtype caffe_cpu_dot(const int n, const Dtype* x, const Dtype* y);
 
@@ -206,6 +255,13 @@ void caffe_gpu_exp(const int n, const Dtype* a, Dtype* y);
 template <typename Dtype>
 void caffe_gpu_powx(const int n, const Dtype* a, const Dtype b, Dtype* y);
 
+template <typename Dtype>
+void caffe_gpu_relu(const int n, const Dtype negative_slope, Dtype* y);
+
+template <typename Dtype>
+void caffe_gpu_relu_backward(const int n, const Dtype negative_slope,
+    const Dtype* y, Dtype* dy);
+
 // caffe_gpu_rng_uniform with two arguments generates integers in the range
 // [0, UINT_MAX].
 void caffe_gpu_rng_uniform(const int n, unsigned int* r);
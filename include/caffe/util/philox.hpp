@@ -0,0 +1,63 @@
+#ifndef CAFFE_UTIL_PHILOX_H_
+#define CAFFE_UTIL_PHILOX_H_
+
+#include <stdint.h>
+
+namespace caffe {
+
+// The Philox4x32-10 counter-based random number generator of Salmon et al.,
+// "Parallel Random Numbers: As Easy as 1, 2, 3" (SC 2011). Its output is a
+// pure function of a 128-bit counter and a 64-bit key, so a stream of values
+// is defined by a seed (the key) alone, and value i of the stream (lane i % 4
+// of the block at counter i / 4) can be computed without generating the
+// values before it. Any part of a stream can thus be filled by any thread and
+// come out the same.
+
+// One Philox4x32-10 block: ten rounds of the bijection on ctr keyed by key.
+inline void philox4x32_10(const uint32_t ctr[4], const uint32_t key[2],
+    uint32_t out[4]) {
+  const uint64_t kMul0 = 0xD2511F53;
+  const uint64_t kMul1 = 0xCD9E8D57;
+  const uint32_t kWeyl0 = 0x9E3779B9;
+  const uint32_t kWeyl1 = 0xBB67AE85;
+  uint32_t x0 = ctr[0], x1 = ctr[1], x2 = ctr[2], x3 = ctr[3];
+  uint32_t k0 = key[0], k1 = key[1];
+  for (int round = 0; round < 10; ++round) {
+    const uint64_t p0 = kMul0 * x0;
+    const uint64_t p1 = kMul1 * x2;
+    const uint32_t y0 = static_cast<uint32_t>(p1 >> 32) ^ x1 ^ k0;
+    const uint32_t y1 = static_cast<uint32_t>(p1);
+    const uint32_t y2 = static_cast<uint32_t>(p0 >> 32) ^ x3 ^ k1;
+    const uint32_t y3 = static_cast<uint32_t>(p0);
+    x0 = y0; x1 = y1; x2 = y2; x3 = y3;
+    k0 += kWeyl0;
+    k1 += kWeyl1;
+  }
+  out[0] = x0; out[1] = x1; out[2] = x2; out[3] = x3;
+}
+
+// The four values of block number block of the stream of seed.
+inline void philox_block(const uint64_t seed, const uint64_t block,
+    uint32_t out[4]) {
+  const uint32_t ctr[4] = { static_cast<uint32_t>(block),
+      static_cast<uint32_t>(block >> 32), 0, 0 };
+  const uint32_t key[2] = { static_cast<uint32_t>(seed),
+      static_cast<uint32_t>(seed >> 32) };
+  philox4x32_10(ctr, key, out);
+}
+
+// Value number index of the stream of seed.
+inline uint32_t philox_uint32(const uint64_t seed, const uint64_t index) {
+  uint32_t out[4];
+  philox_block(seed, index / 4, out);
+  return out[index % 4];
+}
+
+// Maps a value to [0, 1).
+inline double philox_to_unit(const uint32_t x) {
+  return x * (1. / 4294967296.);
+}
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_PHILOX_H_
@@ -0,0 +1,136 @@
+#ifndef CAFFE_UTIL_POOLING_MASK_H_
+#define CAFFE_UTIL_POOLING_MASK_H_
+
+#include <stdint.h>
+#include <cstring>
+
+namespace caffe {
+
+// Compact max pooling switches, written by PoolingLayer to top[1] and read
+// back by UnpoolingLayer from bottom[1] when mask_format is COMPACT.
+//
+// Each pooled output records where its maximum sits inside its (unclipped)
+// kernel_h x kernel_w window: in 2 bits if the window has at most 4 elements
+// (the 2x2 case), in 8 bits if it has at most 256, and otherwise as the
+// 32 bit index into the input plane. The mask begins with the geometry it
+// was packed for, which Matches compares to the geometry of the reader, and
+// every channel plane follows on a Dtype boundary, so the switches are
+// carried by an ordinary Blob<Dtype> of blob_units<Dtype>(planes) elements
+// whose bytes are reinterpreted; sharing that blob passes them along
+// untouched.
+class PoolingMask {
+ public:
+  PoolingMask(const int height, const int width, const int pooled_height,
+      const int pooled_width, const int kernel_h, const int kernel_w,
+      const int stride_h, const int stride_w, const int pad_h,
+      const int pad_w)
+      : height_(height), width_(width), pooled_height_(pooled_height),
+        pooled_width_(pooled_width), kernel_h_(kernel_h), kernel_w_(kernel_w),
+        stride_h_(stride_h), stride_w_(stride_w), pad_h_(pad_h),
+        pad_w_(pad_w) {
+    const int window = kernel_h * kernel_w;
+    bits_ = window <= 4 ? 2 : (window <= 256 ? 8 : 32);
+  }
+
+  inline int bits() const { return bits_; }
+  // Number of Dtype elements taken by the geometry at the start of a mask.
+  template <typename Dtype>
+  inline int header_units() const {
+    return (sizeof(Header) + sizeof(Dtype) - 1) / sizeof(Dtype);
+  }
+  // Number of Dtype elements taken by the switches of one channel plane.
+  template <typename Dtype>
+  inline int plane_units() const {
+    const int bytes = (pooled_height_ * pooled_width_ * bits_ + 7) / 8;
+    return (bytes + sizeof(Dtype) - 1) / sizeof(Dtype);
+  }
+  // Number of Dtype elements taken by the mask of planes channel planes.
+  template <typename Dtype>
+  inline int blob_units(const int planes) const {
+    return header_units<Dtype>() + planes * plane_units<Dtype>();
+  }
+
+  // Write the geometry to the start of the mask at packed.
+  inline void WriteHeader(uint8_t* packed) const {
+    Header header;
+    GetHeader(&header);
+    memcpy(packed, &header, sizeof(header));
+  }
+  // Whether the mask at packed was packed for this geometry.
+  inline bool Matches(const uint8_t* packed) const {
+    Header header, own;
+    memcpy(&header, packed, sizeof(header));
+    GetHeader(&own);
+    return memcmp(&header, &own, sizeof(header)) == 0;
+  }
+
+  // Pack the argmax of every output of one plane, given as indices into the
+  // input plane, into the plane_units() elements at packed.
+  inline void Pack(const int* index, uint8_t* packed) const {
+    const int count = pooled_height_ * pooled_width_;
+    if (bits_ == 32) {
+      memcpy(packed, index, count * sizeof(int32_t));
+      return;
+    }
+    memset(packed, 0, (count * bits_ + 7) / 8);
+    for (int ph = 0; ph < pooled_height_; ++ph) {
+      const int hstart = ph * stride_h_ - pad_h_;
+      for (int pw = 0; pw < pooled_width_; ++pw) {
+        const int i = ph * pooled_width_ + pw;
+        const int offset = (index[i] / width_ - hstart) * kernel_w_
+            + index[i] % width_ - (pw * stride_w_ - pad_w_);
+        if (bits_ == 8) {
+          packed[i] = static_cast<uint8_t>(offset);
+        } else {
+          packed[i >> 2] |= static_cast<uint8_t>(offset << ((i & 3) * 2));
+        }
+      }
+    }
+  }
+
+  // Index into the input plane of the argmax of output (ph, pw).
+  inline int index(const uint8_t* packed, const int ph, const int pw) const {
+    const int i = ph * pooled_width_ + pw;
+    int offset;
+    if (bits_ == 32) {
+      return reinterpret_cast<const int32_t*>(packed)[i];
+    } else if (bits_ == 8) {
+      offset = packed[i];
+    } else {
+      offset = (packed[i >> 2] >> ((i & 3) * 2)) & 3;
+    }
+    return (ph * stride_h_ - pad_h_ + offset / kernel_w_) * width_
+        + pw * stride_w_ - pad_w_ + offset % kernel_w_;
+  }
+
+ private:
+  // The geometry a mask was packed for.
+  struct Header {
+    int32_t height, width, pooled_height, pooled_width, kernel_h, kernel_w,
+        stride_h, stride_w, pad_h, pad_w;
+  };
+
+  inline void GetHeader(Header* header) const {
+    header->height = height_;
+    header->width = width_;
+    header->pooled_height = pooled_height_;
+    header->pooled_width = pooled_width_;
+    header->kernel_h = kernel_h_;
+    header->kernel_w = kernel_w_;
+    header->stride_h = stride_h_;
+    header->stride_w = stride_w_;
+    header->pad_h = pad_h_;
+    header->pad_w = pad_w_;
+  }
+
+  int height_, width_;
+  int pooled_height_, pooled_width_;
+  int kernel_h_, kernel_w_;
+  int stride_h_, stride_w_;
+  int pad_h_, pad_w_;
+  int bits_;
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_POOLING_MASK_H_
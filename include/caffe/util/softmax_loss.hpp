@@ -0,0 +1,59 @@
+#ifndef CAFFE_UTIL_SOFTMAX_LOSS_H_
+#define CAFFE_UTIL_SOFTMAX_LOSS_H_
+
+#include <algorithm>
+#include <cmath>
+
+namespace caffe {
+
+// The fused softmax loss layers work on tiles of kSoftmaxTile consecutive
+// spatial positions of one image. A tile of all the channels stays in cache
+// while its maximum, exponentials, normalizer and loss are computed, so the
+// predictions are read from memory only once per pass.
+const int kSoftmaxTile = 256;
+
+// Number of tiles covering a spatial_dim plane.
+inline int softmax_num_tiles(const int spatial_dim) {
+  return (spatial_dim + kSoftmaxTile - 1) / kSoftmaxTile;
+}
+
+// Softmax over the channels of tile <= kSoftmaxTile consecutive positions.
+// x and prob point at the first position of channel 0 and the channels are
+// spatial_dim apart. Also stores log(sum_c exp(x_c)) of every position in
+// log_norm, so that the loss of class c is log_norm - x_c.
+template <typename Dtype>
+inline void softmax_tile_cpu(const Dtype* x, const int channels,
+    const int spatial_dim, const int tile, Dtype* prob, Dtype* log_norm) {
+  Dtype max_val[kSoftmaxTile];
+  Dtype sum[kSoftmaxTile];
+  std::copy(x, x + tile, max_val);
+  for (int c = 1; c < channels; ++c) {
+    const Dtype* x_c = x + c * spatial_dim;
+    for (int j = 0; j < tile; ++j) {
+      max_val[j] = std::max(max_val[j], x_c[j]);
+    }
+  }
+  std::fill(sum, sum + tile, Dtype(0));
+  for (int c = 0; c < channels; ++c) {
+    const Dtype* x_c = x + c * spatial_dim;
+    Dtype* prob_c = prob + c * spatial_dim;
+    for (int j = 0; j < tile; ++j) {
+      prob_c[j] = exp(x_c[j] - max_val[j]);
+      sum[j] += prob_c[j];
+    }
+  }
+  for (int j = 0; j < tile; ++j) {
+    log_norm[j] = max_val[j] + log(sum[j]);
+    sum[j] = Dtype(1) / sum[j];
+  }
+  for (int c = 0; c < channels; ++c) {
+    Dtype* prob_c = prob + c * spatial_dim;
+    for (int j = 0; j < tile; ++j) {
+      prob_c[j] *= sum[j];
+    }
+  }
+}
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_SOFTMAX_LOSS_H_
@@ -0,0 +1,81 @@
+#ifndef CAFFE_UTIL_TOP_K_H_
+#define CAFFE_UTIL_TOP_K_H_
+
+#include <algorithm>
+
+namespace caffe {
+
+// Top-k selection along one axis of a blob, for ArgMaxLayer and the accuracy
+// layers. The values of a position along the axis are stride apart, and the
+// kernels below work on a tile of up to kTopKTile positions that are
+// consecutive in memory, so their inner loops run over contiguous values and
+// vectorize. Ties rank the larger index first, like sorting the (value,
+// index) pairs in descending order.
+const int kTopKTile = 256;
+
+// Number of tiles covering inner_dim consecutive positions.
+inline int top_k_num_tiles(const int inner_dim) {
+  return (inner_dim + kTopKTile - 1) / kTopKTile;
+}
+
+// The running maximum over the axis of every position of the tile, and its
+// index.
+template <typename Dtype>
+inline void argmax_tile_cpu(const Dtype* x, const int axis_dim,
+    const int stride, const int tile, Dtype* max_val, int* max_idx) {
+  std::copy(x, x + tile, max_val);
+  std::fill(max_idx, max_idx + tile, 0);
+  for (int c = 1; c < axis_dim; ++c) {
+    const Dtype* x_c = x + c * stride;
+    for (int j = 0; j < tile; ++j) {
+      const bool larger = x_c[j] >= max_val[j];
+      max_val[j] = larger ? x_c[j] : max_val[j];
+      max_idx[j] = larger ? c : max_idx[j];
+    }
+  }
+}
+
+// The k largest values over the axis of a single position and their indices,
+// in descending order, kept sorted by insertion as the axis is scanned.
+template <typename Dtype>
+inline void top_k_cpu(const Dtype* x, const int axis_dim, const int stride,
+    const int top_k, Dtype* val, int* idx) {
+  int size = 0;
+  for (int c = 0; c < axis_dim; ++c) {
+    const Dtype v = x[c * stride];
+    if (size == top_k && v < val[top_k - 1]) {
+      continue;
+    }
+    int k = size < top_k ? size++ : top_k - 1;
+    for (; k > 0 && v >= val[k - 1]; --k) {
+      val[k] = val[k - 1];
+      idx[k] = idx[k - 1];
+    }
+    val[k] = v;
+    idx[k] = c;
+  }
+}
+
+// The rank along the axis of the value at index label[j] of every position
+// of the tile, that is the number of values ranked before it. Every label[j]
+// must lie in [0, axis_dim): callers map the others to a valid index first.
+template <typename Dtype>
+inline void label_rank_tile_cpu(const Dtype* x, const int axis_dim,
+    const int stride, const int tile, const int* label, int* rank) {
+  Dtype label_val[kTopKTile];
+  for (int j = 0; j < tile; ++j) {
+    label_val[j] = x[label[j] * stride + j];
+    rank[j] = 0;
+  }
+  for (int c = 0; c < axis_dim; ++c) {
+    const Dtype* x_c = x + c * stride;
+    for (int j = 0; j < tile; ++j) {
+      rank[j] += (x_c[j] > label_val[j]) |
+          ((x_c[j] == label_val[j]) & (c > label[j]));
+    }
+  }
+}
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_TOP_K_H_
@@ -202,6 +202,38 @@ class DeconvolutionLayer : public BaseConvolutionLayer<Dtype> {
   virtual void compute_output_shape();
 };
 
+/**
+ * @brief Deconvolution computed directly on the CPU, without the column
+ *        buffer and the col2im scatter of DeconvolutionLayer.
+ *
+ *   DeconvolutionLayer forms each output by a GEMM into the column buffer
+ *   followed by col2im, which zero-fills the whole output and then scatters
+ *   every column element into it. Here each output row is instead gathered
+ *   from the input rows that contribute to it, split by stride phase so that
+ *   the filter taps of a phase are constant along the row. An output row is
+ *   initialized with the bias, accumulated over the input channels while it
+ *   is still in cache, and written exactly once. For the common stride s,
+ *   kernel 2s upsampling every output pixel gets exactly 2 x 2 taps.
+ *
+ *   The backward pass is the matching direct strided convolution of the top
+ *   diff, so that no column buffer is needed either. Output planes, bottom
+ *   diff planes and filter gradients are split across threads when built with
+ *   OpenMP. Select it with convolution_param { engine: DIRECT }; the GPU mode
+ *   falls back to the DeconvolutionLayer implementation.
+ */
+template <typename Dtype>
+class DirectDeconvolutionLayer : public DeconvolutionLayer<Dtype> {
+ public:
+  explicit DirectDeconvolutionLayer(const LayerParameter& param)
+      : DeconvolutionLayer<Dtype>(param) {}
+
+ protected:
+  virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  virtual void Backward_cpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
+};
+
 #ifdef USE_CUDNN
 /*
  * @brief cuDNN implementation of ConvolutionLayer.
@@ -284,14 +316,16 @@ class Im2colLayer : public Layer<Dtype> {
   int pad_h_, pad_w_;
 };
 
-// Forward declare PoolingLayer and SplitLayer for use in LRNLayer.
-template <typename Dtype> class PoolingLayer;
-template <typename Dtype> class SplitLayer;
+// Forward declare PoolingMask for use in PoolingLayer.
+class PoolingMask;
 
 /**
  * @brief Normalize the input in a local region across or within feature maps.
  *
- * TODO(dox): thorough documentation for Forward, Backward, and proto params.
+ * On the CPU the sums over the local regions are running sums along a
+ * sliding window, and Forward and Backward are each one parallel pass over
+ * num x pixel tiles (ACROSS_CHANNELS) or num x channels (WITHIN_CHANNEL)
+ * with no intermediate blobs besides scale_.
  */
 template <typename Dtype>
 class LRNLayer : public Layer<Dtype> {
@@ -326,13 +360,17 @@ class LRNLayer : public Layer<Dtype> {
       const vector<Blob<Dtype>*>& top);
   virtual void CrossChannelForward_gpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top);
-  virtual void WithinChannelForward(const vector<Blob<Dtype>*>& bottom,
+  virtual void WithinChannelForward_cpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  virtual void WithinChannelForward_gpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top);
   virtual void CrossChannelBackward_cpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
   virtual void CrossChannelBackward_gpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
-  virtual void WithinChannelBackward(const vector<Blob<Dtype>*>& top,
+  virtual void WithinChannelBackward_cpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
+  virtual void WithinChannelBackward_gpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
 
   int size_;
@@ -345,27 +383,10 @@ class LRNLayer : public Layer<Dtype> {
   int height_;
   int width_;
 
-  // Fields used for normalization ACROSS_CHANNELS
-  // scale_ stores the intermediate summing results
+  // scale_ stores the normalizer of each output for Backward: k plus the
+  // scaled sum of squares across channels, or 1 plus the scaled sum of
+  // squares within the channel.
   Blob<Dtype> scale_;
-
-  // Fields used for normalization WITHIN_CHANNEL
-  shared_ptr<SplitLayer<Dtype> > split_layer_;
-  vector<Blob<Dtype>*> split_top_vec_;
-  shared_ptr<PowerLayer<Dtype> > square_layer_;
-  Blob<Dtype> square_input_;
-  Blob<Dtype> square_output_;
-  vector<Blob<Dtype>*> square_bottom_vec_;
-  vector<Blob<Dtype>*> square_top_vec_;
-  shared_ptr<PoolingLayer<Dtype> > pool_layer_;
-  Blob<Dtype> pool_output_;
-  vector<Blob<Dtype>*> pool_top_vec_;
-  shared_ptr<PowerLayer<Dtype> > power_layer_;
-  Blob<Dtype> power_output_;
-  vector<Blob<Dtype>*> power_top_vec_;
-  shared_ptr<EltwiseLayer<Dtype> > product_layer_;
-  Blob<Dtype> product_input_;
-  vector<Blob<Dtype>*> product_bottom_vec_;
 };
 
 
@@ -417,8 +438,13 @@ class PoolingLayer : public Layer<Dtype> {
   int height_, width_;
   int pooled_height_, pooled_width_;
   bool global_pooling_;
+  // Whether a mask top holds packed switches (see util/pooling_mask.hpp).
+  bool compact_mask_;
   Blob<Dtype> rand_idx_;
   Blob<int> max_idx_;
+  // Whether max_idx_ holds the argmax of the last forward pass. It is only
+  // recorded in the TRAIN phase; Backward_cpu recomputes it otherwise.
+  bool max_idx_valid_;
 };
 
 #ifdef USE_CUDNN
@@ -453,6 +479,13 @@ class CuDNNPoolingLayer : public PoolingLayer<Dtype> {
 };
 #endif
 
+/**
+ * @brief Crops the first bottom to the spatial extent of the second, aligned
+ *        by the coordinate maps of the layers between them.
+ *
+ * When the crop is a contiguous region of the first bottom (whole rows), the
+ * top is a view of that region (see Blob::ViewOf) and nothing is copied.
+ */
 template <typename Dtype>
 class CropLayer : public Layer<Dtype> {
  public:
@@ -468,6 +501,10 @@ class CropLayer : public Layer<Dtype> {
   }
   virtual inline int ExactNumBottomBlobs() const { return 2; }
   virtual inline int ExactNumTopBlobs() const { return 1; }
+  virtual inline bool TopSharesBottom(const int top_index,
+      const int bottom_index) const {
+    return bottom_index == 0;
+  }
   virtual inline DiagonalAffineMap<Dtype> coord_map() {
     vector<pair<Dtype, Dtype> > coefs;
     coefs.push_back(make_pair(1, - crop_h_));
@@ -529,12 +566,20 @@ class UnpoolingLayer : public Layer<Dtype> {
   virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
 
+  PoolingMask compact_mask() const;
+  int unpooled_index(const Dtype* plane_mask, const PoolingMask& mask,
+      const int ph, const int pw) const;
+
   int kernel_h_, kernel_w_;
   int stride_h_, stride_w_;
   int pad_h_, pad_w_;
   int channels_;
   int height_, width_;
   int unpooled_height_, unpooled_width_;
+  // Whether bottom[1] holds packed switches (see util/pooling_mask.hpp),
+  // and whether their geometry was checked since the last Reshape.
+  bool compact_mask_;
+  bool compact_mask_checked_;
 };
 
 }  // namespace caffe
@@ -129,6 +129,45 @@ void PyNet::set_input_arrays(bp::object data_obj, bp::object labels_obj) {
       PyArray_DIMS(data_arr)[0]);
 }
 
+bp::object PyNet::ForwardTiled(bp::object image_obj, string blob,
+    size_t memory_budget, int tile_size, int overlap) {
+  PyArrayObject* image_arr =
+      reinterpret_cast<PyArrayObject*>(image_obj.ptr());
+  if (PyArray_NDIM(image_arr) != 4) {
+    throw std::runtime_error("image must be 4-d");
+  }
+  Blob<float>* input = net_->input_blobs()[0];
+  check_contiguous_array(image_arr, "image", input->channels(),
+      PyArray_DIMS(image_arr)[2], PyArray_DIMS(image_arr)[3]);
+  if (PyArray_DIMS(image_arr)[0] != 1) {
+    throw std::runtime_error("image must hold a single image");
+  }
+  if (!blob.empty() && !net_->has_blob(blob)) {
+    throw std::runtime_error("Unknown blob " + blob);
+  }
+  Blob<float> image(1, input->channels(), PyArray_DIMS(image_arr)[2],
+      PyArray_DIMS(image_arr)[3]);
+  caffe_copy(image.count(), static_cast<float*>(PyArray_DATA(image_arr)),
+      image.mutable_cpu_data());
+
+  TiledNet<float> tiled_net(net_.get(), blob);
+  tiled_net.set_memory_budget(memory_budget);
+  tiled_net.set_tile_size(tile_size);
+  tiled_net.set_overlap(overlap);
+  Blob<float> output;
+  tiled_net.Forward(image, &output);
+
+  npy_intp dims[] = {output.num(), output.channels(), output.height(),
+      output.width()};
+  PyObject *obj = PyArray_SimpleNew(4, dims, NPY_FLOAT32);
+  float* output_data = static_cast<float*>(
+      PyArray_DATA(reinterpret_cast<PyArrayObject *>(obj)));
+  caffe_copy(output.count(), output.cpu_data(), output_data);
+  bp::handle<> h(obj);
+
+  return bp::object(h);
+}
+
 PySGDSolver::PySGDSolver(const string& param_file) {
   // as in PyNet, (as a convenience, not a guarantee), create a Python
   // exception if param_file can't be opened
@@ -174,6 +213,7 @@ BOOST_PYTHON_MODULE(_caffe) {
       .add_property("raw_scale",    &PyNet::raw_scale_)
       .add_property("channel_swap", &PyNet::channel_swap_)
       .def("_set_input_arrays",     &PyNet::set_input_arrays)
+      .def("_forward_tiled",        &PyNet::ForwardTiled)
       .def("save",                  &PyNet::save);
 
   bp::class_<PyBlob<float>, PyBlobWrap>(
@@ -110,6 +110,11 @@ class PyNet {
 
   void set_input_arrays(bp::object data_obj, bp::object labels_obj);
 
+  // Run the net over a 1 x C x H x W float32 image in overlapping tiles,
+  // returning the blended output blob as a new array.
+  bp::object ForwardTiled(bp::object image_obj, string blob,
+      size_t memory_budget, int tile_size, int overlap);
+
   // Save the network weights to binary proto for net surgeries.
   void save(string filename) {
     NetParameter net_param;
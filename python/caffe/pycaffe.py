@@ -341,6 +341,30 @@ def _Net_set_input_arrays(self, data, labels):
     return self._set_input_arrays(data, labels)
 
 
+def _Net_forward_tiled(self, image, blob=None, memory_budget=1 << 30,
+                       tile_size=0, overlap=-1):
+    """
+    Run a fully convolutional net over an image too large to run at once,
+    in overlapping tiles blended by a feathering window.
+
+    Take
+    image: (C x H x W) or (1 x C x H x W) ndarray of the net input.
+    blob: name of the blob to blend, or None for the first output.
+    memory_budget: bytes the activations of a batch of tiles may take.
+    tile_size: size of the tiles, or 0 to fit them to the budget.
+    overlap: overlap of the tiles in input pixels, or -1 to cover the
+             receptive field of the net.
+
+    Give
+    output: (K x H' x W') ndarray of the blended blob.
+    """
+    if image.ndim == 3:
+        image = image[np.newaxis]
+    image = np.ascontiguousarray(image, dtype=np.float32)
+    return self._forward_tiled(image, blob or '', memory_budget, tile_size,
+                               overlap)[0]
+
+
 def _Net_batch(self, blobs):
     """
     Batch blob lists according to net's batch size.
@@ -387,4 +411,5 @@ Net.set_channel_swap = _Net_set_channel_swap
 Net.preprocess = _Net_preprocess
 Net.deprocess = _Net_deprocess
 Net.set_input_arrays = _Net_set_input_arrays
+Net.forward_tiled = _Net_forward_tiled
 Net._batch = _Net_batch
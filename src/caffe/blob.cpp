@@ -12,6 +12,10 @@ void Blob<Dtype>::Reshape(const int num, const int channels, const int height,
   CHECK_GE(channels, 0);
   CHECK_GE(height, 0);
   CHECK_GE(width, 0);
+  if (num != num_ || channels != channels_ || height != height_ ||
+      width != width_) {
+    ++shape_generation_;
+  }
   num_ = num;
   channels_ = channels;
   height_ = height;
@@ -19,8 +23,10 @@ void Blob<Dtype>::Reshape(const int num, const int channels, const int height,
   count_ = num_ * channels_ * height_ * width_;
   if (count_ > capacity_) {
     capacity_ = count_;
-    data_.reset(new SyncedMemory(capacity_ * sizeof(Dtype)));
-    diff_.reset(new SyncedMemory(capacity_ * sizeof(Dtype)));
+    data_.reset(new SyncedMemory(capacity_ * sizeof(Dtype), host_policy_,
+        host_node_));
+    diff_.reset(new SyncedMemory(capacity_ * sizeof(Dtype), host_policy_,
+        host_node_));
   }
 }
 
@@ -32,8 +38,9 @@ void Blob<Dtype>::ReshapeLike(const Blob<Dtype>& other) {
 template <typename Dtype>
 Blob<Dtype>::Blob(const int num, const int channels, const int height,
     const int width)
-  // capacity_ must be initialized before calling Reshape
-  : capacity_(0) {
+  // The shape and capacity_ must be initialized before calling Reshape
+  : num_(0), channels_(0), height_(0), width_(0), capacity_(0),
+    shape_generation_(0), host_policy_(HOST_DEFAULT), host_node_(-1) {
   Reshape(num, channels, height, width);
 }
 
@@ -46,6 +53,11 @@ const Dtype* Blob<Dtype>::cpu_data() const {
 template <typename Dtype>
 void Blob<Dtype>::set_cpu_data(Dtype* data) {
   CHECK(data);
+  if (data_->parent()) {
+    // Setting the data of a view ends it.
+    data_.reset(new SyncedMemory(capacity_ * sizeof(Dtype), host_policy_,
+        host_node_));
+  }
   data_->set_cpu_data(data);
 }
 
@@ -103,6 +115,81 @@ void Blob<Dtype>::ShareDiff(const Blob& other) {
   diff_ = other.diff();
 }
 
+template <typename Dtype>
+void Blob<Dtype>::ViewOf(const Blob& other, const int offset) {
+  ViewDataOf(other, offset);
+  ViewDiffOf(other, offset);
+}
+
+template <typename Dtype>
+void Blob<Dtype>::ViewDataOf(const Blob& other, const int offset) {
+  CHECK_GE(offset, 0);
+  CHECK_LE(offset + count_, other.count());
+  data_.reset(new SyncedMemory(other.data(), offset * sizeof(Dtype),
+      count_ * sizeof(Dtype)));
+  capacity_ = count_;
+}
+
+template <typename Dtype>
+void Blob<Dtype>::ViewDiffOf(const Blob& other, const int offset) {
+  CHECK_GE(offset, 0);
+  CHECK_LE(offset + count_, other.count());
+  diff_.reset(new SyncedMemory(other.diff(), offset * sizeof(Dtype),
+      count_ * sizeof(Dtype)));
+  capacity_ = count_;
+}
+
+template <typename Dtype>
+bool Blob<Dtype>::IsViewOf(const Blob& other, const int offset) const {
+  const size_t offset_bytes = offset * sizeof(Dtype);
+  return data_ && diff_ && other.data_ && other.diff_
+      && data_->parent() == other.data_ && data_->offset() == offset_bytes
+      && diff_->parent() == other.diff_ && diff_->offset() == offset_bytes;
+}
+
+template <typename Dtype>
+bool Blob<Dtype>::is_view() const {
+  return (data_ && data_->parent()) || (diff_ && diff_->parent());
+}
+
+template <typename Dtype>
+void Blob<Dtype>::EndView() {
+  if (!is_view()) { return; }
+  capacity_ = count_;
+  if (diff_ && diff_->parent()) {
+    diff_.reset(new SyncedMemory(capacity_ * sizeof(Dtype), host_policy_,
+        host_node_));
+  }
+  if (!(data_ && data_->parent())) { return; }
+  shared_ptr<SyncedMemory> view = data_;
+  data_.reset(new SyncedMemory(capacity_ * sizeof(Dtype), host_policy_,
+      host_node_));
+  switch (Caffe::mode()) {
+  case Caffe::GPU:
+    caffe_copy(count_, static_cast<const Dtype*>(view->gpu_data()),
+        mutable_gpu_data());
+    break;
+  case Caffe::CPU:
+    caffe_copy(count_, static_cast<const Dtype*>(view->cpu_data()),
+        mutable_cpu_data());
+    break;
+  default:
+    LOG(FATAL) << "Unknown caffe mode.";
+  }
+}
+
+template <typename Dtype>
+void Blob<Dtype>::set_host_policy(HostMemoryPolicy policy, int node) {
+  host_policy_ = policy;
+  host_node_ = node;
+  if (data_ && !data_->parent()) {
+    data_->set_host_policy(policy, node);
+  }
+  if (diff_ && !diff_->parent()) {
+    diff_->set_host_policy(policy, node);
+  }
+}
+
 // The "update" method is used for parameter blobs in a Net, which are stored
 // as Blob<float> or Blob<double> -- hence we do not define it for
 // Blob<int> or Blob<unsigned int>.
@@ -1,5 +1,10 @@
+#include <boost/thread/tss.hpp>
 #include <glog/logging.h>
+#ifdef __linux__
+#include <sched.h>
+#endif
 #include <cstdio>
+#include <cstdlib>
 #include <ctime>
 
 #include "caffe/common.hpp"
@@ -7,7 +12,24 @@
 
 namespace caffe {
 
-shared_ptr<Caffe> Caffe::singleton_;
+// The instance of each thread.
+static boost::thread_specific_ptr<Caffe> thread_instance_;
+
+Caffe& Caffe::Get() {
+  if (!thread_instance_.get()) {
+    thread_instance_.reset(new Caffe());
+  }
+  return *thread_instance_;
+}
+
+Caffe::Borrow::Borrow(Caffe* caffe) : own_(thread_instance_.release()) {
+  thread_instance_.reset(caffe);
+}
+
+Caffe::Borrow::~Borrow() {
+  thread_instance_.release();
+  thread_instance_.reset(own_);
+}
 
 // random seeding
 int64_t cluster_seedgen(void) {
@@ -39,16 +61,66 @@ void GlobalInit(int* pargc, char*** pargv) {
   ::google::InstallFailureSignalHandler();
 }
 
+vector<int> ParseIdList(const string& list) {
+  vector<int> ids;
+  stringstream stream(list);
+  string range;
+  while (std::getline(stream, range, ',')) {
+    if (range.find_first_of("0123456789") == string::npos) {
+      continue;
+    }
+    const size_t dash = range.find('-');
+    const int first = atoi(range.substr(0, dash).c_str());
+    const int last = dash == string::npos ? first :
+        atoi(range.substr(dash + 1).c_str());
+    CHECK_GE(first, 0) << "Bad id range " << range;
+    CHECK_LE(first, last) << "Bad id range " << range;
+    for (int id = first; id <= last; ++id) {
+      ids.push_back(id);
+    }
+  }
+  return ids;
+}
+
+bool Caffe::PinThread(const vector<int>& cpus) {
+#ifdef __linux__
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (int i = 0; i < cpus.size(); ++i) {
+    CHECK_GE(cpus[i], 0);
+    CHECK_LT(cpus[i], CPU_SETSIZE) << "CPU " << cpus[i] << " out of range.";
+    CPU_SET(cpus[i], &set);
+  }
+  return !cpus.empty() && sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+  return false;
+#endif
+}
+
+uint64_t Caffe::philox_seed() {
+  Caffe& caffe = Get();
+  if (!caffe.philox_seeded_) {
+    caffe.philox_seeded_ = true;
+    caffe.philox_seed_ = cluster_seedgen();
+  }
+  return caffe.philox_seed_;
+}
+
 #ifdef CPU_ONLY  // CPU-only Caffe.
 
 Caffe::Caffe()
-    : random_generator_(), mode_(Caffe::CPU), phase_(Caffe::TRAIN) { }
+    : random_generator_(), philox_seeded_(false), philox_seed_(0),
+    philox_offset_(0), mode_(Caffe::CPU), phase_(Caffe::TRAIN) { }
 
 Caffe::~Caffe() { }
 
 void Caffe::set_random_seed(const unsigned int seed) {
   // RNG seed
   Get().random_generator_.reset(new RNG(seed));
+  // Philox seed
+  Get().philox_seeded_ = true;
+  Get().philox_seed_ = seed;
+  Get().philox_offset_ = 0;
 }
 
 void Caffe::SetDevice(const int device_id) {
@@ -85,33 +157,65 @@ void* Caffe::RNG::generator() {
 #else  // Normal GPU + CPU Caffe.
 
 Caffe::Caffe()
-    : cublas_handle_(NULL), curand_generator_(NULL), random_generator_(),
-    mode_(Caffe::CPU), phase_(Caffe::TRAIN) {
-  // Try to create a cublas handler, and report an error if failed (but we will
-  // keep the program running as one might just want to run CPU code).
-  if (cublasCreate(&cublas_handle_) != CUBLAS_STATUS_SUCCESS) {
-    LOG(ERROR) << "Cannot create Cublas handle. Cublas won't be available.";
-  }
-  // Try to create a curand handler.
-  if (curandCreateGenerator(&curand_generator_, CURAND_RNG_PSEUDO_DEFAULT)
-      != CURAND_STATUS_SUCCESS ||
-      curandSetPseudoRandomGeneratorSeed(curand_generator_, cluster_seedgen())
-      != CURAND_STATUS_SUCCESS) {
-    LOG(ERROR) << "Cannot create Curand generator. Curand won't be available.";
-  }
-}
+    : cublas_created_(false), cublas_handle_(NULL), curand_created_(false),
+    curand_generator_(NULL), random_generator_(), philox_seeded_(false),
+    philox_seed_(0), philox_offset_(0), mode_(Caffe::CPU),
+    phase_(Caffe::TRAIN) { }
 
 Caffe::~Caffe() {
+  ResetHandles();
+}
+
+void Caffe::ResetHandles() {
   if (cublas_handle_) CUBLAS_CHECK(cublasDestroy(cublas_handle_));
   if (curand_generator_) {
     CURAND_CHECK(curandDestroyGenerator(curand_generator_));
   }
+  cublas_handle_ = NULL;
+  curand_generator_ = NULL;
+  cublas_created_ = false;
+  curand_created_ = false;
+}
+
+cublasHandle_t Caffe::cublas_handle() {
+  Caffe& caffe = Get();
+  if (!caffe.cublas_created_) {
+    caffe.cublas_created_ = true;
+    // Try to create a cublas handler, and report an error if failed (but we
+    // will keep the program running as one might just want to run CPU code).
+    if (cublasCreate(&caffe.cublas_handle_) != CUBLAS_STATUS_SUCCESS) {
+      LOG(ERROR) << "Cannot create Cublas handle. Cublas won't be available.";
+      caffe.cublas_handle_ = NULL;
+    }
+  }
+  return caffe.cublas_handle_;
+}
+
+curandGenerator_t Caffe::curand_generator() {
+  Caffe& caffe = Get();
+  if (!caffe.curand_created_) {
+    caffe.curand_created_ = true;
+    // Try to create a curand handler.
+    if (curandCreateGenerator(&caffe.curand_generator_,
+        CURAND_RNG_PSEUDO_DEFAULT) != CURAND_STATUS_SUCCESS) {
+      LOG(ERROR) << "Cannot create Curand generator. "
+          << "Curand won't be available.";
+      caffe.curand_generator_ = NULL;
+    } else if (curandSetPseudoRandomGeneratorSeed(caffe.curand_generator_,
+        cluster_seedgen()) != CURAND_STATUS_SUCCESS) {
+      LOG(ERROR) << "Cannot seed Curand generator. "
+          << "Curand won't be available.";
+      CURAND_CHECK(curandDestroyGenerator(caffe.curand_generator_));
+      caffe.curand_generator_ = NULL;
+    }
+  }
+  return caffe.curand_generator_;
 }
 
 void Caffe::set_random_seed(const unsigned int seed) {
   // Curand seed
   static bool g_curand_availability_logged = false;
-  if (Get().curand_generator_) {
+  if (curand_generator()) {
     CURAND_CHECK(curandSetPseudoRandomGeneratorSeed(curand_generator(),
         seed));
     CURAND_CHECK(curandSetGeneratorOffset(curand_generator(), 0));
@@ -124,6 +228,10 @@ void Caffe::set_random_seed(const unsigned int seed) {
   }
   // RNG seed
   Get().random_generator_.reset(new RNG(seed));
+  // Philox seed
+  Get().philox_seeded_ = true;
+  Get().philox_seed_ = seed;
+  Get().philox_offset_ = 0;
 }
 
 void Caffe::SetDevice(const int device_id) {
@@ -135,15 +243,9 @@ void Caffe::SetDevice(const int device_id) {
   // The call to cudaSetDevice must come before any calls to Get, which
   // may perform initialization using the GPU.
   CUDA_CHECK(cudaSetDevice(device_id));
-  if (Get().cublas_handle_) CUBLAS_CHECK(cublasDestroy(Get().cublas_handle_));
-  if (Get().curand_generator_) {
-    CURAND_CHECK(curandDestroyGenerator(Get().curand_generator_));
-  }
-  CUBLAS_CHECK(cublasCreate(&Get().cublas_handle_));
-  CURAND_CHECK(curandCreateGenerator(&Get().curand_generator_,
-      CURAND_RNG_PSEUDO_DEFAULT));
-  CURAND_CHECK(curandSetPseudoRandomGeneratorSeed(Get().curand_generator_,
-      cluster_seedgen()));
+  // The handles of the old device are created again, on the new one, when
+  // next used.
+  Get().ResetHandles();
 }
 
 void Caffe::DeviceQuery() {
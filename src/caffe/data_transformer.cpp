@@ -9,13 +9,13 @@
 #include "caffe/data_transformer.hpp"
 #include "caffe/util/io.hpp"
 #include "caffe/util/math_functions.hpp"
-#include "caffe/util/rng.hpp"
+#include "caffe/util/philox.hpp"
 
 namespace caffe {
 
 template<typename Dtype>
 DataTransformer<Dtype>::DataTransformer(const TransformationParameter& param)
-    : param_(param) {
+    : param_(param), has_rand_(false) {
   phase_ = Caffe::phase();
   // check if we want to use mean_file
   if (param_.has_mean_file()) {
@@ -549,21 +549,18 @@ template <typename Dtype>
 void DataTransformer<Dtype>::InitRand() {
   const bool needs_rand = param_.mirror() ||
       (phase_ == Caffe::TRAIN && param_.crop_size());
+  has_rand_ = needs_rand;
   if (needs_rand) {
-    const unsigned int rng_seed = caffe_rng_rand();
-    rng_.reset(new Caffe::RNG(rng_seed));
-  } else {
-    rng_.reset();
+    rand_seed_ = caffe_rng_rand();
+    rand_index_ = 0;
   }
 }
 
 template <typename Dtype>
 int DataTransformer<Dtype>::Rand(int n) {
-  CHECK(rng_);
+  CHECK(has_rand_);
   CHECK_GT(n, 0);
-  caffe::rng_t* rng =
-      static_cast<caffe::rng_t*>(rng_->generator());
-  return ((*rng)() % n);
+  return philox_uint32(rand_seed_, rand_index_++) % n;
 }
 
 INSTANTIATE_CLASS(DataTransformer);
@@ -0,0 +1,284 @@
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "caffe/dataset_factory.hpp"
+#include "caffe/feature_cache.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+FeatureCache<Dtype>::FeatureCache(const size_t max_bytes)
+    : max_bytes_(max_bytes), bytes_(0), hits_(0), misses_(0) {
+}
+
+// Every entry starts with a header, so that entries written by another net
+// or in another precision are caught rather than misread.
+struct EntryHeader {
+  uint32_t magic;
+  int32_t num_blobs;
+  int32_t dtype_size;
+};
+static const uint32_t kEntryMagic = 0x46434831;  // "FCH1"
+
+// The keys of the dataset, in hex so that they sort as numbers.
+static string KeyString(const uint64_t key) {
+  char buffer[17];
+  snprintf(buffer, sizeof(buffer), "%016llx",
+      static_cast<unsigned long long>(key));  // NOLINT(runtime/int)
+  return string(buffer);
+}
+
+template <typename Dtype>
+FeatureCache<Dtype>::FeatureCache(const string& source,
+    const DataParameter_DB backend)
+    : max_bytes_(0), bytes_(0), hits_(0), misses_(0) {
+  dataset_ = DatasetFactory<string, string>(backend);
+  CHECK(dataset_->open(source, Dataset<string, string>::ReadWrite))
+      << "Failed to open feature cache " << source;
+  vector<string> keys;
+  dataset_->keys(&keys);
+  for (int i = 0; i < keys.size(); ++i) {
+    keys_.insert(strtoull(keys[i].c_str(), NULL, 16));
+  }
+  LOG(INFO) << "Opened feature cache " << source << " of " << keys_.size()
+      << " entries";
+}
+
+template <typename Dtype>
+FeatureCache<Dtype>::~FeatureCache() {
+  if (dataset_) {
+    dataset_->close();
+  }
+}
+
+// FNV-1a over 64-bit words of size bytes at data.
+static uint64_t HashBytes(const char* data, const size_t size, uint64_t hash) {
+  const uint64_t kPrime = 0x100000001b3ULL;
+  size_t j = 0;
+  for (; j + sizeof(uint64_t) <= size; j += sizeof(uint64_t)) {
+    uint64_t word;
+    memcpy(&word, data + j, sizeof(word));
+    hash = (hash ^ word) * kPrime;
+  }
+  for (; j < size; ++j) {
+    hash = (hash ^ static_cast<unsigned char>(data[j])) * kPrime;
+  }
+  return hash;
+}
+
+// The final mix, so that every bit of the input reaches every bit of the
+// hash.
+static uint64_t MixHash(uint64_t hash) {
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdULL;
+  hash ^= hash >> 33;
+  return hash;
+}
+
+template <typename Dtype>
+uint64_t FeatureCache<Dtype>::Hash(const vector<Blob<Dtype>*>& blobs,
+    uint64_t seed) {
+  uint64_t hash = seed ^ 0xcbf29ce484222325ULL;
+  for (int i = 0; i < blobs.size(); ++i) {
+    const int shape[4] = { blobs[i]->num(), blobs[i]->channels(),
+        blobs[i]->height(), blobs[i]->width() };
+    hash = HashBytes(reinterpret_cast<const char*>(shape), sizeof(shape),
+        hash);
+    hash = HashBytes(reinterpret_cast<const char*>(blobs[i]->cpu_data()),
+        blobs[i]->count() * sizeof(Dtype), hash);
+  }
+  return MixHash(hash);
+}
+
+template <typename Dtype>
+uint64_t FeatureCache<Dtype>::HashItem(const vector<Blob<Dtype>*>& blobs,
+    const int item, uint64_t seed) {
+  uint64_t hash = seed ^ 0xcbf29ce484222325ULL;
+  for (int i = 0; i < blobs.size(); ++i) {
+    CHECK_LT(item, blobs[i]->num());
+    const int shape[4] = { 1, blobs[i]->channels(), blobs[i]->height(),
+        blobs[i]->width() };
+    hash = HashBytes(reinterpret_cast<const char*>(shape), sizeof(shape),
+        hash);
+    hash = HashBytes(reinterpret_cast<const char*>(
+        blobs[i]->cpu_data() + blobs[i]->offset(item)),
+        blobs[i]->count() / blobs[i]->num() * sizeof(Dtype), hash);
+  }
+  return MixHash(hash);
+}
+
+template <typename Dtype>
+uint64_t FeatureCache<Dtype>::HashString(const string& str, uint64_t seed) {
+  return MixHash(HashBytes(str.data(), str.size(),
+      seed ^ 0xcbf29ce484222325ULL));
+}
+
+template <typename Dtype>
+bool FeatureCache<Dtype>::Get(const uint64_t key,
+    const vector<Blob<Dtype>*>& blobs) {
+  if (keys_.find(key) == keys_.end()) {
+    ++misses_;
+    return false;
+  }
+  Read(key, blobs, -1, 0);
+  ++hits_;
+  return true;
+}
+
+template <typename Dtype>
+bool FeatureCache<Dtype>::GetItems(const vector<uint64_t>& keys,
+    const vector<Blob<Dtype>*>& blobs) {
+  int found = 0;
+  for (int n = 0; n < keys.size(); ++n) {
+    found += keys_.find(keys[n]) != keys_.end();
+  }
+  hits_ += found;
+  misses_ += keys.size() - found;
+  if (keys.empty() || found < static_cast<int>(keys.size())) {
+    return false;
+  }
+  for (int n = 0; n < keys.size(); ++n) {
+    Read(keys[n], blobs, n, keys.size());
+  }
+  return true;
+}
+
+template <typename Dtype>
+void FeatureCache<Dtype>::Read(const uint64_t key,
+    const vector<Blob<Dtype>*>& blobs, const int item, const int num) {
+  string stored;
+  const string* entry = &stored;
+  if (dataset_) {
+    CHECK(dataset_->get(KeyString(key), &stored))
+        << "Failed to read the feature cache";
+  } else {
+    entry = &entries_[key];
+  }
+  const char* data = entry->data();
+  const char* const end = entry->data() + entry->size();
+  EntryHeader header;
+  CHECK_GE(static_cast<size_t>(end - data), sizeof(header))
+      << "Truncated feature cache entry";
+  memcpy(&header, data, sizeof(header));
+  data += sizeof(header);
+  CHECK_EQ(header.magic, kEntryMagic) << "Not a feature cache entry";
+  CHECK_EQ(header.num_blobs, static_cast<int>(blobs.size()))
+      << "The feature cache holds other blobs than the net computes.";
+  CHECK_EQ(header.dtype_size, static_cast<int>(sizeof(Dtype)))
+      << "The feature cache was written in another precision.";
+  for (int i = 0; i < blobs.size(); ++i) {
+    int shape[4];
+    CHECK_GE(static_cast<size_t>(end - data), sizeof(shape))
+        << "Truncated feature cache entry";
+    memcpy(shape, data, sizeof(shape));
+    data += sizeof(shape);
+    // The count of the blob must fit the rest of the entry, checked factor
+    // by factor so that a corrupt shape cannot overflow it.
+    const size_t limit = static_cast<size_t>(end - data) / sizeof(Dtype);
+    size_t count = 1;
+    for (int j = 0; j < 4; ++j) {
+      CHECK_GE(shape[j], 0) << "Corrupt feature cache entry";
+      CHECK(shape[j] == 0 || count <= limit / shape[j])
+          << "Truncated feature cache entry";
+      count *= shape[j];
+    }
+    Dtype* blob_data;
+    if (item < 0) {
+      blobs[i]->Reshape(shape[0], shape[1], shape[2], shape[3]);
+      blob_data = blobs[i]->mutable_cpu_data();
+    } else {
+      // The items of a batch share a shape: the first one sets it.
+      CHECK_EQ(shape[0], 1) << "The feature cache holds no single item.";
+      if (item == 0) {
+        blobs[i]->Reshape(num, shape[1], shape[2], shape[3]);
+      }
+      CHECK(blobs[i]->num() == num && blobs[i]->channels() == shape[1] &&
+          blobs[i]->height() == shape[2] && blobs[i]->width() == shape[3])
+          << "The items of a batch have other shapes in the feature cache.";
+      blob_data = blobs[i]->mutable_cpu_data() + blobs[i]->offset(item);
+    }
+    const size_t size = count * sizeof(Dtype);
+    memcpy(blob_data, data, size);
+    data += size;
+  }
+  CHECK(data == end)
+      << "The feature cache holds other blobs than the net computes.";
+}
+
+template <typename Dtype>
+void FeatureCache<Dtype>::Put(const uint64_t key,
+    const vector<Blob<Dtype>*>& blobs) {
+  Write(key, blobs, -1);
+  if (dataset_) {
+    CHECK(dataset_->commit()) << "Failed to write the feature cache";
+  }
+}
+
+template <typename Dtype>
+void FeatureCache<Dtype>::PutItems(const vector<uint64_t>& keys,
+    const vector<Blob<Dtype>*>& blobs) {
+  for (int i = 0; i < blobs.size(); ++i) {
+    CHECK_EQ(blobs[i]->num(), static_cast<int>(keys.size()))
+        << "Every blob must hold an item per key.";
+  }
+  // The items of a batch go to the dataset in one transaction.
+  for (int n = 0; n < keys.size(); ++n) {
+    Write(keys[n], blobs, n);
+  }
+  if (dataset_) {
+    CHECK(dataset_->commit()) << "Failed to write the feature cache";
+  }
+}
+
+template <typename Dtype>
+void FeatureCache<Dtype>::Write(const uint64_t key,
+    const vector<Blob<Dtype>*>& blobs, const int item) {
+  if (keys_.find(key) != keys_.end()) {
+    return;
+  }
+  size_t size = sizeof(EntryHeader);
+  for (int i = 0; i < blobs.size(); ++i) {
+    const int count = item < 0 ? blobs[i]->count()
+        : blobs[i]->count() / blobs[i]->num();
+    size += 4 * sizeof(int) + count * sizeof(Dtype);
+  }
+  if (!dataset_ && bytes_ + size > max_bytes_) {
+    LOG_FIRST_N(WARNING, 1) << "The feature cache is full at "
+        << keys_.size() << " entries, so it stores no more.";
+    return;
+  }
+  string entry(size, '\0');
+  char* data = &entry[0];
+  EntryHeader header;
+  header.magic = kEntryMagic;
+  header.num_blobs = blobs.size();
+  header.dtype_size = sizeof(Dtype);
+  memcpy(data, &header, sizeof(header));
+  data += sizeof(header);
+  for (int i = 0; i < blobs.size(); ++i) {
+    const int shape[4] = { item < 0 ? blobs[i]->num() : 1,
+        blobs[i]->channels(), blobs[i]->height(), blobs[i]->width() };
+    memcpy(data, shape, sizeof(shape));
+    data += sizeof(shape);
+    const Dtype* blob_data = blobs[i]->cpu_data()
+        + (item < 0 ? 0 : blobs[i]->offset(item));
+    const size_t blob_size =
+        shape[0] * shape[1] * shape[2] * shape[3] * sizeof(Dtype);
+    memcpy(data, blob_data, blob_size);
+    data += blob_size;
+  }
+  if (dataset_) {
+    CHECK(dataset_->put(KeyString(key), entry))
+        << "Failed to write the feature cache";
+  } else {
+    entries_[key].swap(entry);
+    bytes_ += size;
+  }
+  keys_.insert(key);
+}
+
+INSTANTIATE_CLASS(FeatureCache);
+
+}  // namespace caffe
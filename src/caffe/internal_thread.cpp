@@ -15,15 +15,38 @@ bool InternalThread::StartInternalThread() {
   if (!WaitForInternalThreadToExit()) {
     return false;
   }
+  thread_mode_ = Caffe::mode();
+  thread_phase_ = Caffe::phase();
+  thread_cpus_ = Caffe::prefetch_cpus();
+#ifndef CPU_ONLY
+  if (thread_mode_ == Caffe::GPU) {
+    CUDA_CHECK(cudaGetDevice(&thread_device_));
+  }
+#endif
   try {
     thread_ = new caffe::Thread
-        (&InternalThread::InternalThreadEntry, this);
+        (&InternalThread::InternalThreadMain, this);
   } catch (...) {
     return false;
   }
   return true;
 }
 
+void InternalThread::InternalThreadMain() {
+#ifndef CPU_ONLY
+  if (thread_device_ >= 0) {
+    CUDA_CHECK(cudaSetDevice(thread_device_));
+  }
+#endif
+  Caffe::set_mode(thread_mode_);
+  Caffe::set_phase(thread_phase_);
+  Caffe::set_prefetch_cpus(thread_cpus_);
+  if (!thread_cpus_.empty() && !Caffe::PinThread(thread_cpus_)) {
+    LOG_FIRST_N(WARNING, 1) << "Could not pin the prefetch thread.";
+  }
+  InternalThreadEntry();
+}
+
 /** Will not return until the internal thread has exited. */
 bool InternalThread::WaitForInternalThreadToExit() {
   if (is_started()) {
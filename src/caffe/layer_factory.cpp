@@ -15,7 +15,10 @@ Layer<Dtype>* GetConvolutionLayer(
   if (engine == ConvolutionParameter_Engine_DEFAULT) {
     engine = ConvolutionParameter_Engine_CAFFE;
 #ifdef USE_CUDNN
-    engine = ConvolutionParameter_Engine_CUDNN;
+    // Only the Caffe engine applies a fused ReLU.
+    if (!param.has_fused_relu_param()) {
+      engine = ConvolutionParameter_Engine_CUDNN;
+    }
 #endif
   }
   if (engine == ConvolutionParameter_Engine_CAFFE) {
@@ -31,6 +34,28 @@ Layer<Dtype>* GetConvolutionLayer(
 
 REGISTER_LAYER_CREATOR(CONVOLUTION, GetConvolutionLayer);
 
+// Get deconvolution layer according to engine.
+template <typename Dtype>
+Layer<Dtype>* GetDeconvolutionLayer(const LayerParameter& param) {
+  ConvolutionParameter_Engine engine = param.convolution_param().engine();
+  if (engine == ConvolutionParameter_Engine_DEFAULT) {
+    engine = ConvolutionParameter_Engine_CAFFE;
+  }
+  if (engine == ConvolutionParameter_Engine_CAFFE) {
+    return new DeconvolutionLayer<Dtype>(param);
+  } else if (engine == ConvolutionParameter_Engine_DIRECT) {
+    return new DirectDeconvolutionLayer<Dtype>(param);
+  } else if (engine == ConvolutionParameter_Engine_CUDNN) {
+    LOG(INFO) << "CUDNN has no deconvolution. "
+              << "Using Caffe's own deconvolution layer.";
+    return new DeconvolutionLayer<Dtype>(param);
+  } else {
+    LOG(FATAL) << "Layer " << param.name() << " has unknown engine.";
+  }
+}
+
+REGISTER_LAYER_CREATOR(DECONVOLUTION, GetDeconvolutionLayer);
+
 // Get pooling layer according to engine.
 template <typename Dtype>
 Layer<Dtype>* GetPoolingLayer(const LayerParameter& param) {
@@ -1,9 +1,8 @@
 #include <algorithm>
-#include <functional>
-#include <utility>
 #include <vector>
 
 #include "caffe/layer.hpp"
+#include "caffe/util/top_k.hpp"
 #include "caffe/vision_layers.hpp"
 
 namespace caffe {
@@ -13,15 +12,30 @@ void ArgMaxLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
   out_max_val_ = this->layer_param_.argmax_param().out_max_val();
   top_k_ = this->layer_param_.argmax_param().top_k();
+  has_axis_ = this->layer_param_.argmax_param().has_axis();
   CHECK_GE(top_k_, 1) << " top k must not be less than 1.";
-  CHECK_LE(top_k_, bottom[0]->count() / bottom[0]->num())
-      << "top_k must be less than or equal to the number of classes.";
+  if (has_axis_) {
+    axis_ = this->layer_param_.argmax_param().axis();
+    CHECK_GE(axis_, 0) << "axis must be 0, 1, 2 or 3.";
+    CHECK_LT(axis_, 4) << "axis must be 0, 1, 2 or 3.";
+  } else {
+    CHECK_LE(top_k_, bottom[0]->count() / bottom[0]->num())
+        << "top_k must be less than or equal to the number of classes.";
+  }
 }
 
 template <typename Dtype>
 void ArgMaxLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
-  if (out_max_val_) {
+  if (has_axis_) {
+    // Produces max_ind, or max_val if out_max_val, along the axis
+    int shape[4] = { bottom[0]->num(), bottom[0]->channels(),
+        bottom[0]->height(), bottom[0]->width() };
+    CHECK_LE(top_k_, shape[axis_])
+        << "top_k must be less than or equal to the dimension of the axis.";
+    shape[axis_] = top_k_;
+    top[0]->Reshape(shape[0], shape[1], shape[2], shape[3]);
+  } else if (out_max_val_) {
     // Produces max_ind and max_val
     top[0]->Reshape(bottom[0]->num(), 2, top_k_, 1);
   } else {
@@ -35,23 +49,67 @@ void ArgMaxLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
     const vector<Blob<Dtype>*>& top) {
   const Dtype* bottom_data = bottom[0]->cpu_data();
   Dtype* top_data = top[0]->mutable_cpu_data();
-  int num = bottom[0]->num();
-  int dim = bottom[0]->count() / bottom[0]->num();
-  for (int i = 0; i < num; ++i) {
-    std::vector<std::pair<Dtype, int> > bottom_data_vector;
-    for (int j = 0; j < dim; ++j) {
-      bottom_data_vector.push_back(
-          std::make_pair(bottom_data[i * dim + j], j));
-    }
-    std::partial_sort(
-        bottom_data_vector.begin(), bottom_data_vector.begin() + top_k_,
-        bottom_data_vector.end(), std::greater<std::pair<Dtype, int> >());
-    for (int j = 0; j < top_k_; ++j) {
-      top_data[top[0]->offset(i, 0, j)] = bottom_data_vector[j].second;
+  const int top_k = top_k_;
+  // The argmax runs along axis_dim values that are inner_dim apart, for
+  // each of the outer_dim x inner_dim positions of the other axes. Without
+  // an axis it runs over the flattened values of each image.
+  int outer_dim = bottom[0]->num();
+  int axis_dim = bottom[0]->count() / outer_dim;
+  int inner_dim = 1;
+  if (has_axis_) {
+    const int shape[4] = { bottom[0]->num(), bottom[0]->channels(),
+        bottom[0]->height(), bottom[0]->width() };
+    outer_dim = 1;
+    for (int i = 0; i < axis_; ++i) {
+      outer_dim *= shape[i];
     }
-    if (out_max_val_) {
-      for (int j = 0; j < top_k_; ++j) {
-        top_data[top[0]->offset(i, 1, j)] = bottom_data_vector[j].first;
+    axis_dim = shape[axis_];
+    inner_dim = bottom[0]->count() / (outer_dim * axis_dim);
+  }
+  const int top_dim = top[0]->count() / outer_dim;
+  const int k_stride = has_axis_ ? inner_dim : 1;
+  const bool out_ind = !has_axis_ || !out_max_val_;
+  const int val_offset = has_axis_ ? 0 : top_k;
+  const int tiles = top_k_num_tiles(inner_dim);
+#ifdef _OPENMP
+  #pragma omp parallel
+#endif
+  {
+    vector<Dtype> val(top_k);
+    vector<int> ind(top_k);
+#ifdef _OPENMP
+    #pragma omp for
+#endif
+    for (int b = 0; b < outer_dim * tiles; ++b) {
+      const int i = b / tiles;
+      const int j0 = (b % tiles) * kTopKTile;
+      const int tile = std::min(kTopKTile, inner_dim - j0);
+      const Dtype* x = bottom_data + i * axis_dim * inner_dim + j0;
+      Dtype* y = top_data + i * top_dim + j0;
+      if (top_k == 1) {
+        Dtype max_val[kTopKTile];
+        int max_ind[kTopKTile];
+        argmax_tile_cpu(x, axis_dim, inner_dim, tile, max_val, max_ind);
+        for (int j = 0; j < tile; ++j) {
+          if (out_ind) {
+            y[j] = max_ind[j];
+          }
+          if (out_max_val_) {
+            y[val_offset + j] = max_val[j];
+          }
+        }
+        continue;
+      }
+      for (int j = 0; j < tile; ++j) {
+        top_k_cpu(x + j, axis_dim, inner_dim, top_k, &val[0], &ind[0]);
+        for (int k = 0; k < top_k; ++k) {
+          if (out_ind) {
+            y[k * k_stride + j] = ind[k];
+          }
+          if (out_max_val_) {
+            y[val_offset + k * k_stride + j] = val[k];
+          }
+        }
       }
     }
   }
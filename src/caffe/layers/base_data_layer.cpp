@@ -30,6 +30,13 @@ template <typename Dtype>
 void BasePrefetchingDataLayer<Dtype>::LayerSetUp(
     const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
   BaseDataLayer<Dtype>::LayerSetUp(bottom, top);
+  // The prefetch buffers are copied to the tops by this thread, so they are
+  // placed on its node when they are first touched below, or pinned for the
+  // copies to the GPU.
+  const HostMemoryPolicy policy =
+      Caffe::mode() == Caffe::GPU ? HOST_PINNED : HOST_LOCAL;
+  this->prefetch_data_.set_host_policy(policy);
+  this->prefetch_label_.set_host_policy(policy);
   // Now, start the prefetch thread. Before calling prefetch, we make two
   // cpu_data calls so that the prefetch thread does not accidentally make
   // simultaneous cudaMalloc calls when the main thread is running. In some
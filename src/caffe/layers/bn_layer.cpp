@@ -92,154 +92,123 @@ namespace caffe {
     this->param_propagate_down_.resize(this->blobs_.size(), true);
   }
 
+  // The per-channel sums below run over N * H * W values. They are
+  // accumulated in Dtype over short blocks, which vectorizes, and the block
+  // sums are added up in double so that large maps do not lose precision.
+  const int kBNBlock = 512;
+
+  // Adds the sums of x - shift and of its square over count values.
+  template <typename Dtype>
+  static void bn_shifted_sums(const Dtype* x, const int count,
+      const Dtype shift, double* sum, double* sum_sq) {
+    for (int begin = 0; begin < count; begin += kBNBlock) {
+      const int end = std::min(begin + kBNBlock, count);
+      Dtype block_sum = 0, block_sum_sq = 0;
+      for (int i = begin; i < end; ++i) {
+        const Dtype d = x[i] - shift;
+        block_sum += d;
+        block_sum_sq += d * d;
+      }
+      *sum += block_sum;
+      *sum_sq += block_sum_sq;
+    }
+  }
+
+  // Adds the sums of dy and of dy * x over count values.
+  template <typename Dtype>
+  static void bn_dot_sums(const Dtype* dy, const Dtype* x, const int count,
+      double* sum_dy, double* sum_dy_x) {
+    for (int begin = 0; begin < count; begin += kBNBlock) {
+      const int end = std::min(begin + kBNBlock, count);
+      Dtype block_sum = 0, block_dot = 0;
+      for (int i = begin; i < end; ++i) {
+        block_sum += dy[i];
+        block_dot += dy[i] * x[i];
+      }
+      *sum_dy += block_sum;
+      *sum_dy_x += block_dot;
+    }
+  }
+
   template <typename Dtype>
   void BNLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
     const Dtype* bottom_data = bottom[0]->cpu_data();
     Dtype* top_data = top[0]->mutable_cpu_data();
-    const Dtype* const_top_data = top[0]->cpu_data();
 
     const Dtype* scale_data = this->blobs_[0]->cpu_data();
     const Dtype* shift_data = this->blobs_[1]->cpu_data();
+    const int spatial_dim = H_ * W_;
 
     switch (this->layer_param_.bn_param().bn_mode()) {
-    case BNParameter_BNMode_LEARN:
-      // put the squares of bottom into buffer_blob_
-      caffe_powx(bottom[0]->count(), bottom_data, Dtype(2),
-          buffer_blob_.mutable_cpu_data());
-
-      // computes variance using var(X) = E(X^2) - (EX)^2
-      // EX across spatial
-      caffe_cpu_gemv<Dtype>(CblasNoTrans, N_ * C_, H_ * W_,
-          Dtype(1. / (H_ * W_)), bottom_data,
-          spatial_sum_multiplier_.cpu_data(), Dtype(0),
-          spatial_mean_.mutable_cpu_data());
-      // EX across batch
-      caffe_cpu_gemv<Dtype>(CblasTrans, N_, C_, Dtype(1. / N_),
-          spatial_mean_.cpu_data(),
-          batch_sum_multiplier_.cpu_data(), Dtype(0),
-          batch_mean_.mutable_cpu_data());
-
-      // E(X^2) across spatial
-      caffe_cpu_gemv<Dtype>(CblasNoTrans, N_ * C_, H_ * W_,
-          Dtype(1. / (H_ * W_)), buffer_blob_.cpu_data(),
-          spatial_sum_multiplier_.cpu_data(), Dtype(0),
-          spatial_variance_.mutable_cpu_data());
-      // E(X^2) across batch
-      caffe_cpu_gemv<Dtype>(CblasTrans, N_, C_, Dtype(1. / N_),
-          spatial_variance_.cpu_data(),
-          batch_sum_multiplier_.cpu_data(), Dtype(0),
-          batch_variance_.mutable_cpu_data());
-
-      caffe_powx(batch_mean_.count(), batch_mean_.cpu_data(), Dtype(2),
-          buffer_blob_.mutable_cpu_data());  // (EX)^2
-      caffe_sub(batch_mean_.count(), batch_variance_.cpu_data(),
-          buffer_blob_.cpu_data(),
-          batch_variance_.mutable_cpu_data());  // variance
-
-      // save top[1] (batch_mean) and top[2] (batch_variance)
-      if (top.size() > 1) {
-          caffe_copy(batch_mean_.count(), batch_mean_.cpu_data(),
-              top[1]->mutable_cpu_data());
-      }
-      if (top.size() > 2) {
-          caffe_copy(batch_variance_.count(), batch_variance_.cpu_data(),
-              top[2]->mutable_cpu_data());
+    case BNParameter_BNMode_LEARN: {
+      Dtype* mean_data = batch_mean_.mutable_cpu_data();
+      Dtype* std_data = batch_variance_.mutable_cpu_data();
+      Dtype* x_norm_data = x_norm_.mutable_cpu_data();
+      Dtype* top_mean = top.size() > 1 ? top[1]->mutable_cpu_data() : NULL;
+      Dtype* top_variance =
+          top.size() > 2 ? top[2]->mutable_cpu_data() : NULL;
+      // Each channel is independent: one pass for its statistics, one pass
+      // to normalize, scale and shift.
+#ifdef _OPENMP
+      #pragma omp parallel for
+#endif
+      for (int c = 0; c < C_; ++c) {
+        // Sums of x - x_0 and its square, where the first value x_0 of the
+        // channel stands in for the mean so that the variance does not
+        // suffer from cancellation.
+        const Dtype shift = bottom_data[c * spatial_dim];
+        double sum = 0, sum_sq = 0;
+        for (int n = 0; n < N_; ++n) {
+          bn_shifted_sums(bottom_data + (n * C_ + c) * spatial_dim,
+              spatial_dim, shift, &sum, &sum_sq);
+        }
+        const double count = static_cast<double>(N_) * spatial_dim;
+        const double mean = sum / count;
+        const double variance = std::max(sum_sq / count - mean * mean, 0.);
+        mean_data[c] = shift + mean;
+        std_data[c] = sqrt(variance + var_eps_);
+        if (top_mean) {
+          top_mean[c] = mean_data[c];
+        }
+        if (top_variance) {
+          top_variance[c] = variance;
+        }
+
+        const Dtype mu = mean_data[c];
+        const Dtype inv_std = 1. / std_data[c];
+        const Dtype gamma = scale_data[c];
+        const Dtype beta = shift_data[c];
+        for (int n = 0; n < N_; ++n) {
+          const int offset = (n * C_ + c) * spatial_dim;
+          const Dtype* x = bottom_data + offset;
+          Dtype* x_norm = x_norm_data + offset;
+          Dtype* y = top_data + offset;
+          for (int i = 0; i < spatial_dim; ++i) {
+            x_norm[i] = (x[i] - mu) * inv_std;
+            y[i] = x_norm[i] * gamma + beta;
+          }
+        }
       }
-
-      // do mean and variance normalization
-      // subtract mean
-      caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, N_,
-          C_, 1, Dtype(1),
-          batch_sum_multiplier_.cpu_data(),
-          batch_mean_.cpu_data(), Dtype(0),
-          spatial_mean_.mutable_cpu_data());
-
-      caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, N_ * C_,
-          H_ * W_, 1, Dtype(-1),
-          spatial_mean_.cpu_data(),
-          spatial_sum_multiplier_.cpu_data(), Dtype(0),
-          buffer_blob_.mutable_cpu_data());
-
-      caffe_add(buffer_blob_.count(), bottom_data,
-          buffer_blob_.cpu_data(), top_data);
-
-      // normalize variance
-      caffe_add_scalar(batch_variance_.count(), var_eps_,
-        batch_variance_.mutable_cpu_data());
-      caffe_powx(batch_variance_.count(),
-          batch_variance_.cpu_data(), Dtype(0.5),
-          batch_variance_.mutable_cpu_data());
-
-      caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, N_,
-          C_, 1, Dtype(1),
-          batch_sum_multiplier_.cpu_data(),
-          batch_variance_.cpu_data(), Dtype(0),
-          spatial_variance_.mutable_cpu_data());
-      caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans,
-          N_ * C_, H_ * W_, 1, Dtype(1),
-          spatial_variance_.cpu_data(),
-          spatial_sum_multiplier_.cpu_data(), Dtype(0),
-          buffer_blob_.mutable_cpu_data());
-
-      caffe_div(buffer_blob_.count(), const_top_data,
-          buffer_blob_.cpu_data(), top_data);
-
-      // Saving x_norm
-      caffe_copy(buffer_blob_.count(), const_top_data,
-          x_norm_.mutable_cpu_data());
-      // scale
-      caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, N_, C_, 1, Dtype(1),
-          batch_sum_multiplier_.cpu_data(), scale_data, Dtype(0),
-          spatial_variance_.mutable_cpu_data());
-      caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, N_ * C_,
-          H_ * W_, 1, Dtype(1),
-          spatial_variance_.cpu_data(),
-          spatial_sum_multiplier_.cpu_data(), Dtype(0),
-          buffer_blob_.mutable_cpu_data());
-      caffe_mul(buffer_blob_.count(), top_data,
-          buffer_blob_.cpu_data(), top_data);
-
-      // shift
-      caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, N_, C_, 1, Dtype(1),
-          batch_sum_multiplier_.cpu_data(), shift_data, Dtype(0),
-          spatial_mean_.mutable_cpu_data());
-      caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans,
-          N_ * C_, H_ * W_, 1, Dtype(1),
-          spatial_mean_.cpu_data(),
-          spatial_sum_multiplier_.cpu_data(), Dtype(0),
-          buffer_blob_.mutable_cpu_data());
-      caffe_add(buffer_blob_.count(), const_top_data,
-          buffer_blob_.cpu_data(), top_data);
       break;
+    }
     case BNParameter_BNMode_INFERENCE:
-      // scale
-      caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, N_, C_, 1, Dtype(1),
-          batch_sum_multiplier_.cpu_data(), scale_data, Dtype(0),
-          spatial_variance_.mutable_cpu_data());
-      caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, N_ * C_,
-          H_ * W_, 1, Dtype(1),
-          spatial_variance_.cpu_data(),
-          spatial_sum_multiplier_.cpu_data(), Dtype(0),
-          buffer_blob_.mutable_cpu_data());
-      caffe_mul(buffer_blob_.count(), bottom_data,
-          buffer_blob_.cpu_data(), top_data);
-
-      // shift
-      caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, N_, C_, 1, Dtype(1),
-          batch_sum_multiplier_.cpu_data(), shift_data, Dtype(0),
-          spatial_mean_.mutable_cpu_data());
-      caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans,
-          N_ * C_, H_ * W_, 1, Dtype(1),
-          spatial_mean_.cpu_data(),
-          spatial_sum_multiplier_.cpu_data(), Dtype(0),
-          buffer_blob_.mutable_cpu_data());
-      caffe_add(buffer_blob_.count(), const_top_data,
-          buffer_blob_.cpu_data(), top_data);
+#ifdef _OPENMP
+      #pragma omp parallel for
+#endif
+      for (int p = 0; p < N_ * C_; ++p) {
+        const Dtype gamma = scale_data[p % C_];
+        const Dtype beta = shift_data[p % C_];
+        const Dtype* x = bottom_data + p * spatial_dim;
+        Dtype* y = top_data + p * spatial_dim;
+        for (int i = 0; i < spatial_dim; ++i) {
+          y[i] = x[i] * gamma + beta;
+        }
+      }
       break;
     default:
       LOG(FATAL) << "Unknown BN mode.";
-    } 
+    }
   }
 
   template <typename Dtype>
@@ -253,159 +222,67 @@ namespace caffe {
     Dtype* scale_diff = this->blobs_[0]->mutable_cpu_diff();
     Dtype* shift_diff = this->blobs_[1]->mutable_cpu_diff();
     const Dtype* scale_data = this->blobs_[0]->cpu_data();
+    const int spatial_dim = H_ * W_;
 
     switch (this->layer_param_.bn_param().bn_mode()) {
-    case BNParameter_BNMode_LEARN:
-      // Propagate layer to parameters
-      // gradient w.r.t. scale
-      caffe_mul(buffer_blob_.count(), x_norm_.cpu_data(),
-          top_diff, buffer_blob_.mutable_cpu_data());
-      // EX across spatial
-      caffe_cpu_gemv<Dtype>(CblasNoTrans, N_ * C_,
-          H_ * W_, Dtype(1), buffer_blob_.cpu_data(),
-          spatial_sum_multiplier_.cpu_data(), Dtype(0),
-          spatial_variance_.mutable_cpu_diff());
-      // EX across batch
-      caffe_cpu_gemv<Dtype>(CblasTrans, N_, C_, Dtype(1),
-          spatial_variance_.cpu_diff(),
-          batch_sum_multiplier_.cpu_data(), Dtype(0), scale_diff);
-
-      // gradient w.r.t. shift
-      // EX across spatial
-      caffe_cpu_gemv<Dtype>(CblasNoTrans, N_ * C_,
-          H_ * W_, Dtype(1), top_diff,
-          spatial_sum_multiplier_.cpu_data(),
-          Dtype(0), spatial_mean_.mutable_cpu_diff());
-      // EX across batch
-      caffe_cpu_gemv<Dtype>(CblasTrans, N_, C_,
-          Dtype(1), spatial_mean_.cpu_diff(),
-          batch_sum_multiplier_.cpu_data(),
-          Dtype(0), shift_diff);
-
-      // Propagate down
-
-      // put scale * top_diff to buffer_blob_
-      caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, N_, C_, 1, Dtype(1),
-          batch_sum_multiplier_.cpu_data(), scale_data, Dtype(0),
-          spatial_variance_.mutable_cpu_data());
-      caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, N_ * C_,
-          H_ * W_, 1, Dtype(1),
-          spatial_variance_.cpu_data(),
-          spatial_sum_multiplier_.cpu_data(), Dtype(0),
-          buffer_blob_.mutable_cpu_data());
-      caffe_mul(buffer_blob_.count(), top_diff, buffer_blob_.cpu_data(),
-          buffer_blob_.mutable_cpu_data());
-
-      // use new top diff for computation
-      caffe_mul(buffer_blob_.count(),  x_norm_.cpu_data(),
-          buffer_blob_.cpu_data(), bottom_diff);
-      // EX across spatial
-      caffe_cpu_gemv<Dtype>(CblasNoTrans, N_ * C_, H_ * W_,
-          Dtype(1), bottom_diff,
-          spatial_sum_multiplier_.cpu_data(), Dtype(0),
-          spatial_mean_.mutable_cpu_data());
-      // EX across batch
-      caffe_cpu_gemv<Dtype>(CblasTrans, N_, C_, Dtype(1),
-          spatial_mean_.cpu_data(),
-          batch_sum_multiplier_.cpu_data(), Dtype(0),
-          batch_mean_.mutable_cpu_data());
-
-      caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans,
-          N_, C_, 1, Dtype(1),
-          batch_sum_multiplier_.cpu_data(),
-          batch_mean_.cpu_data(), Dtype(0),
-          spatial_mean_.mutable_cpu_data());
-      caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, N_ * C_,
-          H_ * W_, 1, Dtype(1),
-          spatial_mean_.cpu_data(),
-          spatial_sum_multiplier_.cpu_data(), Dtype(0),
-          bottom_diff);
-
-      caffe_mul(buffer_blob_.count(),
-          x_norm_.cpu_data(), bottom_diff, bottom_diff);
-
-      // EX across spatial
-      caffe_cpu_gemv<Dtype>(CblasNoTrans, N_ * C_,
-          H_ * W_, Dtype(1), buffer_blob_.cpu_data(),
-          spatial_sum_multiplier_.cpu_data(), Dtype(0),
-          spatial_mean_.mutable_cpu_data());
-      // EX across batch
-      caffe_cpu_gemv<Dtype>(CblasTrans, N_, C_, Dtype(1),
-          spatial_mean_.cpu_data(),
-          batch_sum_multiplier_.cpu_data(), Dtype(0),
-          batch_mean_.mutable_cpu_data());
-
-      caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans,
-          N_, C_, 1, Dtype(1),
-          batch_sum_multiplier_.cpu_data(),
-          batch_mean_.cpu_data(), Dtype(0),
-          spatial_mean_.mutable_cpu_data());
-      caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans,
-          N_ * C_, H_ * W_, 1, Dtype(1),
-          spatial_mean_.cpu_data(),
-          spatial_sum_multiplier_.cpu_data(), Dtype(1), bottom_diff);
-
-      caffe_cpu_axpby(buffer_blob_.count(), Dtype(1),
-          buffer_blob_.cpu_data(), Dtype(-1. / (N_ * H_ * W_)),
-          bottom_diff);
-
-      // put the squares of bottom into buffer_blob_
-      caffe_powx(buffer_blob_.count(), bottom_data, Dtype(2),
-          buffer_blob_.mutable_cpu_data());
-
-      caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans,
-          N_, C_, 1, Dtype(1),
-          batch_sum_multiplier_.cpu_data(),
-          batch_variance_.cpu_data(), Dtype(0),
-          spatial_variance_.mutable_cpu_data());
-      caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans,
-          N_ * C_, H_ * W_, 1, Dtype(1),
-          spatial_variance_.cpu_data(),
-          spatial_sum_multiplier_.cpu_data(), Dtype(0),
-          buffer_blob_.mutable_cpu_data());
-
-      caffe_div(buffer_blob_.count(), bottom_diff,
-          buffer_blob_.cpu_data(), bottom_diff);
+    case BNParameter_BNMode_LEARN: {
+      const Dtype* x_norm_data = x_norm_.cpu_data();
+      const Dtype* std_data = batch_variance_.cpu_data();
+      const Dtype inv_count = Dtype(1) / (N_ * spatial_dim);
+      // Per channel: one pass for the scale and shift gradients, which are
+      // also the sums the bottom gradient needs, and one pass for
+      //   dx = scale / std * (dy - mean(dy) - x_norm * mean(dy * x_norm)).
+#ifdef _OPENMP
+      #pragma omp parallel for
+#endif
+      for (int c = 0; c < C_; ++c) {
+        double sum_dy = 0, sum_dy_x_norm = 0;
+        for (int n = 0; n < N_; ++n) {
+          const int offset = (n * C_ + c) * spatial_dim;
+          bn_dot_sums(top_diff + offset, x_norm_data + offset, spatial_dim,
+              &sum_dy, &sum_dy_x_norm);
+        }
+        scale_diff[c] = sum_dy_x_norm;
+        shift_diff[c] = sum_dy;
+        if (!propagate_down[0]) {
+          continue;
+        }
+        const Dtype mean_dy = sum_dy * inv_count;
+        const Dtype mean_dy_x_norm = sum_dy_x_norm * inv_count;
+        const Dtype factor = scale_data[c] / std_data[c];
+        for (int n = 0; n < N_; ++n) {
+          const int offset = (n * C_ + c) * spatial_dim;
+          const Dtype* dy = top_diff + offset;
+          const Dtype* x_norm = x_norm_data + offset;
+          Dtype* dx = bottom_diff + offset;
+          for (int i = 0; i < spatial_dim; ++i) {
+            dx[i] = factor * (dy[i] - mean_dy - x_norm[i] * mean_dy_x_norm);
+          }
+        }
+      }
       break;
+    }
     case BNParameter_BNMode_INFERENCE:
-      // Propagate layer to parameters
-      // gradient w.r.t. scale
-      caffe_mul(buffer_blob_.count(), bottom_data,
-          top_diff, buffer_blob_.mutable_cpu_data());
-      // EX across spatial
-      caffe_cpu_gemv<Dtype>(CblasNoTrans, N_ * C_,
-          H_ * W_, Dtype(1), buffer_blob_.cpu_data(),
-          spatial_sum_multiplier_.cpu_data(), Dtype(0),
-          spatial_variance_.mutable_cpu_diff());
-      // EX across batch
-      caffe_cpu_gemv<Dtype>(CblasTrans, N_, C_, Dtype(1),
-          spatial_variance_.cpu_diff(),
-          batch_sum_multiplier_.cpu_data(), Dtype(0), scale_diff);
-
-      // gradient w.r.t. shift
-      // EX across spatial
-      caffe_cpu_gemv<Dtype>(CblasNoTrans, N_ * C_,
-          H_ * W_, Dtype(1), top_diff,
-          spatial_sum_multiplier_.cpu_data(),
-          Dtype(0), spatial_mean_.mutable_cpu_diff());
-      // EX across batch
-      caffe_cpu_gemv<Dtype>(CblasTrans, N_, C_,
-          Dtype(1), spatial_mean_.cpu_diff(),
-          batch_sum_multiplier_.cpu_data(),
-          Dtype(0), shift_diff);
-
-      // Propagate down
-      // put scale * top_diff to buffer_blob_
-      caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, N_, C_, 1, Dtype(1),
-          batch_sum_multiplier_.cpu_data(), scale_data, Dtype(0),
-          spatial_variance_.mutable_cpu_data());
-      caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, N_ * C_,
-          H_ * W_, 1, Dtype(1),
-          spatial_variance_.cpu_data(),
-          spatial_sum_multiplier_.cpu_data(), Dtype(0),
-          buffer_blob_.mutable_cpu_data());
-      caffe_mul(buffer_blob_.count(), top_diff, buffer_blob_.cpu_data(),
-          bottom_diff);
+#ifdef _OPENMP
+      #pragma omp parallel for
+#endif
+      for (int c = 0; c < C_; ++c) {
+        double sum_dy = 0, sum_dy_x = 0;
+        for (int n = 0; n < N_; ++n) {
+          const int offset = (n * C_ + c) * spatial_dim;
+          bn_dot_sums(top_diff + offset, bottom_data + offset, spatial_dim,
+              &sum_dy, &sum_dy_x);
+          if (propagate_down[0]) {
+            const Dtype* dy = top_diff + offset;
+            Dtype* dx = bottom_diff + offset;
+            for (int i = 0; i < spatial_dim; ++i) {
+              dx[i] = dy[i] * scale_data[c];
+            }
+          }
+        }
+        scale_diff[c] = sum_dy_x;
+        shift_diff[c] = sum_dy;
+      }
       break;
     default:
       LOG(FATAL) << "Unknown BN mode.";
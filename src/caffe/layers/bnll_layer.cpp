@@ -1,7 +1,9 @@
 #include <algorithm>
+#include <cmath>
 #include <vector>
 
 #include "caffe/layer.hpp"
+#include "caffe/util/fast_math.hpp"
 #include "caffe/vision_layers.hpp"
 
 namespace caffe {
@@ -14,10 +16,14 @@ void BNLLLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
   const Dtype* bottom_data = bottom[0]->cpu_data();
   Dtype* top_data = top[0]->mutable_cpu_data();
   const int count = bottom[0]->count();
+#ifdef _OPENMP
+  #pragma omp parallel for
+#endif
   for (int i = 0; i < count; ++i) {
-    top_data[i] = bottom_data[i] > 0 ?
-        bottom_data[i] + log(1. + exp(-bottom_data[i])) :
-        log(1. + exp(bottom_data[i]));
+    // log(1 + exp(x)) = max(x, 0) + log(1 + exp(-|x|)), which does not
+    // overflow.
+    top_data[i] = std::max(bottom_data[i], Dtype(0))
+        + fast_log(Dtype(1) + fast_exp(-std::fabs(bottom_data[i])));
   }
 }
 
@@ -30,9 +36,12 @@ void BNLLLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     const Dtype* top_diff = top[0]->cpu_diff();
     Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
     const int count = bottom[0]->count();
-    Dtype expval;
+#ifdef _OPENMP
+    #pragma omp parallel for
+#endif
     for (int i = 0; i < count; ++i) {
-      expval = exp(std::min(bottom_data[i], Dtype(kBNLL_THRESHOLD)));
+      const Dtype expval =
+          fast_exp(std::min(bottom_data[i], Dtype(kBNLL_THRESHOLD)));
       bottom_diff[i] = top_diff[i] * expval / (expval + 1.);
     }
   }
@@ -1,6 +1,8 @@
+#include <algorithm>
 #include <vector>
 
 #include "caffe/layer.hpp"
+#include "caffe/net.hpp"
 #include "caffe/util/math_functions.hpp"
 #include "caffe/vision_layers.hpp"
 
@@ -39,6 +41,57 @@ void ConcatLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
   }
   top[0]->Reshape(num_, channels_, height_, width_);
   CHECK_EQ(count_, top[0]->count());
+  // When each bottom is one contiguous slice of the top (concatenating along
+  // num, or along channels of a single image), make the bottoms views of
+  // their slices, so that their producers write the top in place and there
+  // is nothing to copy in Forward and Backward. Not if the top is written in
+  // place, which would overwrite the outputs of the producers, not if a blob
+  // is concatenated more than once, and not for bottoms that are already
+  // views of other blobs.
+  bool use_views = (concat_dim_ == 0 || num_ == 1)
+      && !(this->net_ && this->net_->HasInPlaceConsumer(top[0]));
+  vector<int> offsets(bottom.size(), 0);
+  for (int i = 0; i < bottom.size(); ++i) {
+    if (i > 0) {
+      offsets[i] = offsets[i - 1] + bottom[i - 1]->count();
+    }
+    if (std::find(bottom.begin(), bottom.begin() + i, bottom[i])
+        != bottom.begin() + i) {
+      use_views = false;
+    }
+  }
+  // End stale views of the top first, before any slice is copied over them.
+  for (int i = 0; i < bottom.size(); ++i) {
+    if (bottom[i]->data()->parent() == top[0]->data()
+        && !(use_views && bottom[i]->IsViewOf(*top[0], offsets[i]))) {
+      bottom[i]->EndView();
+    }
+  }
+  if (!use_views) { return; }
+  for (int i = 0; i < bottom.size(); ++i) {
+    if (!bottom[i]->is_view()) {
+      // Keep what the producer has already written.
+      CopySlice(bottom[i], top[0], offsets[i]);
+      bottom[i]->ViewOf(*top[0], offsets[i]);
+    }
+  }
+}
+
+template <typename Dtype>
+void ConcatLayer<Dtype>::CopySlice(const Blob<Dtype>* bottom,
+    Blob<Dtype>* top, const int offset) {
+  switch (Caffe::mode()) {
+  case Caffe::CPU:
+    caffe_copy(bottom->count(), bottom->cpu_data(),
+        top->mutable_cpu_data() + offset);
+    break;
+  case Caffe::GPU:
+    caffe_copy(bottom->count(), bottom->gpu_data(),
+        top->mutable_gpu_data() + offset);
+    break;
+  default:
+    LOG(FATAL) << "Unknown caffe mode.";
+  }
 }
 
 template <typename Dtype>
@@ -48,14 +101,21 @@ void ConcatLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
   if (concat_dim_== 0) {
     int offset_num = 0;
     for (int i = 0; i < bottom.size(); ++i) {
-      const Dtype* bottom_data = bottom[i]->cpu_data();
-      int num_elem = bottom[i]->count();
-      caffe_copy(num_elem, bottom_data, top_data+top[0]->offset(offset_num));
+      if (!bottom[i]->IsViewOf(*top[0], top[0]->offset(offset_num))) {
+        const Dtype* bottom_data = bottom[i]->cpu_data();
+        int num_elem = bottom[i]->count();
+        caffe_copy(num_elem, bottom_data,
+            top_data + top[0]->offset(offset_num));
+      }
       offset_num += bottom[i]->num();
     }
   } else if (concat_dim_ == 1) {
     int offset_channel = 0;
     for (int i = 0; i < bottom.size(); ++i) {
+      if (bottom[i]->IsViewOf(*top[0], top[0]->offset(0, offset_channel))) {
+        offset_channel += bottom[i]->channels();
+        continue;
+      }
       const Dtype* bottom_data = bottom[i]->cpu_data();
       int num_elem =
         bottom[i]->channels()*bottom[i]->height()*bottom[i]->width();
@@ -76,7 +136,8 @@ void ConcatLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     int offset_num = 0;
     for (int i = 0; i < bottom.size(); ++i) {
       Blob<Dtype>* blob = bottom[i];
-      if (propagate_down[i]) {
+      if (propagate_down[i]
+          && !blob->IsViewOf(*top[0], top[0]->offset(offset_num))) {
         Dtype* bottom_diff = blob->mutable_cpu_diff();
         caffe_copy(blob->count(), top_diff + top[0]->offset(offset_num),
                    bottom_diff);
@@ -87,7 +148,8 @@ void ConcatLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     int offset_channel = 0;
     for (int i = 0; i < bottom.size(); ++i) {
       Blob<Dtype>* blob = bottom[i];
-      if (propagate_down[i]) {
+      if (propagate_down[i]
+          && !blob->IsViewOf(*top[0], top[0]->offset(0, offset_channel))) {
         Dtype* bottom_diff = blob->mutable_cpu_diff();
         int num_elem = blob->channels()*blob->height()*blob->width();
         for (int n = 0; n < num_; ++n) {
@@ -13,14 +13,20 @@ void ConcatLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
   if (concat_dim_ == 0) {
     int offset_num = 0;
     for (int i = 0; i < bottom.size(); ++i) {
-      const Dtype* bottom_data = bottom[i]->gpu_data();
-      caffe_copy(bottom[i]->count(), bottom_data,
-        top_data + top[0]->offset(offset_num));
+      if (!bottom[i]->IsViewOf(*top[0], top[0]->offset(offset_num))) {
+        const Dtype* bottom_data = bottom[i]->gpu_data();
+        caffe_copy(bottom[i]->count(), bottom_data,
+          top_data + top[0]->offset(offset_num));
+      }
       offset_num += bottom[i]->num();
     }
   } else if (concat_dim_ == 1) {
     int offset_channel = 0;
     for (int i = 0; i < bottom.size(); ++i) {
+      if (bottom[i]->IsViewOf(*top[0], top[0]->offset(0, offset_channel))) {
+        offset_channel += bottom[i]->channels();
+        continue;
+      }
       const Dtype* bottom_data = bottom[i]->gpu_data();
       int num_elem =
         bottom[i]->channels() * bottom[i]->height() * bottom[i]->width();
@@ -44,7 +50,8 @@ void ConcatLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
     int offset_num = 0;
     for (int i = 0; i < bottom.size(); ++i) {
       Blob<Dtype>* blob = bottom[i];
-      if (propagate_down[i]) {
+      if (propagate_down[i]
+          && !blob->IsViewOf(*top[0], top[0]->offset(offset_num))) {
         Dtype* bottom_diff = blob->mutable_gpu_diff();
         caffe_copy(blob->count(), top_diff + top[0]->offset(offset_num),
                        bottom_diff);
@@ -55,7 +62,8 @@ void ConcatLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
     int offset_channel = 0;
     for (int i = 0; i < bottom.size(); ++i) {
       Blob<Dtype>* blob = bottom[i];
-      if (propagate_down[i]) {
+      if (propagate_down[i]
+          && !blob->IsViewOf(*top[0], top[0]->offset(0, offset_channel))) {
         Dtype* bottom_diff = blob->mutable_gpu_diff();
         int num_elem = blob->channels()*blob->height()*blob->width();
         for (int n = 0; n < num_; ++n) {
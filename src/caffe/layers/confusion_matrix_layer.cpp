@@ -0,0 +1,193 @@
+#include <algorithm>
+#include <vector>
+
+#include "caffe/layer.hpp"
+#include "caffe/util/top_k.hpp"
+#include "caffe/vision_layers.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+void ConfusionMatrixLayer<Dtype>::LayerSetUp(
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  const ConfusionMatrixParameter& param =
+      this->layer_param_.confusion_matrix_param();
+  predicted_labels_ = bottom[0]->channels() == 1;
+  if (predicted_labels_) {
+    CHECK(param.has_num_classes())
+        << "num_classes must be given when bottom[0] holds labels.";
+    num_classes_ = param.num_classes();
+  } else {
+    num_classes_ = param.has_num_classes() ? param.num_classes()
+        : bottom[0]->channels();
+    CHECK_EQ(num_classes_, bottom[0]->channels())
+        << "num_classes must match the channels of the predictions.";
+  }
+  CHECK_GE(num_classes_, 1);
+  has_ignore_label_ = param.has_ignore_label();
+  if (has_ignore_label_) {
+    ignore_label_ = param.ignore_label();
+  }
+  ResetState();
+}
+
+template <typename Dtype>
+void ConfusionMatrixLayer<Dtype>::Reshape(
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  CHECK_EQ(bottom[0]->num(), bottom[1]->num())
+      << "The data and label should have the same number.";
+  CHECK_EQ(bottom[1]->channels(), 1)
+      << "Label data should have channel 1.";
+  CHECK_EQ(bottom[0]->height(), bottom[1]->height())
+      << "The data and label should have the same height.";
+  CHECK_EQ(bottom[0]->width(), bottom[1]->width())
+      << "The data and label should have the same width.";
+  CHECK_EQ(predicted_labels_, bottom[0]->channels() == 1)
+      << "The predictions cannot change between scores and labels.";
+  top[0]->Reshape(1, 1, 1, 1);
+  if (top.size() >= 2) {
+    top[1]->Reshape(1, 1, 1, 1);
+  }
+  if (top.size() >= 3) {
+    top[2]->Reshape(1, num_classes_, 1, 1);
+  }
+}
+
+template <typename Dtype>
+void ConfusionMatrixLayer<Dtype>::ResetState() {
+  confusion_.assign(num_classes_ * num_classes_, 0);
+  skipped_ = 0;
+}
+
+template <typename Dtype>
+void ConfusionMatrixLayer<Dtype>::Forward_cpu(
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  const Dtype* bottom_data = bottom[0]->cpu_data();
+  const Dtype* bottom_label = bottom[1]->cpu_data();
+  const int num = bottom[0]->num();
+  const int channels = bottom[0]->channels();
+  const int dim = bottom[0]->count() / num;
+  const int spatial_dim = bottom[0]->height() * bottom[0]->width();
+  const int tiles = top_k_num_tiles(spatial_dim);
+  int64_t skipped = 0;
+  // Every thread counts its pixels into its own matrix, and the matrices are
+  // added up at the end.
+#ifdef _OPENMP
+  #pragma omp parallel reduction(+: skipped)
+#endif
+  {
+    vector<int64_t> confusion(num_classes_ * num_classes_, 0);
+#ifdef _OPENMP
+    #pragma omp for
+#endif
+    for (int b = 0; b < num * tiles; ++b) {
+      const int i = b / tiles;
+      const int j0 = (b % tiles) * kTopKTile;
+      const int tile = std::min(kTopKTile, spatial_dim - j0);
+      const Dtype* data = bottom_data + i * dim + j0;
+      const Dtype* label = bottom_label + i * spatial_dim + j0;
+      int predicted[kTopKTile];
+      if (predicted_labels_) {
+        for (int j = 0; j < tile; ++j) {
+          predicted[j] = static_cast<int>(data[j]);
+        }
+      } else {
+        Dtype max_val[kTopKTile];
+        argmax_tile_cpu(data, channels, spatial_dim, tile, max_val, predicted);
+      }
+      for (int j = 0; j < tile; ++j) {
+        const int label_value = static_cast<int>(label[j]);
+        if (has_ignore_label_ && label_value == ignore_label_) {
+          continue;
+        }
+        if (label_value < 0 || label_value >= num_classes_
+            || predicted[j] < 0 || predicted[j] >= num_classes_) {
+          ++skipped;
+          continue;
+        }
+        ++confusion[label_value * num_classes_ + predicted[j]];
+      }
+    }
+#ifdef _OPENMP
+    #pragma omp critical
+#endif
+    for (int k = 0; k < confusion.size(); ++k) {
+      confusion_[k] += confusion[k];
+    }
+  }
+  if (skipped) {
+    LOG_FIRST_N(WARNING, 1) << this->layer_param_.name() << " skips pixels "
+        << "labeled or predicted outside of its " << num_classes_
+        << " classes; set ignore_label for a void label.";
+    skipped_ += skipped;
+  }
+
+  vector<double> metrics;
+  ComputeMetrics(&metrics);
+  top[0]->mutable_cpu_data()[0] = metrics[0];
+  if (top.size() >= 2) {
+    top[1]->mutable_cpu_data()[0] = metrics[1];
+  }
+  if (top.size() >= 3) {
+    for (int c = 0; c < num_classes_; ++c) {
+      top[2]->mutable_cpu_data()[c] = metrics[2 + c];
+    }
+  }
+}
+
+template <typename Dtype>
+void ConfusionMatrixLayer<Dtype>::ComputeMetrics(
+    vector<double>* metrics) const {
+  // IoU of class c = true positives / (pixels labeled c + pixels predicted
+  // c - true positives). Classes that were neither seen nor predicted do not
+  // count towards the means.
+  metrics->assign(num_classes_ + 2, 0);
+  int64_t total = 0;
+  int seen_classes = 0;
+  for (int c = 0; c < num_classes_; ++c) {
+    int64_t labeled = 0, predicted = 0;
+    for (int k = 0; k < num_classes_; ++k) {
+      labeled += confusion_[c * num_classes_ + k];
+      predicted += confusion_[k * num_classes_ + c];
+    }
+    total += labeled;
+    const int64_t true_positives = confusion_[c * num_classes_ + c];
+    const int64_t union_size = labeled + predicted - true_positives;
+    if (union_size == 0) {
+      continue;
+    }
+    const double iou = static_cast<double>(true_positives) / union_size;
+    (*metrics)[2 + c] = iou;
+    (*metrics)[0] += iou;
+    (*metrics)[1] += labeled * iou;
+    ++seen_classes;
+  }
+  if (seen_classes > 0) {
+    (*metrics)[0] /= seen_classes;
+  }
+  if (total > 0) {
+    (*metrics)[1] /= total;
+  }
+}
+
+template <typename Dtype>
+void ConfusionMatrixLayer<Dtype>::ReportState() {
+  vector<double> metrics;
+  ComputeMetrics(&metrics);
+  const string& name = this->layer_param_.name();
+  LOG(INFO) << "    " << name << ": mean IoU = " << metrics[0]
+      << ", frequency weighted IoU = " << metrics[1];
+  for (int c = 0; c < num_classes_; ++c) {
+    LOG(INFO) << "    " << name << ": IoU of class " << c << " = "
+        << metrics[2 + c];
+  }
+  if (skipped_) {
+    LOG(INFO) << "    " << name << ": " << skipped_
+        << " pixels out of range were not counted";
+  }
+}
+
+INSTANTIATE_CLASS(ConfusionMatrixLayer);
+REGISTER_LAYER_CLASS(CONFUSION_MATRIX, ConfusionMatrixLayer);
+
+}  // namespace caffe
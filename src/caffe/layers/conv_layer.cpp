@@ -30,6 +30,12 @@ void ConvolutionLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
         const Dtype* bias = this->blobs_[1]->cpu_data();
         this->forward_cpu_bias(top_data + top[i]->offset(n), bias);
       }
+      // Apply a fused ReLU while the output of the image is still in cache.
+      if (this->layer_param_.has_fused_relu_param()) {
+        caffe_cpu_relu(top[i]->count() / this->num_,
+            Dtype(this->layer_param_.fused_relu_param().negative_slope()),
+            top_data + top[i]->offset(n));
+      }
     }
   }
 }
@@ -40,6 +46,11 @@ void ConvolutionLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
   const Dtype* weight = this->blobs_[0]->cpu_data();
   Dtype* weight_diff = this->blobs_[0]->mutable_cpu_diff();
   for (int i = 0; i < top.size(); ++i) {
+    if (this->layer_param_.has_fused_relu_param()) {
+      caffe_cpu_relu_backward(top[i]->count(),
+          Dtype(this->layer_param_.fused_relu_param().negative_slope()),
+          top[i]->cpu_data(), top[i]->mutable_cpu_diff());
+    }
     const Dtype* top_diff = top[i]->cpu_diff();
     const Dtype* bottom_data = bottom[i]->cpu_data();
     Dtype* bottom_diff = bottom[i]->mutable_cpu_diff();
@@ -22,6 +22,12 @@ void ConvolutionLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
         const Dtype* bias = this->blobs_[1]->gpu_data();
         this->forward_gpu_bias(top_data + top[i]->offset(n), bias);
       }
+      // Apply a fused ReLU while the output of the image is still in cache.
+      if (this->layer_param_.has_fused_relu_param()) {
+        caffe_gpu_relu(top[i]->count() / this->num_,
+            Dtype(this->layer_param_.fused_relu_param().negative_slope()),
+            top_data + top[i]->offset(n));
+      }
     }
   }
 }
@@ -32,6 +38,11 @@ void ConvolutionLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
   const Dtype* weight = this->blobs_[0]->gpu_data();
   Dtype* weight_diff = this->blobs_[0]->mutable_gpu_diff();
   for (int i = 0; i < top.size(); ++i) {
+    if (this->layer_param_.has_fused_relu_param()) {
+      caffe_gpu_relu_backward(top[i]->count(),
+          Dtype(this->layer_param_.fused_relu_param().negative_slope()),
+          top[i]->gpu_data(), top[i]->mutable_gpu_diff());
+    }
     const Dtype* top_diff = top[i]->gpu_diff();
     // Bias gradient, if necessary.
     if (this->bias_term_ && this->param_propagate_down_[1]) {
@@ -79,11 +79,31 @@ void CropLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
     const vector<Blob<Dtype>*>& top) {
   top[0]->Reshape(bottom[0]->num(), bottom[0]->channels(), bottom[1]->height(),
       bottom[1]->width());
+  // A crop of whole rows (of a single image, or of all rows) is a contiguous
+  // region of the bottom, so the top can be a view of it instead of a copy,
+  // unless the top is written in place, or is already a view of another blob.
+  const bool contiguous = top[0]->width() == bottom[0]->width()
+      && (top[0]->height() == bottom[0]->height()
+          || top[0]->num() * top[0]->channels() == 1);
+  const int offset = bottom[0]->offset(0, 0, crop_h_, crop_w_);
+  const bool view_of_bottom = top[0]->data()->parent() == bottom[0]->data();
+  if (contiguous && !this->net_->HasInPlaceConsumer(top[0])) {
+    if (!top[0]->is_view() || (view_of_bottom
+        && !top[0]->IsViewOf(*bottom[0], offset))) {
+      top[0]->ViewOf(*bottom[0], offset);
+    }
+  } else if (view_of_bottom) {
+    top[0]->EndView();
+  }
 }
 
 template <typename Dtype>
 void CropLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
     const vector<Blob<Dtype>*>& top) {
+  if (top[0]->IsViewOf(*bottom[0],
+      bottom[0]->offset(0, 0, crop_h_, crop_w_))) {
+    return;
+  }
   const Dtype* bottom_data = bottom[0]->cpu_data();
   Dtype* top_data = top[0]->mutable_cpu_data();
   for (int n = 0; n < top[0]->num(); ++n) {
@@ -102,7 +122,13 @@ void CropLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
   const Dtype* top_diff = top[0]->cpu_diff();
   Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
-  if (propagate_down[0]) {
+  const int offset = bottom[0]->offset(0, 0, crop_h_, crop_w_);
+  if (propagate_down[0] && top[0]->IsViewOf(*bottom[0], offset)) {
+    // The top diff is already in place; zero the rest.
+    caffe_set(offset, static_cast<Dtype>(0), bottom_diff);
+    caffe_set(bottom[0]->count() - offset - top[0]->count(),
+        static_cast<Dtype>(0), bottom_diff + offset + top[0]->count());
+  } else if (propagate_down[0]) {
     caffe_set(bottom[0]->count(), static_cast<Dtype>(0), bottom_diff);
     for (int n = 0; n < top[0]->num(); ++n) {
       for (int c = 0; c < top[0]->channels(); ++c) {
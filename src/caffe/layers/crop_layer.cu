@@ -25,6 +25,10 @@ __global__ void copy_kernel(const int n, const int height, const int width,
 template <typename Dtype>
 void CropLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
     const vector<Blob<Dtype>*>& top) {
+  if (top[0]->IsViewOf(*bottom[0],
+      bottom[0]->offset(0, 0, crop_h_, crop_w_))) {
+    return;
+  }
   const Dtype* bottom_data = bottom[0]->gpu_data();
   Dtype* top_data = top[0]->mutable_gpu_data();
   const int lines = top[0]->count() / top[0]->width();
@@ -43,8 +47,14 @@ void CropLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
   const Dtype* top_diff = top[0]->gpu_diff();
   Dtype* bottom_diff = bottom[0]->mutable_gpu_diff();
   const int lines = top[0]->count() / top[0]->width();
+  const int offset = bottom[0]->offset(0, 0, crop_h_, crop_w_);
 
-  if (propagate_down[0]) {
+  if (propagate_down[0] && top[0]->IsViewOf(*bottom[0], offset)) {
+    // The top diff is already in place; zero the rest.
+    caffe_gpu_set(offset, static_cast<Dtype>(0), bottom_diff);
+    caffe_gpu_set(bottom[0]->count() - offset - top[0]->count(),
+        static_cast<Dtype>(0), bottom_diff + offset + top[0]->count());
+  } else if (propagate_down[0]) {
     caffe_gpu_set(bottom[0]->count(), static_cast<Dtype>(0), bottom_diff);
     // NOLINT_NEXT_LINE(whitespace/operators)
     copy_kernel<<<CAFFE_GET_BLOCKS(lines), CAFFE_CUDA_NUM_THREADS>>>(
@@ -74,5 +74,5 @@ STUB_GPU(DeconvolutionLayer);
 #endif
 
 INSTANTIATE_CLASS(DeconvolutionLayer);
-REGISTER_LAYER_CLASS(DECONVOLUTION, DeconvolutionLayer);
+
 }  // namespace caffe
@@ -0,0 +1,223 @@
+#include <algorithm>
+#include <vector>
+
+#include "caffe/layer.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/vision_layers.hpp"
+
+namespace caffe {
+
+// Output (or input) index range [lo, hi) that a filter tap maps into bounds:
+// index = q * stride + offset must lie in [0, limit) for q in [0, q_limit).
+static inline void tap_range(const int offset, const int stride,
+    const int limit, const int q_limit, int* lo, int* hi) {
+  *lo = offset >= 0 ? 0 : (-offset + stride - 1) / stride;
+  *hi = limit - offset <= 0 ? 0 : (limit - offset - 1) / stride + 1;
+  *hi = std::min(*hi, q_limit);
+}
+
+template <typename Dtype>
+void DirectDeconvolutionLayer<Dtype>::Forward_cpu(
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  const int kernel_h = this->kernel_h_, kernel_w = this->kernel_w_;
+  const int stride_h = this->stride_h_, stride_w = this->stride_w_;
+  const int pad_h = this->pad_h_, pad_w = this->pad_w_;
+  const int height = this->height_, width = this->width_;
+  const int height_out = this->height_out_, width_out = this->width_out_;
+  const int channels = this->channels_;
+  const int num_output = this->num_output_;
+  const int channels_g = channels / this->group_;
+  const int num_output_g = num_output / this->group_;
+  const int kernel_count = kernel_h * kernel_w;
+  const Dtype* weight = this->blobs_[0]->cpu_data();
+  const Dtype* bias = this->bias_term_ ? this->blobs_[1]->cpu_data() : NULL;
+  for (int i = 0; i < bottom.size(); ++i) {
+    const Dtype* bottom_data = bottom[i]->cpu_data();
+    Dtype* top_data = top[i]->mutable_cpu_data();
+    const int planes = this->num_ * num_output;
+#ifdef _OPENMP
+    #pragma omp parallel for
+#endif
+    for (int p = 0; p < planes; ++p) {
+      const int n = p / num_output;
+      const int o = p % num_output;
+      const int g = o / num_output_g;
+      const int o_g = o % num_output_g;
+      const Dtype bias_value = bias ? bias[o] : Dtype(0);
+      for (int y = 0; y < height_out; ++y) {
+        Dtype* top_row = top_data + (p * height_out + y) * width_out;
+        caffe_set(width_out, bias_value, top_row);
+        // Output row y gathers input rows (y + pad_h) / stride_h - t through
+        // filter rows (y + pad_h) % stride_h + t * stride_h.
+        const int y_phase = (y + pad_h) % stride_h;
+        const int y_base = (y + pad_h) / stride_h;
+        for (int c = g * channels_g; c < (g + 1) * channels_g; ++c) {
+          const Dtype* bottom_plane = bottom_data
+              + (n * channels + c) * height * width;
+          const Dtype* weight_c = weight
+              + (c * num_output_g + o_g) * kernel_count;
+          for (int kh = y_phase; kh < kernel_h; kh += stride_h) {
+            const int h = y_base - (kh - y_phase) / stride_h;
+            if (h < 0 || h >= height) {
+              continue;
+            }
+            const Dtype* bottom_row = bottom_plane + h * width;
+            const Dtype* weight_row = weight_c + kh * kernel_w;
+            // Column tap kw sends input column q to output q * stride_w + kw
+            // - pad_w, so along the row each tap is a constant-weight axpy.
+            for (int kw = 0; kw < kernel_w; ++kw) {
+              const Dtype w = weight_row[kw];
+              const int offset = kw - pad_w;
+              int q_begin, q_end;
+              tap_range(offset, stride_w, width_out, width, &q_begin, &q_end);
+              if (q_begin >= q_end) {
+                continue;
+              }
+              // Start at the first column in the row: offset alone may lie
+              // before it.
+              Dtype* out = top_row + offset + q_begin * stride_w;
+              const Dtype* in = bottom_row + q_begin;
+              for (int q = 0; q < q_end - q_begin; ++q) {
+                out[q * stride_w] += w * in[q];
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void DirectDeconvolutionLayer<Dtype>::Backward_cpu(
+    const vector<Blob<Dtype>*>& top, const vector<bool>& propagate_down,
+    const vector<Blob<Dtype>*>& bottom) {
+  const int kernel_h = this->kernel_h_, kernel_w = this->kernel_w_;
+  const int stride_h = this->stride_h_, stride_w = this->stride_w_;
+  const int pad_h = this->pad_h_, pad_w = this->pad_w_;
+  const int height = this->height_, width = this->width_;
+  const int height_out = this->height_out_, width_out = this->width_out_;
+  const int channels = this->channels_;
+  const int num_output = this->num_output_;
+  const int channels_g = channels / this->group_;
+  const int num_output_g = num_output / this->group_;
+  const int kernel_count = kernel_h * kernel_w;
+  const int num = this->num_;
+  const Dtype* weight = this->blobs_[0]->cpu_data();
+  Dtype* weight_diff = this->blobs_[0]->mutable_cpu_diff();
+  for (int i = 0; i < top.size(); ++i) {
+    const Dtype* top_diff = top[i]->cpu_diff();
+    const Dtype* bottom_data = bottom[i]->cpu_data();
+    // Bias gradient, if necessary.
+    if (this->bias_term_ && this->param_propagate_down_[1]) {
+      Dtype* bias_diff = this->blobs_[1]->mutable_cpu_diff();
+#ifdef _OPENMP
+      #pragma omp parallel for
+#endif
+      for (int o = 0; o < num_output; ++o) {
+        Dtype sum = 0;
+        for (int n = 0; n < num; ++n) {
+          const Dtype* top_plane = top_diff
+              + (n * num_output + o) * height_out * width_out;
+          for (int j = 0; j < height_out * width_out; ++j) {
+            sum += top_plane[j];
+          }
+        }
+        bias_diff[o] += sum;
+      }
+    }
+    // Gradient w.r.t. weight: each (input, output) channel pair owns its
+    // kernel_h x kernel_w filter, so the pairs are independent.
+    if (this->param_propagate_down_[0]) {
+      const int pairs = channels * num_output_g;
+#ifdef _OPENMP
+      #pragma omp parallel for
+#endif
+      for (int p = 0; p < pairs; ++p) {
+        const int c = p / num_output_g;
+        const int o = (c / channels_g) * num_output_g + p % num_output_g;
+        Dtype* weight_diff_p = weight_diff + p * kernel_count;
+        for (int kh = 0; kh < kernel_h; ++kh) {
+          int h_begin, h_end;
+          tap_range(kh - pad_h, stride_h, height_out, height, &h_begin,
+              &h_end);
+          for (int kw = 0; kw < kernel_w; ++kw) {
+            const int offset = kw - pad_w;
+            int q_begin, q_end;
+            tap_range(offset, stride_w, width_out, width, &q_begin, &q_end);
+            if (q_begin >= q_end) {
+              continue;
+            }
+            Dtype sum = 0;
+            for (int n = 0; n < num; ++n) {
+              const Dtype* bottom_plane = bottom_data
+                  + (n * channels + c) * height * width;
+              const Dtype* top_plane = top_diff
+                  + (n * num_output + o) * height_out * width_out;
+              for (int h = h_begin; h < h_end; ++h) {
+                const Dtype* bottom_row = bottom_plane + h * width + q_begin;
+                const Dtype* top_row = top_plane
+                    + (h * stride_h + kh - pad_h) * width_out + offset
+                    + q_begin * stride_w;
+                for (int q = 0; q < q_end - q_begin; ++q) {
+                  sum += bottom_row[q] * top_row[q * stride_w];
+                }
+              }
+            }
+            weight_diff_p[kh * kernel_w + kw] += sum;
+          }
+        }
+      }
+    }
+    // Gradient w.r.t. bottom data: a strided convolution of the top diff that
+    // writes each bottom row once.
+    if (propagate_down[i]) {
+      Dtype* bottom_diff = bottom[i]->mutable_cpu_diff();
+      const int planes = num * channels;
+#ifdef _OPENMP
+      #pragma omp parallel for
+#endif
+      for (int p = 0; p < planes; ++p) {
+        const int n = p / channels;
+        const int c = p % channels;
+        const int g = c / channels_g;
+        const Dtype* weight_c = weight + c * num_output_g * kernel_count;
+        for (int h = 0; h < height; ++h) {
+          Dtype* bottom_row = bottom_diff + (p * height + h) * width;
+          caffe_set(width, Dtype(0), bottom_row);
+          for (int o_g = 0; o_g < num_output_g; ++o_g) {
+            const Dtype* top_plane = top_diff + (n * num_output
+                + g * num_output_g + o_g) * height_out * width_out;
+            const Dtype* weight_o = weight_c + o_g * kernel_count;
+            for (int kh = 0; kh < kernel_h; ++kh) {
+              const int y = h * stride_h + kh - pad_h;
+              if (y < 0 || y >= height_out) {
+                continue;
+              }
+              const Dtype* top_row = top_plane + y * width_out;
+              for (int kw = 0; kw < kernel_w; ++kw) {
+                const Dtype w = weight_o[kh * kernel_w + kw];
+                const int offset = kw - pad_w;
+                int q_begin, q_end;
+                tap_range(offset, stride_w, width_out, width, &q_begin,
+                    &q_end);
+                if (q_begin >= q_end) {
+                  continue;
+                }
+                const Dtype* in = top_row + offset + q_begin * stride_w;
+                Dtype* out = bottom_row + q_begin;
+                for (int q = 0; q < q_end - q_begin; ++q) {
+                  out[q] += w * in[q * stride_w];
+                }
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+INSTANTIATE_CLASS(DirectDeconvolutionLayer);
+
+}  // namespace caffe
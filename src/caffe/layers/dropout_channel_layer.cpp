@@ -19,12 +19,6 @@ void DropoutChannelLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
   DCHECK(threshold_ < 1.);
   scale_ = 1. / (1. - threshold_);
   uint_thres_ = static_cast<unsigned int>(UINT_MAX * threshold_);
-
-  // Figure out the dimensions
-  N_ = bottom[0]->num();
-  C_ = bottom[0]->channels();
-  H_ = bottom[0]->height();
-  W_ = bottom[0]->width();
 }
 
 template <typename Dtype>
@@ -32,18 +26,26 @@ void DropoutChannelLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
   NeuronLayer<Dtype>::Reshape(bottom, top);
   // Set up the cache for random number generation
-  rand_mat_.Reshape(bottom[0]->num(), bottom[0]->channels(),
-      bottom[0]->height(), bottom[0]->width());
-  rand_vec_.Reshape(bottom[0]->num(), bottom[0]->channels(),
-      1, 1);
+  rand_vec_.Reshape(bottom[0]->num(), bottom[0]->channels(), 1, 1);
+}
 
-  // fill spatial multiplier
-  spatial_sum_multiplier_.Reshape(1, 1, bottom[0]->height(), bottom[0]->width());
-  Dtype* spatial_multipl_data = spatial_sum_multiplier_.mutable_cpu_data();
-  caffe_set(spatial_sum_multiplier_.count(), Dtype(1),
-      spatial_multipl_data);
-  caffe_set(spatial_sum_multiplier_.count(), Dtype(0),
-      spatial_sum_multiplier_.mutable_cpu_diff());
+// Multiply every channel plane of x by scale if its draw is above the
+// threshold, and by 0 otherwise.
+template <typename Dtype>
+static void dropout_channel_cpu(const int planes, const int spatial_dim,
+    const Dtype* x, const Dtype* rand, const Dtype threshold,
+    const Dtype scale, Dtype* y) {
+#ifdef _OPENMP
+  #pragma omp parallel for
+#endif
+  for (int p = 0; p < planes; ++p) {
+    const Dtype factor = (rand[p] > threshold) * scale;
+    const Dtype* x_p = x + p * spatial_dim;
+    Dtype* y_p = y + p * spatial_dim;
+    for (int i = 0; i < spatial_dim; ++i) {
+      y_p[i] = x_p[i] * factor;
+    }
+  }
 }
 
 template <typename Dtype>
@@ -51,21 +53,13 @@ void DropoutChannelLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
     const vector<Blob<Dtype>*>& top) {
   const Dtype* bottom_data = bottom[0]->cpu_data();
   Dtype* top_data = top[0]->mutable_cpu_data();
-  const Dtype* const_vec = rand_vec_.cpu_data();
-  Dtype* vec = rand_vec_.mutable_cpu_data();
-  Dtype* mask = rand_mat_.mutable_cpu_data();
-  const int count = bottom[0]->count();
   if (Caffe::phase() == Caffe::TRAIN) {
     // Create random numbers
-    caffe_rng_uniform(rand_vec_.count(), Dtype(0), Dtype(1), vec);
-    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, 
-                          N_ * C_, H_ * W_, 1, Dtype(1),
-                          const_vec, spatial_sum_multiplier_.cpu_data(),
-                          Dtype(0), mask); 
-
-    for (int i = 0; i < count; ++i) {
-      top_data[i] = bottom_data[i] * (mask[i] > threshold_) * scale_;
-    }
+    Dtype* vec = rand_vec_.mutable_cpu_data();
+    caffe_philox_uniform(rand_vec_.count(), Dtype(0), Dtype(1), vec);
+    dropout_channel_cpu(rand_vec_.count(),
+        bottom[0]->height() * bottom[0]->width(), bottom_data, vec,
+        threshold_, scale_, top_data);
   } else {
     caffe_copy(bottom[0]->count(), bottom_data, top_data);
   }
@@ -79,11 +73,9 @@ void DropoutChannelLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     const Dtype* top_diff = top[0]->cpu_diff();
     Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
     if (Caffe::phase() == Caffe::TRAIN) {
-      const Dtype* mask = rand_mat_.cpu_data();
-      const int count = bottom[0]->count();
-      for (int i = 0; i < count; ++i) {
-        bottom_diff[i] = top_diff[i] * (mask[i] > threshold_) * scale_;
-      }
+      dropout_channel_cpu(rand_vec_.count(),
+          bottom[0]->height() * bottom[0]->width(), top_diff,
+          rand_vec_.cpu_data(), threshold_, scale_, bottom_diff);
     } else {
       caffe_copy(top[0]->count(), top_diff, bottom_diff);
     }
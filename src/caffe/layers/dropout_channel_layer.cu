@@ -12,11 +12,11 @@ namespace caffe {
 
 
 template <typename Dtype>
-__global__ void DropoutChannelForward(const int n, const Dtype* in,
-    const Dtype* mask, const Dtype threshold, const float scale,
-    Dtype* out) {
+__global__ void DropoutChannelForward(const int n, const int spatial_dim,
+    const Dtype* in, const Dtype* mask, const Dtype threshold,
+    const float scale, Dtype* out) {
   CUDA_KERNEL_LOOP(index, n) {
-    out[index] = in[index] * (mask[index] > threshold) * scale;
+    out[index] = in[index] * (mask[index / spatial_dim] > threshold) * scale;
   }
 }
 
@@ -26,22 +26,15 @@ void DropoutChannelLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
   const Dtype* bottom_data = bottom[0]->gpu_data();
   Dtype* top_data = top[0]->mutable_gpu_data();
   const int count = bottom[0]->count();
+  const int spatial_dim = bottom[0]->height() * bottom[0]->width();
   if (Caffe::phase() == Caffe::TRAIN) {
-    const Dtype* const_vec = rand_vec_.gpu_data();
-    Dtype* vec = rand_vec_.mutable_gpu_data();
-    Dtype* mask = rand_mat_.mutable_gpu_data();
-
-    caffe_gpu_rng_uniform(rand_vec_.count(), Dtype(0), Dtype(1), vec);
-
-    caffe_gpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, 
-                          N_ * C_, H_ * W_, 1, Dtype(1),
-                          const_vec, spatial_sum_multiplier_.gpu_data(),
-                          Dtype(0), mask);
-
+    Dtype* mask = rand_vec_.mutable_gpu_data();
+    caffe_gpu_rng_uniform(rand_vec_.count(), Dtype(0), Dtype(1), mask);
     // set thresholds
     // NOLINT_NEXT_LINE(whitespace/operators)
-    DropoutChannelForward<Dtype><<<CAFFE_GET_BLOCKS(count), CAFFE_CUDA_NUM_THREADS>>>(
-        count, bottom_data, mask, threshold_, scale_, top_data);
+    DropoutChannelForward<Dtype><<<CAFFE_GET_BLOCKS(count),
+      CAFFE_CUDA_NUM_THREADS>>>(
+        count, spatial_dim, bottom_data, mask, threshold_, scale_, top_data);
     CUDA_POST_KERNEL_CHECK;
   } else {
     caffe_copy(count, bottom_data, top_data);
@@ -49,11 +42,12 @@ void DropoutChannelLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
 }
 
 template <typename Dtype>
-__global__ void DropoutChannelBackward(const int n, const Dtype* in_diff,
-    const Dtype* mask, const Dtype threshold, const float scale,
-    Dtype* out_diff) {
+__global__ void DropoutChannelBackward(const int n, const int spatial_dim,
+    const Dtype* in_diff, const Dtype* mask, const Dtype threshold,
+    const float scale, Dtype* out_diff) {
   CUDA_KERNEL_LOOP(index, n) {
-    out_diff[index] = in_diff[index] * scale * (mask[index] > threshold);
+    out_diff[index] =
+        in_diff[index] * scale * (mask[index / spatial_dim] > threshold);
   }
 }
 
@@ -65,12 +59,14 @@ void DropoutChannelLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
     const Dtype* top_diff = top[0]->gpu_diff();
     Dtype* bottom_diff = bottom[0]->mutable_gpu_diff();
     if (Caffe::phase() == Caffe::TRAIN) {
-      const Dtype* mask = rand_mat_.gpu_data();
+      const Dtype* mask = rand_vec_.gpu_data();
       const int count = bottom[0]->count();
+      const int spatial_dim = bottom[0]->height() * bottom[0]->width();
       // NOLINT_NEXT_LINE(whitespace/operators)
       DropoutChannelBackward<Dtype><<<CAFFE_GET_BLOCKS(count),
         CAFFE_CUDA_NUM_THREADS>>>(
-          count, top_diff, mask, threshold_, scale_, bottom_diff);
+          count, spatial_dim, top_diff, mask, threshold_, scale_,
+          bottom_diff);
       CUDA_POST_KERNEL_CHECK;
     } else {
       caffe_copy(top[0]->count(), top_diff, bottom_diff);
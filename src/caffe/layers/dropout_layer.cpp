@@ -1,11 +1,13 @@
 // TODO (sergeyk): effect should not be dependent on phase. wasted memcpy.
 
+#include <algorithm>
 #include <vector>
 
 #include "caffe/common.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/syncedmem.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/philox.hpp"
 #include "caffe/vision_layers.hpp"
 
 namespace caffe {
@@ -25,9 +27,29 @@ template <typename Dtype>
 void DropoutLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
   NeuronLayer<Dtype>::Reshape(bottom, top);
-  // Set up the cache for random number generation
+  // Set up the cache for random number generation. Blob memory is allocated
+  // on first use, so only the one of the current mode takes space.
   rand_vec_.Reshape(bottom[0]->num(), bottom[0]->channels(),
       bottom[0]->height(), bottom[0]->width());
+  mask_.Reshape((bottom[0]->count() + 31) / 32, 1, 1, 1);
+}
+
+// Multiply every input by scale if its bit of the mask is set, and by 0
+// otherwise.
+template <typename Dtype>
+static void dropout_mask_cpu(const int count, const Dtype* x,
+    const unsigned int* mask, const Dtype scale, Dtype* y) {
+#ifdef _OPENMP
+  #pragma omp parallel for
+#endif
+  for (int w = 0; w < (count + 31) / 32; ++w) {
+    const unsigned int bits = mask[w];
+    const int begin = w * 32;
+    const int end = std::min(begin + 32, count);
+    for (int i = begin; i < end; ++i) {
+      y[i] = x[i] * ((bits >> (i - begin)) & 1) * scale;
+    }
+  }
 }
 
 template <typename Dtype>
@@ -35,14 +57,29 @@ void DropoutLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
     const vector<Blob<Dtype>*>& top) {
   const Dtype* bottom_data = bottom[0]->cpu_data();
   Dtype* top_data = top[0]->mutable_cpu_data();
-  unsigned int* mask = rand_vec_.mutable_cpu_data();
   const int count = bottom[0]->count();
   if (Caffe::phase() == Caffe::TRAIN) {
-    // Create random numbers
-    caffe_rng_bernoulli(count, 1. - threshold_, mask);
-    for (int i = 0; i < count; ++i) {
-      top_data[i] = bottom_data[i] * mask[i] * scale_;
+    // Create random numbers: an input is kept if its value of the Philox
+    // stream is above the threshold. The 32 bits of a mask word come from 8
+    // Philox blocks, so the words are generated in parallel.
+    unsigned int* mask = mask_.mutable_cpu_data();
+    const uint64_t seed = Caffe::philox_seed();
+    const uint64_t first_block = Caffe::philox_offset(mask_.count() * 32) / 4;
+#ifdef _OPENMP
+    #pragma omp parallel for
+#endif
+    for (int w = 0; w < mask_.count(); ++w) {
+      unsigned int word = 0;
+      for (int b = 0; b < 8; ++b) {
+        uint32_t x[4];
+        philox_block(seed, first_block + w * 8 + b, x);
+        for (int j = 0; j < 4; ++j) {
+          word |= static_cast<unsigned int>(x[j] > uint_thres_) << (b * 4 + j);
+        }
+      }
+      mask[w] = word;
     }
+    dropout_mask_cpu(count, bottom_data, mask, scale_, top_data);
   } else {
     caffe_copy(bottom[0]->count(), bottom_data, top_data);
   }
@@ -56,11 +93,8 @@ void DropoutLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     const Dtype* top_diff = top[0]->cpu_diff();
     Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
     if (Caffe::phase() == Caffe::TRAIN) {
-      const unsigned int* mask = rand_vec_.cpu_data();
-      const int count = bottom[0]->count();
-      for (int i = 0; i < count; ++i) {
-        bottom_diff[i] = top_diff[i] * mask[i] * scale_;
-      }
+      dropout_mask_cpu(bottom[0]->count(), top_diff, mask_.cpu_data(), scale_,
+          bottom_diff);
     } else {
       caffe_copy(top[0]->count(), top_diff, bottom_diff);
     }
@@ -1,11 +1,10 @@
 #include <algorithm>
-#include <functional>
-#include <utility>
 #include <vector>
 
 #include "caffe/layer.hpp"
 #include "caffe/util/io.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/top_k.hpp"
 #include "caffe/vision_layers.hpp"
 
 namespace caffe {
@@ -41,43 +40,58 @@ void EltwiseAccuracyLayer<Dtype>::Reshape(
 template <typename Dtype>
 void EltwiseAccuracyLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
     const vector<Blob<Dtype>*>& top) {
-  Dtype accuracy = 0;
   const Dtype* bottom_data = bottom[0]->cpu_data();
   const Dtype* bottom_label = bottom[1]->cpu_data();
   int num = bottom[0]->num();
   int dim = bottom[0]->count() / bottom[0]->num();
   int spatial_dim = bottom[0]->height() * bottom[0]->width();
   int channels = bottom[0]->channels();
+  const int tiles = top_k_num_tiles(spatial_dim);
+  int accuracy = 0;
   int ignored_pixel_num = 0;
-  vector<Dtype> maxval(top_k_+1);
-  vector<int> max_id(top_k_+1);
-  for (int i = 0; i < num; ++i) {
-    for (int j = 0; j < spatial_dim; j++){
-      const int label_value = static_cast<int>(bottom_label[i * spatial_dim + j]);
-      if (has_ignore_label_ && label_value == ignore_label_) {
-        ignored_pixel_num++;
-        continue;
+  // The pixels of a tile are ranked together over the channels: the label is
+  // in the top k if fewer than k channels rank before it. Top-1 only needs
+  // the running argmax.
+#ifdef _OPENMP
+  #pragma omp parallel for reduction(+: accuracy, ignored_pixel_num)
+#endif
+  for (int b = 0; b < num * tiles; ++b) {
+    const int i = b / tiles;
+    const int j0 = (b % tiles) * kTopKTile;
+    const int tile = std::min(kTopKTile, spatial_dim - j0);
+    const Dtype* data = bottom_data + i * dim + j0;
+    int label[kTopKTile];
+    // Pixels that cannot be right: ignored ones, and those whose label is no
+    // channel, which count as wrong. Their label is set to 0 so that the
+    // kernels never index with it.
+    bool missed[kTopKTile];
+    for (int j = 0; j < tile; ++j) {
+      label[j] = static_cast<int>(bottom_label[i * spatial_dim + j0 + j]);
+      const bool ignored = has_ignore_label_ && label[j] == ignore_label_;
+      ignored_pixel_num += ignored;
+      missed[j] = ignored || label[j] < 0 || label[j] >= channels;
+      if (missed[j]) {
+        label[j] = 0;
       }
-      // Top-k accuracy
-      std::vector<std::pair<Dtype, int> > bottom_data_vector;
-      for (int k = 0; k < channels; ++k) {
-        bottom_data_vector.push_back(
-          std::make_pair(bottom_data[i * dim + k * spatial_dim + j], k));
+    }
+    if (top_k_ == 1) {
+      Dtype max_val[kTopKTile];
+      int max_idx[kTopKTile];
+      argmax_tile_cpu(data, channels, spatial_dim, tile, max_val, max_idx);
+      for (int j = 0; j < tile; ++j) {
+        accuracy += !missed[j] && max_idx[j] == label[j];
       }
-      std::partial_sort(
-          bottom_data_vector.begin(), bottom_data_vector.begin() + top_k_,
-          bottom_data_vector.end(), std::greater<std::pair<Dtype, int> >());
-      // check if true label is in top k predictions
-      for (int k = 0; k < top_k_; k++) {
-        if (bottom_data_vector[k].second == label_value) {
-          ++accuracy;
-          break;
-        }
+    } else {
+      int rank[kTopKTile];
+      label_rank_tile_cpu(data, channels, spatial_dim, tile, label, rank);
+      for (int j = 0; j < tile; ++j) {
+        accuracy += !missed[j] && rank[j] < top_k_;
       }
     }
   }
   // LOG(INFO) << "EltwiseAccuracy: " << eltwise_accuracy;
-  top[0]->mutable_cpu_data()[0] = accuracy / (num * spatial_dim - ignored_pixel_num);
+  top[0]->mutable_cpu_data()[0] =
+      Dtype(accuracy) / (num * spatial_dim - ignored_pixel_num);
   // Accuracy layer should not be used as a loss function.
 }
 
@@ -18,6 +18,11 @@ void EltwiseLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
       && this->layer_param().eltwise_param().coeff_size())) <<
       "Eltwise layer only takes coefficients for summation.";
   op_ = this->layer_param_.eltwise_param().operation();
+  // The product gradient is computed from the output, which a fused ReLU
+  // with a negative slope would change.
+  CHECK(!(op_ == EltwiseParameter_EltwiseOp_PROD
+      && this->layer_param_.has_fused_relu_param())) <<
+      "Eltwise layer only fuses a ReLU for summation and maximum.";
   // Blob-wise coefficients for the elementwise operation.
   coeffs_ = vector<Dtype>(bottom.size(), 1);
   if (this->layer_param().eltwise_param().coeff_size()) {
@@ -102,6 +107,11 @@ void EltwiseLayer<Dtype>::Forward_cpu(
   default:
     LOG(FATAL) << "Unknown elementwise operation.";
   }
+  if (this->layer_param_.has_fused_relu_param()) {
+    caffe_cpu_relu(count,
+        Dtype(this->layer_param_.fused_relu_param().negative_slope()),
+        top_data);
+  }
 }
 
 template <typename Dtype>
@@ -109,6 +119,11 @@ void EltwiseLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
   const int* mask = NULL;
   const int count = top[0]->count();
+  if (this->layer_param_.has_fused_relu_param()) {
+    caffe_cpu_relu_backward(count,
+        Dtype(this->layer_param_.fused_relu_param().negative_slope()),
+        top[0]->cpu_data(), top[0]->mutable_cpu_diff());
+  }
   const Dtype* top_data = top[0]->cpu_data();
   const Dtype* top_diff = top[0]->cpu_diff();
   for (int i = 0; i < bottom.size(); ++i) {
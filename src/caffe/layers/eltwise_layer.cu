@@ -66,6 +66,11 @@ void EltwiseLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
   default:
     LOG(FATAL) << "Unknown elementwise operation.";
   }
+  if (this->layer_param_.has_fused_relu_param()) {
+    caffe_gpu_relu(count,
+        Dtype(this->layer_param_.fused_relu_param().negative_slope()),
+        top_data);
+  }
 }
 
 template <typename Dtype>
@@ -85,6 +90,11 @@ void EltwiseLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
     const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
   const int* mask = NULL;
   const int count = top[0]->count();
+  if (this->layer_param_.has_fused_relu_param()) {
+    caffe_gpu_relu_backward(count,
+        Dtype(this->layer_param_.fused_relu_param().negative_slope()),
+        top[0]->gpu_data(), top[0]->mutable_gpu_diff());
+  }
   const Dtype* top_data = top[0]->gpu_data();
   const Dtype* top_diff = top[0]->gpu_diff();
   for (int i = 0; i < bottom.size(); ++i) {
@@ -70,12 +70,22 @@ void InnerProductLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
         bias_multiplier_.cpu_data(),
         this->blobs_[1]->cpu_data(), (Dtype)1., top_data);
   }
+  if (this->layer_param_.has_fused_relu_param()) {
+    caffe_cpu_relu(top[0]->count(),
+        Dtype(this->layer_param_.fused_relu_param().negative_slope()),
+        top_data);
+  }
 }
 
 template <typename Dtype>
 void InnerProductLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     const vector<bool>& propagate_down,
     const vector<Blob<Dtype>*>& bottom) {
+  if (this->layer_param_.has_fused_relu_param()) {
+    caffe_cpu_relu_backward(top[0]->count(),
+        Dtype(this->layer_param_.fused_relu_param().negative_slope()),
+        top[0]->cpu_data(), top[0]->mutable_cpu_diff());
+  }
   if (this->param_propagate_down_[0]) {
     const Dtype* top_diff = top[0]->cpu_diff();
     const Dtype* bottom_data = bottom[0]->cpu_data();
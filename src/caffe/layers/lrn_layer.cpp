@@ -1,11 +1,113 @@
+#include <algorithm>
 #include <vector>
 
 #include "caffe/layer.hpp"
+#include "caffe/util/fast_math.hpp"
 #include "caffe/util/math_functions.hpp"
 #include "caffe/vision_layers.hpp"
 
 namespace caffe {
 
+// The pixels of an image are split into tiles of kLRNTile, so that the
+// ACROSS_CHANNELS loops are parallel over num x tiles and each keeps the
+// running sums of its tile on the stack.
+const int kLRNTile = 256;
+
+// The terms summed over a window: squared inputs in Forward, and
+// top_diff * top_data / scale in Backward.
+template <typename Dtype>
+struct LRNSquare {
+  explicit LRNSquare(const Dtype* x) : x(x) {}
+  Dtype operator()(const int i) const { return x[i] * x[i]; }
+  const Dtype* x;
+};
+
+template <typename Dtype>
+struct LRNRatio {
+  LRNRatio(const Dtype* top_diff, const Dtype* top_data, const Dtype* scale)
+      : top_diff(top_diff), top_data(top_data), scale(scale) {}
+  Dtype operator()(const int i) const {
+    return top_diff[i] * top_data[i] / scale[i];
+  }
+  const Dtype* top_diff;
+  const Dtype* top_data;
+  const Dtype* scale;
+};
+
+// Sets sum[c * spatial + i] to the sum of value over the channels of the
+// window of size centred at c, for the pixels i in [begin, end), with a
+// running sum that adds the head channel and drops the tail one.
+template <typename Dtype, typename Value>
+static void LRNChannelSum(const Value& value, const int channels,
+    const int spatial, const int size, const int begin, const int end,
+    Dtype* sum) {
+  const int pre_pad = (size - 1) / 2;
+  const int tile = end - begin;
+  Dtype accum[kLRNTile];
+  std::fill(accum, accum + tile, Dtype(0));
+  for (int c = 0; c < std::min(pre_pad, channels); ++c) {
+    for (int i = 0; i < tile; ++i) {
+      accum[i] += value(c * spatial + begin + i);
+    }
+  }
+  for (int c = 0; c < channels; ++c) {
+    const int head = c + pre_pad;
+    const int tail = c - pre_pad;
+    if (head < channels) {
+      for (int i = 0; i < tile; ++i) {
+        accum[i] += value(head * spatial + begin + i);
+      }
+    }
+    caffe_copy(tile, accum, sum + c * spatial + begin);
+    if (tail >= 0) {
+      for (int i = 0; i < tile; ++i) {
+        accum[i] -= value(tail * spatial + begin + i);
+      }
+    }
+  }
+}
+
+// Sets sum[h * width + w] to the sum of value over the size x size window
+// centred at (h, w), clipped to the plane: col_sum (width long) keeps the
+// sums of the window rows for each column, and each output row slides a
+// running sum along it.
+template <typename Dtype, typename Value>
+static void LRNPlaneSum(const Value& value, const int height,
+    const int width, const int size, Dtype* col_sum, Dtype* sum) {
+  const int pre_pad = (size - 1) / 2;
+  std::fill(col_sum, col_sum + width, Dtype(0));
+  for (int h = 0; h < std::min(pre_pad, height); ++h) {
+    for (int w = 0; w < width; ++w) {
+      col_sum[w] += value(h * width + w);
+    }
+  }
+  for (int h = 0; h < height; ++h) {
+    if (h + pre_pad < height) {
+      for (int w = 0; w < width; ++w) {
+        col_sum[w] += value((h + pre_pad) * width + w);
+      }
+    }
+    Dtype accum = 0;
+    for (int w = 0; w < std::min(pre_pad, width); ++w) {
+      accum += col_sum[w];
+    }
+    for (int w = 0; w < width; ++w) {
+      if (w + pre_pad < width) {
+        accum += col_sum[w + pre_pad];
+      }
+      sum[h * width + w] = accum;
+      if (w - pre_pad >= 0) {
+        accum -= col_sum[w - pre_pad];
+      }
+    }
+    if (h - pre_pad >= 0) {
+      for (int w = 0; w < width; ++w) {
+        col_sum[w] -= value((h - pre_pad) * width + w);
+      }
+    }
+  }
+}
+
 template <typename Dtype>
 void LRNLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
@@ -15,55 +117,6 @@ void LRNLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
   alpha_ = this->layer_param_.lrn_param().alpha();
   beta_ = this->layer_param_.lrn_param().beta();
   k_ = this->layer_param_.lrn_param().k();
-  if (this->layer_param_.lrn_param().norm_region() ==
-      LRNParameter_NormRegion_WITHIN_CHANNEL) {
-    // Set up split_layer_ to use inputs in the numerator and denominator.
-    split_top_vec_.clear();
-    split_top_vec_.push_back(&product_input_);
-    split_top_vec_.push_back(&square_input_);
-    LayerParameter split_param;
-    split_layer_.reset(new SplitLayer<Dtype>(split_param));
-    split_layer_->SetUp(bottom, split_top_vec_);
-    // Set up square_layer_ to square the inputs.
-    square_bottom_vec_.clear();
-    square_top_vec_.clear();
-    square_bottom_vec_.push_back(&square_input_);
-    square_top_vec_.push_back(&square_output_);
-    LayerParameter square_param;
-    square_param.mutable_power_param()->set_power(Dtype(2));
-    square_layer_.reset(new PowerLayer<Dtype>(square_param));
-    square_layer_->SetUp(square_bottom_vec_, square_top_vec_);
-    // Set up pool_layer_ to sum over square neighborhoods of the input.
-    pool_top_vec_.clear();
-    pool_top_vec_.push_back(&pool_output_);
-    LayerParameter pool_param;
-    pool_param.mutable_pooling_param()->set_pool(
-        PoolingParameter_PoolMethod_AVE);
-    pool_param.mutable_pooling_param()->set_pad(pre_pad_);
-    pool_param.mutable_pooling_param()->set_kernel_size(size_);
-    pool_layer_.reset(new PoolingLayer<Dtype>(pool_param));
-    pool_layer_->SetUp(square_top_vec_, pool_top_vec_);
-    // Set up power_layer_ to compute (1 + alpha_/N^2 s)^-beta_, where s is
-    // the sum of a squared neighborhood (the output of pool_layer_).
-    power_top_vec_.clear();
-    power_top_vec_.push_back(&power_output_);
-    LayerParameter power_param;
-    power_param.mutable_power_param()->set_power(-beta_);
-    power_param.mutable_power_param()->set_scale(alpha_);
-    power_param.mutable_power_param()->set_shift(Dtype(1));
-    power_layer_.reset(new PowerLayer<Dtype>(power_param));
-    power_layer_->SetUp(pool_top_vec_, power_top_vec_);
-    // Set up a product_layer_ to compute outputs by multiplying inputs by the
-    // inverse demoninator computed by the power layer.
-    product_bottom_vec_.clear();
-    product_bottom_vec_.push_back(&product_input_);
-    product_bottom_vec_.push_back(&power_output_);
-    LayerParameter product_param;
-    EltwiseParameter* eltwise_param = product_param.mutable_eltwise_param();
-    eltwise_param->set_operation(EltwiseParameter_EltwiseOp_PROD);
-    product_layer_.reset(new EltwiseLayer<Dtype>(product_param));
-    product_layer_->SetUp(product_bottom_vec_, top);
-  }
 }
 
 template <typename Dtype>
@@ -73,19 +126,8 @@ void LRNLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
   channels_ = bottom[0]->channels();
   height_ = bottom[0]->height();
   width_ = bottom[0]->width();
-  switch (this->layer_param_.lrn_param().norm_region()) {
-  case LRNParameter_NormRegion_ACROSS_CHANNELS:
-    top[0]->Reshape(num_, channels_, height_, width_);
-    scale_.Reshape(num_, channels_, height_, width_);
-    break;
-  case LRNParameter_NormRegion_WITHIN_CHANNEL:
-    split_layer_->Reshape(bottom, split_top_vec_);
-    square_layer_->Reshape(square_bottom_vec_, square_top_vec_);
-    pool_layer_->Reshape(square_top_vec_, pool_top_vec_);
-    power_layer_->Reshape(pool_top_vec_, power_top_vec_);
-    product_layer_->Reshape(product_bottom_vec_, top);
-    break;
-  }
+  top[0]->Reshape(num_, channels_, height_, width_);
+  scale_.Reshape(num_, channels_, height_, width_);
 }
 
 template <typename Dtype>
@@ -96,7 +138,7 @@ void LRNLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
     CrossChannelForward_cpu(bottom, top);
     break;
   case LRNParameter_NormRegion_WITHIN_CHANNEL:
-    WithinChannelForward(bottom, top);
+    WithinChannelForward_cpu(bottom, top);
     break;
   default:
     LOG(FATAL) << "Unknown normalization region.";
@@ -109,72 +151,70 @@ void LRNLayer<Dtype>::CrossChannelForward_cpu(
   const Dtype* bottom_data = bottom[0]->cpu_data();
   Dtype* top_data = top[0]->mutable_cpu_data();
   Dtype* scale_data = scale_.mutable_cpu_data();
-  // start with the constant value
-  for (int i = 0; i < scale_.count(); ++i) {
-    scale_data[i] = k_;
-  }
-  Blob<Dtype> padded_square(1, channels_ + size_ - 1, height_, width_);
-  Dtype* padded_square_data = padded_square.mutable_cpu_data();
-  caffe_set(padded_square.count(), Dtype(0), padded_square_data);
-  Dtype alpha_over_size = alpha_ / size_;
-  // go through the images
-  for (int n = 0; n < num_; ++n) {
-    // compute the padded square
-    caffe_sqr(channels_ * height_ * width_,
-        bottom_data + bottom[0]->offset(n),
-        padded_square_data + padded_square.offset(0, pre_pad_));
-    // Create the first channel scale
-    for (int c = 0; c < size_; ++c) {
-      caffe_axpy<Dtype>(height_ * width_, alpha_over_size,
-          padded_square_data + padded_square.offset(0, c),
-          scale_data + scale_.offset(n, 0));
-    }
-    for (int c = 1; c < channels_; ++c) {
-      // copy previous scale
-      caffe_copy<Dtype>(height_ * width_,
-          scale_data + scale_.offset(n, c - 1),
-          scale_data + scale_.offset(n, c));
-      // add head
-      caffe_axpy<Dtype>(height_ * width_, alpha_over_size,
-          padded_square_data + padded_square.offset(0, c + size_ - 1),
-          scale_data + scale_.offset(n, c));
-      // subtract tail
-      caffe_axpy<Dtype>(height_ * width_, -alpha_over_size,
-          padded_square_data + padded_square.offset(0, c - 1),
-          scale_data + scale_.offset(n, c));
+  const int spatial = height_ * width_;
+  const int num_tiles = (spatial + kLRNTile - 1) / kLRNTile;
+  const Dtype alpha_over_size = alpha_ / size_;
+#ifdef _OPENMP
+  #pragma omp parallel for
+#endif
+  for (int job = 0; job < num_ * num_tiles; ++job) {
+    const int offset = (job / num_tiles) * channels_ * spatial;
+    const int begin = (job % num_tiles) * kLRNTile;
+    const int end = std::min(begin + kLRNTile, spatial);
+    LRNChannelSum(LRNSquare<Dtype>(bottom_data + offset), channels_, spatial,
+        size_, begin, end, scale_data + offset);
+    for (int c = 0; c < channels_; ++c) {
+      for (int i = offset + c * spatial + begin;
+           i < offset + c * spatial + end; ++i) {
+        scale_data[i] = k_ + alpha_over_size * scale_data[i];
+        top_data[i] = bottom_data[i] * fast_pow(scale_data[i], -beta_);
+      }
     }
   }
-
-  // In the end, compute output
-  caffe_powx<Dtype>(scale_.count(), scale_data, -beta_, top_data);
-  caffe_mul<Dtype>(scale_.count(), top_data, bottom_data, top_data);
 }
 
 template <typename Dtype>
-void LRNLayer<Dtype>::WithinChannelForward(
+void LRNLayer<Dtype>::WithinChannelForward_cpu(
     const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
-  split_layer_->Forward(bottom, split_top_vec_);
-  square_layer_->Forward(square_bottom_vec_, square_top_vec_);
-  pool_layer_->Forward(square_top_vec_, pool_top_vec_);
-  power_layer_->Forward(pool_top_vec_, power_top_vec_);
-  product_layer_->Forward(product_bottom_vec_, top);
+  const Dtype* bottom_data = bottom[0]->cpu_data();
+  Dtype* top_data = top[0]->mutable_cpu_data();
+  Dtype* scale_data = scale_.mutable_cpu_data();
+  const int spatial = height_ * width_;
+  const Dtype alpha_over_size = alpha_ / (size_ * size_);
+#ifdef _OPENMP
+  #pragma omp parallel for
+#endif
+  for (int plane = 0; plane < num_ * channels_; ++plane) {
+    const int offset = plane * spatial;
+    vector<Dtype> col_sum(width_);
+    LRNPlaneSum(LRNSquare<Dtype>(bottom_data + offset), height_, width_,
+        size_, &col_sum[0], scale_data + offset);
+    for (int i = offset; i < offset + spatial; ++i) {
+      scale_data[i] = Dtype(1) + alpha_over_size * scale_data[i];
+      top_data[i] = bottom_data[i] * fast_pow(scale_data[i], -beta_);
+    }
+  }
 }
 
 template <typename Dtype>
 void LRNLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
+  if (!propagate_down[0]) { return; }
   switch (this->layer_param_.lrn_param().norm_region()) {
   case LRNParameter_NormRegion_ACROSS_CHANNELS:
     CrossChannelBackward_cpu(top, propagate_down, bottom);
     break;
   case LRNParameter_NormRegion_WITHIN_CHANNEL:
-    WithinChannelBackward(top, propagate_down, bottom);
+    WithinChannelBackward_cpu(top, propagate_down, bottom);
     break;
   default:
     LOG(FATAL) << "Unknown normalization region.";
   }
 }
 
+// With y_i = x_i * s_i^-beta, the bottom diff is
+//   dy_i * s_i^-beta - 2 * alpha * beta / N * x_i * sum_j (dy_j * y_j / s_j)
+// over the windows j that contain i, which are the window centred at i.
 template <typename Dtype>
 void LRNLayer<Dtype>::CrossChannelBackward_cpu(
     const vector<Blob<Dtype>*>& top, const vector<bool>& propagate_down,
@@ -184,64 +224,53 @@ void LRNLayer<Dtype>::CrossChannelBackward_cpu(
   const Dtype* bottom_data = bottom[0]->cpu_data();
   const Dtype* scale_data = scale_.cpu_data();
   Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
-  Blob<Dtype> padded_ratio(1, channels_ + size_ - 1, height_, width_);
-  Blob<Dtype> accum_ratio(1, 1, height_, width_);
-  Dtype* padded_ratio_data = padded_ratio.mutable_cpu_data();
-  Dtype* accum_ratio_data = accum_ratio.mutable_cpu_data();
-  // We hack a little bit by using the diff() to store an additional result
-  Dtype* accum_ratio_times_bottom = accum_ratio.mutable_cpu_diff();
-  caffe_set(padded_ratio.count(), Dtype(0), padded_ratio_data);
-  Dtype cache_ratio_value = 2. * alpha_ * beta_ / size_;
-
-  caffe_powx<Dtype>(scale_.count(), scale_data, -beta_, bottom_diff);
-  caffe_mul<Dtype>(scale_.count(), top_diff, bottom_diff, bottom_diff);
-
-  // go through individual data
-  int inverse_pre_pad = size_ - (size_ + 1) / 2;
-  for (int n = 0; n < num_; ++n) {
-    int block_offset = scale_.offset(n);
-    // first, compute diff_i * y_i / s_i
-    caffe_mul<Dtype>(channels_ * height_ * width_,
-        top_diff + block_offset, top_data + block_offset,
-        padded_ratio_data + padded_ratio.offset(0, inverse_pre_pad));
-    caffe_div<Dtype>(channels_ * height_ * width_,
-        padded_ratio_data + padded_ratio.offset(0, inverse_pre_pad),
-        scale_data + block_offset,
-        padded_ratio_data + padded_ratio.offset(0, inverse_pre_pad));
-    // Now, compute the accumulated ratios and the bottom diff
-    caffe_set(accum_ratio.count(), Dtype(0), accum_ratio_data);
-    for (int c = 0; c < size_ - 1; ++c) {
-      caffe_axpy<Dtype>(height_ * width_, 1.,
-          padded_ratio_data + padded_ratio.offset(0, c), accum_ratio_data);
-    }
+  const int spatial = height_ * width_;
+  const int num_tiles = (spatial + kLRNTile - 1) / kLRNTile;
+  const Dtype cache_ratio_value = 2. * alpha_ * beta_ / size_;
+#ifdef _OPENMP
+  #pragma omp parallel for
+#endif
+  for (int job = 0; job < num_ * num_tiles; ++job) {
+    const int offset = (job / num_tiles) * channels_ * spatial;
+    const int begin = (job % num_tiles) * kLRNTile;
+    const int end = std::min(begin + kLRNTile, spatial);
+    LRNChannelSum(LRNRatio<Dtype>(top_diff + offset, top_data + offset,
+        scale_data + offset), channels_, spatial, size_, begin, end,
+        bottom_diff + offset);
     for (int c = 0; c < channels_; ++c) {
-      caffe_axpy<Dtype>(height_ * width_, 1.,
-          padded_ratio_data + padded_ratio.offset(0, c + size_ - 1),
-          accum_ratio_data);
-      // compute bottom diff
-      caffe_mul<Dtype>(height_ * width_,
-          bottom_data + top[0]->offset(n, c),
-          accum_ratio_data, accum_ratio_times_bottom);
-      caffe_axpy<Dtype>(height_ * width_, -cache_ratio_value,
-          accum_ratio_times_bottom, bottom_diff + top[0]->offset(n, c));
-      caffe_axpy<Dtype>(height_ * width_, -1.,
-          padded_ratio_data + padded_ratio.offset(0, c), accum_ratio_data);
+      for (int i = offset + c * spatial + begin;
+           i < offset + c * spatial + end; ++i) {
+        bottom_diff[i] = top_diff[i] * fast_pow(scale_data[i], -beta_)
+            - cache_ratio_value * bottom_data[i] * bottom_diff[i];
+      }
     }
   }
 }
 
 template <typename Dtype>
-void LRNLayer<Dtype>::WithinChannelBackward(
+void LRNLayer<Dtype>::WithinChannelBackward_cpu(
     const vector<Blob<Dtype>*>& top, const vector<bool>& propagate_down,
     const vector<Blob<Dtype>*>& bottom) {
-  if (propagate_down[0]) {
-    vector<bool> product_propagate_down(2, true);
-    product_layer_->Backward(top, product_propagate_down, product_bottom_vec_);
-    power_layer_->Backward(power_top_vec_, propagate_down, pool_top_vec_);
-    pool_layer_->Backward(pool_top_vec_, propagate_down, square_top_vec_);
-    square_layer_->Backward(square_top_vec_, propagate_down,
-                            square_bottom_vec_);
-    split_layer_->Backward(split_top_vec_, propagate_down, bottom);
+  const Dtype* top_diff = top[0]->cpu_diff();
+  const Dtype* top_data = top[0]->cpu_data();
+  const Dtype* bottom_data = bottom[0]->cpu_data();
+  const Dtype* scale_data = scale_.cpu_data();
+  Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
+  const int spatial = height_ * width_;
+  const Dtype cache_ratio_value = 2. * alpha_ * beta_ / (size_ * size_);
+#ifdef _OPENMP
+  #pragma omp parallel for
+#endif
+  for (int plane = 0; plane < num_ * channels_; ++plane) {
+    const int offset = plane * spatial;
+    vector<Dtype> col_sum(width_);
+    LRNPlaneSum(LRNRatio<Dtype>(top_diff + offset, top_data + offset,
+        scale_data + offset), height_, width_, size_, &col_sum[0],
+        bottom_diff + offset);
+    for (int i = offset; i < offset + spatial; ++i) {
+      bottom_diff[i] = top_diff[i] * fast_pow(scale_data[i], -beta_)
+          - cache_ratio_value * bottom_data[i] * bottom_diff[i];
+    }
   }
 }
 
@@ -249,6 +278,8 @@ void LRNLayer<Dtype>::WithinChannelBackward(
 STUB_GPU(LRNLayer);
 STUB_GPU_FORWARD(LRNLayer, CrossChannelForward);
 STUB_GPU_BACKWARD(LRNLayer, CrossChannelBackward);
+STUB_GPU_FORWARD(LRNLayer, WithinChannelForward);
+STUB_GPU_BACKWARD(LRNLayer, WithinChannelBackward);
 #endif
 
 INSTANTIATE_CLASS(LRNLayer);
@@ -61,7 +61,7 @@ void LRNLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
     CrossChannelForward_gpu(bottom, top);
     break;
   case LRNParameter_NormRegion_WITHIN_CHANNEL:
-    WithinChannelForward(bottom, top);
+    WithinChannelForward_gpu(bottom, top);
     break;
   default:
     LOG(FATAL) << "Unknown normalization region.";
@@ -103,16 +103,62 @@ template void LRNLayer<float>::CrossChannelForward_gpu(
 template void LRNLayer<double>::CrossChannelForward_gpu(
     const vector<Blob<double>*>& bottom, const vector<Blob<double>*>& top);
 
+template <typename Dtype>
+__global__ void LRNWithinChannelFillScale(const int nthreads, const Dtype* in,
+    const int height, const int width, const int size,
+    const Dtype alpha_over_size, Dtype* scale) {
+  CUDA_KERNEL_LOOP(index, nthreads) {
+    int w = index % width;
+    int h = (index / width) % height;
+    int pre_pad = (size - 1) / 2;
+    int hstart = max(h - pre_pad, 0);
+    int wstart = max(w - pre_pad, 0);
+    int hend = min(h + pre_pad + 1, height);
+    int wend = min(w + pre_pad + 1, width);
+    in += (index / width / height) * height * width;
+    Dtype accum_scale = 0;
+    for (int ph = hstart; ph < hend; ++ph) {
+      for (int pw = wstart; pw < wend; ++pw) {
+        accum_scale += in[ph * width + pw] * in[ph * width + pw];
+      }
+    }
+    scale[index] = 1 + accum_scale * alpha_over_size;
+  }
+}
+
+template <typename Dtype>
+void LRNLayer<Dtype>::WithinChannelForward_gpu(
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  const Dtype* bottom_data = bottom[0]->gpu_data();
+  Dtype* top_data = top[0]->mutable_gpu_data();
+  Dtype* scale_data = scale_.mutable_gpu_data();
+  int n_threads = bottom[0]->count();
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  LRNWithinChannelFillScale<<<CAFFE_GET_BLOCKS(n_threads),
+      CAFFE_CUDA_NUM_THREADS>>>(n_threads, bottom_data, height_, width_,
+      size_, alpha_ / (size_ * size_), scale_data);
+  CUDA_POST_KERNEL_CHECK;
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  LRNComputeOutput<<<CAFFE_GET_BLOCKS(n_threads), CAFFE_CUDA_NUM_THREADS>>>(
+      n_threads, bottom_data, scale_data, -beta_, top_data);
+  CUDA_POST_KERNEL_CHECK;
+}
+template void LRNLayer<float>::WithinChannelForward_gpu(
+    const vector<Blob<float>*>& bottom, const vector<Blob<float>*>& top);
+template void LRNLayer<double>::WithinChannelForward_gpu(
+    const vector<Blob<double>*>& bottom, const vector<Blob<double>*>& top);
+
 
 template <typename Dtype>
 void LRNLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
     const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
+  if (!propagate_down[0]) { return; }
   switch (this->layer_param_.lrn_param().norm_region()) {
   case LRNParameter_NormRegion_ACROSS_CHANNELS:
     CrossChannelBackward_gpu(top, propagate_down, bottom);
     break;
   case LRNParameter_NormRegion_WITHIN_CHANNEL:
-    WithinChannelBackward(top, propagate_down, bottom);
+    WithinChannelBackward_gpu(top, propagate_down, bottom);
     break;
   default:
     LOG(FATAL) << "Unknown normalization region.";
@@ -200,6 +246,53 @@ template void LRNLayer<double>::CrossChannelBackward_gpu(
     const vector<Blob<double>*>& bottom);
 
 
+template <typename Dtype>
+__global__ void LRNWithinChannelComputeDiff(const int nthreads,
+    const Dtype* bottom_data, const Dtype* top_data, const Dtype* scale,
+    const Dtype* top_diff, const int height, const int width, const int size,
+    const Dtype negative_beta, const Dtype cache_ratio, Dtype* bottom_diff) {
+  CUDA_KERNEL_LOOP(index, nthreads) {
+    int w = index % width;
+    int h = (index / width) % height;
+    int pre_pad = (size - 1) / 2;
+    int hstart = max(h - pre_pad, 0);
+    int wstart = max(w - pre_pad, 0);
+    int hend = min(h + pre_pad + 1, height);
+    int wend = min(w + pre_pad + 1, width);
+    int offset = (index / width / height) * height * width;
+    Dtype accum_ratio = 0;
+    for (int ph = hstart; ph < hend; ++ph) {
+      for (int pw = wstart; pw < wend; ++pw) {
+        int p = offset + ph * width + pw;
+        accum_ratio += top_diff[p] * top_data[p] / scale[p];
+      }
+    }
+    bottom_diff[index] = top_diff[index] * pow(scale[index], negative_beta)
+        - cache_ratio * bottom_data[index] * accum_ratio;
+  }
+}
+
+template <typename Dtype>
+void LRNLayer<Dtype>::WithinChannelBackward_gpu(
+    const vector<Blob<Dtype>*>& top, const vector<bool>& propagate_down,
+    const vector<Blob<Dtype>*>& bottom) {
+  int n_threads = bottom[0]->count();
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  LRNWithinChannelComputeDiff<<<CAFFE_GET_BLOCKS(n_threads),
+      CAFFE_CUDA_NUM_THREADS>>>(n_threads, bottom[0]->gpu_data(),
+      top[0]->gpu_data(), scale_.gpu_data(), top[0]->gpu_diff(), height_,
+      width_, size_, -beta_, Dtype(2. * alpha_ * beta_ / (size_ * size_)),
+      bottom[0]->mutable_gpu_diff());
+  CUDA_POST_KERNEL_CHECK;
+}
+template void LRNLayer<float>::WithinChannelBackward_gpu(
+    const vector<Blob<float>*>& top, const vector<bool>& propagate_down,
+    const vector<Blob<float>*>& bottom);
+template void LRNLayer<double>::WithinChannelBackward_gpu(
+    const vector<Blob<double>*>& top, const vector<bool>& propagate_down,
+    const vector<Blob<double>*>& bottom);
+
+
 
 INSTANTIATE_LAYER_GPU_FUNCS(LRNLayer);
 
@@ -1,4 +1,5 @@
 #include <algorithm>
+#include <cmath>
 #include <vector>
 
 #include "caffe/common_layers.hpp"
@@ -12,16 +13,14 @@ void MVNLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
   top[0]->Reshape(bottom[0]->num(), bottom[0]->channels(),
       bottom[0]->height(), bottom[0]->width());
-  mean_.Reshape(bottom[0]->num(), bottom[0]->channels(),
-      1, 1);
-  variance_.Reshape(bottom[0]->num(), bottom[0]->channels(),
-      1, 1);
-  temp_.Reshape(bottom[0]->num(), bottom[0]->channels(),
-      bottom[0]->height(), bottom[0]->width());
-  sum_multiplier_.Reshape(1, 1,
-      bottom[0]->height(), bottom[0]->width());
-  Dtype* multiplier_data = sum_multiplier_.mutable_cpu_data();
-  caffe_set(sum_multiplier_.count(), Dtype(1), multiplier_data);
+  if (this->layer_param_.mvn_param().across_channels()) {
+    num_ = bottom[0]->num();
+  } else {
+    num_ = bottom[0]->num() * bottom[0]->channels();
+  }
+  dim_ = bottom[0]->count() / num_;
+  mean_.Reshape(num_, 1, 1, 1);
+  std_.Reshape(num_, 1, 1, 1);
 }
 
 template <typename Dtype>
@@ -29,60 +28,41 @@ void MVNLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
     const vector<Blob<Dtype>*>& top) {
   const Dtype* bottom_data = bottom[0]->cpu_data();
   Dtype* top_data = top[0]->mutable_cpu_data();
-  int num;
-  if (this->layer_param_.mvn_param().across_channels())
-    num = bottom[0]->num();
-  else
-    num = bottom[0]->num() * bottom[0]->channels();
-
-  int dim = bottom[0]->count() / num;
-  Dtype eps = 1e-10;
-
-  if (this->layer_param_.mvn_param().normalize_variance()) {
-    // put the squares of bottom into temp_
-    caffe_powx(bottom[0]->count(), bottom_data, Dtype(2),
-        temp_.mutable_cpu_data());
-
-    // computes variance using var(X) = E(X^2) - (EX)^2
-    caffe_cpu_gemv<Dtype>(CblasNoTrans, num, dim, 1. / dim, bottom_data,
-        sum_multiplier_.cpu_data(), 0., mean_.mutable_cpu_data());  // EX
-    caffe_cpu_gemv<Dtype>(CblasNoTrans, num, dim, 1. / dim, temp_.cpu_data(),
-        sum_multiplier_.cpu_data(), 0.,
-        variance_.mutable_cpu_data());  // E(X^2)
-    caffe_powx(mean_.count(), mean_.cpu_data(), Dtype(2),
-        temp_.mutable_cpu_data());  // (EX)^2
-    caffe_sub(mean_.count(), variance_.cpu_data(), temp_.cpu_data(),
-        variance_.mutable_cpu_data());  // variance
-
-    // do mean and variance normalization
-    // subtract mean
-    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num, dim, 1, -1.,
-            mean_.cpu_data(), sum_multiplier_.cpu_data(), 0.,
-            temp_.mutable_cpu_data());
-
-    caffe_add(temp_.count(), bottom_data, temp_.cpu_data(), top_data);
-
-    // normalize variance
-    caffe_powx(variance_.count(), variance_.cpu_data(), Dtype(0.5),
-          variance_.mutable_cpu_data());
-
-    caffe_add_scalar(variance_.count(), eps, variance_.mutable_cpu_data());
-
-    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num, dim, 1, 1.,
-          variance_.cpu_data(), sum_multiplier_.cpu_data(), 0.,
-          temp_.mutable_cpu_data());
-
-    caffe_div(temp_.count(), top_data, temp_.cpu_data(), top_data);
-  } else {
-    caffe_cpu_gemv<Dtype>(CblasNoTrans, num, dim, 1. / dim, bottom_data,
-            sum_multiplier_.cpu_data(), 0., mean_.mutable_cpu_data());  // EX
-
-    // subtract mean
-    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num, dim, 1, -1.,
-            mean_.cpu_data(), sum_multiplier_.cpu_data(), 0.,
-            temp_.mutable_cpu_data());
-
-    caffe_add(temp_.count(), bottom_data, temp_.cpu_data(), top_data);
+  Dtype* mean_data = mean_.mutable_cpu_data();
+  Dtype* std_data = std_.mutable_cpu_data();
+  const bool normalize_variance =
+      this->layer_param_.mvn_param().normalize_variance();
+  const Dtype eps = 1e-10;
+#ifdef _OPENMP
+  #pragma omp parallel for
+#endif
+  for (int n = 0; n < num_; ++n) {
+    const Dtype* x = bottom_data + n * dim_;
+    Dtype* y = top_data + n * dim_;
+    // Sum the deviations from the first value rather than the values, so
+    // that var(X) = E(X^2) - (EX)^2 does not cancel away when the mean is
+    // large next to the spread.
+    const Dtype shift = x[0];
+    Dtype sum = 0;
+    Dtype sum_sq = 0;
+    for (int i = 0; i < dim_; ++i) {
+      const Dtype d = x[i] - shift;
+      sum += d;
+      sum_sq += d * d;
+    }
+    const Dtype shifted_mean = sum / dim_;
+    const Dtype mean = shift + shifted_mean;
+    Dtype scale = 1;
+    if (normalize_variance) {
+      const Dtype variance = std::max(
+          sum_sq / dim_ - shifted_mean * shifted_mean, Dtype(0));
+      std_data[n] = std::sqrt(variance) + eps;
+      scale = Dtype(1) / std_data[n];
+    }
+    mean_data[n] = mean;
+    for (int i = 0; i < dim_; ++i) {
+      y[i] = (x[i] - mean) * scale;
+    }
   }
 }
 
@@ -92,64 +72,33 @@ void MVNLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     const vector<Blob<Dtype>*>& bottom) {
   const Dtype* top_diff = top[0]->cpu_diff();
   const Dtype* top_data = top[0]->cpu_data();
-  const Dtype* bottom_data = bottom[0]->cpu_data();
   Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
-
-  int num;
-  if (this->layer_param_.mvn_param().across_channels())
-    num = bottom[0]->num();
-  else
-    num = bottom[0]->num() * bottom[0]->channels();
-
-  int dim = bottom[0]->count() / num;
-  Dtype eps = 1e-10;
-
-  if (this->layer_param_.mvn_param().normalize_variance()) {
-    caffe_mul(temp_.count(), top_data, top_diff, bottom_diff);
-    caffe_cpu_gemv<Dtype>(CblasNoTrans, num, dim, 1., bottom_diff,
-          sum_multiplier_.cpu_data(), 0., mean_.mutable_cpu_data());
-    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num, dim, 1, 1.,
-          mean_.cpu_data(), sum_multiplier_.cpu_data(), 0.,
-          bottom_diff);
-    caffe_mul(temp_.count(), top_data, bottom_diff, bottom_diff);
-
-    caffe_cpu_gemv<Dtype>(CblasNoTrans, num, dim, 1., top_diff,
-            sum_multiplier_.cpu_data(), 0., mean_.mutable_cpu_data());
-    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num, dim, 1, 1.,
-            mean_.cpu_data(), sum_multiplier_.cpu_data(), 1.,
-            bottom_diff);
-
-    caffe_cpu_axpby(temp_.count(), Dtype(1), top_diff, Dtype(-1. / dim),
-        bottom_diff);
-
-    // put the squares of bottom into temp_
-    caffe_powx(temp_.count(), bottom_data, Dtype(2),
-        temp_.mutable_cpu_data());
-
-    // computes variance using var(X) = E(X^2) - (EX)^2
-    caffe_cpu_gemv<Dtype>(CblasNoTrans, num, dim, 1. / dim, bottom_data,
-        sum_multiplier_.cpu_data(), 0., mean_.mutable_cpu_data());  // EX
-    caffe_cpu_gemv<Dtype>(CblasNoTrans, num, dim, 1. / dim, temp_.cpu_data(),
-        sum_multiplier_.cpu_data(), 0.,
-        variance_.mutable_cpu_data());  // E(X^2)
-    caffe_powx(mean_.count(), mean_.cpu_data(), Dtype(2),
-        temp_.mutable_cpu_data());  // (EX)^2
-    caffe_sub(mean_.count(), variance_.cpu_data(), temp_.cpu_data(),
-        variance_.mutable_cpu_data());  // variance
-
-    // normalize variance
-    caffe_powx(variance_.count(), variance_.cpu_data(), Dtype(0.5),
-          variance_.mutable_cpu_data());
-
-    caffe_add_scalar(variance_.count(), eps, variance_.mutable_cpu_data());
-
-    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num, dim, 1, 1.,
-        variance_.cpu_data(), sum_multiplier_.cpu_data(), 0.,
-        temp_.mutable_cpu_data());
-
-    caffe_div(temp_.count(), bottom_diff, temp_.cpu_data(), bottom_diff);
-  } else {
-    caffe_copy(temp_.count(), top_diff, bottom_diff);
+  if (!this->layer_param_.mvn_param().normalize_variance()) {
+    caffe_copy(bottom[0]->count(), top_diff, bottom_diff);
+    return;
+  }
+  const Dtype* std_data = std_.cpu_data();
+  // With y = (x - mean) / std over a group of dim values,
+  //   dE/dx = (dE/dy - mean(dE/dy) - y * mean(dE/dy * y)) / std.
+#ifdef _OPENMP
+  #pragma omp parallel for
+#endif
+  for (int n = 0; n < num_; ++n) {
+    const Dtype* dy = top_diff + n * dim_;
+    const Dtype* y = top_data + n * dim_;
+    Dtype* dx = bottom_diff + n * dim_;
+    Dtype sum_dy = 0;
+    Dtype sum_dy_y = 0;
+    for (int i = 0; i < dim_; ++i) {
+      sum_dy += dy[i];
+      sum_dy_y += dy[i] * y[i];
+    }
+    const Dtype mean_dy = sum_dy / dim_;
+    const Dtype mean_dy_y = sum_dy_y / dim_;
+    const Dtype inv_std = Dtype(1) / std_data[n];
+    for (int i = 0; i < dim_; ++i) {
+      dx[i] = (dy[i] - mean_dy - y[i] * mean_dy_y) * inv_std;
+    }
   }
 }
 
@@ -7,66 +7,121 @@
 
 namespace caffe {
 
+// The threads of the block reducing each group; a power of two.
+const int kMVNThreads = 256;
+
+// Sums a and b over the threads of the block, into a[0] and b[0].
+template <typename Dtype>
+__device__ void MVNBlockSum(Dtype* a, Dtype* b) {
+  for (int stride = kMVNThreads / 2; stride > 0; stride /= 2) {
+    __syncthreads();
+    if (threadIdx.x < stride) {
+      a[threadIdx.x] += a[threadIdx.x + stride];
+      b[threadIdx.x] += b[threadIdx.x + stride];
+    }
+  }
+  __syncthreads();
+}
+
+// The moments of each group, from sums shifted by its first value as on the
+// CPU, one block per group so that the threads read the group coalesced.
+template <typename Dtype>
+__global__ void MVNMoments(const int num, const int dim, const Dtype* in,
+    const bool normalize_variance, const Dtype eps, Dtype* mean,
+    Dtype* std) {
+  __shared__ Dtype sum[kMVNThreads];
+  __shared__ Dtype sum_sq[kMVNThreads];
+  for (int n = blockIdx.x; n < num; n += gridDim.x) {
+    const Dtype* x = in + n * dim;
+    const Dtype shift = x[0];
+    Dtype s = 0;
+    Dtype s_sq = 0;
+    for (int i = threadIdx.x; i < dim; i += kMVNThreads) {
+      const Dtype d = x[i] - shift;
+      s += d;
+      s_sq += d * d;
+    }
+    sum[threadIdx.x] = s;
+    sum_sq[threadIdx.x] = s_sq;
+    MVNBlockSum(sum, sum_sq);
+    if (threadIdx.x == 0) {
+      const Dtype shifted_mean = sum[0] / dim;
+      mean[n] = shift + shifted_mean;
+      if (normalize_variance) {
+        const Dtype variance = sum_sq[0] / dim - shifted_mean * shifted_mean;
+        std[n] = sqrt(max(variance, Dtype(0))) + eps;
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+__global__ void MVNNormalize(const int count, const int dim, const Dtype* in,
+    const Dtype* mean, const Dtype* std, const bool normalize_variance,
+    Dtype* out) {
+  CUDA_KERNEL_LOOP(index, count) {
+    const int n = index / dim;
+    out[index] = in[index] - mean[n];
+    if (normalize_variance) {
+      out[index] /= std[n];
+    }
+  }
+}
+
 template <typename Dtype>
 void MVNLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
     const vector<Blob<Dtype>*>& top) {
   const Dtype* bottom_data = bottom[0]->gpu_data();
   Dtype* top_data = top[0]->mutable_gpu_data();
-  int num;
-  if (this->layer_param_.mvn_param().across_channels())
-    num = bottom[0]->num();
-  else
-    num = bottom[0]->num() * bottom[0]->channels();
-
-  int dim = bottom[0]->count() / num;
-
-  if (this->layer_param_.mvn_param().normalize_variance()) {
-    // put the squares of bottom into temp_
-    caffe_gpu_powx(bottom[0]->count(), bottom_data, Dtype(2),
-        temp_.mutable_gpu_data());
-
-    // computes variance using var(X) = E(X^2) - (EX)^2
-    caffe_gpu_gemv<Dtype>(CblasNoTrans, num, dim, 1. / dim, bottom_data,
-        sum_multiplier_.gpu_data(), 0., mean_.mutable_gpu_data());  // EX
-    caffe_gpu_gemv<Dtype>(CblasNoTrans, num, dim, 1. / dim, temp_.gpu_data(),
-        sum_multiplier_.gpu_data(), 0.,
-        variance_.mutable_gpu_data());  // E(X^2)
-    caffe_gpu_powx(mean_.count(), mean_.gpu_data(), Dtype(2),
-        temp_.mutable_gpu_data());  // (EX)^2
-    caffe_gpu_sub(mean_.count(), variance_.gpu_data(), temp_.gpu_data(),
-        variance_.mutable_gpu_data());  // variance
-
-    Dtype eps = 1e-10;
-
-    // do mean and variance normalization
-    // subtract mean
-    caffe_gpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num, dim, 1, -1.,
-            mean_.gpu_data(), sum_multiplier_.gpu_data(), 0.,
-            temp_.mutable_gpu_data());
-
-    caffe_gpu_add(temp_.count(), bottom_data, temp_.gpu_data(), top_data);
-
-    // normalize variance
-    caffe_gpu_powx(variance_.count(), variance_.gpu_data(), Dtype(0.5),
-          variance_.mutable_gpu_data());
-
-    caffe_gpu_add_scalar(variance_.count(), eps, variance_.mutable_gpu_data());
-
-    caffe_gpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num, dim, 1, 1.,
-          variance_.gpu_data(), sum_multiplier_.gpu_data(), 0.,
-          temp_.mutable_gpu_data());
-
-    caffe_gpu_div(temp_.count(), top_data, temp_.gpu_data(), top_data);
-  } else {
-    caffe_gpu_gemv<Dtype>(CblasNoTrans, num, dim, 1. / dim, bottom_data,
-            sum_multiplier_.gpu_data(), 0., mean_.mutable_gpu_data());  // EX
+  const bool normalize_variance =
+      this->layer_param_.mvn_param().normalize_variance();
+  const int count = bottom[0]->count();
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  MVNMoments<Dtype><<<std::min(num_, 65535), kMVNThreads>>>(
+      num_, dim_, bottom_data, normalize_variance, Dtype(1e-10),
+      mean_.mutable_gpu_data(), std_.mutable_gpu_data());
+  CUDA_POST_KERNEL_CHECK;
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  MVNNormalize<Dtype><<<CAFFE_GET_BLOCKS(count), CAFFE_CUDA_NUM_THREADS>>>(
+      count, dim_, bottom_data, mean_.gpu_data(), std_.gpu_data(),
+      normalize_variance, top_data);
+  CUDA_POST_KERNEL_CHECK;
+}
 
-    // subtract mean
-    caffe_gpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num, dim, 1, -1.,
-            mean_.gpu_data(), sum_multiplier_.gpu_data(), 0.,
-            temp_.mutable_gpu_data());
+// The sums of dE/dy and dE/dy * y over each group, one block per group.
+template <typename Dtype>
+__global__ void MVNDiffSums(const int num, const int dim,
+    const Dtype* top_diff, const Dtype* top_data, Dtype* sum_dy,
+    Dtype* sum_dy_y) {
+  __shared__ Dtype sum[kMVNThreads];
+  __shared__ Dtype sum_y[kMVNThreads];
+  for (int n = blockIdx.x; n < num; n += gridDim.x) {
+    const Dtype* dy = top_diff + n * dim;
+    const Dtype* y = top_data + n * dim;
+    Dtype s = 0;
+    Dtype s_y = 0;
+    for (int i = threadIdx.x; i < dim; i += kMVNThreads) {
+      s += dy[i];
+      s_y += dy[i] * y[i];
+    }
+    sum[threadIdx.x] = s;
+    sum_y[threadIdx.x] = s_y;
+    MVNBlockSum(sum, sum_y);
+    if (threadIdx.x == 0) {
+      sum_dy[n] = sum[0];
+      sum_dy_y[n] = sum_y[0];
+    }
+  }
+}
 
-    caffe_gpu_add(temp_.count(), bottom_data, temp_.gpu_data(), top_data);
+template <typename Dtype>
+__global__ void MVNBackward(const int count, const int dim,
+    const Dtype* top_diff, const Dtype* top_data, const Dtype* sum_dy,
+    const Dtype* sum_dy_y, const Dtype* std, Dtype* bottom_diff) {
+  CUDA_KERNEL_LOOP(index, count) {
+    const int n = index / dim;
+    bottom_diff[index] = (top_diff[index] - sum_dy[n] / dim
+        - top_data[index] * sum_dy_y[n] / dim) / std[n];
   }
 }
 
@@ -76,66 +131,23 @@ void MVNLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
     const vector<Blob<Dtype>*>& bottom) {
   const Dtype* top_diff = top[0]->gpu_diff();
   const Dtype* top_data = top[0]->gpu_data();
-  const Dtype* bottom_data = bottom[0]->gpu_data();
   Dtype* bottom_diff = bottom[0]->mutable_gpu_diff();
-
-  int num;
-  if (this->layer_param_.mvn_param().across_channels())
-    num = bottom[0]->num();
-  else
-    num = bottom[0]->num() * bottom[0]->channels();
-
-  int dim = bottom[0]->count() / num;
-
-  Dtype eps = 1e-10;
-
-  if (this->layer_param_.mvn_param().normalize_variance()) {
-    caffe_gpu_mul(temp_.count(), top_data, top_diff, bottom_diff);
-    caffe_gpu_gemv<Dtype>(CblasNoTrans, num, dim, 1., bottom_diff,
-          sum_multiplier_.gpu_data(), 0., mean_.mutable_gpu_data());
-    caffe_gpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num, dim, 1, 1.,
-          mean_.gpu_data(), sum_multiplier_.gpu_data(), 0.,
-          bottom_diff);
-    caffe_gpu_mul(temp_.count(), top_data, bottom_diff, bottom_diff);
-
-    caffe_gpu_gemv<Dtype>(CblasNoTrans, num, dim, 1., top_diff,
-            sum_multiplier_.gpu_data(), 0., mean_.mutable_gpu_data());
-    caffe_gpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num, dim, 1, 1.,
-            mean_.gpu_data(), sum_multiplier_.gpu_data(), 1.,
-            bottom_diff);
-
-    caffe_gpu_axpby(temp_.count(), Dtype(1), top_diff, Dtype(-1. / dim),
-        bottom_diff);
-
-    // put the squares of bottom into temp_
-    caffe_gpu_powx(temp_.count(), bottom_data, Dtype(2),
-        temp_.mutable_gpu_data());
-
-    // computes variance using var(X) = E(X^2) - (EX)^2
-    caffe_gpu_gemv<Dtype>(CblasNoTrans, num, dim, 1. / dim, bottom_data,
-        sum_multiplier_.gpu_data(), 0., mean_.mutable_gpu_data());  // EX
-    caffe_gpu_gemv<Dtype>(CblasNoTrans, num, dim, 1. / dim, temp_.gpu_data(),
-        sum_multiplier_.gpu_data(), 0.,
-        variance_.mutable_gpu_data());  // E(X^2)
-    caffe_gpu_powx(mean_.count(), mean_.gpu_data(), Dtype(2),
-        temp_.mutable_gpu_data());  // (EX)^2
-    caffe_gpu_sub(mean_.count(), variance_.gpu_data(), temp_.gpu_data(),
-        variance_.mutable_gpu_data());  // variance
-
-    // normalize variance
-    caffe_gpu_powx(variance_.count(), variance_.gpu_data(), Dtype(0.5),
-          variance_.mutable_gpu_data());
-
-    caffe_gpu_add_scalar(variance_.count(), eps, variance_.mutable_gpu_data());
-
-    caffe_gpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num, dim, 1, 1.,
-        variance_.gpu_data(), sum_multiplier_.gpu_data(), 0.,
-        temp_.mutable_gpu_data());
-
-    caffe_gpu_div(temp_.count(), bottom_diff, temp_.gpu_data(), bottom_diff);
-  } else {
-    caffe_copy(temp_.count(), top_diff, bottom_diff);
+  const int count = bottom[0]->count();
+  if (!this->layer_param_.mvn_param().normalize_variance()) {
+    caffe_copy(count, top_diff, bottom_diff);
+    return;
   }
+  // The per-group sums go in the diffs of mean_ and std_.
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  MVNDiffSums<Dtype><<<std::min(num_, 65535), kMVNThreads>>>(
+      num_, dim_, top_diff, top_data, mean_.mutable_gpu_diff(),
+      std_.mutable_gpu_diff());
+  CUDA_POST_KERNEL_CHECK;
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  MVNBackward<Dtype><<<CAFFE_GET_BLOCKS(count), CAFFE_CUDA_NUM_THREADS>>>(
+      count, dim_, top_diff, top_data, mean_.gpu_diff(), std_.gpu_diff(),
+      std_.gpu_data(), bottom_diff);
+  CUDA_POST_KERNEL_CHECK;
 }
 
 
@@ -6,6 +6,7 @@
 #include "caffe/layer.hpp"
 #include "caffe/syncedmem.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/pooling_mask.hpp"
 #include "caffe/vision_layers.hpp"
 
 namespace caffe {
@@ -38,6 +39,8 @@ void PoolingLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
       || (!pool_param.has_stride_h() && !pool_param.has_stride_w()))
       << "Stride is stride OR stride_h and stride_w are required.";
   global_pooling_ = pool_param.global_pooling();
+  compact_mask_ =
+      pool_param.mask_format() == PoolingParameter_MaskFormat_COMPACT;
   if (global_pooling_) {
     kernel_h_ = bottom[0]->height();
     kernel_w_ = bottom[0]->width();
@@ -106,7 +109,12 @@ void PoolingLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
   }
   top[0]->Reshape(bottom[0]->num(), channels_, pooled_height_,
       pooled_width_);
-  if (top.size() > 1) {
+  if (top.size() > 1 && compact_mask_) {
+    const PoolingMask mask(height_, width_, pooled_height_, pooled_width_,
+        kernel_h_, kernel_w_, stride_h_, stride_w_, pad_h_, pad_w_);
+    top[1]->Reshape(1, 1, 1,
+        mask.blob_units<Dtype>(bottom[0]->num() * channels_));
+  } else if (top.size() > 1) {
     top[1]->ReshapeLike(*top[0]);
   }
   // If max pooling, we will initialize the vector index part.
@@ -114,6 +122,7 @@ void PoolingLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
       PoolingParameter_PoolMethod_MAX && top.size() == 1) {
     max_idx_.Reshape(bottom[0]->num(), channels_, pooled_height_,
         pooled_width_);
+    max_idx_valid_ = false;
   }
   // If stochastic pooling, we will initialize the random index part.
   if (this->layer_param_.pooling_param().pool() ==
@@ -123,101 +132,309 @@ void PoolingLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
   }
 }
 
-// TODO(Yangqing): Is there a faster way to do pooling in the channel-first
-// case?
+// Geometry of one pooling pass, shared by the per-plane kernels below.
+struct PoolShape {
+  int height, width;
+  int pooled_height, pooled_width;
+  int kernel_h, kernel_w;
+  int stride_h, stride_w;
+  int pad_h, pad_w;
+
+  // The dominant unpadded 2x2 and 3x3 stride 2 windows get unrolled kernels;
+  // returns the kernel size, or 0 if the generic path has to be used.
+  int fast_kernel() const {
+    if (pad_h == 0 && pad_w == 0 && stride_h == 2 && stride_w == 2 &&
+        kernel_h == kernel_w && (kernel_h == 2 || kernel_h == 3)) {
+      return kernel_h;
+    }
+    return 0;
+  }
+  // Number of leading output rows / columns whose window lies fully inside
+  // the image; ceil-mode pooling may clip the last ones.
+  int full_rows() const {
+    return height < kernel_h ? 0 :
+        min(pooled_height, (height - kernel_h) / stride_h + 1);
+  }
+  int full_cols() const {
+    return width < kernel_w ? 0 :
+        min(pooled_width, (width - kernel_w) / stride_w + 1);
+  }
+  PoolingMask compact_mask() const {
+    return PoolingMask(height, width, pooled_height, pooled_width,
+        kernel_h, kernel_w, stride_h, stride_w, pad_h, pad_w);
+  }
+};
+
+// Max over the (clipped) window of output (ph, pw), first maximum in
+// row-major order wins. The argmax goes to mask unless it is NULL.
+template <typename Dtype, typename Mtype>
+inline void max_pool_window(const Dtype* in, const PoolShape& s,
+    const int ph, const int pw, Dtype* out, Mtype* mask) {
+  int hstart = ph * s.stride_h - s.pad_h;
+  int wstart = pw * s.stride_w - s.pad_w;
+  const int hend = min(hstart + s.kernel_h, s.height);
+  const int wend = min(wstart + s.kernel_w, s.width);
+  hstart = max(hstart, 0);
+  wstart = max(wstart, 0);
+  Dtype value = -FLT_MAX;
+  int index = -1;
+  for (int h = hstart; h < hend; ++h) {
+    for (int w = wstart; w < wend; ++w) {
+      if (in[h * s.width + w] > value) {
+        value = in[h * s.width + w];
+        index = h * s.width + w;
+      }
+    }
+  }
+  out[ph * s.pooled_width + pw] = value;
+  if (mask) {
+    mask[ph * s.pooled_width + pw] = static_cast<Mtype>(index);
+  }
+}
+
+// K x K, stride 2 max pooling of the first `cols` outputs of a row whose
+// window starts at input row `row`. The window loops are unrolled and the
+// compares are select-only, so the loop over outputs vectorizes.
+template <typename Dtype, typename Mtype, int K>
+inline void max_pool_row_s2(const Dtype* in, const int width, const int row,
+    const int cols, Dtype* out, Mtype* mask) {
+  const Dtype* in_row = in + row * width;
+  if (mask) {
+    for (int pw = 0; pw < cols; ++pw) {
+      const Dtype* window = in_row + 2 * pw;
+      Dtype value = window[0];
+      int offset = 0;
+      for (int kh = 0; kh < K; ++kh) {
+        for (int kw = (kh == 0); kw < K; ++kw) {
+          const Dtype v = window[kh * width + kw];
+          offset = v > value ? kh * width + kw : offset;
+          value = v > value ? v : value;
+        }
+      }
+      out[pw] = value;
+      mask[pw] = static_cast<Mtype>(row * width + 2 * pw + offset);
+    }
+  } else {
+    for (int pw = 0; pw < cols; ++pw) {
+      const Dtype* window = in_row + 2 * pw;
+      Dtype value = window[0];
+      for (int kh = 0; kh < K; ++kh) {
+        for (int kw = (kh == 0); kw < K; ++kw) {
+          value = max(value, window[kh * width + kw]);
+        }
+      }
+      out[pw] = value;
+    }
+  }
+}
+
+template <typename Dtype, typename Mtype>
+void max_pool_plane(const Dtype* in, const PoolShape& s, Dtype* out,
+    Mtype* mask) {
+  const int fast = s.fast_kernel();
+  const int full_rows = fast ? s.full_rows() : 0;
+  const int full_cols = fast ? s.full_cols() : 0;
+  for (int ph = 0; ph < s.pooled_height; ++ph) {
+    int pw = 0;
+    if (ph < full_rows) {
+      Dtype* out_row = out + ph * s.pooled_width;
+      Mtype* mask_row = mask ? mask + ph * s.pooled_width : NULL;
+      if (fast == 2) {
+        max_pool_row_s2<Dtype, Mtype, 2>(in, s.width, 2 * ph, full_cols,
+            out_row, mask_row);
+      } else {
+        max_pool_row_s2<Dtype, Mtype, 3>(in, s.width, 2 * ph, full_cols,
+            out_row, mask_row);
+      }
+      pw = full_cols;
+    }
+    for (; pw < s.pooled_width; ++pw) {
+      max_pool_window(in, s, ph, pw, out, mask);
+    }
+  }
+}
+
+// Max pooling over all channel planes, in parallel.
+template <typename Dtype, typename Mtype>
+void max_pool_cpu(const Dtype* bottom_data, const int planes,
+    const PoolShape& s, Dtype* top_data, Mtype* mask) {
+  const int in_dim = s.height * s.width;
+  const int out_dim = s.pooled_height * s.pooled_width;
+#ifdef _OPENMP
+  #pragma omp parallel for
+#endif
+  for (int p = 0; p < planes; ++p) {
+    max_pool_plane(bottom_data + p * in_dim, s, top_data + p * out_dim,
+        mask ? mask + p * out_dim : NULL);
+  }
+}
+
+// Max pooling that packs the argmax of each plane into compact switches.
+template <typename Dtype>
+void max_pool_compact_cpu(const Dtype* bottom_data, const int planes,
+    const PoolShape& s, Dtype* top_data, Dtype* top_mask) {
+  const PoolingMask mask = s.compact_mask();
+  const int units = mask.plane_units<Dtype>();
+  const int in_dim = s.height * s.width;
+  const int out_dim = s.pooled_height * s.pooled_width;
+  mask.WriteHeader(reinterpret_cast<uint8_t*>(top_mask));
+  top_mask += mask.header_units<Dtype>();
+#ifdef _OPENMP
+  #pragma omp parallel for
+#endif
+  for (int p = 0; p < planes; ++p) {
+    vector<int> index(out_dim);
+    max_pool_plane(bottom_data + p * in_dim, s, top_data + p * out_dim,
+        &index[0]);
+    mask.Pack(&index[0], reinterpret_cast<uint8_t*>(top_mask + p * units));
+  }
+}
+
+template <typename Dtype>
+inline void ave_pool_window(const Dtype* in, const PoolShape& s,
+    const int ph, const int pw, Dtype* out) {
+  int hstart = ph * s.stride_h - s.pad_h;
+  int wstart = pw * s.stride_w - s.pad_w;
+  int hend = min(hstart + s.kernel_h, s.height + s.pad_h);
+  int wend = min(wstart + s.kernel_w, s.width + s.pad_w);
+  const int pool_size = (hend - hstart) * (wend - wstart);
+  hstart = max(hstart, 0);
+  wstart = max(wstart, 0);
+  hend = min(hend, s.height);
+  wend = min(wend, s.width);
+  Dtype sum = 0;
+  for (int h = hstart; h < hend; ++h) {
+    for (int w = wstart; w < wend; ++w) {
+      sum += in[h * s.width + w];
+    }
+  }
+  out[ph * s.pooled_width + pw] = sum / pool_size;
+}
+
+template <typename Dtype, int K>
+inline void ave_pool_row_s2(const Dtype* in, const int width, const int row,
+    const int cols, Dtype* out) {
+  const Dtype* in_row = in + row * width;
+  for (int pw = 0; pw < cols; ++pw) {
+    const Dtype* window = in_row + 2 * pw;
+    Dtype sum = 0;
+    for (int kh = 0; kh < K; ++kh) {
+      for (int kw = 0; kw < K; ++kw) {
+        sum += window[kh * width + kw];
+      }
+    }
+    out[pw] = sum / (K * K);
+  }
+}
+
+template <typename Dtype>
+void ave_pool_cpu(const Dtype* bottom_data, const int planes,
+    const PoolShape& s, Dtype* top_data) {
+  const int in_dim = s.height * s.width;
+  const int out_dim = s.pooled_height * s.pooled_width;
+  const int fast = s.fast_kernel();
+  const int full_rows = fast ? s.full_rows() : 0;
+  const int full_cols = fast ? s.full_cols() : 0;
+#ifdef _OPENMP
+  #pragma omp parallel for
+#endif
+  for (int p = 0; p < planes; ++p) {
+    const Dtype* in = bottom_data + p * in_dim;
+    Dtype* out = top_data + p * out_dim;
+    for (int ph = 0; ph < s.pooled_height; ++ph) {
+      int pw = 0;
+      if (ph < full_rows) {
+        if (fast == 2) {
+          ave_pool_row_s2<Dtype, 2>(in, s.width, 2 * ph, full_cols,
+              out + ph * s.pooled_width);
+        } else {
+          ave_pool_row_s2<Dtype, 3>(in, s.width, 2 * ph, full_cols,
+              out + ph * s.pooled_width);
+        }
+        pw = full_cols;
+      }
+      for (; pw < s.pooled_width; ++pw) {
+        ave_pool_window(in, s, ph, pw, out);
+      }
+    }
+  }
+}
+
+template <typename Dtype, typename Mtype>
+void max_unpool_diff_cpu(const Dtype* top_diff, const Mtype* mask,
+    const int planes, const PoolShape& s, Dtype* bottom_diff) {
+  const int in_dim = s.height * s.width;
+  const int out_dim = s.pooled_height * s.pooled_width;
+#ifdef _OPENMP
+  #pragma omp parallel for
+#endif
+  for (int p = 0; p < planes; ++p) {
+    Dtype* diff = bottom_diff + p * in_dim;
+    caffe_set(in_dim, Dtype(0), diff);
+    for (int i = p * out_dim; i < (p + 1) * out_dim; ++i) {
+      diff[static_cast<int>(mask[i])] += top_diff[i];
+    }
+  }
+}
+
+template <typename Dtype>
+void max_unpool_diff_compact_cpu(const Dtype* top_diff, const Dtype* top_mask,
+    const int planes, const PoolShape& s, Dtype* bottom_diff) {
+  const PoolingMask mask = s.compact_mask();
+  const int units = mask.plane_units<Dtype>();
+  const int in_dim = s.height * s.width;
+  const int out_dim = s.pooled_height * s.pooled_width;
+  top_mask += mask.header_units<Dtype>();
+#ifdef _OPENMP
+  #pragma omp parallel for
+#endif
+  for (int p = 0; p < planes; ++p) {
+    const uint8_t* packed = reinterpret_cast<const uint8_t*>(
+        top_mask + p * units);
+    const Dtype* diff_in = top_diff + p * out_dim;
+    Dtype* diff = bottom_diff + p * in_dim;
+    caffe_set(in_dim, Dtype(0), diff);
+    for (int ph = 0; ph < s.pooled_height; ++ph) {
+      for (int pw = 0; pw < s.pooled_width; ++pw) {
+        diff[mask.index(packed, ph, pw)] += diff_in[ph * s.pooled_width + pw];
+      }
+    }
+  }
+}
+
 template <typename Dtype>
 void PoolingLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
   const Dtype* bottom_data = bottom[0]->cpu_data();
   Dtype* top_data = top[0]->mutable_cpu_data();
-  const int top_count = top[0]->count();
+  const int planes = bottom[0]->num() * channels_;
+  const PoolShape shape = { height_, width_, pooled_height_, pooled_width_,
+      kernel_h_, kernel_w_, stride_h_, stride_w_, pad_h_, pad_w_ };
   // We'll output the mask to top[1] if it's of size >1.
   const bool use_top_mask = top.size() > 1;
-  int* mask = NULL;  // suppress warnings about uninitalized variables
-  Dtype* top_mask = NULL;
   // Different pooling methods. We explicitly do the switch outside the for
   // loop to save time, although this results in more code.
   switch (this->layer_param_.pooling_param().pool()) {
   case PoolingParameter_PoolMethod_MAX:
-    // Initialize
-    if (use_top_mask) {
-      top_mask = top[1]->mutable_cpu_data();
-      caffe_set(top_count, Dtype(-1), top_mask);
+    if (use_top_mask && compact_mask_) {
+      max_pool_compact_cpu(bottom_data, planes, shape, top_data,
+          top[1]->mutable_cpu_data());
+    } else if (use_top_mask) {
+      max_pool_cpu(bottom_data, planes, shape, top_data,
+          top[1]->mutable_cpu_data());
+    } else if (Caffe::phase() == Caffe::TRAIN) {
+      max_pool_cpu(bottom_data, planes, shape, top_data,
+          max_idx_.mutable_cpu_data());
+      max_idx_valid_ = true;
     } else {
-      mask = max_idx_.mutable_cpu_data();
-      caffe_set(top_count, -1, mask);
-    }
-    caffe_set(top_count, Dtype(-FLT_MAX), top_data);
-    // The main loop
-    for (int n = 0; n < bottom[0]->num(); ++n) {
-      for (int c = 0; c < channels_; ++c) {
-        for (int ph = 0; ph < pooled_height_; ++ph) {
-          for (int pw = 0; pw < pooled_width_; ++pw) {
-            int hstart = ph * stride_h_ - pad_h_;
-            int wstart = pw * stride_w_ - pad_w_;
-            int hend = min(hstart + kernel_h_, height_);
-            int wend = min(wstart + kernel_w_, width_);
-            hstart = max(hstart, 0);
-            wstart = max(wstart, 0);
-            const int pool_index = ph * pooled_width_ + pw;
-            for (int h = hstart; h < hend; ++h) {
-              for (int w = wstart; w < wend; ++w) {
-                const int index = h * width_ + w;
-                if (bottom_data[index] > top_data[pool_index]) {
-                  top_data[pool_index] = bottom_data[index];
-                  if (use_top_mask) {
-                    top_mask[pool_index] = static_cast<Dtype>(index);
-                  } else {
-                    mask[pool_index] = index;
-                  }
-                }
-              }
-            }
-          }
-        }
-        // compute offset
-        bottom_data += bottom[0]->offset(0, 1);
-        top_data += top[0]->offset(0, 1);
-        if (use_top_mask) {
-          top_mask += top[0]->offset(0, 1);
-        } else {
-          mask += top[0]->offset(0, 1);
-        }
-      }
+      // Nobody reads the internal argmax outside of training, so skip it.
+      // Backward_cpu recovers it if it is called anyway.
+      max_pool_cpu<Dtype, int>(bottom_data, planes, shape, top_data, NULL);
+      max_idx_valid_ = false;
     }
     break;
   case PoolingParameter_PoolMethod_AVE:
-    for (int i = 0; i < top_count; ++i) {
-      top_data[i] = 0;
-    }
-    // The main loop
-    for (int n = 0; n < bottom[0]->num(); ++n) {
-      for (int c = 0; c < channels_; ++c) {
-        for (int ph = 0; ph < pooled_height_; ++ph) {
-          for (int pw = 0; pw < pooled_width_; ++pw) {
-            int hstart = ph * stride_h_ - pad_h_;
-            int wstart = pw * stride_w_ - pad_w_;
-            int hend = min(hstart + kernel_h_, height_ + pad_h_);
-            int wend = min(wstart + kernel_w_, width_ + pad_w_);
-            int pool_size = (hend - hstart) * (wend - wstart);
-            hstart = max(hstart, 0);
-            wstart = max(wstart, 0);
-            hend = min(hend, height_);
-            wend = min(wend, width_);
-            for (int h = hstart; h < hend; ++h) {
-              for (int w = wstart; w < wend; ++w) {
-                top_data[ph * pooled_width_ + pw] +=
-                    bottom_data[h * width_ + w];
-              }
-            }
-            top_data[ph * pooled_width_ + pw] /= pool_size;
-          }
-        }
-        // compute offset
-        bottom_data += bottom[0]->offset(0, 1);
-        top_data += top[0]->offset(0, 1);
-      }
-    }
+    ave_pool_cpu(bottom_data, planes, shape, top_data);
     break;
   case PoolingParameter_PoolMethod_STOCHASTIC:
     NOT_IMPLEMENTED;
@@ -235,67 +452,57 @@ void PoolingLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
   }
   const Dtype* top_diff = top[0]->cpu_diff();
   Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
-  // Different pooling methods. We explicitly do the switch outside the for
-  // loop to save time, although this results in more codes.
-  caffe_set(bottom[0]->count(), Dtype(0), bottom_diff);
+  const int planes = top[0]->num() * channels_;
+  const PoolShape shape = { height_, width_, pooled_height_, pooled_width_,
+      kernel_h_, kernel_w_, stride_h_, stride_w_, pad_h_, pad_w_ };
   // We'll output the mask to top[1] if it's of size >1.
   const bool use_top_mask = top.size() > 1;
-  const int* mask = NULL;  // suppress warnings about uninitialized variables
-  const Dtype* top_mask = NULL;
   switch (this->layer_param_.pooling_param().pool()) {
   case PoolingParameter_PoolMethod_MAX:
-    // The main loop
-    if (use_top_mask) {
-      top_mask = top[1]->cpu_data();
+    if (use_top_mask && compact_mask_) {
+      max_unpool_diff_compact_cpu(top_diff, top[1]->cpu_data(), planes, shape,
+          bottom_diff);
+    } else if (use_top_mask) {
+      max_unpool_diff_cpu(top_diff, top[1]->cpu_data(), planes, shape,
+          bottom_diff);
     } else {
-      mask = max_idx_.cpu_data();
-    }
-    for (int n = 0; n < top[0]->num(); ++n) {
-      for (int c = 0; c < channels_; ++c) {
-        for (int ph = 0; ph < pooled_height_; ++ph) {
-          for (int pw = 0; pw < pooled_width_; ++pw) {
-            const int index = ph * pooled_width_ + pw;
-            const int bottom_index =
-                use_top_mask ? top_mask[index] : mask[index];
-            bottom_diff[bottom_index] += top_diff[index];
-          }
-        }
-        bottom_diff += bottom[0]->offset(0, 1);
-        top_diff += top[0]->offset(0, 1);
-        if (use_top_mask) {
-          top_mask += top[0]->offset(0, 1);
-        } else {
-          mask += top[0]->offset(0, 1);
-        }
+      if (!max_idx_valid_) {
+        Blob<Dtype> pooled;
+        pooled.ReshapeLike(*top[0]);
+        max_pool_cpu(bottom[0]->cpu_data(), planes, shape,
+            pooled.mutable_cpu_data(), max_idx_.mutable_cpu_data());
+        max_idx_valid_ = true;
       }
+      max_unpool_diff_cpu(top_diff, max_idx_.cpu_data(), planes, shape,
+          bottom_diff);
     }
     break;
   case PoolingParameter_PoolMethod_AVE:
-    // The main loop
-    for (int n = 0; n < top[0]->num(); ++n) {
-      for (int c = 0; c < channels_; ++c) {
-        for (int ph = 0; ph < pooled_height_; ++ph) {
-          for (int pw = 0; pw < pooled_width_; ++pw) {
-            int hstart = ph * stride_h_ - pad_h_;
-            int wstart = pw * stride_w_ - pad_w_;
-            int hend = min(hstart + kernel_h_, height_ + pad_h_);
-            int wend = min(wstart + kernel_w_, width_ + pad_w_);
-            int pool_size = (hend - hstart) * (wend - wstart);
-            hstart = max(hstart, 0);
-            wstart = max(wstart, 0);
-            hend = min(hend, height_);
-            wend = min(wend, width_);
-            for (int h = hstart; h < hend; ++h) {
-              for (int w = wstart; w < wend; ++w) {
-                bottom_diff[h * width_ + w] +=
-                  top_diff[ph * pooled_width_ + pw] / pool_size;
-              }
+#ifdef _OPENMP
+    #pragma omp parallel for
+#endif
+    for (int p = 0; p < planes; ++p) {
+      const Dtype* diff_in = top_diff + p * pooled_height_ * pooled_width_;
+      Dtype* diff_out = bottom_diff + p * height_ * width_;
+      caffe_set(height_ * width_, Dtype(0), diff_out);
+      for (int ph = 0; ph < pooled_height_; ++ph) {
+        for (int pw = 0; pw < pooled_width_; ++pw) {
+          int hstart = ph * stride_h_ - pad_h_;
+          int wstart = pw * stride_w_ - pad_w_;
+          int hend = min(hstart + kernel_h_, height_ + pad_h_);
+          int wend = min(wstart + kernel_w_, width_ + pad_w_);
+          int pool_size = (hend - hstart) * (wend - wstart);
+          hstart = max(hstart, 0);
+          wstart = max(wstart, 0);
+          hend = min(hend, height_);
+          wend = min(wend, width_);
+          const Dtype value = diff_in[ph * pooled_width_ + pw] / pool_size;
+          for (int h = hstart; h < hend; ++h) {
+            for (int w = wstart; w < wend; ++w) {
+              diff_out[h * width_ + w] += value;
             }
           }
         }
-        // offset
-        bottom_diff += bottom[0]->offset(0, 1);
-        top_diff += top[0]->offset(0, 1);
       }
     }
     break;
@@ -4,6 +4,7 @@
 
 #include "caffe/layer.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/softmax_loss.hpp"
 #include "caffe/vision_layers.hpp"
 
 namespace caffe {
@@ -15,12 +16,6 @@ template <typename Dtype>
 void RedSoftmaxWithLossLayer<Dtype>::LayerSetUp(
     const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
   LossLayer<Dtype>::LayerSetUp(bottom, top);
-  softmax_bottom_vec_.clear();
-  softmax_bottom_vec_.push_back(bottom[0]);
-  softmax_top_vec_.clear();
-  softmax_top_vec_.push_back(&prob_);
-  softmax_layer_->SetUp(softmax_bottom_vec_, softmax_top_vec_);
-
   has_ignore_label_ =
     this->layer_param_.loss_param().has_ignore_label();
   if (has_ignore_label_) {
@@ -40,7 +35,7 @@ template <typename Dtype>
 void RedSoftmaxWithLossLayer<Dtype>::Reshape(
     const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
   LossLayer<Dtype>::Reshape(bottom, top);
-  softmax_layer_->Reshape(softmax_bottom_vec_, softmax_top_vec_);
+  prob_.ReshapeLike(*bottom[0]);
   target_sum_.ReshapeLike(*bottom[1]);
   if (top.size() >= 2) {
     // softmax output
@@ -51,36 +46,51 @@ void RedSoftmaxWithLossLayer<Dtype>::Reshape(
 template <typename Dtype>
 void RedSoftmaxWithLossLayer<Dtype>::Forward_cpu(
     const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
-  // The forward pass computes the softmax prob values.
-  softmax_layer_->Forward(softmax_bottom_vec_, softmax_top_vec_);
-  const Dtype* prob_data = prob_.cpu_data();
+  // The softmax and the loss are computed together, one spatial tile of one
+  // image at a time.
+  const Dtype* bottom_data = bottom[0]->cpu_data();
+  Dtype* prob_data = prob_.mutable_cpu_data();
   const Dtype* label = bottom[1]->cpu_data();
   Dtype* target_sum_data = target_sum_.mutable_cpu_data();
-  int num = prob_.num();
-  int dim = prob_.count() / num;
-  int spatial_dim = prob_.height() * prob_.width();
+  const int num = prob_.num();
+  const int dim = prob_.count() / num;
+  const int spatial_dim = prob_.height() * prob_.width();
+  const int tiles = softmax_num_tiles(spatial_dim);
   int count = 0;
-  Dtype loss = 0;
-  for (int i = 0; i < num; ++i) {
-    for (int j = 0; j < spatial_dim; j++) {
-      const int label_value = static_cast<int>(label[i * spatial_dim + j]);
+  double loss = 0;
+#ifdef _OPENMP
+  #pragma omp parallel for reduction(+: loss, count)
+#endif
+  for (int b = 0; b < num * tiles; ++b) {
+    const int i = b / tiles;
+    const int j0 = (b % tiles) * kSoftmaxTile;
+    const int tile = min(kSoftmaxTile, spatial_dim - j0);
+    const Dtype* prob = prob_data + i * dim + j0;
+    const Dtype* tile_label = label + i * spatial_dim + j0;
+    Dtype* tile_target_sum = target_sum_data + i * spatial_dim + j0;
+    Dtype log_norm[kSoftmaxTile];
+    softmax_tile_cpu(bottom_data + i * dim + j0, red_cls_num_, spatial_dim,
+        tile, prob_data + i * dim + j0, log_norm);
+    for (int j = 0; j < tile; ++j) {
+      const int label_value = static_cast<int>(tile_label[j]);
       if (has_ignore_label_ && label_value == ignore_label_) {
         continue;
       }
       DCHECK_GE(label_value, 0);
-      DCHECK_LT(label_value, prob_.channels());
+      DCHECK_LT(label_value, cls_num_);
 
       const int target_from = label_value * red_cls_num_ / cls_num_;
-      const int target_to = min(red_cls_num_, (label_value+1) * red_cls_num_ / cls_num_);
+      const int target_to =
+          min(red_cls_num_, (label_value + 1) * red_cls_num_ / cls_num_);
       Dtype target_sum_val = 0;
       for (int c = target_from; c < target_to; c++) {
-        target_sum_val += prob_data[i * dim + c * spatial_dim + j];
+        target_sum_val += prob[c * spatial_dim + j];
       }
       // compute loss
-      loss -= log(std::max(target_sum_val, Dtype(FLT_MIN)));
+      loss -= log(max(target_sum_val, Dtype(FLT_MIN)));
 
       // save target sum data to use it for backpropagation
-      target_sum_data[i * spatial_dim + j] = target_sum_val;
+      tile_target_sum[j] = target_sum_val;
 
       ++count;
     }
@@ -96,8 +106,9 @@ void RedSoftmaxWithLossLayer<Dtype>::Forward_cpu(
 }
 
 template <typename Dtype>
-void RedSoftmaxWithLossLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
-    const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
+void RedSoftmaxWithLossLayer<Dtype>::Backward_cpu(
+    const vector<Blob<Dtype>*>& top, const vector<bool>& propagate_down,
+    const vector<Blob<Dtype>*>& bottom) {
   if (propagate_down[1]) {
     LOG(FATAL) << this->type_name()
                << " Layer cannot backpropagate to label inputs.";
@@ -105,39 +116,57 @@ void RedSoftmaxWithLossLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& to
   if (propagate_down[0]) {
     Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
     const Dtype* prob_data = prob_.cpu_data();
-    caffe_copy(prob_.count(), prob_data, bottom_diff);
     const Dtype* label = bottom[1]->cpu_data();
     const Dtype* target_sum_data = target_sum_.cpu_data();
-    int num = prob_.num();
-    int dim = prob_.count() / num;
-    int spatial_dim = prob_.height() * prob_.width();
-    int count = 0;
-    for (int i = 0; i < num; ++i) {
-      for (int j = 0; j < spatial_dim; ++j) {
-        const int label_value = static_cast<int>(label[i * spatial_dim + j]);
+    const int num = prob_.num();
+    const int dim = prob_.count() / num;
+    const int spatial_dim = prob_.height() * prob_.width();
+    const int tiles = softmax_num_tiles(spatial_dim);
+    int count = num * spatial_dim;
+    if (has_ignore_label_) {
+      for (int i = 0; i < num * spatial_dim; ++i) {
+        count -= static_cast<int>(label[i]) == ignore_label_;
+      }
+    }
+    // Scale gradient
+    const Dtype loss_weight = top[0]->cpu_diff()[0];
+    const Dtype scale = normalize_ ? loss_weight / count : loss_weight / num;
+    // The scaled prob - prob / target_sum over the target classes, in one
+    // sweep per tile.
+#ifdef _OPENMP
+    #pragma omp parallel for
+#endif
+    for (int b = 0; b < num * tiles; ++b) {
+      const int i = b / tiles;
+      const int j0 = (b % tiles) * kSoftmaxTile;
+      const int tile = min(kSoftmaxTile, spatial_dim - j0);
+      const Dtype* prob = prob_data + i * dim + j0;
+      Dtype* diff = bottom_diff + i * dim + j0;
+      const Dtype* tile_label = label + i * spatial_dim + j0;
+      const Dtype* tile_target_sum = target_sum_data + i * spatial_dim + j0;
+      for (int c = 0; c < red_cls_num_; ++c) {
+        for (int j = 0; j < tile; ++j) {
+          diff[c * spatial_dim + j] = prob[c * spatial_dim + j] * scale;
+        }
+      }
+      for (int j = 0; j < tile; ++j) {
+        const int label_value = static_cast<int>(tile_label[j]);
         if (has_ignore_label_ && label_value == ignore_label_) {
-          for (int c = 0; c < bottom[0]->channels(); ++c) {
-            bottom_diff[i * dim + c * spatial_dim + j] = 0;
+          for (int c = 0; c < red_cls_num_; ++c) {
+            diff[c * spatial_dim + j] = 0;
           }
         } else {
-      	  const int target_from = label_value * red_cls_num_ / cls_num_;
-          const int target_to = min(red_cls_num_, (label_value+1) * red_cls_num_ / cls_num_);
-          const Dtype target_sum_val = target_sum_data[i * spatial_dim + j];
+          const int target_from = label_value * red_cls_num_ / cls_num_;
+          const int target_to =
+              min(red_cls_num_, (label_value + 1) * red_cls_num_ / cls_num_);
+          const Dtype target_scale = scale / tile_target_sum[j];
           for (int c = target_from; c < target_to; c++) {
-            Dtype prob_val = prob_data[i * dim + c * spatial_dim + j];
-            bottom_diff[i * dim + c * spatial_dim + j] -= prob_val / target_sum_val; 
-          }   
-          ++count;
+            diff[c * spatial_dim + j] -=
+                prob[c * spatial_dim + j] * target_scale;
+          }
         }
       }
     }
-    // Scale gradient
-    const Dtype loss_weight = top[0]->cpu_diff()[0];
-    if (normalize_) {
-      caffe_scal(prob_.count(), loss_weight / count, bottom_diff);
-    } else {
-      caffe_scal(prob_.count(), loss_weight / num, bottom_diff);
-    }
   }
 }
 
@@ -4,6 +4,7 @@
 
 #include "caffe/layer.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/softmax_loss.hpp"
 #include "caffe/vision_layers.hpp"
 
 namespace caffe {
@@ -12,12 +13,6 @@ template <typename Dtype>
 void SoftmaxWithLossLayer<Dtype>::LayerSetUp(
     const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
   LossLayer<Dtype>::LayerSetUp(bottom, top);
-  softmax_bottom_vec_.clear();
-  softmax_bottom_vec_.push_back(bottom[0]);
-  softmax_top_vec_.clear();
-  softmax_top_vec_.push_back(&prob_);
-  softmax_layer_->SetUp(softmax_bottom_vec_, softmax_top_vec_);
-
   has_ignore_label_ =
     this->layer_param_.loss_param().has_ignore_label();
   if (has_ignore_label_) {
@@ -30,7 +25,7 @@ template <typename Dtype>
 void SoftmaxWithLossLayer<Dtype>::Reshape(
     const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
   LossLayer<Dtype>::Reshape(bottom, top);
-  softmax_layer_->Reshape(softmax_bottom_vec_, softmax_top_vec_);
+  prob_.ReshapeLike(*bottom[0]);
   if (top.size() >= 2) {
     // softmax output
     top[1]->ReshapeLike(*bottom[0]);
@@ -40,25 +35,40 @@ void SoftmaxWithLossLayer<Dtype>::Reshape(
 template <typename Dtype>
 void SoftmaxWithLossLayer<Dtype>::Forward_cpu(
     const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
-  // The forward pass computes the softmax prob values.
-  softmax_layer_->Forward(softmax_bottom_vec_, softmax_top_vec_);
-  const Dtype* prob_data = prob_.cpu_data();
+  // The softmax and the loss are computed together, one spatial tile of one
+  // image at a time.
+  const Dtype* bottom_data = bottom[0]->cpu_data();
+  Dtype* prob_data = prob_.mutable_cpu_data();
   const Dtype* label = bottom[1]->cpu_data();
-  int num = prob_.num();
-  int dim = prob_.count() / num;
-  int spatial_dim = prob_.height() * prob_.width();
+  const int num = prob_.num();
+  const int channels = prob_.channels();
+  const int dim = prob_.count() / num;
+  const int spatial_dim = prob_.height() * prob_.width();
+  const int tiles = softmax_num_tiles(spatial_dim);
   int count = 0;
-  Dtype loss = 0;
-  for (int i = 0; i < num; ++i) {
-    for (int j = 0; j < spatial_dim; j++) {
-      const int label_value = static_cast<int>(label[i * spatial_dim + j]);
+  double loss = 0;
+#ifdef _OPENMP
+  #pragma omp parallel for reduction(+: loss, count)
+#endif
+  for (int b = 0; b < num * tiles; ++b) {
+    const int i = b / tiles;
+    const int j0 = (b % tiles) * kSoftmaxTile;
+    const int tile = std::min(kSoftmaxTile, spatial_dim - j0);
+    const Dtype* x = bottom_data + i * dim + j0;
+    const Dtype* tile_label = label + i * spatial_dim + j0;
+    Dtype log_norm[kSoftmaxTile];
+    softmax_tile_cpu(x, channels, spatial_dim, tile, prob_data + i * dim + j0,
+        log_norm);
+    for (int j = 0; j < tile; ++j) {
+      const int label_value = static_cast<int>(tile_label[j]);
       if (has_ignore_label_ && label_value == ignore_label_) {
         continue;
       }
       DCHECK_GE(label_value, 0);
-      DCHECK_LT(label_value, prob_.channels());
-      loss -= log(std::max(prob_data[i * dim + label_value * spatial_dim + j],
-                           Dtype(FLT_MIN)));
+      DCHECK_LT(label_value, channels);
+      // -log(prob) of the label, clamped as if prob >= FLT_MIN.
+      loss += std::min(log_norm[j] - x[label_value * spatial_dim + j],
+                       Dtype(-log(FLT_MIN)));
       ++count;
     }
   }
@@ -82,32 +92,48 @@ void SoftmaxWithLossLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
   if (propagate_down[0]) {
     Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
     const Dtype* prob_data = prob_.cpu_data();
-    caffe_copy(prob_.count(), prob_data, bottom_diff);
     const Dtype* label = bottom[1]->cpu_data();
-    int num = prob_.num();
-    int dim = prob_.count() / num;
-    int spatial_dim = prob_.height() * prob_.width();
-    int count = 0;
-    for (int i = 0; i < num; ++i) {
-      for (int j = 0; j < spatial_dim; ++j) {
-        const int label_value = static_cast<int>(label[i * spatial_dim + j]);
+    const int num = prob_.num();
+    const int channels = prob_.channels();
+    const int dim = prob_.count() / num;
+    const int spatial_dim = prob_.height() * prob_.width();
+    const int tiles = softmax_num_tiles(spatial_dim);
+    int count = num * spatial_dim;
+    if (has_ignore_label_) {
+      for (int i = 0; i < num * spatial_dim; ++i) {
+        count -= static_cast<int>(label[i]) == ignore_label_;
+      }
+    }
+    // Scale gradient
+    const Dtype loss_weight = top[0]->cpu_diff()[0];
+    const Dtype scale = normalize_ ? loss_weight / count : loss_weight / num;
+    // The scaled prob - 1{label} in one sweep per tile.
+#ifdef _OPENMP
+    #pragma omp parallel for
+#endif
+    for (int b = 0; b < num * tiles; ++b) {
+      const int i = b / tiles;
+      const int j0 = (b % tiles) * kSoftmaxTile;
+      const int tile = std::min(kSoftmaxTile, spatial_dim - j0);
+      const Dtype* prob = prob_data + i * dim + j0;
+      Dtype* diff = bottom_diff + i * dim + j0;
+      const Dtype* tile_label = label + i * spatial_dim + j0;
+      for (int c = 0; c < channels; ++c) {
+        for (int j = 0; j < tile; ++j) {
+          diff[c * spatial_dim + j] = prob[c * spatial_dim + j] * scale;
+        }
+      }
+      for (int j = 0; j < tile; ++j) {
+        const int label_value = static_cast<int>(tile_label[j]);
         if (has_ignore_label_ && label_value == ignore_label_) {
-          for (int c = 0; c < bottom[0]->channels(); ++c) {
-            bottom_diff[i * dim + c * spatial_dim + j] = 0;
+          for (int c = 0; c < channels; ++c) {
+            diff[c * spatial_dim + j] = 0;
           }
         } else {
-          bottom_diff[i * dim + label_value * spatial_dim + j] -= 1;
-          ++count;
+          diff[label_value * spatial_dim + j] -= scale;
         }
       }
     }
-    // Scale gradient
-    const Dtype loss_weight = top[0]->cpu_diff()[0];
-    if (normalize_) {
-      caffe_scal(prob_.count(), loss_weight / count, bottom_diff);
-    } else {
-      caffe_scal(prob_.count(), loss_weight / num, bottom_diff);
-    }
   }
 }
 
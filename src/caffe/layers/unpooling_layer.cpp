@@ -6,6 +6,7 @@
 #include "caffe/layer.hpp"
 #include "caffe/syncedmem.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/pooling_mask.hpp"
 #include "caffe/vision_layers.hpp"
 
 namespace caffe {
@@ -69,6 +70,10 @@ void UnpoolingLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
     CHECK_LT(pad_w_, kernel_w_);
   }
 
+  compact_mask_ =
+      unpool_param.mask_format() == PoolingParameter_MaskFormat_COMPACT;
+  compact_mask_checked_ = false;
+
   if (unpool_param.has_unpool_size()) {
     unpooled_height_ = unpooled_width_ = unpool_param.unpool_size();
   } else if (unpool_param.has_unpool_h() &&
@@ -98,6 +103,37 @@ void UnpoolingLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
 
   top[0]->Reshape(bottom[0]->num(), channels_, unpooled_height_,
       unpooled_width_);
+  if (bottom.size() > 1 && compact_mask_) {
+    const PoolingMask mask = compact_mask();
+    CHECK_EQ(bottom[1]->count(),
+        mask.blob_units<Dtype>(bottom[0]->num() * channels_))
+        << "Compact mask does not match the unpooling geometry.";
+    // The pooling writes the mask in Forward, so its geometry is checked on
+    // the first Forward after each Reshape.
+    compact_mask_checked_ = false;
+  }
+}
+
+template <typename Dtype>
+PoolingMask UnpoolingLayer<Dtype>::compact_mask() const {
+  return PoolingMask(unpooled_height_, unpooled_width_, height_, width_,
+      kernel_h_, kernel_w_, stride_h_, stride_w_, pad_h_, pad_w_);
+}
+
+// Index into the unpooled plane that bottom element (ph, pw) of a plane goes
+// to: its switch if there is a mask, else the top-left of its window.
+template <typename Dtype>
+int UnpoolingLayer<Dtype>::unpooled_index(const Dtype* plane_mask,
+      const PoolingMask& mask, const int ph, const int pw) const {
+  if (!plane_mask) {
+    const int uph = max(0, min(ph * stride_h_ - pad_h_, unpooled_height_ - 1));
+    const int upw = max(0, min(pw * stride_w_ - pad_w_, unpooled_width_ - 1));
+    return uph * unpooled_width_ + upw;
+  }
+  if (compact_mask_) {
+    return mask.index(reinterpret_cast<const uint8_t*>(plane_mask), ph, pw);
+  }
+  return static_cast<int>(plane_mask[ph * width_ + pw]);
 }
 
 // TODO(Yangqing): Is there a faster way to do unpooling in the channel-first
@@ -107,45 +143,46 @@ void UnpoolingLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
   const Dtype* bottom_data = bottom[0]->cpu_data();
   Dtype* top_data = top[0]->mutable_cpu_data();
-  const int top_count = top[0]->count();
   // We'll get the mask from bottom[1] if it's of size >1.
   const bool use_bottom_mask = bottom.size() > 1;
   const Dtype* bottom_mask = NULL;
   // Different unpooling methods. We explicitly do the switch outside the for
   // loop to save time, although this results in more code.
   switch (this->layer_param_.unpooling_param().unpool()) {
-  case UnpoolingParameter_UnpoolMethod_MAX:
-    caffe_set(top_count, Dtype(0), top_data);
-    // Initialize
+  case UnpoolingParameter_UnpoolMethod_MAX: {
+    const PoolingMask mask = compact_mask();
+    const int planes = bottom[0]->num() * channels_;
+    const int mask_dim = !use_bottom_mask ? 0 :
+        (compact_mask_ ? mask.plane_units<Dtype>() : height_ * width_);
     if (use_bottom_mask) {
       bottom_mask = bottom[1]->cpu_data();
-    } 
-    // The main loop
-    for (int n = 0; n < bottom[0]->num(); ++n) {
-      for (int c = 0; c < channels_; ++c) {
-        for (int ph = 0; ph < height_; ++ph) {
-          for (int pw = 0; pw < width_; ++pw) {
-            int uph = max(0,min(ph * stride_h_ - pad_h_, unpooled_height_-1));
-            int upw = max(0,min(pw * stride_w_ - pad_w_, unpooled_width_-1)); 
-	    const int index = ph * width_ + pw;
-            const int unpooled_index = uph * unpooled_width_ + upw; 
-            if (use_bottom_mask) {
-              const int mask_index = bottom_mask[index];
-              top_data[mask_index] = bottom_data[index];
-            } else {
-              top_data[unpooled_index] = bottom_data[index];
-            }
-          }
+    }
+    if (use_bottom_mask && compact_mask_) {
+      CHECK(compact_mask_checked_ ||
+          mask.Matches(reinterpret_cast<const uint8_t*>(bottom_mask)))
+          << "Compact mask was packed by a pooling of other geometry than "
+          << "this unpooling: check kernel, stride, pad and unpool size.";
+      compact_mask_checked_ = true;
+      bottom_mask += mask.header_units<Dtype>();
+    }
+    // The main loop, in parallel over the channel planes
+#ifdef _OPENMP
+    #pragma omp parallel for
+#endif
+    for (int p = 0; p < planes; ++p) {
+      const Dtype* plane_data = bottom_data + p * height_ * width_;
+      const Dtype* plane_mask = bottom_mask ? bottom_mask + p * mask_dim : NULL;
+      Dtype* plane_top = top_data + p * unpooled_height_ * unpooled_width_;
+      caffe_set(unpooled_height_ * unpooled_width_, Dtype(0), plane_top);
+      for (int ph = 0; ph < height_; ++ph) {
+        for (int pw = 0; pw < width_; ++pw) {
+          plane_top[unpooled_index(plane_mask, mask, ph, pw)] =
+              plane_data[ph * width_ + pw];
         }
-        // compute offset
-        bottom_data += bottom[0]->offset(0, 1);
-        top_data += top[0]->offset(0, 1);
-        if (use_bottom_mask) {
-          bottom_mask += bottom[1]->offset(0, 1);
-        } 
       }
     }
     break;
+  }
   case UnpoolingParameter_UnpoolMethod_AVE:
      // The main loop
     for (int n = 0; n < top[0]->num(); ++n) {
@@ -224,36 +261,35 @@ void UnpoolingLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
   const bool use_bottom_mask = bottom.size() > 1;
   const Dtype* bottom_mask = NULL;
   switch (this->layer_param_.unpooling_param().unpool()) {
-  case UnpoolingParameter_UnpoolMethod_MAX:
+  case UnpoolingParameter_UnpoolMethod_MAX: {
+    const PoolingMask mask = compact_mask();
+    const int planes = bottom[0]->num() * channels_;
+    const int mask_dim = !use_bottom_mask ? 0 :
+        (compact_mask_ ? mask.plane_units<Dtype>() : height_ * width_);
     if (use_bottom_mask) {
       bottom_mask = bottom[1]->cpu_data();
-    } 
-    // The main loop
-    for (int n = 0; n < top[0]->num(); ++n) {
-      for (int c = 0; c < channels_; ++c) {
-        for (int ph = 0; ph < height_; ++ph) {
-          for (int pw = 0; pw < width_; ++pw) {
-            int uph = max(0,min(ph * stride_h_ - pad_h_, unpooled_height_-1));
-            int upw = max(0,min(pw * stride_w_ - pad_w_, unpooled_width_-1)); 
-            const int index = ph * width_ + pw;
-            const int unpooled_index = uph * unpooled_width_ + upw; 
-            if (use_bottom_mask) {
-              const int mask_index = bottom_mask[index];
-              bottom_diff[index] = top_diff[mask_index]; 
-            } else {
-              bottom_diff[index] = top_diff[unpooled_index];
-            }
-          }
+    }
+    if (use_bottom_mask && compact_mask_) {
+      bottom_mask += mask.header_units<Dtype>();
+    }
+    // The main loop, in parallel over the channel planes
+#ifdef _OPENMP
+    #pragma omp parallel for
+#endif
+    for (int p = 0; p < planes; ++p) {
+      const Dtype* plane_top =
+          top_diff + p * unpooled_height_ * unpooled_width_;
+      const Dtype* plane_mask = bottom_mask ? bottom_mask + p * mask_dim : NULL;
+      Dtype* plane_diff = bottom_diff + p * height_ * width_;
+      for (int ph = 0; ph < height_; ++ph) {
+        for (int pw = 0; pw < width_; ++pw) {
+          plane_diff[ph * width_ + pw] =
+              plane_top[unpooled_index(plane_mask, mask, ph, pw)];
         }
-        // compute offset
-        bottom_diff += bottom[0]->offset(0, 1);
-        top_diff += top[0]->offset(0, 1);
-        if (use_bottom_mask) {
-          bottom_mask += bottom[1]->offset(0, 1);
-        } 
       }
     }
     break;
+  }
   case UnpoolingParameter_UnpoolMethod_AVE:
     for (int i = 0; i < bottom[0]->count(); ++i) {
       bottom_diff[i] = 0;
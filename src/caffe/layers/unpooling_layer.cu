@@ -108,6 +108,13 @@ __global__ void TileUnpoolForward(const int nthreads, const Dtype* bottom_data,
 template <typename Dtype>
 void UnpoolingLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
+  if (bottom.size() > 1 && compact_mask_) {
+    // Compact switches are only unpacked on the CPU.
+    LOG_FIRST_N(WARNING, 1) << this->layer_param_.name() << " runs on the "
+        << "CPU: compact masks are not supported on the GPU.";
+    Forward_cpu(bottom, top);
+    return;
+  }
   const Dtype* bottom_data = bottom[0]->gpu_data();
   int count = bottom[0]->count();
   Dtype* top_data = top[0]->mutable_gpu_data();
@@ -247,6 +254,10 @@ void UnpoolingLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
   if (!propagate_down[0]) {
     return;
   }
+  if (bottom.size() > 1 && compact_mask_) {
+    Backward_cpu(top, propagate_down, bottom);
+    return;
+  }
   const Dtype* top_diff = top[0]->gpu_diff();
   Dtype* bottom_diff = bottom[0]->mutable_gpu_diff();
   const int count = bottom[0]->count();
@@ -1,3 +1,7 @@
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 #include <algorithm>
 #include <map>
 #include <set>
@@ -30,12 +34,53 @@ Net<Dtype>::Net(const string& param_file) {
   Init(param);
 }
 
+template <typename Dtype>
+Net<Dtype>::Net(const NetParameter& param, const Net* net) {
+  // The replica keeps the layers of net whatever the phase of this thread.
+  NetParameter replica_param(param);
+  replica_param.mutable_state()->set_phase(net->phase_);
+  Init(replica_param);
+  CHECK_EQ(layers_.size(), net->layers_.size())
+      << "A replica has to be made from the param of the net it replicates.";
+  for (int i = 0; i < layers_.size(); ++i) {
+    CHECK_EQ(layer_names_[i], net->layer_names_[i])
+        << "A replica has to be made from the param of the net it replicates.";
+  }
+  CHECK_EQ(params_.size(), net->params_.size());
+  for (int i = 0; i < params_.size(); ++i) {
+    Blob<Dtype>* param_blob = net->params_[i].get();
+    params_[i]->ShareData(*param_blob);
+    // Bring the parameters to the device now, so that the replicas only read
+    // them.
+    switch (Caffe::mode()) {
+    case Caffe::CPU:
+      param_blob->cpu_data();
+      break;
+    case Caffe::GPU:
+      param_blob->gpu_data();
+      break;
+    default:
+      LOG(FATAL) << "Unknown caffe mode.";
+    }
+  }
+}
+
 template <typename Dtype>
 void Net<Dtype>::Init(const NetParameter& in_param) {
   // Filter layers based on their include/exclude rules and
   // the current NetState.
   NetParameter filtered_param;
   FilterNet(in_param, &filtered_param);
+  phase_ = in_param.state().has_phase() ? in_param.state().phase()
+      : (Caffe::phase() == Caffe::TRAIN ? TRAIN : TEST);
+  if (filtered_param.fold_batch_norm()) {
+    NetParameter unfolded_param(filtered_param);
+    FoldBatchNorm(unfolded_param, &filtered_param, &folded_bn_layers_);
+  }
+  if (filtered_param.fuse_relu()) {
+    NetParameter unfused_param(filtered_param);
+    FuseReLU(unfused_param, &filtered_param, &fused_relu_layers_);
+  }
   LOG(INFO) << "Initializing net from parameters: " << std::endl
             << filtered_param.DebugString();
   // Create a copy of filtered_param with splits added where necessary.
@@ -218,18 +263,503 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
     layer_names_index_[layer_names_[layer_id]] = layer_id;
   }
   GetLearningRateAndWeightDecay();
+  // The OpenMP threads on every NUMA node read the parameters.
+  for (int i = 0; i < params_.size(); ++i) {
+    if (param_owners_[i] < 0) {
+      params_[i]->set_host_policy(HOST_INTERLEAVE);
+    }
+  }
+  share_activations_ = param.share_activations();
+  PlanActivations(param);
+  ShareBuffers();
+  // Nothing is recorded yet, so that the first Forward reshapes every layer
+  // with the whole net set up (as ConcatLayer and CropLayer need for views).
+  layer_shape_generations_.assign(layers_.size(), vector<uint64_t>());
+  layer_reshapes_.assign(layers_.size(), 0);
+  if (param.parallel_branches()) {
+    CHECK(activation_buffers_.empty() && diff_buffers_.empty())
+        << "parallel_branches cannot be combined with share_activations, "
+        << "share_diffs or recompute.";
+    PlanWaves();
+  }
+  PlanFrozenPrefix();
   LOG(INFO) << "Network initialization done.";
   LOG(INFO) << "Memory required for data: " << memory_used_ * sizeof(Dtype);
+  if (activation_buffers_.size() || diff_buffers_.size()) {
+    size_t data_shared = 0;
+    for (int i = 0; i < activation_buffers_.size(); ++i) {
+      data_shared += activation_buffers_[i]->count();
+    }
+    size_t diff_shared = 0;
+    for (int i = 0; i < diff_buffers_.size(); ++i) {
+      diff_shared += diff_buffers_[i]->count();
+    }
+    LOG(INFO) << "Memory required for shared data: "
+        << data_shared * sizeof(Dtype) << " in " << activation_buffers_.size()
+        << " buffers, for shared diffs: " << diff_shared * sizeof(Dtype)
+        << " in " << diff_buffers_.size() << " buffers";
+  }
   // Don't display debug info by default.
   debug_info_ = false;
 }
 
+// Returns the root of blob_id in the forest of groups of GroupBlobs.
+static int BlobGroup(const vector<int>& parent, int blob_id) {
+  while (parent[blob_id] != blob_id) {
+    blob_id = parent[blob_id];
+  }
+  return blob_id;
+}
+
+template <typename Dtype>
+void Net<Dtype>::GroupBlobs(vector<int>* group, vector<int>* first,
+    vector<int>* last) const {
+  const int num_blobs = blobs_.size();
+  const int num_layers = layers_.size();
+  // The first layer writing each blob and the last layer using it. Inputs
+  // are written before the first layer.
+  first->assign(num_blobs, num_layers);
+  last->assign(num_blobs, -1);
+  // Blobs that may share memory form groups, as trees rooted at the blob
+  // that owns the memory.
+  vector<int> parent(num_blobs);
+  for (int blob_id = 0; blob_id < num_blobs; ++blob_id) {
+    parent[blob_id] = blob_id;
+  }
+  for (int layer_id = 0; layer_id < num_layers; ++layer_id) {
+    const Layer<Dtype>& layer = *layers_[layer_id];
+    for (int bottom_id = 0; bottom_id < bottom_id_vecs_[layer_id].size();
+         ++bottom_id) {
+      const int blob_id = bottom_id_vecs_[layer_id][bottom_id];
+      (*last)[blob_id] = std::max((*last)[blob_id], layer_id);
+    }
+    for (int top_id = 0; top_id < top_id_vecs_[layer_id].size(); ++top_id) {
+      const int blob_id = top_id_vecs_[layer_id][top_id];
+      (*first)[blob_id] = std::min((*first)[blob_id], layer_id);
+      (*last)[blob_id] = std::max((*last)[blob_id], layer_id);
+      for (int bottom_id = 0; bottom_id < bottom_id_vecs_[layer_id].size();
+           ++bottom_id) {
+        const int top_group = BlobGroup(parent, blob_id);
+        const int bottom_group = BlobGroup(parent,
+            bottom_id_vecs_[layer_id][bottom_id]);
+        if (top_group == bottom_group) { continue; }
+        if (layer.TopSharesBottom(top_id, bottom_id)) {
+          parent[top_group] = bottom_group;
+        } else if (layer.BottomSharesTop(bottom_id, top_id)) {
+          parent[bottom_group] = top_group;
+        }
+      }
+    }
+  }
+  for (int i = 0; i < net_input_blob_indices_.size(); ++i) {
+    (*first)[net_input_blob_indices_[i]] = -1;
+  }
+  // Each group is alive as long as any of its blobs.
+  group->resize(num_blobs);
+  for (int blob_id = 0; blob_id < num_blobs; ++blob_id) {
+    const int root = BlobGroup(parent, blob_id);
+    (*group)[blob_id] = root;
+    (*first)[root] = std::min((*first)[root], (*first)[blob_id]);
+    (*last)[root] = std::max((*last)[root], (*last)[blob_id]);
+  }
+}
+
+template <typename Dtype>
+int Net<Dtype>::PlanBuffers(const vector<int>& roots, const vector<int>& first,
+    const vector<int>& last, vector<int>* blob_buffers) const {
+  vector<pair<int, int> > groups;
+  for (int i = 0; i < roots.size(); ++i) {
+    groups.push_back(make_pair(first[roots[i]], roots[i]));
+  }
+  std::sort(groups.begin(), groups.end());
+  // Give each group, in the order they are written, a buffer no longer used
+  // by then: the smallest that is large enough, or else the largest.
+  vector<int> buffer_last;
+  vector<int> buffer_count;
+  blob_buffers->assign(blobs_.size(), -1);
+  for (int i = 0; i < groups.size(); ++i) {
+    const int blob_id = groups[i].second;
+    const int count = blobs_[blob_id]->count();
+    int buffer = -1;
+    for (int j = 0; j < buffer_last.size(); ++j) {
+      if (buffer_last[j] >= groups[i].first) { continue; }
+      if (buffer < 0) {
+        buffer = j;
+        continue;
+      }
+      const bool fits = buffer_count[j] >= count;
+      const bool best_fits = buffer_count[buffer] >= count;
+      if (fits ? (!best_fits || buffer_count[j] < buffer_count[buffer])
+               : (!best_fits && buffer_count[j] > buffer_count[buffer])) {
+        buffer = j;
+      }
+    }
+    if (buffer < 0) {
+      buffer = buffer_last.size();
+      buffer_last.push_back(-1);
+      buffer_count.push_back(0);
+    }
+    buffer_last[buffer] = last[blob_id];
+    buffer_count[buffer] = std::max(buffer_count[buffer], count);
+    (*blob_buffers)[blob_id] = buffer;
+    DLOG(INFO) << "Blob " << blob_names_[blob_id] << " shares buffer "
+        << buffer << " for layers " << groups[i].first << " to "
+        << last[blob_id];
+  }
+  return buffer_last.size();
+}
+
+template <typename Dtype>
+void Net<Dtype>::PlanActivations(const NetParameter& param) {
+  activation_buffers_.clear();
+  diff_buffers_.clear();
+  blob_activation_buffers_.assign(blobs_.size(), -1);
+  blob_diff_buffers_.assign(blobs_.size(), -1);
+  blob_segments_.assign(blobs_.size(), -1);
+  segment_layers_.clear();
+  segment_sizes_.clear();
+  bool recompute = false;
+  for (int layer_id = 0; layer_id < param.layers_size(); ++layer_id) {
+    recompute |= param.layers(layer_id).recompute();
+  }
+  if (!param.share_activations() && !param.share_diffs() && !recompute) {
+    return;
+  }
+  vector<int> group, first, last;
+  GroupBlobs(&group, &first, &last);
+  // The groups of the net inputs and outputs, of blobs with a loss weight and
+  // of the blobs to keep have their own memory.
+  vector<bool> keep(blobs_.size(), false);
+  for (int i = 0; i < net_input_blob_indices_.size(); ++i) {
+    keep[group[net_input_blob_indices_[i]]] = true;
+  }
+  for (int i = 0; i < net_output_blob_indices_.size(); ++i) {
+    keep[group[net_output_blob_indices_[i]]] = true;
+  }
+  for (int blob_id = 0; blob_id < blobs_.size(); ++blob_id) {
+    if (blob_loss_weights_.size() > blob_id && blob_loss_weights_[blob_id]) {
+      keep[group[blob_id]] = true;
+    }
+  }
+  for (int i = 0; i < param.keep_blob_size(); ++i) {
+    CHECK(has_blob(param.keep_blob(i)))
+        << "Unknown blob to keep: " << param.keep_blob(i);
+    keep[group[blob_names_index_[param.keep_blob(i)]]] = true;
+  }
+  vector<int> roots;
+  for (int blob_id = 0; blob_id < blobs_.size(); ++blob_id) {
+    if (group[blob_id] == blob_id && !keep[blob_id]) {
+      roots.push_back(blob_id);
+    }
+  }
+  if (param.share_activations()) {
+    activation_buffers_.resize(
+        PlanBuffers(roots, first, last, &blob_activation_buffers_));
+    LOG(INFO) << "Sharing " << roots.size() << " activations in "
+        << activation_buffers_.size() << " buffers";
+  } else {
+    if (param.share_diffs()) {
+      // Backward may read the diff of a blob that not every layer using it
+      // writes, as Slice and Split do for a top that only feeds Accuracy:
+      // such a diff has to stay zero, as in a net without sharing, so the
+      // blob keeps its own.
+      vector<bool> read(blobs_.size(), false);
+      vector<bool> unwritten(blobs_.size(), false);
+      for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+        for (int top_id = 0; top_id < top_id_vecs_[layer_id].size();
+             ++top_id) {
+          if (layer_need_backward_[layer_id]) {
+            read[top_id_vecs_[layer_id][top_id]] = true;
+          }
+        }
+        for (int bottom_id = 0; bottom_id < bottom_id_vecs_[layer_id].size();
+             ++bottom_id) {
+          if (!layer_need_backward_[layer_id]
+              || !bottom_need_backward_[layer_id][bottom_id]) {
+            unwritten[bottom_id_vecs_[layer_id][bottom_id]] = true;
+          }
+        }
+      }
+      vector<int> diff_roots;
+      for (int i = 0; i < roots.size(); ++i) {
+        if (!read[roots[i]] || !unwritten[roots[i]]) {
+          diff_roots.push_back(roots[i]);
+        }
+      }
+      diff_buffers_.resize(
+          PlanBuffers(diff_roots, first, last, &blob_diff_buffers_));
+      LOG(INFO) << "Sharing " << diff_roots.size() << " diffs in "
+          << diff_buffers_.size() << " buffers";
+    }
+    if (recompute) {
+      PlanRecompute(param, group, first, last, keep);
+    }
+  }
+  for (int i = 0; i < activation_buffers_.size(); ++i) {
+    activation_buffers_[i].reset(new Blob<Dtype>());
+  }
+  for (int i = 0; i < diff_buffers_.size(); ++i) {
+    diff_buffers_[i].reset(new Blob<Dtype>());
+  }
+}
+
+template <typename Dtype>
+void Net<Dtype>::PlanRecompute(const NetParameter& param,
+    const vector<int>& group, const vector<int>& first,
+    const vector<int>& last, const vector<bool>& keep) {
+  const int num_blobs = blobs_.size();
+  const int num_layers = layers_.size();
+  // A group is dropped if it is not kept and every layer writing it is
+  // recomputed, and a layer is recomputed only if all its tops are dropped.
+  vector<bool> recompute(num_layers);
+  for (int layer_id = 0; layer_id < num_layers; ++layer_id) {
+    // Splits only share the memory of their bottoms, so they go with them.
+    recompute[layer_id] = (param.layers(layer_id).recompute()
+        || param.layers(layer_id).type() == LayerParameter_LayerType_SPLIT)
+        && top_id_vecs_[layer_id].size() > 0;
+    // Layers without bottoms read new data each time they run.
+    if (recompute[layer_id] && (bottom_id_vecs_[layer_id].empty()
+        || !layers_[layer_id]->CanRecompute())) {
+      LOG(INFO) << "Keeping the tops of " << layer_names_[layer_id]
+          << ", which cannot be replayed";
+      recompute[layer_id] = false;
+    }
+  }
+  vector<bool> dropped(num_blobs);
+  for (bool changed = true; changed; ) {
+    changed = false;
+    for (int blob_id = 0; blob_id < num_blobs; ++blob_id) {
+      dropped[blob_id] = group[blob_id] == blob_id && !keep[blob_id];
+    }
+    for (int layer_id = 0; layer_id < num_layers; ++layer_id) {
+      for (int top_id = 0; top_id < top_id_vecs_[layer_id].size(); ++top_id) {
+        if (!recompute[layer_id]) {
+          dropped[group[top_id_vecs_[layer_id][top_id]]] = false;
+        }
+      }
+    }
+    for (int layer_id = 0; layer_id < num_layers; ++layer_id) {
+      for (int top_id = 0; top_id < top_id_vecs_[layer_id].size(); ++top_id) {
+        if (recompute[layer_id]
+            && !dropped[group[top_id_vecs_[layer_id][top_id]]]) {
+          LOG_IF(INFO, param.layers(layer_id).recompute())
+              << "Keeping the tops of " << layer_names_[layer_id]
+              << ", which cannot be recomputed";
+          recompute[layer_id] = false;
+          changed = true;
+        }
+      }
+    }
+  }
+  // The dropped groups used by one recomputed layer form a segment, which is
+  // recomputed at once. Segments alive at the same time are merged, so that
+  // segments can share the buffers of their groups.
+  vector<int> parent(num_blobs);
+  for (int blob_id = 0; blob_id < num_blobs; ++blob_id) {
+    parent[blob_id] = blob_id;
+  }
+  for (int layer_id = 0; layer_id < num_layers; ++layer_id) {
+    if (!recompute[layer_id]) { continue; }
+    const int segment = BlobGroup(parent, group[top_id_vecs_[layer_id][0]]);
+    for (int bottom_id = 0; bottom_id < bottom_id_vecs_[layer_id].size();
+         ++bottom_id) {
+      const int root = group[bottom_id_vecs_[layer_id][bottom_id]];
+      if (dropped[root] && BlobGroup(parent, root) != segment) {
+        parent[BlobGroup(parent, root)] = segment;
+      }
+    }
+    for (int top_id = 1; top_id < top_id_vecs_[layer_id].size(); ++top_id) {
+      const int root = group[top_id_vecs_[layer_id][top_id]];
+      if (BlobGroup(parent, root) != segment) {
+        parent[BlobGroup(parent, root)] = segment;
+      }
+    }
+  }
+  vector<int> segment_first(first);
+  vector<int> segment_last(last);
+  for (int blob_id = 0; blob_id < num_blobs; ++blob_id) {
+    if (!dropped[blob_id]) { continue; }
+    const int segment = BlobGroup(parent, blob_id);
+    segment_first[segment] = std::min(segment_first[segment], first[blob_id]);
+    segment_last[segment] = std::max(segment_last[segment], last[blob_id]);
+  }
+  vector<pair<int, int> > segments;
+  for (int blob_id = 0; blob_id < num_blobs; ++blob_id) {
+    if (dropped[blob_id] && BlobGroup(parent, blob_id) == blob_id) {
+      segments.push_back(make_pair(segment_first[blob_id], blob_id));
+    }
+  }
+  std::sort(segments.begin(), segments.end());
+  for (int i = 1, end = -1; i < segments.size(); ++i) {
+    const int previous = BlobGroup(parent, segments[i - 1].second);
+    end = std::max(end, segment_last[previous]);
+    if (segments[i].first <= end) {
+      parent[segments[i].second] = previous;
+    }
+  }
+  // Number the segments, and give the groups of each segment, in order,
+  // buffers 0, 1, ...
+  map<int, int> segment_ids;
+  vector<int> segment_sizes;
+  for (int i = 0; i < segments.size(); ++i) {
+    const int root = BlobGroup(parent, segments[i].second);
+    if (segment_ids.find(root) == segment_ids.end()) {
+      const int segment_id = segment_ids.size();
+      segment_ids[root] = segment_id;
+      segment_sizes.push_back(0);
+    }
+  }
+  vector<pair<int, int> > groups;
+  for (int blob_id = 0; blob_id < num_blobs; ++blob_id) {
+    if (dropped[blob_id]) {
+      groups.push_back(make_pair(first[blob_id], blob_id));
+    }
+  }
+  std::sort(groups.begin(), groups.end());
+  for (int i = 0; i < groups.size(); ++i) {
+    const int blob_id = groups[i].second;
+    const int segment = segment_ids[BlobGroup(parent, blob_id)];
+    blob_activation_buffers_[blob_id] = segment_sizes[segment]++;
+  }
+  for (int blob_id = 0; blob_id < num_blobs; ++blob_id) {
+    if (dropped[group[blob_id]]) {
+      blob_segments_[blob_id] =
+          segment_ids[BlobGroup(parent, group[blob_id])];
+    }
+  }
+  segment_sizes_ = segment_sizes;
+  segment_layers_.resize(segment_sizes.size());
+  for (int layer_id = 0; layer_id < num_layers; ++layer_id) {
+    if (recompute[layer_id]) {
+      segment_layers_[blob_segments_[top_id_vecs_[layer_id][0]]].push_back(
+          layer_id);
+    }
+  }
+  const int num_buffers = segment_sizes.size() ?
+      *std::max_element(segment_sizes.begin(), segment_sizes.end()) : 0;
+  activation_buffers_.resize(num_buffers);
+  buffer_segments_.assign(num_buffers, -1);
+  layer_philox_positions_.assign(num_layers, 0);
+  LOG(INFO) << "Recomputing " << groups.size() << " activations in "
+      << segment_layers_.size() << " segments, sharing " << num_buffers
+      << " buffers";
+}
+
+template <typename Dtype>
+void Net<Dtype>::ShareBuffers() {
+  vector<int> counts(activation_buffers_.size(), 0);
+  vector<int> diff_counts(diff_buffers_.size(), 0);
+  for (int blob_id = 0; blob_id < blobs_.size(); ++blob_id) {
+    const int count = blobs_[blob_id]->count();
+    const int buffer = blob_activation_buffers_[blob_id];
+    if (buffer >= 0) {
+      counts[buffer] = std::max(counts[buffer], count);
+    }
+    const int diff_buffer = blob_diff_buffers_[blob_id];
+    if (diff_buffer >= 0) {
+      diff_counts[diff_buffer] = std::max(diff_counts[diff_buffer], count);
+    }
+  }
+  for (int i = 0; i < activation_buffers_.size(); ++i) {
+    const SyncedMemory* memory = activation_buffers_[i]->count() ?
+        activation_buffers_[i]->data().get() : NULL;
+    activation_buffers_[i]->Reshape(counts[i], 1, 1, 1);
+    // A reallocated buffer no longer holds the segment it held.
+    if (memory && activation_buffers_[i]->data().get() != memory
+        && i < buffer_segments_.size()) {
+      buffer_segments_[i] = -1;
+    }
+  }
+  for (int i = 0; i < diff_buffers_.size(); ++i) {
+    diff_buffers_[i]->Reshape(diff_counts[i], 1, 1, 1);
+  }
+  for (int blob_id = 0; blob_id < blobs_.size(); ++blob_id) {
+    Blob<Dtype>* blob = blobs_[blob_id].get();
+    const int buffer = blob_activation_buffers_[blob_id];
+    if (buffer >= 0
+        && blob->data()->parent() != activation_buffers_[buffer]->data()) {
+      // Forward-only nets need no diffs of their own either.
+      if (share_activations_) {
+        blob->ViewOf(*activation_buffers_[buffer], 0);
+      } else {
+        blob->ViewDataOf(*activation_buffers_[buffer], 0);
+      }
+    }
+    const int diff_buffer = blob_diff_buffers_[blob_id];
+    if (diff_buffer >= 0
+        && blob->diff()->parent() != diff_buffers_[diff_buffer]->diff()) {
+      blob->ViewDiffOf(*diff_buffers_[diff_buffer], 0);
+    }
+  }
+}
+
+template <typename Dtype>
+bool Net<Dtype>::LeftBuffers(const int layer_id) const {
+  for (int top_id = 0; top_id < top_id_vecs_[layer_id].size(); ++top_id) {
+    const int blob_id = top_id_vecs_[layer_id][top_id];
+    const Blob<Dtype>* blob = blobs_[blob_id].get();
+    const int buffer = blob_activation_buffers_[blob_id];
+    if (buffer >= 0
+        && blob->data()->parent() != activation_buffers_[buffer]->data()) {
+      return true;
+    }
+    const int diff_buffer = blob_diff_buffers_[blob_id];
+    if (diff_buffer >= 0
+        && blob->diff()->parent() != diff_buffers_[diff_buffer]->diff()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+template <typename Dtype>
+void Net<Dtype>::Recompute(const int segment) {
+  const uint64_t philox_position = Caffe::philox_position();
+  const vector<int>& layer_ids = segment_layers_[segment];
+  for (int i = 0; i < layer_ids.size(); ++i) {
+    const int layer_id = layer_ids[i];
+    // Draw the same random numbers as the first time.
+    Caffe::set_philox_position(layer_philox_positions_[layer_id]);
+    layers_[layer_id]->Forward(bottom_vecs_[layer_id], top_vecs_[layer_id]);
+    WroteSegment(layer_id);
+  }
+  Caffe::set_philox_position(philox_position);
+}
+
+template <typename Dtype>
+void Net<Dtype>::RecomputeDropped(const int layer_id) {
+  vector<int> blob_ids(bottom_id_vecs_[layer_id]);
+  blob_ids.insert(blob_ids.end(), top_id_vecs_[layer_id].begin(),
+      top_id_vecs_[layer_id].end());
+  for (int i = 0; i < blob_ids.size(); ++i) {
+    const int segment = blob_segments_[blob_ids[i]];
+    if (segment < 0) { continue; }
+    for (int buffer = 0; buffer < segment_sizes_[segment]; ++buffer) {
+      if (buffer_segments_[buffer] != segment) {
+        Recompute(segment);
+        break;
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void Net<Dtype>::WroteSegment(const int layer_id) {
+  for (int top_id = 0; top_id < top_id_vecs_[layer_id].size(); ++top_id) {
+    const int blob_id = top_id_vecs_[layer_id][top_id];
+    const int buffer = blob_activation_buffers_[blob_id];
+    if (buffer >= 0) {
+      buffer_segments_[buffer] = blob_segments_[blob_id];
+    }
+  }
+}
+
 template <typename Dtype>
 void Net<Dtype>::FilterNet(const NetParameter& param,
     NetParameter* param_filtered) {
   NetState net_state(param.state());
-  // Let the phase of the net be the current global phase provided in the Caffe
-  // singleton, unless explicitly provided by the state.
+  // Let the phase of the net be the current phase of the Caffe instance of
+  // the thread, unless explicitly provided by the state.
   if (!net_state.has_phase()) {
     switch (Caffe::phase()) {
       case Caffe::TRAIN:
@@ -329,6 +859,183 @@ bool Net<Dtype>::StateMeetsRule(const NetState& state,
   return true;
 }
 
+// Fold a BN layer's per-channel scale and shift into the weights and bias of
+// the layer feeding it: each output channel's filter and bias are scaled by
+// the channel's scale, and the shift is added to the bias.
+template <typename Dtype>
+static void FoldScaleShift(const int num_output, const int weight_dim,
+    const Dtype* scale, const Dtype* shift, Dtype* weight, Dtype* bias) {
+  for (int o = 0; o < num_output; ++o) {
+    for (int i = 0; i < weight_dim; ++i) {
+      weight[o * weight_dim + i] *= scale[o];
+    }
+    bias[o] = bias[o] * scale[o] + shift[o];
+  }
+}
+
+// Whether a layer after layer_id reads blob_name before it is written again.
+static bool ReadAfter(const NetParameter& param, const int layer_id,
+    const string& blob_name) {
+  for (int j = layer_id + 1; j < param.layers_size(); ++j) {
+    const LayerParameter& later = param.layers(j);
+    for (int k = 0; k < later.bottom_size(); ++k) {
+      if (later.bottom(k) == blob_name) {
+        return true;
+      }
+    }
+    if (std::find(later.top().begin(), later.top().end(), blob_name)
+        != later.top().end()) {
+      return false;
+    }
+  }
+  return false;
+}
+
+template <typename Dtype>
+void Net<Dtype>::FoldBatchNorm(const NetParameter& param,
+    NetParameter* param_folded, map<string, string>* folded_layers) {
+  param_folded->CopyFrom(param);
+  param_folded->clear_layers();
+  // The index in param_folded of the layer that last wrote each blob, and
+  // how many layers have read it since.
+  map<string, int> producer;
+  map<string, int> readers;
+  for (int i = 0; i < param.layers_size(); ++i) {
+    const LayerParameter& layer_param = param.layers(i);
+    bool fold = layer_param.type() == LayerParameter_LayerType_BN &&
+        layer_param.bn_param().bn_mode() == BNParameter_BNMode_INFERENCE &&
+        layer_param.bottom_size() == 1 && layer_param.top_size() == 1 &&
+        producer.count(layer_param.bottom(0)) &&
+        readers[layer_param.bottom(0)] == 0;
+    LayerParameter* source = NULL;
+    if (fold) {
+      source = param_folded->mutable_layers(producer[layer_param.bottom(0)]);
+      fold = (source->type() == LayerParameter_LayerType_CONVOLUTION ||
+          source->type() == LayerParameter_LayerType_INNER_PRODUCT) &&
+          source->top_size() == 1 && source->param_size() == 0;
+    }
+    // Unless BN runs in place, nothing after it may read its input.
+    const string bottom_name = fold ? layer_param.bottom(0) : "";
+    if (fold && layer_param.top(0) != bottom_name) {
+      fold = !ReadAfter(param, i, bottom_name);
+    }
+    if (!fold) {
+      for (int j = 0; j < layer_param.bottom_size(); ++j) {
+        ++readers[layer_param.bottom(j)];
+      }
+      for (int j = 0; j < layer_param.top_size(); ++j) {
+        producer[layer_param.top(j)] = param_folded->layers_size();
+        readers[layer_param.top(j)] = 0;
+      }
+      param_folded->add_layers()->CopyFrom(layer_param);
+      continue;
+    }
+    LOG(INFO) << "Folding layer " << layer_param.name() << " into "
+        << source->name();
+    source->set_top(0, layer_param.top(0));
+    producer[layer_param.top(0)] = producer[bottom_name];
+    readers[layer_param.top(0)] = 0;
+    if (source->type() == LayerParameter_LayerType_CONVOLUTION) {
+      source->mutable_convolution_param()->set_bias_term(true);
+    } else {
+      source->mutable_inner_product_param()->set_bias_term(true);
+    }
+    if (source->blobs_lr_size() == 1) {
+      source->add_blobs_lr(source->blobs_lr(0));
+    }
+    if (source->weight_decay_size() == 1) {
+      source->add_weight_decay(source->weight_decay(0));
+    }
+    if (folded_layers) {
+      (*folded_layers)[layer_param.name()] = source->name();
+    }
+    // Fold the weights too if they are part of the net parameter, which
+    // needs the weights of both layers.
+    CHECK_EQ(source->blobs_size() > 0, layer_param.blobs_size() > 0)
+        << "Folding BN layer " << layer_param.name() << " requires the "
+        << "weights of both it and layer " << source->name();
+    if (source->blobs_size() > 0) {
+      CHECK_EQ(layer_param.blobs_size(), 2)
+          << "Incompatible number of blobs for layer " << layer_param.name();
+      const int num_output = layer_param.blobs(0).data_size();
+      CHECK_EQ(layer_param.blobs(1).data_size(), num_output);
+      CHECK_EQ(source->blobs(0).data_size() % num_output, 0)
+          << "BN layer " << layer_param.name() << " does not match layer "
+          << source->name();
+      if (source->blobs_size() == 1) {
+        BlobProto* bias = source->add_blobs();
+        bias->set_num(1);
+        bias->set_channels(1);
+        bias->set_height(1);
+        bias->set_width(num_output);
+        for (int j = 0; j < num_output; ++j) {
+          bias->add_data(0);
+        }
+      }
+      CHECK_EQ(source->blobs(1).data_size(), num_output);
+      FoldScaleShift(num_output, source->blobs(0).data_size() / num_output,
+          layer_param.blobs(0).data().data(),
+          layer_param.blobs(1).data().data(),
+          source->mutable_blobs(0)->mutable_data()->mutable_data(),
+          source->mutable_blobs(1)->mutable_data()->mutable_data());
+    }
+  }
+}
+
+template <typename Dtype>
+void Net<Dtype>::FuseReLU(const NetParameter& param,
+    NetParameter* param_fused, map<string, string>* fused_layers) {
+  param_fused->CopyFrom(param);
+  param_fused->clear_layers();
+  // The index in param_fused of the layer that last wrote each blob, and
+  // how many layers have read it since.
+  map<string, int> producer;
+  map<string, int> readers;
+  for (int i = 0; i < param.layers_size(); ++i) {
+    const LayerParameter& layer_param = param.layers(i);
+    bool fuse = layer_param.type() == LayerParameter_LayerType_RELU &&
+        layer_param.bottom_size() == 1 && layer_param.top_size() == 1 &&
+        layer_param.loss_weight_size() == 0 &&
+        producer.count(layer_param.bottom(0)) &&
+        readers[layer_param.bottom(0)] == 0;
+    LayerParameter* source = NULL;
+    if (fuse) {
+      source = param_fused->mutable_layers(producer[layer_param.bottom(0)]);
+      fuse = (source->type() == LayerParameter_LayerType_CONVOLUTION ||
+          source->type() == LayerParameter_LayerType_INNER_PRODUCT ||
+          (source->type() == LayerParameter_LayerType_ELTWISE &&
+           source->eltwise_param().operation() !=
+           EltwiseParameter_EltwiseOp_PROD)) &&
+          source->top_size() == 1 && !source->has_fused_relu_param();
+    }
+    // Unless the ReLU runs in place, nothing after it may read its input.
+    const string bottom_name = fuse ? layer_param.bottom(0) : "";
+    if (fuse && layer_param.top(0) != bottom_name) {
+      fuse = !ReadAfter(param, i, bottom_name);
+    }
+    if (!fuse) {
+      for (int j = 0; j < layer_param.bottom_size(); ++j) {
+        ++readers[layer_param.bottom(j)];
+      }
+      for (int j = 0; j < layer_param.top_size(); ++j) {
+        producer[layer_param.top(j)] = param_fused->layers_size();
+        readers[layer_param.top(j)] = 0;
+      }
+      param_fused->add_layers()->CopyFrom(layer_param);
+      continue;
+    }
+    LOG(INFO) << "Fusing layer " << layer_param.name() << " into "
+        << source->name();
+    source->set_top(0, layer_param.top(0));
+    producer[layer_param.top(0)] = producer[bottom_name];
+    readers[layer_param.top(0)] = 0;
+    source->mutable_fused_relu_param()->CopyFrom(layer_param.relu_param());
+    if (fused_layers) {
+      (*fused_layers)[layer_param.name()] = source->name();
+    }
+  }
+}
+
 // Helper for Net::Init: add a new input or top blob to the net.  (Inputs have
 // layer_id == -1, tops have layer_id >= 0.)
 template <typename Dtype>
@@ -499,21 +1206,254 @@ void Net<Dtype>::GetLearningRateAndWeightDecay() {
   }
 }
 
+template <typename Dtype>
+Dtype Net<Dtype>::ForwardLayer(const int layer_id) {
+  // LOG(ERROR) << "Forwarding " << layer_names_[layer_id];
+  if (ShapeChanged(layer_id)) {
+    layers_[layer_id]->Reshape(bottom_vecs_[layer_id], top_vecs_[layer_id]);
+    ReshapedLayer(layer_id);
+    // A top that outgrew its view got memory of its own: grow the buffers
+    // instead, before the layer writes it.
+    if (LeftBuffers(layer_id)) { ShareBuffers(); }
+  }
+  if (segment_layers_.size()) {
+    layer_philox_positions_[layer_id] = Caffe::philox_position();
+  }
+  const Dtype layer_loss =
+      layers_[layer_id]->Forward(bottom_vecs_[layer_id], top_vecs_[layer_id]);
+  if (segment_layers_.size()) { WroteSegment(layer_id); }
+  if (debug_info_) { ForwardDebugInfo(layer_id); }
+  return layer_loss;
+}
+
+template <typename Dtype>
+void Net<Dtype>::PlanFrozenPrefix() {
+  // The layers that learn, or share a parameter with a layer that learns.
+  vector<bool> layer_learns(layers_.size(), false);
+  for (int param_id = 0; param_id < params_.size(); ++param_id) {
+    const int owner = param_owners_[param_id] < 0 ?
+        param_id : param_owners_[param_id];
+    if (params_lr_[owner] > 0 || params_lr_[param_id] > 0) {
+      layer_learns[param_layer_indices_[param_id].first] = true;
+      layer_learns[param_layer_indices_[owner].first] = true;
+    }
+  }
+  num_frozen_layers_ = 0;
+  for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    bool frozen = bottom_vecs_[layer_id].empty() ||
+        (!layer_need_backward_[layer_id] && !layer_learns[layer_id] &&
+         !layers_[layer_id]->DrawsRandom());
+    for (int top_id = 0; top_id < top_id_vecs_[layer_id].size(); ++top_id) {
+      frozen &= layers_[layer_id]->loss(top_id) == 0;
+    }
+    if (!frozen) { break; }
+    num_frozen_layers_ = layer_id + 1;
+  }
+  frozen_inputs_.clear();
+  frozen_outputs_.clear();
+  vector<bool> computed(blobs_.size(), false);
+  vector<bool> input(blobs_.size(), false);
+  for (int layer_id = 0; layer_id < num_frozen_layers_; ++layer_id) {
+    if (bottom_vecs_[layer_id].empty()) { continue; }
+    for (int bottom_id = 0; bottom_id < bottom_id_vecs_[layer_id].size();
+         ++bottom_id) {
+      const int blob_id = bottom_id_vecs_[layer_id][bottom_id];
+      if (!computed[blob_id] && !input[blob_id]) {
+        input[blob_id] = true;
+        frozen_inputs_.push_back(blobs_[blob_id].get());
+      }
+    }
+    for (int top_id = 0; top_id < top_id_vecs_[layer_id].size(); ++top_id) {
+      computed[top_id_vecs_[layer_id][top_id]] = true;
+    }
+  }
+  vector<bool> output(blobs_.size(), false);
+  for (int layer_id = num_frozen_layers_; layer_id < layers_.size();
+       ++layer_id) {
+    for (int bottom_id = 0; bottom_id < bottom_id_vecs_[layer_id].size();
+         ++bottom_id) {
+      output[bottom_id_vecs_[layer_id][bottom_id]] = true;
+    }
+  }
+  for (int i = 0; i < net_output_blob_indices_.size(); ++i) {
+    output[net_output_blob_indices_[i]] = true;
+  }
+  for (int blob_id = 0; blob_id < blobs_.size(); ++blob_id) {
+    if (computed[blob_id] && output[blob_id]) {
+      frozen_outputs_.push_back(blobs_[blob_id].get());
+    }
+  }
+  // The outputs can be cached item by item if every item is computed from
+  // its own inputs alone: the frozen blobs keep the batch size, and no
+  // layer normalizes over the batch.
+  frozen_per_item_ = !frozen_inputs_.empty();
+  for (int i = 0; i < frozen_inputs_.size(); ++i) {
+    frozen_per_item_ &= frozen_inputs_[i]->num() == frozen_inputs_[0]->num();
+  }
+  for (int i = 0; i < frozen_outputs_.size() && frozen_per_item_; ++i) {
+    frozen_per_item_ &= frozen_outputs_[i]->num() == frozen_inputs_[0]->num();
+  }
+  for (int layer_id = 0; layer_id < num_frozen_layers_; ++layer_id) {
+    frozen_per_item_ &=
+        layers_[layer_id]->type() != LayerParameter_LayerType_BN;
+  }
+  frozen_params_hashed_ = false;
+}
+
+template <typename Dtype>
+void Net<Dtype>::set_feature_cache(shared_ptr<FeatureCache<Dtype> > cache) {
+  feature_cache_.reset();
+  frozen_params_hashed_ = false;
+  if (!cache) { return; }
+  CHECK(activation_buffers_.empty())
+      << "A feature cache cannot be combined with share_activations or "
+      << "recompute.";
+  if (frozen_outputs_.empty()) {
+    LOG(INFO) << "The net has no frozen layers to cache.";
+    return;
+  }
+  for (int layer_id = 0; layer_id < num_frozen_layers_; ++layer_id) {
+    const TransformationParameter& transform_param =
+        layers_[layer_id]->layer_param().transform_param();
+    if (transform_param.mirror() || transform_param.crop_size()) {
+      LOG(WARNING) << layer_names_[layer_id] << " mirrors or crops its data "
+          << "at random in training, so the feature cache will seldom hit.";
+    }
+    if (!frozen_per_item_ &&
+        layers_[layer_id]->layer_param().image_data_param().shuffle()) {
+      LOG(WARNING) << layer_names_[layer_id] << " shuffles its data, but "
+          << "the frozen layers mix the items of a batch, so the feature "
+          << "cache only hits batches that repeat whole.";
+    }
+  }
+  LOG(INFO) << "Caching the outputs of the first " << num_frozen_layers_
+      << " layers";
+  feature_cache_ = cache;
+}
+
+template <typename Dtype>
+Dtype Net<Dtype>::ForwardFrozen() {
+  Dtype loss = 0;
+  for (int i = 0; i < num_frozen_layers_; ++i) {
+    if (bottom_vecs_[i].empty()) { loss += ForwardLayer(i); }
+  }
+  // The weights are hashed on the first Forward, once they are loaded, with
+  // the parameters of the frozen layers, so that a cache kept across runs
+  // misses once they change. The data layers only make the inputs, which
+  // are hashed anyway.
+  if (!frozen_params_hashed_) {
+    uint64_t layers_hash = 0;
+    for (int i = 0; i < num_frozen_layers_; ++i) {
+      if (bottom_vecs_[i].empty()) { continue; }
+      LayerParameter layer_param(layers_[i]->layer_param());
+      layer_param.clear_blobs();
+      string serialized;
+      layer_param.SerializeToString(&serialized);
+      layers_hash = FeatureCache<Dtype>::HashString(serialized, layers_hash);
+    }
+    vector<Blob<Dtype>*> frozen_params;
+    for (int param_id = 0; param_id < params_.size(); ++param_id) {
+      if (param_layer_indices_[param_id].first < num_frozen_layers_) {
+        frozen_params.push_back(params_[param_id].get());
+      }
+    }
+    frozen_params_hash_ =
+        FeatureCache<Dtype>::Hash(frozen_params, layers_hash);
+    frozen_params_hashed_ = true;
+  }
+  // Items are looked up one by one, so that the data layers may shuffle.
+  const int num = frozen_per_item_ ? frozen_inputs_[0]->num() : 0;
+  bool per_item = num > 0;
+  for (int i = 0; i < frozen_inputs_.size() && per_item; ++i) {
+    per_item = frozen_inputs_[i]->num() == num;
+  }
+  vector<uint64_t> keys;
+  if (per_item) {
+    for (int n = 0; n < num; ++n) {
+      keys.push_back(FeatureCache<Dtype>::HashItem(frozen_inputs_, n,
+          frozen_params_hash_));
+    }
+    if (feature_cache_->GetItems(keys, frozen_outputs_)) { return loss; }
+  } else {
+    keys.push_back(
+        FeatureCache<Dtype>::Hash(frozen_inputs_, frozen_params_hash_));
+    if (feature_cache_->Get(keys[0], frozen_outputs_)) { return loss; }
+  }
+  for (int i = 0; i < num_frozen_layers_; ++i) {
+    if (!bottom_vecs_[i].empty()) { loss += ForwardLayer(i); }
+  }
+  if (per_item) {
+    feature_cache_->PutItems(keys, frozen_outputs_);
+  } else {
+    feature_cache_->Put(keys[0], frozen_outputs_);
+  }
+  return loss;
+}
+
 template <typename Dtype>
 Dtype Net<Dtype>::ForwardFromTo(int start, int end) {
   CHECK_GE(start, 0);
   CHECK_LT(end, layers_.size());
   Dtype loss = 0;
+  if (feature_cache_ && start == 0 && end + 1 >= num_frozen_layers_) {
+    loss += ForwardFrozen();
+    start = num_frozen_layers_;
+  }
+  if (RunsWaves()) {
+    vector<Dtype> losses(layers_.size(), Dtype(0));
+    vector<int> wave;
+    for (int w = 0; w < layer_waves_.size(); ++w) {
+      wave.clear();
+      for (int j = 0; j < layer_waves_[w].size(); ++j) {
+        const int i = layer_waves_[w][j];
+        if (i >= start && i <= end) { wave.push_back(i); }
+      }
+      RunWave(wave, &losses);
+    }
+    // Summed in layer order, as they are run one by one.
+    for (int i = start; i <= end; ++i) {
+      loss += losses[i];
+    }
+    return loss;
+  }
   for (int i = start; i <= end; ++i) {
-    // LOG(ERROR) << "Forwarding " << layer_names_[i];
-    layers_[i]->Reshape(bottom_vecs_[i], top_vecs_[i]);
-    Dtype layer_loss = layers_[i]->Forward(bottom_vecs_[i], top_vecs_[i]);
-    loss += layer_loss;
-    if (debug_info_) { ForwardDebugInfo(i); }
+    loss += ForwardLayer(i);
   }
   return loss;
 }
 
+template <typename Dtype>
+bool Net<Dtype>::ShapeChanged(const int layer_id) const {
+  const vector<uint64_t>& generations = layer_shape_generations_[layer_id];
+  const vector<Blob<Dtype>*>& bottom = bottom_vecs_[layer_id];
+  const vector<Blob<Dtype>*>& top = top_vecs_[layer_id];
+  if (generations.size() != bottom.size() + top.size()) { return true; }
+  for (int i = 0; i < bottom.size(); ++i) {
+    if (bottom[i]->shape_generation() != generations[i]) { return true; }
+  }
+  for (int i = 0; i < top.size(); ++i) {
+    if (top[i]->shape_generation() != generations[bottom.size() + i]) {
+      return true;
+    }
+  }
+  return false;
+}
+
+template <typename Dtype>
+void Net<Dtype>::ReshapedLayer(const int layer_id) {
+  vector<uint64_t>& generations = layer_shape_generations_[layer_id];
+  const vector<Blob<Dtype>*>& bottom = bottom_vecs_[layer_id];
+  const vector<Blob<Dtype>*>& top = top_vecs_[layer_id];
+  generations.clear();
+  ++layer_reshapes_[layer_id];
+  for (int i = 0; i < bottom.size(); ++i) {
+    generations.push_back(bottom[i]->shape_generation());
+  }
+  for (int i = 0; i < top.size(); ++i) {
+    generations.push_back(top[i]->shape_generation());
+  }
+}
+
 template <typename Dtype>
 Dtype Net<Dtype>::ForwardFrom(int start) {
   return ForwardFromTo(start, layers_.size() - 1);
@@ -569,13 +1509,151 @@ template <typename Dtype>
 void Net<Dtype>::BackwardFromTo(int start, int end) {
   CHECK_GE(end, 0);
   CHECK_LT(start, layers_.size());
+  CHECK(!share_activations_)
+      << "Cannot run Backward on a net with share_activations.";
+  if (RunsWaves()) {
+    vector<int> wave;
+    for (int w = layer_waves_.size() - 1; w >= 0; --w) {
+      wave.clear();
+      for (int j = 0; j < layer_waves_[w].size(); ++j) {
+        const int i = layer_waves_[w][j];
+        if (i >= end && i <= start) { wave.push_back(i); }
+      }
+      RunWave(wave, NULL);
+    }
+    return;
+  }
   for (int i = start; i >= end; --i) {
-    if (layer_need_backward_[i]) {
-      layers_[i]->Backward(
-          top_vecs_[i], bottom_need_backward_[i], bottom_vecs_[i]);
-      if (debug_info_) { BackwardDebugInfo(i); }
+    BackwardLayer(i);
+  }
+}
+
+template <typename Dtype>
+void Net<Dtype>::BackwardLayer(const int layer_id) {
+  if (!layer_need_backward_[layer_id]) { return; }
+  if (segment_layers_.size()) { RecomputeDropped(layer_id); }
+  layers_[layer_id]->Backward(top_vecs_[layer_id],
+      bottom_need_backward_[layer_id], bottom_vecs_[layer_id]);
+  if (debug_info_) { BackwardDebugInfo(layer_id); }
+}
+
+template <typename Dtype>
+void Net<Dtype>::PlanWaves() {
+  // The memory of each blob, the blobs sharing the memory of a bottom of the
+  // layer that produces them counting as that bottom.
+  vector<int> blob_memory(blobs_.size());
+  for (int i = 0; i < blobs_.size(); ++i) {
+    blob_memory[i] = i;
+  }
+  for (int i = 0; i < layers_.size(); ++i) {
+    for (int t = 0; t < top_id_vecs_[i].size(); ++t) {
+      for (int b = 0; b < bottom_id_vecs_[i].size(); ++b) {
+        if (layers_[i]->TopSharesBottom(t, b)) {
+          blob_memory[top_id_vecs_[i][t]] =
+              blob_memory[bottom_id_vecs_[i][b]];
+        }
+      }
+    }
+  }
+  // The parameters of each layer, by the id of their owner.
+  vector<vector<int> > layer_params(layers_.size());
+  for (int i = 0; i < params_.size(); ++i) {
+    layer_params[param_layer_indices_[i].first].push_back(
+        param_owners_[i] < 0 ? i : param_owners_[i]);
+  }
+  vector<int> last_writer(blobs_.size(), -1);
+  vector<vector<int> > readers(blobs_.size());
+  vector<int> last_param_user(params_.size(), -1);
+  int last_random = -1;
+  vector<int> layer_wave(layers_.size());
+  layer_waves_.clear();
+  for (int i = 0; i < layers_.size(); ++i) {
+    vector<int> after;
+    for (int b = 0; b < bottom_id_vecs_[i].size(); ++b) {
+      const int memory = blob_memory[bottom_id_vecs_[i][b]];
+      after.push_back(last_writer[memory]);
+    }
+    for (int t = 0; t < top_id_vecs_[i].size(); ++t) {
+      const int memory = blob_memory[top_id_vecs_[i][t]];
+      after.push_back(last_writer[memory]);
+      after.insert(after.end(), readers[memory].begin(),
+          readers[memory].end());
+    }
+    for (int p = 0; p < layer_params[i].size(); ++p) {
+      after.push_back(last_param_user[layer_params[i][p]]);
+      last_param_user[layer_params[i][p]] = i;
     }
+    if (layers_[i]->DrawsRandom()) {
+      after.push_back(last_random);
+      last_random = i;
+    }
+    layer_wave[i] = 0;
+    for (int j = 0; j < after.size(); ++j) {
+      if (after[j] >= 0 && after[j] != i) {
+        layer_wave[i] = std::max(layer_wave[i], layer_wave[after[j]] + 1);
+      }
+    }
+    for (int b = 0; b < bottom_id_vecs_[i].size(); ++b) {
+      readers[blob_memory[bottom_id_vecs_[i][b]]].push_back(i);
+    }
+    for (int t = 0; t < top_id_vecs_[i].size(); ++t) {
+      const int memory = blob_memory[top_id_vecs_[i][t]];
+      last_writer[memory] = i;
+      readers[memory].clear();
+    }
+    if (layer_wave[i] >= layer_waves_.size()) {
+      layer_waves_.resize(layer_wave[i] + 1);
+    }
+    layer_waves_[layer_wave[i]].push_back(i);
   }
+  LOG(INFO) << "Running " << layers_.size() << " layers in "
+      << layer_waves_.size() << " waves.";
+}
+
+template <typename Dtype>
+bool Net<Dtype>::RunsWaves() const {
+  return layer_waves_.size() && Caffe::mode() == Caffe::CPU && !debug_info_;
+}
+
+template <typename Dtype>
+void Net<Dtype>::RunWave(const vector<int>& wave, vector<Dtype>* losses) {
+  if (wave.empty()) { return; }
+  if (wave.size() == 1) {
+    if (losses) {
+      (*losses)[wave[0]] = ForwardLayer(wave[0]);
+    } else {
+      BackwardLayer(wave[0]);
+    }
+    return;
+  }
+  // The threads run the layers with the mode, phase and random numbers of
+  // this thread.
+  Caffe* const caffe = &Caffe::Get();
+#ifdef _OPENMP
+  // One thread per layer, each with its share of the threads for the loops
+  // of the layer.
+  const int max_threads = omp_get_max_threads();
+  const int wave_threads =
+      std::min(max_threads, static_cast<int>(wave.size()));
+  const int layer_threads = std::max(1, max_threads / wave_threads);
+  const int max_levels = omp_get_max_active_levels();
+  omp_set_max_active_levels(std::max(max_levels, 2));
+  #pragma omp parallel for num_threads(wave_threads) schedule(dynamic, 1)
+#endif
+  for (int j = 0; j < wave.size(); ++j) {
+#ifdef _OPENMP
+    omp_set_num_threads(layer_threads);
+#endif
+    Caffe::Borrow borrow(caffe);
+    if (losses) {
+      (*losses)[wave[j]] = ForwardLayer(wave[j]);
+    } else {
+      BackwardLayer(wave[j]);
+    }
+  }
+#ifdef _OPENMP
+  omp_set_max_active_levels(max_levels);
+#endif
 }
 
 template <typename Dtype>
@@ -638,6 +1716,8 @@ void Net<Dtype>::UpdateDebugInfo(const int param_id) {
 
 template <typename Dtype>
 void Net<Dtype>::ShareTrainedLayersWith(Net* other) {
+  CHECK(folded_bn_layers_.empty() && other->folded_bn_layers_.empty())
+      << "Cannot share weights with a net that folds BN layers.";
   int num_source_layers = other->layers().size();
   for (int i = 0; i < num_source_layers; ++i) {
     Layer<Dtype>* source_layer = other->layers()[i].get();
@@ -686,12 +1766,24 @@ template <typename Dtype>
 void Net<Dtype>::Reshape() {
   for (int i = 0; i < layers_.size(); ++i) {
     layers_[i]->Reshape(bottom_vecs_[i], top_vecs_[i]);
+    ReshapedLayer(i);
+  }
+  if (activation_buffers_.size() || diff_buffers_.size()) {
+    ShareBuffers();
   }
 }
 
 template <typename Dtype>
 void Net<Dtype>::CopyTrainedLayersFrom(const NetParameter& param) {
   int num_source_layers = param.layers_size();
+  // The layers that BN layers were folded into, and the source BN layers.
+  set<string> fold_targets;
+  for (map<string, string>::const_iterator it = folded_bn_layers_.begin();
+       it != folded_bn_layers_.end(); ++it) {
+    fold_targets.insert(it->second);
+  }
+  set<string> copied_layers;
+  vector<int> folded_sources;
   for (int i = 0; i < num_source_layers; ++i) {
     const LayerParameter& source_layer = param.layers(i);
     const string& source_layer_name = source_layer.name();
@@ -701,21 +1793,65 @@ void Net<Dtype>::CopyTrainedLayersFrom(const NetParameter& param) {
       ++target_layer_id;
     }
     if (target_layer_id == layer_names_.size()) {
-      DLOG(INFO) << "Ignoring source layer " << source_layer_name;
+      if (folded_bn_layers_.count(source_layer_name)) {
+        folded_sources.push_back(i);
+      } else {
+        DLOG(INFO) << "Ignoring source layer " << source_layer_name;
+      }
       continue;
     }
     DLOG(INFO) << "Copying source layer " << source_layer_name;
     vector<shared_ptr<Blob<Dtype> > >& target_blobs =
         layers_[target_layer_id]->blobs();
-    CHECK_EQ(target_blobs.size(), source_layer.blobs_size())
-        << "Incompatible number of blobs for layer " << source_layer_name;
-    for (int j = 0; j < target_blobs.size(); ++j) {
+    // A layer that BN was folded into may have gained a bias.
+    const bool bias_added = fold_targets.count(source_layer_name) &&
+        target_blobs.size() == source_layer.blobs_size() + 1;
+    if (!bias_added) {
+      CHECK_EQ(target_blobs.size(), source_layer.blobs_size())
+          << "Incompatible number of blobs for layer " << source_layer_name;
+    } else {
+      caffe_set(target_blobs[1]->count(), Dtype(0),
+          target_blobs[1]->mutable_cpu_data());
+    }
+    for (int j = 0; j < source_layer.blobs_size(); ++j) {
       CHECK_EQ(target_blobs[j]->num(), source_layer.blobs(j).num());
       CHECK_EQ(target_blobs[j]->channels(), source_layer.blobs(j).channels());
       CHECK_EQ(target_blobs[j]->height(), source_layer.blobs(j).height());
       CHECK_EQ(target_blobs[j]->width(), source_layer.blobs(j).width());
       target_blobs[j]->FromProto(source_layer.blobs(j));
     }
+    copied_layers.insert(source_layer_name);
+  }
+  // Fold the BN weights into the freshly copied weights of their targets.
+  set<string> folded_layers;
+  for (int i = 0; i < folded_sources.size(); ++i) {
+    const LayerParameter& source_layer = param.layers(folded_sources[i]);
+    const string& target_name = folded_bn_layers_[source_layer.name()];
+    folded_layers.insert(source_layer.name());
+    CHECK(copied_layers.count(target_name))
+        << "Folding BN layer " << source_layer.name() << " requires the "
+        << "weights of layer " << target_name << " from the same source.";
+    CHECK_EQ(source_layer.blobs_size(), 2)
+        << "Incompatible number of blobs for layer " << source_layer.name();
+    vector<shared_ptr<Blob<Dtype> > >& target_blobs =
+        layer_by_name(target_name)->blobs();
+    Blob<Dtype> scale, shift;
+    scale.FromProto(source_layer.blobs(0));
+    shift.FromProto(source_layer.blobs(1));
+    const int num_output = target_blobs[1]->count();
+    CHECK_EQ(scale.count(), num_output);
+    CHECK_EQ(shift.count(), num_output);
+    FoldScaleShift(num_output, target_blobs[0]->count() / num_output,
+        scale.cpu_data(), shift.cpu_data(),
+        target_blobs[0]->mutable_cpu_data(),
+        target_blobs[1]->mutable_cpu_data());
+  }
+  // Copying a target without its BN layer would leave it unnormalized.
+  for (map<string, string>::const_iterator it = folded_bn_layers_.begin();
+       it != folded_bn_layers_.end(); ++it) {
+    CHECK(!copied_layers.count(it->second) || folded_layers.count(it->first))
+        << "Copying layer " << it->second << " requires the weights of BN "
+        << "layer " << it->first << ", folded into it, from the same source.";
   }
 }
 
@@ -785,6 +1921,20 @@ void Net<Dtype>::Update() {
   }
 }
 
+template <typename Dtype>
+bool Net<Dtype>::HasInPlaceConsumer(const Blob<Dtype>* blob) const {
+  if (layers_.size() < bottom_vecs_.size()) { return true; }
+  for (int i = 0; i < layers_.size(); ++i) {
+    if (std::find(bottom_vecs_[i].begin(), bottom_vecs_[i].end(), blob)
+        != bottom_vecs_[i].end()
+        && std::find(top_vecs_[i].begin(), top_vecs_[i].end(), blob)
+        != top_vecs_[i].end()) {
+      return true;
+    }
+  }
+  return false;
+}
+
 template <typename Dtype>
 bool Net<Dtype>::has_blob(const string& blob_name) {
   return blob_names_index_.find(blob_name) != blob_names_index_.end();
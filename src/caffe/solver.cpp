@@ -80,6 +80,17 @@ void Solver<Dtype>::InitTrainNet() {
   net_state.MergeFrom(param_.train_state());
   net_param.mutable_state()->CopyFrom(net_state);
   net_.reset(new Net<Dtype>(net_param));
+  if (param_.cache_frozen_features()) {
+    shared_ptr<FeatureCache<Dtype> > cache;
+    if (param_.has_feature_cache_source()) {
+      cache.reset(new FeatureCache<Dtype>(param_.feature_cache_source(),
+          param_.feature_cache_backend()));
+    } else {
+      cache.reset(new FeatureCache<Dtype>(
+          static_cast<size_t>(param_.feature_cache_limit_mb()) << 20));
+    }
+    net_->set_feature_cache(cache);
+  }
 }
 
 template <typename Dtype>
@@ -298,6 +309,10 @@ void Solver<Dtype>::Test(const int test_net_id) {
   vector<int> test_score_output_id;
   vector<Blob<Dtype>*> bottom_vec;
   const shared_ptr<Net<Dtype> >& test_net = test_nets_[test_net_id];
+  // Metrics such as confusion matrices accumulate over this test pass only.
+  for (int i = 0; i < test_net->layers().size(); ++i) {
+    test_net->layers()[i]->ResetState();
+  }
   Dtype loss = 0;
   for (int i = 0; i < param_.test_iter(test_net_id); ++i) {
     Dtype iter_loss;
@@ -342,6 +357,9 @@ void Solver<Dtype>::Test(const int test_net_id) {
     LOG(INFO) << "    Test net output #" << i << ": " << output_name << " = "
         << mean_score << loss_msg_stream.str();
   }
+  for (int i = 0; i < test_net->layers().size(); ++i) {
+    test_net->layers()[i]->ReportState();
+  }
   Caffe::set_phase(Caffe::TRAIN);
 }
 
@@ -458,6 +476,10 @@ void SGDSolver<Dtype>::PreSolve() {
     temp_.push_back(shared_ptr<Blob<Dtype> >(new Blob<Dtype>(
         net_param->num(), net_param->channels(), net_param->height(),
         net_param->width())));
+    // Spread like the parameters they update.
+    history_.back()->set_host_policy(HOST_INTERLEAVE);
+    update_.back()->set_host_policy(HOST_INTERLEAVE);
+    temp_.back()->set_host_policy(HOST_INTERLEAVE);
   }
 }
 
@@ -1,4 +1,16 @@
+#include <boost/thread/mutex.hpp>
+#include <sys/mman.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#include <algorithm>
 #include <cstring>
+#include <fstream>  // NOLINT(readability/streams)
+#include <map>
+#include <string>
+#include <vector>
 
 #include "caffe/common.hpp"
 #include "caffe/syncedmem.hpp"
@@ -6,9 +18,320 @@
 
 namespace caffe {
 
+namespace {
+
+const size_t kHostAlignment = 64;
+const size_t kHugePageSize = 2 << 20;
+
+// The memory policy modes of mbind(2), which are not in the libc headers.
+const int kMpolPreferred = 1;
+const int kMpolBind = 2;
+const int kMpolInterleave = 3;
+const int kMaxNumaNodes = 1024;
+
+// The online NUMA nodes, or none if the machine does not report them.
+const vector<int>& NumaNodes() {
+  static vector<int>* nodes = NULL;
+  if (!nodes) {
+    std::ifstream file("/sys/devices/system/node/online");
+    string list;
+    std::getline(file, list);
+    nodes = new vector<int>(ParseIdList(list));
+  }
+  return *nodes;
+}
+
+// The policy an allocation actually follows: the placements only mean
+// something with several nodes, and pinning needs CUDA.
+HostMemoryPolicy EffectivePolicy(HostMemoryPolicy policy) {
+  if (policy == HOST_PINNED) {
+#ifndef CPU_ONLY
+    return HOST_PINNED;
+#else
+    policy = HOST_LOCAL;
+#endif
+  }
+  return NumaNodes().size() > 1 ? policy : HOST_DEFAULT;
+}
+
+// Sets the policy of fresh pages, before anything touches them.
+void BindPages(void* ptr, const size_t size, const HostMemoryPolicy policy,
+    const int node) {
+#if defined(__linux__) && defined(SYS_mbind)
+  const int kBits = 8 * sizeof(unsigned long);  // NOLINT(runtime/int)
+  unsigned long mask[kMaxNumaNodes / kBits];  // NOLINT(runtime/int)
+  memset(mask, 0, sizeof(mask));
+  int mode;
+  switch (policy) {
+  case HOST_BIND:
+    CHECK_GE(node, 0) << "HOST_BIND needs a node.";
+    CHECK_LT(node, kMaxNumaNodes);
+    mask[node / kBits] |= 1UL << (node % kBits);
+    mode = kMpolBind;
+    break;
+  case HOST_INTERLEAVE:
+    for (int i = 0; i < NumaNodes().size(); ++i) {
+      const int n = NumaNodes()[i];
+      if (n >= 0 && n < kMaxNumaNodes) {
+        mask[n / kBits] |= 1UL << (n % kBits);
+      }
+    }
+    mode = kMpolInterleave;
+    break;
+  default:
+    // Preferring no node places each page on the node of the thread that
+    // first touches it, whatever the policy of the process.
+    mode = kMpolPreferred;
+  }
+  if (syscall(SYS_mbind, ptr, size, mode, mask, kMaxNumaNodes + 1, 0) != 0) {
+    LOG_FIRST_N(WARNING, 1) << "mbind failed, host memory is placed by "
+        << "the default policy.";
+  }
+#endif
+}
+
+// The process-wide cache behind CaffeMallocHost. It is never destroyed, so
+// that blobs freed by static destructors can still return their blocks.
+class HostMemoryPool {
+ public:
+  HostMemoryPool()
+      : cache_limit_(static_cast<size_t>(1) << 30), huge_pages_(false) {
+    memset(&stats_, 0, sizeof(stats_));
+  }
+
+  static HostMemoryPool& Get() {
+    static HostMemoryPool* pool = new HostMemoryPool();
+    return *pool;
+  }
+
+  // The size class of size: a multiple of 64 up to 256 bytes, and above that
+  // a multiple of a quarter of the largest power of two below size, so that
+  // less than a fifth of the block goes unused.
+  static size_t SizeClass(const size_t size) {
+    if (size <= 4 * kHostAlignment) {
+      return std::max(kHostAlignment,
+          (size + kHostAlignment - 1) / kHostAlignment * kHostAlignment);
+    }
+    size_t power = 4 * kHostAlignment;
+    while (power <= (size - 1) / 2) {
+      power *= 2;
+    }
+    const size_t step = power / 4;
+    return (size + step - 1) / step * step;
+  }
+
+  void* Allocate(const size_t size, const HostMemoryPolicy policy,
+      const int node) {
+    if (policy != HOST_DEFAULT) {
+      return AllocatePlaced(size, policy, node);
+    }
+    const size_t class_size = SizeClass(size);
+    bool huge;
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      ++stats_.allocations;
+      stats_.live_bytes += class_size;
+      stats_.peak_bytes = std::max(stats_.peak_bytes, stats_.live_bytes);
+      std::vector<void*>& blocks = cache_[class_size];
+      if (!blocks.empty()) {
+        void* ptr = blocks.back();
+        blocks.pop_back();
+        stats_.cached_bytes -= class_size;
+        ++stats_.cache_hits;
+        return ptr;
+      }
+      huge = huge_pages_ && class_size >= kHugePageSize;
+    }
+    void* ptr = NULL;
+    if (posix_memalign(&ptr, huge ? kHugePageSize : kHostAlignment,
+        class_size) != 0) {
+      ptr = NULL;
+    }
+    if (!ptr) {
+      // Whatever the cache holds may be enough for the system to satisfy
+      // the request.
+      Release(0);
+      if (posix_memalign(&ptr, huge ? kHugePageSize : kHostAlignment,
+          class_size) != 0) {
+        ptr = NULL;
+      }
+    }
+    if (!ptr) {
+      boost::mutex::scoped_lock lock(mutex_);
+      stats_.live_bytes -= class_size;
+      return NULL;
+    }
+#ifdef MADV_HUGEPAGE
+    if (huge) {
+      madvise(ptr, class_size, MADV_HUGEPAGE);
+    }
+#endif
+    return ptr;
+  }
+
+  void Free(void* ptr, const size_t size, const HostMemoryPolicy policy) {
+    if (policy != HOST_DEFAULT) {
+      FreePlaced(ptr, size, policy);
+      return;
+    }
+    const size_t class_size = SizeClass(size);
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      stats_.live_bytes -= class_size;
+      if (stats_.cached_bytes + class_size <= cache_limit_) {
+        cache_[class_size].push_back(ptr);
+        stats_.cached_bytes += class_size;
+        return;
+      }
+    }
+    free(ptr);
+  }
+
+  // Frees cached blocks, largest first, until at most limit bytes remain.
+  void Release(const size_t limit) {
+    std::vector<void*> released;
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      for (std::map<size_t, std::vector<void*> >::reverse_iterator it =
+           cache_.rbegin(); it != cache_.rend(); ++it) {
+        while (stats_.cached_bytes > limit && !it->second.empty()) {
+          released.push_back(it->second.back());
+          it->second.pop_back();
+          stats_.cached_bytes -= it->first;
+        }
+      }
+    }
+    for (int i = 0; i < released.size(); ++i) {
+      free(released[i]);
+    }
+  }
+
+  Caffe::HostMemoryStats stats() {
+    boost::mutex::scoped_lock lock(mutex_);
+    return stats_;
+  }
+
+  void set_cache_limit(const size_t bytes) {
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      cache_limit_ = bytes;
+    }
+    Release(bytes);
+  }
+
+  void set_huge_pages(const bool huge_pages) {
+    boost::mutex::scoped_lock lock(mutex_);
+    huge_pages_ = huge_pages;
+  }
+
+ private:
+  static size_t PageSize(const size_t size) {
+    const size_t page = sysconf(_SC_PAGESIZE);
+    return std::max(page, (size + page - 1) / page * page);
+  }
+
+  // Placed memory bypasses the cache: fresh pages, so that the policy decides
+  // where they go when they are first touched.
+  void* AllocatePlaced(const size_t size, const HostMemoryPolicy policy,
+      const int node) {
+    const size_t length = PageSize(size);
+    void* ptr = NULL;
+    bool huge;
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      ++stats_.allocations;
+      stats_.live_bytes += length;
+      stats_.peak_bytes = std::max(stats_.peak_bytes, stats_.live_bytes);
+      huge = huge_pages_ && length >= kHugePageSize;
+    }
+    if (policy == HOST_PINNED) {
+#ifndef CPU_ONLY
+      if (cudaMallocHost(&ptr, length) != cudaSuccess) {
+        ptr = NULL;
+      }
+#endif
+    } else {
+      ptr = mmap(NULL, length, PROT_READ | PROT_WRITE,
+          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (ptr == MAP_FAILED) {
+        ptr = NULL;
+      } else {
+#ifdef MADV_HUGEPAGE
+        if (huge) {
+          madvise(ptr, length, MADV_HUGEPAGE);
+        }
+#endif
+        BindPages(ptr, length, policy, node);
+      }
+    }
+    if (!ptr) {
+      boost::mutex::scoped_lock lock(mutex_);
+      stats_.live_bytes -= length;
+    }
+    return ptr;
+  }
+
+  void FreePlaced(void* ptr, const size_t size,
+      const HostMemoryPolicy policy) {
+    const size_t length = PageSize(size);
+    if (policy == HOST_PINNED) {
+#ifndef CPU_ONLY
+      CUDA_CHECK(cudaFreeHost(ptr));
+#endif
+    } else {
+      munmap(ptr, length);
+    }
+    boost::mutex::scoped_lock lock(mutex_);
+    stats_.live_bytes -= length;
+  }
+
+  boost::mutex mutex_;
+  std::map<size_t, std::vector<void*> > cache_;
+  Caffe::HostMemoryStats stats_;
+  size_t cache_limit_;
+  bool huge_pages_;
+};
+
+}  // namespace
+
+void CaffeMallocHost(void** ptr, size_t size, HostMemoryPolicy policy,
+    int node) {
+  *ptr = HostMemoryPool::Get().Allocate(size, EffectivePolicy(policy), node);
+  CHECK(*ptr) << "host allocation of size " << size << " failed";
+}
+
+void CaffeFreeHost(void* ptr, size_t size, HostMemoryPolicy policy) {
+  HostMemoryPool::Get().Free(ptr, size, EffectivePolicy(policy));
+}
+
+Caffe::HostMemoryStats Caffe::host_memory_stats() {
+  return HostMemoryPool::Get().stats();
+}
+
+void Caffe::set_host_memory_cache_limit(const size_t bytes) {
+  HostMemoryPool::Get().set_cache_limit(bytes);
+}
+
+void Caffe::set_host_huge_pages(const bool huge_pages) {
+  HostMemoryPool::Get().set_huge_pages(huge_pages);
+}
+
+void Caffe::ReleaseHostMemoryCache() {
+  HostMemoryPool::Get().Release(0);
+}
+
+SyncedMemory::SyncedMemory(const shared_ptr<SyncedMemory>& parent,
+    size_t offset, size_t size)
+    : cpu_ptr_(NULL), gpu_ptr_(NULL), size_(size), head_(UNINITIALIZED),
+      own_cpu_data_(false), parent_(parent), offset_(offset),
+      host_policy_(HOST_DEFAULT), host_node_(-1) {
+  CHECK(parent_);
+  CHECK_LE(offset_ + size_, parent_->size()) << "View out of range.";
+}
+
 SyncedMemory::~SyncedMemory() {
   if (cpu_ptr_ && own_cpu_data_) {
-    CaffeFreeHost(cpu_ptr_);
+    CaffeFreeHost(cpu_ptr_, size_, host_policy_);
   }
 
 #ifndef CPU_ONLY
@@ -21,7 +344,7 @@ SyncedMemory::~SyncedMemory() {
 inline void SyncedMemory::to_cpu() {
   switch (head_) {
   case UNINITIALIZED:
-    CaffeMallocHost(&cpu_ptr_, size_);
+    CaffeMallocHost(&cpu_ptr_, size_, host_policy_, host_node_);
     caffe_memset(size_, 0, cpu_ptr_);
     head_ = HEAD_AT_CPU;
     own_cpu_data_ = true;
@@ -29,7 +352,7 @@ inline void SyncedMemory::to_cpu() {
   case HEAD_AT_GPU:
 #ifndef CPU_ONLY
     if (cpu_ptr_ == NULL) {
-      CaffeMallocHost(&cpu_ptr_, size_);
+      CaffeMallocHost(&cpu_ptr_, size_, host_policy_, host_node_);
       own_cpu_data_ = true;
     }
     caffe_gpu_memcpy(size_, gpu_ptr_, cpu_ptr_);
@@ -69,22 +392,45 @@ inline void SyncedMemory::to_gpu() {
 }
 
 const void* SyncedMemory::cpu_data() {
+  if (parent_) {
+    return static_cast<const char*>(parent_->cpu_data()) + offset_;
+  }
   to_cpu();
   return (const void*)cpu_ptr_;
 }
 
 void SyncedMemory::set_cpu_data(void* data) {
   CHECK(data);
+  CHECK(!parent_) << "Cannot set the data of a view.";
   if (own_cpu_data_) {
-    CaffeFreeHost(cpu_ptr_);
+    CaffeFreeHost(cpu_ptr_, size_, host_policy_);
   }
   cpu_ptr_ = data;
   head_ = HEAD_AT_CPU;
   own_cpu_data_ = false;
 }
 
+void SyncedMemory::set_host_policy(HostMemoryPolicy policy, int node) {
+  CHECK(!parent_) << "Cannot place the memory of a view.";
+  if (policy == host_policy_ && node == host_node_) {
+    return;
+  }
+  if (cpu_ptr_ && own_cpu_data_) {
+    void* cpu_ptr;
+    CaffeMallocHost(&cpu_ptr, size_, policy, node);
+    memcpy(cpu_ptr, cpu_ptr_, size_);
+    CaffeFreeHost(cpu_ptr_, size_, host_policy_);
+    cpu_ptr_ = cpu_ptr;
+  }
+  host_policy_ = policy;
+  host_node_ = node;
+}
+
 const void* SyncedMemory::gpu_data() {
 #ifndef CPU_ONLY
+  if (parent_) {
+    return static_cast<const char*>(parent_->gpu_data()) + offset_;
+  }
   to_gpu();
   return (const void*)gpu_ptr_;
 #else
@@ -93,6 +439,9 @@ const void* SyncedMemory::gpu_data() {
 }
 
 void* SyncedMemory::mutable_cpu_data() {
+  if (parent_) {
+    return static_cast<char*>(parent_->mutable_cpu_data()) + offset_;
+  }
   to_cpu();
   head_ = HEAD_AT_CPU;
   return cpu_ptr_;
@@ -100,6 +449,9 @@ void* SyncedMemory::mutable_cpu_data() {
 
 void* SyncedMemory::mutable_gpu_data() {
 #ifndef CPU_ONLY
+  if (parent_) {
+    return static_cast<char*>(parent_->mutable_gpu_data()) + offset_;
+  }
   to_gpu();
   head_ = HEAD_AT_GPU;
   return gpu_ptr_;
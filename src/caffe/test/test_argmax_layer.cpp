@@ -165,5 +165,50 @@ TYPED_TEST(ArgMaxLayerTest, TestCPUMaxValTopK) {
   }
 }
 
+TYPED_TEST(ArgMaxLayerTest, TestCPUAxisTopK) {
+  // Per-pixel argmax over the channels, with more pixels than one tile.
+  this->blob_bottom_->Reshape(2, 20, 17, 19);
+  FillerParameter filler_param;
+  GaussianFiller<TypeParam> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  for (int t = 0; t < 2; ++t) {
+    const int top_k = t == 0 ? 1 : this->top_k_;
+    LayerParameter layer_param;
+    ArgMaxParameter* argmax_param = layer_param.mutable_argmax_param();
+    argmax_param->set_axis(1);
+    argmax_param->set_top_k(top_k);
+    ArgMaxLayer<TypeParam> layer(layer_param);
+    layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    EXPECT_EQ(this->blob_top_->num(), 2);
+    EXPECT_EQ(this->blob_top_->channels(), top_k);
+    EXPECT_EQ(this->blob_top_->height(), 17);
+    EXPECT_EQ(this->blob_top_->width(), 19);
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    Blob<TypeParam> top_val;
+    vector<Blob<TypeParam>*> top_val_vec(1, &top_val);
+    argmax_param->set_out_max_val(true);
+    ArgMaxLayer<TypeParam> val_layer(layer_param);
+    val_layer.SetUp(this->blob_bottom_vec_, top_val_vec);
+    val_layer.Forward(this->blob_bottom_vec_, top_val_vec);
+    for (int n = 0; n < 2; ++n) {
+      for (int h = 0; h < 17; ++h) {
+        for (int w = 0; w < 19; ++w) {
+          for (int j = 0; j < top_k; ++j) {
+            const int max_ind = this->blob_top_->data_at(n, j, h, w);
+            const TypeParam max_val = top_val.data_at(n, j, h, w);
+            EXPECT_EQ(this->blob_bottom_->data_at(n, max_ind, h, w), max_val);
+            int count = 0;
+            for (int c = 0; c < 20; ++c) {
+              if (this->blob_bottom_->data_at(n, c, h, w) > max_val) {
+                ++count;
+              }
+            }
+            EXPECT_EQ(j, count);
+          }
+        }
+      }
+    }
+  }
+}
 
 }  // namespace caffe
@@ -54,4 +54,47 @@ TYPED_TEST(BlobSimpleTest, TestReshape) {
   EXPECT_EQ(this->blob_->count(), 120);
 }
 
+TYPED_TEST(BlobSimpleTest, TestShapeGeneration) {
+  this->blob_->Reshape(2, 3, 4, 5);
+  const uint64_t generation = this->blob_->shape_generation();
+  this->blob_->Reshape(2, 3, 4, 5);
+  EXPECT_EQ(generation, this->blob_->shape_generation());
+  // The same count in another shape is still a change.
+  this->blob_->Reshape(2, 3, 5, 4);
+  EXPECT_GT(this->blob_->shape_generation(), generation);
+}
+
+TYPED_TEST(BlobSimpleTest, TestHostPolicy) {
+  this->blob_->Reshape(2, 3, 4, 5);
+  this->blob_->set_host_policy(HOST_LOCAL);
+  EXPECT_EQ(HOST_LOCAL, this->blob_->data()->host_policy());
+  // Reallocated memory keeps the policy.
+  this->blob_->Reshape(2, 3, 40, 50);
+  EXPECT_EQ(HOST_LOCAL, this->blob_->data()->host_policy());
+  EXPECT_EQ(HOST_LOCAL, this->blob_->diff()->host_policy());
+}
+
+TYPED_TEST(BlobSimpleTest, TestViewOf) {
+  Caffe::set_mode(Caffe::CPU);
+  this->blob_->Reshape(1, 3, 4, 5);
+  const int offset = this->blob_preshaped_->offset(1);
+  this->blob_->ViewOf(*this->blob_preshaped_, offset);
+  EXPECT_TRUE(this->blob_->is_view());
+  EXPECT_TRUE(this->blob_->IsViewOf(*this->blob_preshaped_, offset));
+  EXPECT_FALSE(this->blob_->IsViewOf(*this->blob_preshaped_, 0));
+  EXPECT_EQ(this->blob_->cpu_data(),
+      this->blob_preshaped_->cpu_data() + offset);
+  EXPECT_EQ(this->blob_->cpu_diff(),
+      this->blob_preshaped_->cpu_diff() + offset);
+  // Writes to the view are writes to the slice.
+  this->blob_->mutable_cpu_data()[0] = 7;
+  EXPECT_EQ(this->blob_preshaped_->data_at(1, 0, 0, 0), 7);
+  // Ending the view keeps the data but not the aliasing.
+  this->blob_->EndView();
+  EXPECT_FALSE(this->blob_->is_view());
+  EXPECT_EQ(this->blob_->data_at(0, 0, 0, 0), 7);
+  this->blob_->mutable_cpu_data()[0] = 8;
+  EXPECT_EQ(this->blob_preshaped_->data_at(1, 0, 0, 0), 7);
+}
+
 }  // namespace caffe
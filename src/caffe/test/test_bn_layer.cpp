@@ -0,0 +1,150 @@
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/common_layers.hpp"
+#include "caffe/filler.hpp"
+#include "gtest/gtest.h"
+
+#include "caffe/test/test_caffe_main.hpp"
+#include "caffe/test/test_gradient_check_util.hpp"
+
+namespace caffe {
+
+template <typename TypeParam>
+class BNLayerTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+ protected:
+  BNLayerTest()
+      : blob_bottom_(new Blob<Dtype>(2, 3, 4, 5)),
+        blob_top_(new Blob<Dtype>()),
+        blob_top_mean_(new Blob<Dtype>()),
+        blob_top_variance_(new Blob<Dtype>()) {
+    // fill the values, away from zero to exercise the variance computation
+    FillerParameter filler_param;
+    filler_param.set_mean(10);
+    filler_param.set_std(2);
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(this->blob_bottom_);
+    blob_bottom_vec_.push_back(blob_bottom_);
+    blob_top_vec_.push_back(blob_top_);
+  }
+  virtual ~BNLayerTest() {
+    delete blob_bottom_;
+    delete blob_top_;
+    delete blob_top_mean_;
+    delete blob_top_variance_;
+  }
+  Blob<Dtype>* const blob_bottom_;
+  Blob<Dtype>* const blob_top_;
+  Blob<Dtype>* const blob_top_mean_;
+  Blob<Dtype>* const blob_top_variance_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+};
+
+TYPED_TEST_CASE(BNLayerTest, TestDtypesAndDevices);
+
+TYPED_TEST(BNLayerTest, TestForwardLearn) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  BNParameter* bn_param = layer_param.mutable_bn_param();
+  bn_param->mutable_scale_filler()->set_value(2);
+  bn_param->mutable_shift_filler()->set_value(-1);
+  this->blob_top_vec_.push_back(this->blob_top_mean_);
+  this->blob_top_vec_.push_back(this->blob_top_variance_);
+  BNLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  const int num = this->blob_bottom_->num();
+  const int channels = this->blob_bottom_->channels();
+  const int height = this->blob_bottom_->height();
+  const int width = this->blob_bottom_->width();
+  const int count = num * height * width;
+  for (int j = 0; j < channels; ++j) {
+    double mean = 0, variance = 0, top_mean = 0, top_variance = 0;
+    for (int i = 0; i < num; ++i) {
+      for (int k = 0; k < height; ++k) {
+        for (int l = 0; l < width; ++l) {
+          mean += this->blob_bottom_->data_at(i, j, k, l);
+          top_mean += this->blob_top_->data_at(i, j, k, l);
+        }
+      }
+    }
+    mean /= count;
+    top_mean /= count;
+    for (int i = 0; i < num; ++i) {
+      for (int k = 0; k < height; ++k) {
+        for (int l = 0; l < width; ++l) {
+          const double x = this->blob_bottom_->data_at(i, j, k, l) - mean;
+          const double y = this->blob_top_->data_at(i, j, k, l) - top_mean;
+          variance += x * x;
+          top_variance += y * y;
+        }
+      }
+    }
+    variance /= count;
+    top_variance /= count;
+    const Dtype kErrorBound = 0.001;
+    EXPECT_NEAR(mean, this->blob_top_mean_->cpu_data()[j], kErrorBound);
+    EXPECT_NEAR(variance, this->blob_top_variance_->cpu_data()[j],
+        kErrorBound);
+    // normalized, then scaled by 2 and shifted by -1
+    EXPECT_NEAR(-1, top_mean, kErrorBound);
+    EXPECT_NEAR(4, top_variance, kErrorBound);
+  }
+}
+
+TYPED_TEST(BNLayerTest, TestForwardInference) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  BNParameter* bn_param = layer_param.mutable_bn_param();
+  bn_param->set_bn_mode(BNParameter_BNMode_INFERENCE);
+  bn_param->mutable_scale_filler()->set_type("gaussian");
+  bn_param->mutable_shift_filler()->set_type("gaussian");
+  BNLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  const Dtype* scale = layer.blobs()[0]->cpu_data();
+  const Dtype* shift = layer.blobs()[1]->cpu_data();
+  for (int i = 0; i < this->blob_bottom_->num(); ++i) {
+    for (int j = 0; j < this->blob_bottom_->channels(); ++j) {
+      for (int k = 0; k < this->blob_bottom_->height(); ++k) {
+        for (int l = 0; l < this->blob_bottom_->width(); ++l) {
+          EXPECT_NEAR(this->blob_top_->data_at(i, j, k, l),
+              this->blob_bottom_->data_at(i, j, k, l) * scale[j] + shift[j],
+              1e-4);
+        }
+      }
+    }
+  }
+}
+
+TYPED_TEST(BNLayerTest, TestGradientLearn) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  BNParameter* bn_param = layer_param.mutable_bn_param();
+  bn_param->mutable_scale_filler()->set_type("gaussian");
+  bn_param->mutable_shift_filler()->set_type("gaussian");
+  BNLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_);
+}
+
+TYPED_TEST(BNLayerTest, TestGradientInference) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  BNParameter* bn_param = layer_param.mutable_bn_param();
+  bn_param->set_bn_mode(BNParameter_BNMode_INFERENCE);
+  bn_param->mutable_scale_filler()->set_type("gaussian");
+  bn_param->mutable_shift_filler()->set_type("gaussian");
+  BNLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_);
+}
+
+}  // namespace caffe
@@ -1,3 +1,4 @@
+#include <boost/thread.hpp>
 #include <cstring>
 
 #include "gtest/gtest.h"
@@ -36,6 +37,39 @@ TEST_F(CommonTest, TestPhase) {
   EXPECT_EQ(Caffe::phase(), Caffe::TEST);
 }
 
+// Records the phase of a new thread, then the phase it sees borrowing caffe
+// after setting its own, then its own again.
+static void RecordThreadPhases(Caffe* caffe, Caffe::Phase* phases) {
+  phases[0] = Caffe::phase();
+  Caffe::set_phase(Caffe::TRAIN);
+  {
+    Caffe::Borrow borrow(caffe);
+    phases[1] = Caffe::phase();
+  }
+  phases[2] = Caffe::phase();
+}
+
+TEST_F(CommonTest, TestThreadPhase) {
+  Caffe::set_phase(Caffe::TEST);
+  Caffe::Phase phases[3];
+  boost::thread thread(RecordThreadPhases, &Caffe::Get(), phases);
+  thread.join();
+  EXPECT_EQ(Caffe::TRAIN, phases[0]);
+  EXPECT_EQ(Caffe::TEST, phases[1]);
+  EXPECT_EQ(Caffe::TRAIN, phases[2]);
+  EXPECT_EQ(Caffe::TEST, Caffe::phase());
+}
+
+TEST_F(CommonTest, TestParseIdList) {
+  const vector<int> ids = ParseIdList("0-3,8\n");
+  ASSERT_EQ(5, ids.size());
+  for (int i = 0; i < 4; ++i) {
+    EXPECT_EQ(i, ids[i]);
+  }
+  EXPECT_EQ(8, ids[4]);
+  EXPECT_TRUE(ParseIdList("").empty());
+}
+
 TEST_F(CommonTest, TestRandSeedCPU) {
   SyncedMemory data_a(10 * sizeof(int));
   SyncedMemory data_b(10 * sizeof(int));
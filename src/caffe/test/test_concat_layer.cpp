@@ -6,6 +6,7 @@
 #include "caffe/blob.hpp"
 #include "caffe/common.hpp"
 #include "caffe/filler.hpp"
+#include "caffe/util/math_functions.hpp"
 #include "caffe/vision_layers.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
@@ -110,6 +111,45 @@ TYPED_TEST(ConcatLayerTest, TestNum) {
   }
 }
 
+TYPED_TEST(ConcatLayerTest, TestNumView) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  layer_param.mutable_concat_param()->set_concat_dim(0);
+  ConcatLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_1, this->blob_top_vec_);
+  // Concatenating along num, the bottoms become views of the top.
+  const int offset = this->blob_bottom_0->count();
+  EXPECT_TRUE(this->blob_bottom_0->IsViewOf(*this->blob_top_, 0));
+  EXPECT_TRUE(this->blob_bottom_2->IsViewOf(*this->blob_top_, offset));
+  // Writes to the bottoms after setup still reach the top.
+  caffe_set(this->blob_bottom_2->count(), Dtype(4),
+      this->blob_bottom_2->mutable_cpu_data());
+  layer.Forward(this->blob_bottom_vec_1, this->blob_top_vec_);
+  for (int i = 0; i < this->blob_top_->count(); ++i) {
+    EXPECT_EQ(this->blob_top_->cpu_data()[i], i < offset ? 1 : 4);
+  }
+}
+
+TYPED_TEST(ConcatLayerTest, TestChannelsNoView) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  ConcatLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_0, this->blob_top_vec_);
+  // With more than one image, channel slices are not contiguous.
+  EXPECT_FALSE(this->blob_bottom_0->is_view());
+  EXPECT_FALSE(this->blob_bottom_1->is_view());
+}
+
+TYPED_TEST(ConcatLayerTest, TestGradientNum) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  layer_param.mutable_concat_param()->set_concat_dim(0);
+  ConcatLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-2, 1e-2);
+  checker.CheckGradient(&layer, this->blob_bottom_vec_1,
+    this->blob_top_vec_);
+}
+
 TYPED_TEST(ConcatLayerTest, TestGradient) {
   typedef typename TypeParam::Dtype Dtype;
   LayerParameter layer_param;
@@ -0,0 +1,185 @@
+#include <stdint.h>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/vision_layers.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+class ConfusionMatrixLayerTest : public ::testing::Test {
+ protected:
+  ConfusionMatrixLayerTest()
+      : blob_bottom_data_(new Blob<Dtype>(2, 4, 17, 19)),
+        blob_bottom_label_(new Blob<Dtype>(2, 1, 17, 19)),
+        blob_top_mean_iou_(new Blob<Dtype>()),
+        blob_top_fw_iou_(new Blob<Dtype>()),
+        blob_top_iou_(new Blob<Dtype>()) {
+    Caffe::set_mode(Caffe::CPU);
+    blob_bottom_vec_.push_back(blob_bottom_data_);
+    blob_bottom_vec_.push_back(blob_bottom_label_);
+    blob_top_vec_.push_back(blob_top_mean_iou_);
+    blob_top_vec_.push_back(blob_top_fw_iou_);
+    blob_top_vec_.push_back(blob_top_iou_);
+  }
+  virtual ~ConfusionMatrixLayerTest() {
+    delete blob_bottom_data_;
+    delete blob_bottom_label_;
+    delete blob_top_mean_iou_;
+    delete blob_top_fw_iou_;
+    delete blob_top_iou_;
+  }
+
+  // Fill new scores and labels 0 to 4, where 4 is ignored, and add their
+  // pixels to the reference confusion matrix.
+  void FillBatch(vector<int64_t>* confusion) {
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(blob_bottom_data_);
+    Dtype* label = blob_bottom_label_->mutable_cpu_data();
+    for (int i = 0; i < blob_bottom_label_->count(); ++i) {
+      label[i] = caffe_rng_rand() % 5;
+    }
+    for (int n = 0; n < 2; ++n) {
+      for (int h = 0; h < 17; ++h) {
+        for (int w = 0; w < 19; ++w) {
+          const int label_value = blob_bottom_label_->data_at(n, 0, h, w);
+          if (label_value == 4) {
+            continue;
+          }
+          int predicted = 0;
+          for (int c = 1; c < 4; ++c) {
+            if (blob_bottom_data_->data_at(n, c, h, w) >
+                blob_bottom_data_->data_at(n, predicted, h, w)) {
+              predicted = c;
+            }
+          }
+          ++(*confusion)[label_value * 4 + predicted];
+        }
+      }
+    }
+  }
+
+  Blob<Dtype>* const blob_bottom_data_;
+  Blob<Dtype>* const blob_bottom_label_;
+  Blob<Dtype>* const blob_top_mean_iou_;
+  Blob<Dtype>* const blob_top_fw_iou_;
+  Blob<Dtype>* const blob_top_iou_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+};
+
+TYPED_TEST_CASE(ConfusionMatrixLayerTest, TestDtypes);
+
+TYPED_TEST(ConfusionMatrixLayerTest, TestSetup) {
+  LayerParameter layer_param;
+  ConfusionMatrixLayer<TypeParam> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  EXPECT_EQ(this->blob_top_mean_iou_->count(), 1);
+  EXPECT_EQ(this->blob_top_fw_iou_->count(), 1);
+  EXPECT_EQ(this->blob_top_iou_->channels(), 4);
+  EXPECT_EQ(this->blob_top_iou_->count(), 4);
+}
+
+TYPED_TEST(ConfusionMatrixLayerTest, TestForwardAccumulate) {
+  LayerParameter layer_param;
+  layer_param.mutable_confusion_matrix_param()->set_ignore_label(4);
+  ConfusionMatrixLayer<TypeParam> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  vector<int64_t> confusion(16, 0);
+  const int kBatches = 3;
+  for (int b = 0; b < kBatches; ++b) {
+    this->FillBatch(&confusion);
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  }
+  // The outputs are the metrics of the matrix of all the batches.
+  const double mean_iou = this->blob_top_mean_iou_->cpu_data()[0];
+  const double fw_iou = this->blob_top_fw_iou_->cpu_data()[0];
+  const TypeParam* iou = this->blob_top_iou_->cpu_data();
+  for (int i = 0; i < 16; ++i) {
+    EXPECT_EQ(confusion[i], layer.confusion()[i]);
+  }
+  int64_t total = 0;
+  double expected_mean_iou = 0, expected_fw_iou = 0;
+  for (int c = 0; c < 4; ++c) {
+    int64_t labeled = 0, predicted = 0;
+    for (int k = 0; k < 4; ++k) {
+      labeled += confusion[c * 4 + k];
+      predicted += confusion[k * 4 + c];
+    }
+    const double expected_iou = static_cast<double>(confusion[c * 4 + c]) /
+        (labeled + predicted - confusion[c * 4 + c]);
+    EXPECT_NEAR(expected_iou, iou[c], 1e-4);
+    expected_mean_iou += expected_iou / 4;
+    expected_fw_iou += expected_iou * labeled;
+    total += labeled;
+  }
+  EXPECT_NEAR(expected_mean_iou, mean_iou, 1e-4);
+  EXPECT_NEAR(expected_fw_iou / total, fw_iou, 1e-4);
+  // After a reset only the next batch counts.
+  layer.ResetState();
+  confusion.assign(16, 0);
+  this->FillBatch(&confusion);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  for (int i = 0; i < 16; ++i) {
+    EXPECT_EQ(confusion[i], layer.confusion()[i]);
+  }
+}
+
+TYPED_TEST(ConfusionMatrixLayerTest, TestSkipOutOfRange) {
+  // Without ignore_label, the label 4 and a void label 255 are not classes.
+  LayerParameter layer_param;
+  ConfusionMatrixLayer<TypeParam> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  vector<int64_t> confusion(16, 0);
+  this->FillBatch(&confusion);
+  TypeParam* label = this->blob_bottom_label_->mutable_cpu_data();
+  int64_t out_of_range = 0;
+  for (int i = 0; i < this->blob_bottom_label_->count(); ++i) {
+    if (label[i] == 4) {
+      label[i] = i % 2 ? 4 : 255;
+      ++out_of_range;
+    }
+  }
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  EXPECT_EQ(out_of_range, layer.skipped());
+  for (int i = 0; i < 16; ++i) {
+    EXPECT_EQ(confusion[i], layer.confusion()[i]);
+  }
+  layer.ResetState();
+  EXPECT_EQ(0, layer.skipped());
+}
+
+TYPED_TEST(ConfusionMatrixLayerTest, TestForwardPredictedLabels) {
+  // Feed the argmax labels instead of the scores.
+  Blob<TypeParam> predicted(2, 1, 17, 19);
+  vector<Blob<TypeParam>*> bottom_vec;
+  bottom_vec.push_back(&predicted);
+  bottom_vec.push_back(this->blob_bottom_label_);
+  LayerParameter layer_param;
+  layer_param.mutable_confusion_matrix_param()->set_ignore_label(4);
+  layer_param.mutable_confusion_matrix_param()->set_num_classes(4);
+  ConfusionMatrixLayer<TypeParam> layer(layer_param);
+  layer.SetUp(bottom_vec, this->blob_top_vec_);
+  vector<int64_t> confusion(16, 0);
+  this->FillBatch(&confusion);
+  LayerParameter argmax_param;
+  argmax_param.mutable_argmax_param()->set_axis(1);
+  ArgMaxLayer<TypeParam> argmax_layer(argmax_param);
+  vector<Blob<TypeParam>*> argmax_bottom_vec(1, this->blob_bottom_data_);
+  vector<Blob<TypeParam>*> argmax_top_vec(1, &predicted);
+  argmax_layer.SetUp(argmax_bottom_vec, argmax_top_vec);
+  argmax_layer.Forward(argmax_bottom_vec, argmax_top_vec);
+  layer.Forward(bottom_vec, this->blob_top_vec_);
+  for (int i = 0; i < 16; ++i) {
+    EXPECT_EQ(confusion[i], layer.confusion()[i]);
+  }
+}
+
+}  // namespace caffe
@@ -0,0 +1,211 @@
+#include <cstring>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/vision_layers.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+#include "caffe/test/test_gradient_check_util.hpp"
+
+namespace caffe {
+
+// Since DirectDeconvolutionLayer only has a CPU implementation, the tests
+// compare it against the GEMM + col2im DeconvolutionLayer on the CPU.
+template <typename Dtype>
+class DirectDeconvolutionLayerTest : public ::testing::Test {
+ protected:
+  DirectDeconvolutionLayerTest()
+      : blob_bottom_(new Blob<Dtype>(2, 4, 5, 3)),
+        blob_top_(new Blob<Dtype>()),
+        blob_top_ref_(new Blob<Dtype>()) {}
+  virtual void SetUp() {
+    Caffe::set_mode(Caffe::CPU);
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(this->blob_bottom_);
+    blob_bottom_vec_.push_back(blob_bottom_);
+    blob_top_vec_.push_back(blob_top_);
+    blob_top_ref_vec_.push_back(blob_top_ref_);
+  }
+  virtual ~DirectDeconvolutionLayerTest() {
+    delete blob_bottom_;
+    delete blob_top_;
+    delete blob_top_ref_;
+  }
+
+  // Run the direct and the reference engine with the same weights and check
+  // that the outputs and all gradients agree.
+  void CheckAgainstReference(const LayerParameter& layer_param) {
+    LayerParameter ref_param(layer_param);
+    ref_param.mutable_convolution_param()->set_engine(
+        ConvolutionParameter_Engine_CAFFE);
+    DeconvolutionLayer<Dtype> ref_layer(ref_param);
+    ref_layer.SetUp(blob_bottom_vec_, blob_top_ref_vec_);
+    DirectDeconvolutionLayer<Dtype> layer(layer_param);
+    layer.SetUp(blob_bottom_vec_, blob_top_vec_);
+    ASSERT_EQ(layer.blobs().size(), ref_layer.blobs().size());
+    for (int i = 0; i < layer.blobs().size(); ++i) {
+      layer.blobs()[i]->CopyFrom(*ref_layer.blobs()[i]);
+    }
+    ASSERT_EQ(blob_top_->num(), blob_top_ref_->num());
+    ASSERT_EQ(blob_top_->channels(), blob_top_ref_->channels());
+    ASSERT_EQ(blob_top_->height(), blob_top_ref_->height());
+    ASSERT_EQ(blob_top_->width(), blob_top_ref_->width());
+    ref_layer.Forward(blob_bottom_vec_, blob_top_ref_vec_);
+    layer.Forward(blob_bottom_vec_, blob_top_vec_);
+    for (int i = 0; i < blob_top_->count(); ++i) {
+      EXPECT_NEAR(blob_top_->cpu_data()[i], blob_top_ref_->cpu_data()[i],
+          1e-4);
+    }
+    // Backward with the same top diff through both engines.
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    Blob<Dtype> top_diff;
+    top_diff.ReshapeLike(*blob_top_);
+    filler.Fill(&top_diff);
+    vector<bool> propagate_down(1, true);
+    caffe_copy(top_diff.count(), top_diff.cpu_data(),
+        blob_top_ref_->mutable_cpu_diff());
+    for (int i = 0; i < ref_layer.blobs().size(); ++i) {
+      caffe_set(ref_layer.blobs()[i]->count(), Dtype(0),
+          ref_layer.blobs()[i]->mutable_cpu_diff());
+    }
+    ref_layer.Backward(blob_top_ref_vec_, propagate_down, blob_bottom_vec_);
+    Blob<Dtype> ref_bottom_diff;
+    ref_bottom_diff.CopyFrom(*blob_bottom_, true, true);
+    caffe_copy(top_diff.count(), top_diff.cpu_data(),
+        blob_top_->mutable_cpu_diff());
+    for (int i = 0; i < layer.blobs().size(); ++i) {
+      caffe_set(layer.blobs()[i]->count(), Dtype(0),
+          layer.blobs()[i]->mutable_cpu_diff());
+    }
+    layer.Backward(blob_top_vec_, propagate_down, blob_bottom_vec_);
+    for (int i = 0; i < blob_bottom_->count(); ++i) {
+      EXPECT_NEAR(blob_bottom_->cpu_diff()[i], ref_bottom_diff.cpu_diff()[i],
+          1e-4);
+    }
+    for (int b = 0; b < layer.blobs().size(); ++b) {
+      const Blob<Dtype>& param = *layer.blobs()[b];
+      const Blob<Dtype>& ref = *ref_layer.blobs()[b];
+      for (int i = 0; i < param.count(); ++i) {
+        EXPECT_NEAR(param.cpu_diff()[i], ref.cpu_diff()[i], 1e-3);
+      }
+    }
+  }
+
+  Blob<Dtype>* const blob_bottom_;
+  Blob<Dtype>* const blob_top_;
+  Blob<Dtype>* const blob_top_ref_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+  vector<Blob<Dtype>*> blob_top_ref_vec_;
+};
+
+TYPED_TEST_CASE(DirectDeconvolutionLayerTest, TestDtypes);
+
+TYPED_TEST(DirectDeconvolutionLayerTest, TestSetup) {
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_size(4);
+  convolution_param->set_stride(2);
+  convolution_param->set_pad(1);
+  convolution_param->set_num_output(3);
+  convolution_param->set_engine(ConvolutionParameter_Engine_DIRECT);
+  layer_param.set_type(LayerParameter_LayerType_DECONVOLUTION);
+  shared_ptr<Layer<TypeParam> > layer(
+      LayerRegistry<TypeParam>::CreateLayer(layer_param));
+  EXPECT_TRUE(dynamic_cast<DirectDeconvolutionLayer<TypeParam>*>(
+      layer.get()) != NULL);
+  layer->SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  EXPECT_EQ(this->blob_top_->num(), 2);
+  EXPECT_EQ(this->blob_top_->channels(), 3);
+  EXPECT_EQ(this->blob_top_->height(), 10);
+  EXPECT_EQ(this->blob_top_->width(), 6);
+}
+
+TYPED_TEST(DirectDeconvolutionLayerTest, TestCuDNNEngineFallsBack) {
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_size(4);
+  convolution_param->set_stride(2);
+  convolution_param->set_num_output(3);
+  convolution_param->set_engine(ConvolutionParameter_Engine_CUDNN);
+  layer_param.set_type(LayerParameter_LayerType_DECONVOLUTION);
+  shared_ptr<Layer<TypeParam> > layer(
+      LayerRegistry<TypeParam>::CreateLayer(layer_param));
+  EXPECT_TRUE(dynamic_cast<DeconvolutionLayer<TypeParam>*>(
+      layer.get()) != NULL);
+  EXPECT_TRUE(dynamic_cast<DirectDeconvolutionLayer<TypeParam>*>(
+      layer.get()) == NULL);
+}
+
+TYPED_TEST(DirectDeconvolutionLayerTest, TestUpsample2x) {
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_size(4);
+  convolution_param->set_stride(2);
+  convolution_param->set_pad(1);
+  convolution_param->set_num_output(3);
+  convolution_param->set_engine(ConvolutionParameter_Engine_DIRECT);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  this->CheckAgainstReference(layer_param);
+}
+
+TYPED_TEST(DirectDeconvolutionLayerTest, TestUpsample3xNoPad) {
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_size(6);
+  convolution_param->set_stride(3);
+  convolution_param->set_num_output(2);
+  convolution_param->set_bias_term(false);
+  convolution_param->set_engine(ConvolutionParameter_Engine_DIRECT);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  this->CheckAgainstReference(layer_param);
+}
+
+TYPED_TEST(DirectDeconvolutionLayerTest, TestRectangularGroup) {
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_h(3);
+  convolution_param->set_kernel_w(2);
+  convolution_param->set_stride_h(2);
+  convolution_param->set_stride_w(1);
+  convolution_param->set_pad_h(1);
+  convolution_param->set_pad_w(0);
+  convolution_param->set_num_output(4);
+  convolution_param->set_group(2);
+  convolution_param->set_engine(ConvolutionParameter_Engine_DIRECT);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  this->CheckAgainstReference(layer_param);
+}
+
+TYPED_TEST(DirectDeconvolutionLayerTest, TestGradient) {
+  typedef TypeParam Dtype;
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_size(4);
+  convolution_param->set_stride(2);
+  convolution_param->set_pad(1);
+  convolution_param->set_num_output(2);
+  convolution_param->set_engine(ConvolutionParameter_Engine_DIRECT);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  DirectDeconvolutionLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_);
+}
+
+}  // namespace caffe
@@ -0,0 +1,131 @@
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <utility>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/vision_layers.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+class EltwiseAccuracyLayerTest : public ::testing::Test {
+ protected:
+  EltwiseAccuracyLayerTest()
+      : blob_bottom_data_(new Blob<Dtype>(2, 10, 17, 19)),
+        blob_bottom_label_(new Blob<Dtype>(2, 1, 17, 19)),
+        blob_top_(new Blob<Dtype>()) {
+    // fill the scores, rounded so that some pixels have tied classes
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(this->blob_bottom_data_);
+    Dtype* data = blob_bottom_data_->mutable_cpu_data();
+    for (int i = 0; i < blob_bottom_data_->count(); ++i) {
+      data[i] = floor(data[i] * 2);
+    }
+    // labels 0 to 10, where 10 may be ignored
+    Dtype* label_data = blob_bottom_label_->mutable_cpu_data();
+    for (int i = 0; i < blob_bottom_label_->count(); ++i) {
+      label_data[i] = caffe_rng_rand() % 11;
+    }
+    blob_bottom_vec_.push_back(blob_bottom_data_);
+    blob_bottom_vec_.push_back(blob_bottom_label_);
+    blob_top_vec_.push_back(blob_top_);
+  }
+  virtual ~EltwiseAccuracyLayerTest() {
+    delete blob_bottom_data_;
+    delete blob_bottom_label_;
+    delete blob_top_;
+  }
+
+  // The accuracy from sorting the (score, class) pairs of every pixel, with
+  // label 10 ignored or else counted as wrong like any label that is no
+  // class.
+  Dtype ReferenceAccuracy(const int top_k, const bool ignore = true) {
+    int correct = 0;
+    int count = 0;
+    for (int n = 0; n < blob_bottom_data_->num(); ++n) {
+      for (int h = 0; h < blob_bottom_data_->height(); ++h) {
+        for (int w = 0; w < blob_bottom_data_->width(); ++w) {
+          const int label = blob_bottom_label_->data_at(n, 0, h, w);
+          if (label == 10 && ignore) {
+            continue;
+          }
+          std::vector<std::pair<Dtype, int> > scores;
+          for (int c = 0; c < blob_bottom_data_->channels(); ++c) {
+            scores.push_back(
+                std::make_pair(blob_bottom_data_->data_at(n, c, h, w), c));
+          }
+          std::partial_sort(scores.begin(), scores.begin() + top_k,
+              scores.end(), std::greater<std::pair<Dtype, int> >());
+          for (int k = 0; k < top_k; ++k) {
+            if (scores[k].second == label) {
+              ++correct;
+              break;
+            }
+          }
+          ++count;
+        }
+      }
+    }
+    return static_cast<Dtype>(correct) / count;
+  }
+
+  Blob<Dtype>* const blob_bottom_data_;
+  Blob<Dtype>* const blob_bottom_label_;
+  Blob<Dtype>* const blob_top_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+};
+
+TYPED_TEST_CASE(EltwiseAccuracyLayerTest, TestDtypes);
+
+TYPED_TEST(EltwiseAccuracyLayerTest, TestForwardCPU) {
+  LayerParameter layer_param;
+  Caffe::set_mode(Caffe::CPU);
+  layer_param.mutable_eltwise_accuracy_param()->set_ignore_label(10);
+  EltwiseAccuracyLayer<TypeParam> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  EXPECT_NEAR(this->blob_top_->data_at(0, 0, 0, 0),
+      this->ReferenceAccuracy(1), 1e-4);
+}
+
+TYPED_TEST(EltwiseAccuracyLayerTest, TestForwardCPUTopK) {
+  LayerParameter layer_param;
+  Caffe::set_mode(Caffe::CPU);
+  layer_param.mutable_eltwise_accuracy_param()->set_ignore_label(10);
+  layer_param.mutable_eltwise_accuracy_param()->set_top_k(3);
+  EltwiseAccuracyLayer<TypeParam> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  EXPECT_NEAR(this->blob_top_->data_at(0, 0, 0, 0),
+      this->ReferenceAccuracy(3), 1e-4);
+}
+
+TYPED_TEST(EltwiseAccuracyLayerTest, TestForwardCPULabelOutOfRange) {
+  // Without ignore_label, the labels 10 and 255 are no class of the 10.
+  TypeParam* label_data = this->blob_bottom_label_->mutable_cpu_data();
+  for (int i = 0; i < this->blob_bottom_label_->count(); i += 7) {
+    label_data[i] = 255;
+  }
+  Caffe::set_mode(Caffe::CPU);
+  for (int top_k = 1; top_k <= 3; top_k += 2) {
+    LayerParameter layer_param;
+    layer_param.mutable_eltwise_accuracy_param()->set_top_k(top_k);
+    EltwiseAccuracyLayer<TypeParam> layer(layer_param);
+    layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    EXPECT_NEAR(this->blob_top_->data_at(0, 0, 0, 0),
+        this->ReferenceAccuracy(top_k, false), 1e-4);
+  }
+}
+
+}  // namespace caffe
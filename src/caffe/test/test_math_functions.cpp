@@ -1,8 +1,10 @@
 #include <stdint.h>  // for uint32_t & uint64_t
 #include <time.h>
+#include <algorithm>
 #include <climits>
 #include <cmath>  // for std::fabs
 #include <cstdlib>  // for rand_r
+#include <limits>
 
 #include "gtest/gtest.h"
 
@@ -144,6 +146,85 @@ TYPED_TEST(MathFunctionsTest, TestCopyCPU) {
   }
 }
 
+TYPED_TEST(MathFunctionsTest, TestExpLogCPU) {
+  const int n = this->blob_bottom_->count();
+  TypeParam* x = this->blob_bottom_->mutable_cpu_data();
+  // Spread the inputs over most of the float range of exp.
+  caffe_scal<TypeParam>(n, 10, x);
+  TypeParam* y = this->blob_top_->mutable_cpu_data();
+  caffe_exp<TypeParam>(n, x, y);
+  for (int i = 0; i < n; ++i) {
+    const double expected = std::exp(static_cast<double>(x[i]));
+    EXPECT_NEAR(y[i], expected, 1e-6 * expected);
+  }
+  caffe_log<TypeParam>(n, y, this->blob_top_->mutable_cpu_diff());
+  const TypeParam* log_y = this->blob_top_->cpu_diff();
+  for (int i = 0; i < n; ++i) {
+    const double expected = std::log(static_cast<double>(y[i]));
+    EXPECT_NEAR(log_y[i], expected, 1e-6 * std::max(std::fabs(expected), 1.));
+  }
+}
+
+TYPED_TEST(MathFunctionsTest, TestPowxCPU) {
+  const int n = this->blob_bottom_->count();
+  const TypeParam* x = this->blob_bottom_->cpu_data();
+  TypeParam* a = this->blob_bottom_->mutable_cpu_diff();
+  caffe_abs<TypeParam>(n, x, a);
+  const int num_powers = 5;
+  const TypeParam powers[num_powers] = { -0.75, 0.5, 1, 2, 2.5 };
+  for (int p = 0; p < num_powers; ++p) {
+    TypeParam* y = this->blob_top_->mutable_cpu_data();
+    caffe_powx<TypeParam>(n, a, powers[p], y);
+    for (int i = 0; i < n; ++i) {
+      const double expected = std::pow(static_cast<double>(a[i]),
+          static_cast<double>(powers[p]));
+      // The error of exp(b * log(a)) grows with the magnitude of b * log(a).
+      EXPECT_NEAR(y[i], expected,
+          1e-6 * expected * std::max(std::fabs(std::log(expected)), 1.));
+    }
+  }
+}
+
+TYPED_TEST(MathFunctionsTest, TestTanhSigmoidCPU) {
+  const int n = this->blob_bottom_->count();
+  TypeParam* x = this->blob_bottom_->mutable_cpu_data();
+  caffe_scal<TypeParam>(n, 5, x);
+  TypeParam* y = this->blob_top_->mutable_cpu_data();
+  caffe_tanh<TypeParam>(n, x, y);
+  for (int i = 0; i < n; ++i) {
+    EXPECT_NEAR(y[i], std::tanh(static_cast<double>(x[i])), 1e-6);
+  }
+  caffe_sigmoid<TypeParam>(n, x, y);
+  for (int i = 0; i < n; ++i) {
+    EXPECT_NEAR(y[i], 1. / (1. + std::exp(-static_cast<double>(x[i]))), 1e-6);
+  }
+}
+
+TYPED_TEST(MathFunctionsTest, TestExpLogEdgeCasesCPU) {
+  const TypeParam inf = std::numeric_limits<TypeParam>::infinity();
+  const TypeParam nan = std::numeric_limits<TypeParam>::quiet_NaN();
+  const int n = 7;
+  const TypeParam x[n] = { nan, inf, -inf, 0, -1, 88.6, 89 };
+  TypeParam y[n];
+  caffe_exp<TypeParam>(n, x, y);
+  EXPECT_NE(y[0], y[0]);
+  EXPECT_EQ(inf, y[1]);
+  EXPECT_EQ(0, y[2]);
+  EXPECT_EQ(1, y[3]);
+  EXPECT_NEAR(y[4], std::exp(-1.), 1e-6);
+  // Finite up to log(FLT_MAX), and inf above, as from libm.
+  const double expected = std::exp(static_cast<double>(x[5]));
+  EXPECT_NEAR(y[5], expected, 1e-6 * expected);
+  EXPECT_EQ(sizeof(TypeParam) == 4 ? inf : std::exp(TypeParam(89)), y[6]);
+  caffe_log<TypeParam>(n, x, y);
+  EXPECT_NE(y[0], y[0]);
+  EXPECT_EQ(inf, y[1]);
+  EXPECT_NE(y[2], y[2]);
+  EXPECT_EQ(-inf, y[3]);
+  EXPECT_NE(y[4], y[4]);
+  EXPECT_NEAR(y[5], std::log(static_cast<double>(x[5])), 1e-6);
+}
+
 #ifndef CPU_ONLY
 
 // TODO: Fix caffe_gpu_hamming_distance and re-enable this test.
@@ -6,6 +6,7 @@
 #include "caffe/common.hpp"
 #include "caffe/common_layers.hpp"
 #include "caffe/filler.hpp"
+#include "caffe/util/math_functions.hpp"
 #include "gtest/gtest.h"
 
 #include "caffe/test/test_caffe_main.hpp"
@@ -70,6 +71,41 @@ TYPED_TEST(MVNLayerTest, TestForward) {
   }
 }
 
+TYPED_TEST(MVNLayerTest, TestForwardLargeMean) {
+  typedef typename TypeParam::Dtype Dtype;
+  // A mean large next to the spread, where E(X^2) - (EX)^2 over the raw
+  // values loses most of its precision in float.
+  caffe_add_scalar(this->blob_bottom_->count(), Dtype(1000),
+      this->blob_bottom_->mutable_cpu_data());
+  LayerParameter layer_param;
+  MVNLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  int num = this->blob_bottom_->num();
+  int channels = this->blob_bottom_->channels();
+  int height = this->blob_bottom_->height();
+  int width = this->blob_bottom_->width();
+
+  for (int i = 0; i < num; ++i) {
+    for (int j = 0; j < channels; ++j) {
+      Dtype sum = 0, var = 0;
+      for (int k = 0; k < height; ++k) {
+        for (int l = 0; l < width; ++l) {
+          Dtype data = this->blob_top_->data_at(i, j, k, l);
+          sum += data;
+          var += data * data;
+        }
+      }
+      sum /= height * width;
+      var /= height * width;
+
+      const Dtype kErrorBound = 0.001;
+      EXPECT_NEAR(0, sum, kErrorBound);
+      EXPECT_NEAR(1, var, kErrorBound);
+    }
+  }
+}
+
 TYPED_TEST(MVNLayerTest, TestForwardMeanOnly) {
   typedef typename TypeParam::Dtype Dtype;
   LayerParameter layer_param;
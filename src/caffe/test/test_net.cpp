@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <boost/thread.hpp>
 #include <string>
 #include <utility>
 #include <vector>
@@ -2201,4 +2203,1192 @@ TYPED_TEST(NetTest, TestReshape) {
   }
 }
 
+TYPED_TEST(NetTest, TestReshapeChangedShapes) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->InitReshapableNet();
+  Blob<Dtype>* input_blob = this->net_->input_blobs()[0];
+  Blob<Dtype>* output_blob = this->net_->output_blobs()[0];
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(input_blob);
+  this->net_->ForwardPrefilled();
+  vector<uint64_t> generations;
+  for (int i = 0; i < this->net_->blobs().size(); ++i) {
+    generations.push_back(this->net_->blobs()[i]->shape_generation());
+  }
+  // The first Forward reshapes every layer.
+  const vector<int> reshapes = this->net_->layer_reshapes();
+  ASSERT_EQ(this->net_->layers().size(), reshapes.size());
+  for (int i = 0; i < reshapes.size(); ++i) {
+    EXPECT_EQ(1, reshapes[i]);
+  }
+  // With the same input shape, nothing changes shape again, and no layer is
+  // reshaped.
+  this->net_->ForwardPrefilled();
+  for (int i = 0; i < this->net_->blobs().size(); ++i) {
+    EXPECT_EQ(generations[i], this->net_->blobs()[i]->shape_generation());
+  }
+  for (int i = 0; i < reshapes.size(); ++i) {
+    EXPECT_EQ(reshapes[i], this->net_->layer_reshapes()[i]);
+  }
+  // A new input shape reaches the output.
+  const int num = output_blob->num();
+  const uint64_t output_generation = output_blob->shape_generation();
+  input_blob->Reshape(2 * input_blob->num(), input_blob->channels(),
+      input_blob->height(), input_blob->width());
+  filler.Fill(input_blob);
+  this->net_->ForwardPrefilled();
+  EXPECT_EQ(2 * num, output_blob->num());
+  EXPECT_NE(output_generation, output_blob->shape_generation());
+  for (int i = 0; i < reshapes.size(); ++i) {
+    EXPECT_EQ(reshapes[i] + 1, this->net_->layer_reshapes()[i]);
+  }
+}
+
+TYPED_TEST(NetTest, TestFoldBatchNorm) {
+  typedef typename TypeParam::Dtype Dtype;
+  const string proto =
+      "name: 'FoldBatchNormNetwork' "
+      "input: 'data' "
+      "input_dim: 2 "
+      "input_dim: 3 "
+      "input_dim: 5 "
+      "input_dim: 5 "
+      "layers: { "
+      "  name: 'conv1' "
+      "  type: CONVOLUTION "
+      "  convolution_param { "
+      "    num_output: 4 "
+      "    kernel_size: 3 "
+      "    bias_term: false "
+      "    weight_filler { type: 'gaussian' } "
+      "  } "
+      "  blobs_lr: 1. "
+      "  bottom: 'data' "
+      "  top: 'conv1' "
+      "} "
+      "layers: { "
+      "  name: 'bn1' "
+      "  type: BN "
+      "  bn_param { "
+      "    bn_mode: INFERENCE "
+      "    scale_filler { type: 'gaussian' } "
+      "    shift_filler { type: 'gaussian' } "
+      "  } "
+      "  bottom: 'conv1' "
+      "  top: 'bn1' "
+      "} "
+      "layers: { "
+      "  name: 'ip' "
+      "  type: INNER_PRODUCT "
+      "  inner_product_param { "
+      "    num_output: 5 "
+      "    weight_filler { type: 'gaussian' } "
+      "    bias_filler { type: 'gaussian' } "
+      "  } "
+      "  bottom: 'bn1' "
+      "  top: 'ip' "
+      "} "
+      "layers: { "
+      "  name: 'bn2' "
+      "  type: BN "
+      "  bn_param { "
+      "    bn_mode: INFERENCE "
+      "    scale_filler { type: 'gaussian' } "
+      "    shift_filler { type: 'gaussian' } "
+      "  } "
+      "  bottom: 'ip' "
+      "  top: 'ip' "
+      "} ";
+  Caffe::set_random_seed(this->seed_);
+  this->InitNetFromProtoString(proto);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->net_->input_blobs()[0]);
+  this->net_->ForwardPrefilled();
+  const Blob<Dtype>* expected = this->net_->output_blobs()[0];
+  NetParameter trained_param;
+  this->net_->ToProto(&trained_param);
+
+  // Fold at load time.
+  NetParameter param;
+  CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+  param.set_fold_batch_norm(true);
+  Net<Dtype> folded_net(param);
+  EXPECT_EQ(2, folded_net.layers().size());
+  EXPECT_FALSE(folded_net.has_blob("conv1"));
+  EXPECT_TRUE(folded_net.has_blob("bn1"));
+  folded_net.CopyTrainedLayersFrom(trained_param);
+  // Fold the weights carried by the net parameter.
+  NetParameter folded_param;
+  Net<Dtype>::FoldBatchNorm(trained_param, &folded_param);
+  for (int i = 0; i < 4; ++i) {
+    folded_param.add_input_dim(param.input_dim(i));
+  }
+  EXPECT_EQ(2, folded_param.layers_size());
+  ASSERT_EQ(2, folded_param.layers(0).blobs_size());
+  Net<Dtype> folded_weights_net(folded_param);
+  folded_weights_net.CopyTrainedLayersFrom(folded_param);
+
+  Net<Dtype>* nets[] = { &folded_net, &folded_weights_net };
+  for (int n = 0; n < 2; ++n) {
+    nets[n]->input_blobs()[0]->CopyFrom(*this->net_->input_blobs()[0]);
+    nets[n]->ForwardPrefilled();
+    const Blob<Dtype>* output = nets[n]->output_blobs()[0];
+    ASSERT_EQ(expected->count(), output->count());
+    for (int i = 0; i < expected->count(); ++i) {
+      EXPECT_NEAR(expected->cpu_data()[i], output->cpu_data()[i], 1e-4);
+    }
+  }
+}
+
+TYPED_TEST(NetTest, TestFuseReLU) {
+  typedef typename TypeParam::Dtype Dtype;
+  const string proto =
+      "name: 'FuseReLUNetwork' "
+      "force_backward: true "
+      "input: 'data' "
+      "input_dim: 2 "
+      "input_dim: 3 "
+      "input_dim: 5 "
+      "input_dim: 5 "
+      "layers: { "
+      "  name: 'conv1' "
+      "  type: CONVOLUTION "
+      "  convolution_param { "
+      "    num_output: 4 "
+      "    kernel_size: 3 "
+      "    weight_filler { type: 'gaussian' } "
+      "    bias_filler { type: 'gaussian' } "
+      "  } "
+      "  bottom: 'data' "
+      "  top: 'conv1' "
+      "} "
+      "layers: { "
+      "  name: 'relu1' "
+      "  type: RELU "
+      "  relu_param { negative_slope: 0.1 } "
+      "  bottom: 'conv1' "
+      "  top: 'conv1' "
+      "} "
+      "layers: { "
+      "  name: 'ip1' "
+      "  type: INNER_PRODUCT "
+      "  inner_product_param { "
+      "    num_output: 6 "
+      "    weight_filler { type: 'gaussian' } "
+      "    bias_filler { type: 'gaussian' } "
+      "  } "
+      "  bottom: 'conv1' "
+      "  top: 'ip1' "
+      "} "
+      "layers: { "
+      "  name: 'relu2' "
+      "  type: RELU "
+      "  bottom: 'ip1' "
+      "  top: 'relu2' "
+      "} "
+      "layers: { "
+      "  name: 'ip2' "
+      "  type: INNER_PRODUCT "
+      "  inner_product_param { "
+      "    num_output: 6 "
+      "    weight_filler { type: 'gaussian' } "
+      "  } "
+      "  bottom: 'relu2' "
+      "  top: 'ip2' "
+      "} "
+      "layers: { "
+      "  name: 'sum' "
+      "  type: ELTWISE "
+      "  bottom: 'relu2' "
+      "  bottom: 'ip2' "
+      "  top: 'sum' "
+      "} "
+      "layers: { "
+      "  name: 'relu3' "
+      "  type: RELU "
+      "  bottom: 'sum' "
+      "  top: 'sum' "
+      "} ";
+  Caffe::set_random_seed(this->seed_);
+  this->InitNetFromProtoString(proto);
+  NetParameter trained_param;
+  this->net_->ToProto(&trained_param);
+  NetParameter param;
+  CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+  param.set_fuse_relu(true);
+  Net<Dtype> fused_net(param);
+  fused_net.CopyTrainedLayersFrom(trained_param);
+  EXPECT_EQ(3, fused_net.fused_relu_layers().size());
+  EXPECT_FALSE(fused_net.has_layer("relu1"));
+  EXPECT_FALSE(fused_net.has_blob("ip1"));
+  EXPECT_TRUE(fused_net.has_blob("relu2"));
+
+  // The fused net computes the same outputs and gradients.
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->net_->input_blobs()[0]);
+  fused_net.input_blobs()[0]->CopyFrom(*this->net_->input_blobs()[0]);
+  Net<Dtype>* nets[] = { this->net_.get(), &fused_net };
+  for (int n = 0; n < 2; ++n) {
+    nets[n]->ForwardPrefilled();
+    Blob<Dtype>* output = nets[n]->output_blobs()[0];
+    caffe_set(output->count(), Dtype(1), output->mutable_cpu_diff());
+    nets[n]->Backward();
+  }
+  const Blob<Dtype>* expected = this->net_->output_blobs()[0];
+  const Blob<Dtype>* output = fused_net.output_blobs()[0];
+  ASSERT_EQ(expected->count(), output->count());
+  for (int i = 0; i < expected->count(); ++i) {
+    EXPECT_NEAR(expected->cpu_data()[i], output->cpu_data()[i], 1e-4);
+  }
+  const Blob<Dtype>* expected_diff = this->net_->input_blobs()[0];
+  const Blob<Dtype>* output_diff = fused_net.input_blobs()[0];
+  for (int i = 0; i < expected_diff->count(); ++i) {
+    EXPECT_NEAR(expected_diff->cpu_diff()[i], output_diff->cpu_diff()[i],
+        1e-4);
+  }
+  ASSERT_EQ(this->net_->params().size(), fused_net.params().size());
+  for (int j = 0; j < fused_net.params().size(); ++j) {
+    const Blob<Dtype>* expected_param = this->net_->params()[j].get();
+    const Blob<Dtype>* param_diff = fused_net.params()[j].get();
+    for (int i = 0; i < expected_param->count(); ++i) {
+      EXPECT_NEAR(expected_param->cpu_diff()[i], param_diff->cpu_diff()[i],
+          1e-4);
+    }
+  }
+}
+
+TYPED_TEST(NetTest, TestShareActivations) {
+  typedef typename TypeParam::Dtype Dtype;
+  const string proto =
+      "name: 'ShareActivationsNetwork' "
+      "input: 'data' "
+      "input_dim: 1 "
+      "input_dim: 3 "
+      "input_dim: 6 "
+      "input_dim: 6 "
+      "layers: { "
+      "  name: 'conv1' "
+      "  type: CONVOLUTION "
+      "  convolution_param { "
+      "    num_output: 4 "
+      "    kernel_size: 3 "
+      "    pad: 1 "
+      "    weight_filler { type: 'gaussian' } "
+      "    bias_filler { type: 'gaussian' } "
+      "  } "
+      "  bottom: 'data' "
+      "  top: 'conv1' "
+      "} "
+      "layers: { "
+      "  name: 'relu1' "
+      "  type: RELU "
+      "  bottom: 'conv1' "
+      "  top: 'conv1' "
+      "} "
+      "layers: { "
+      "  name: 'conv2' "
+      "  type: CONVOLUTION "
+      "  convolution_param { "
+      "    num_output: 5 "
+      "    kernel_size: 1 "
+      "    weight_filler { type: 'gaussian' } "
+      "  } "
+      "  bottom: 'conv1' "
+      "  top: 'conv2' "
+      "} "
+      "layers: { "
+      "  name: 'conv3' "
+      "  type: CONVOLUTION "
+      "  convolution_param { "
+      "    num_output: 4 "
+      "    kernel_size: 1 "
+      "    weight_filler { type: 'gaussian' } "
+      "  } "
+      "  bottom: 'conv2' "
+      "  top: 'conv3' "
+      "} "
+      "layers: { "
+      "  name: 'concat' "
+      "  type: CONCAT "
+      "  bottom: 'conv3' "
+      "  bottom: 'conv1' "
+      "  top: 'concat' "
+      "} "
+      "layers: { "
+      "  name: 'flat' "
+      "  type: FLATTEN "
+      "  bottom: 'concat' "
+      "  top: 'flat' "
+      "} "
+      "layers: { "
+      "  name: 'ip' "
+      "  type: INNER_PRODUCT "
+      "  inner_product_param { "
+      "    num_output: 3 "
+      "    weight_filler { type: 'gaussian' } "
+      "  } "
+      "  bottom: 'flat' "
+      "  top: 'ip' "
+      "} "
+      "layers: { "
+      "  name: 'relu2' "
+      "  type: RELU "
+      "  bottom: 'ip' "
+      "  top: 'relu2' "
+      "} "
+      "layers: { "
+      "  name: 'ip2' "
+      "  type: INNER_PRODUCT "
+      "  inner_product_param { "
+      "    num_output: 2 "
+      "    weight_filler { type: 'gaussian' } "
+      "  } "
+      "  bottom: 'relu2' "
+      "  top: 'ip2' "
+      "} ";
+  Caffe::set_random_seed(this->seed_);
+  this->InitNetFromProtoString(proto);
+  NetParameter trained_param;
+  this->net_->ToProto(&trained_param);
+  NetParameter param;
+  CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+  param.set_share_activations(true);
+  param.add_keep_blob("conv2");
+  Net<Dtype> shared_net(param);
+  shared_net.CopyTrainedLayersFrom(trained_param);
+  // conv1, its split, conv3, concat and flat share memory through their
+  // layers, and relu2 reuses their buffer once ip has run.
+  EXPECT_EQ(2, shared_net.activation_buffers().size());
+  EXPECT_EQ(shared_net.blob_by_name("concat")->data()->parent(),
+      shared_net.blob_by_name("relu2")->data()->parent());
+  EXPECT_FALSE(shared_net.blob_by_name("conv2")->is_view());
+
+  // The shared net computes the same outputs and kept blobs, also after the
+  // input is reshaped.
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  for (int num = 1; num <= 2; ++num) {
+    Blob<Dtype>* input = this->net_->input_blobs()[0];
+    input->Reshape(num, input->channels(), input->height(), input->width());
+    filler.Fill(input);
+    this->net_->Reshape();
+    shared_net.input_blobs()[0]->ReshapeLike(*input);
+    shared_net.input_blobs()[0]->CopyFrom(*input);
+    shared_net.Reshape();
+    for (int iter = 0; iter < 2; ++iter) {
+      this->net_->ForwardPrefilled();
+      shared_net.ForwardPrefilled();
+      const char* names[] = { "ip2", "conv2" };
+      for (int n = 0; n < 2; ++n) {
+        const Blob<Dtype>* expected = this->net_->blob_by_name(names[n]).get();
+        const Blob<Dtype>* output = shared_net.blob_by_name(names[n]).get();
+        ASSERT_EQ(expected->count(), output->count());
+        for (int i = 0; i < expected->count(); ++i) {
+          EXPECT_NEAR(expected->cpu_data()[i], output->cpu_data()[i], 1e-4);
+        }
+      }
+    }
+  }
+}
+
+TYPED_TEST(NetTest, TestShareDiffsAndRecompute) {
+  typedef typename TypeParam::Dtype Dtype;
+  const string proto =
+      "name: 'RecomputeNetwork' "
+      "force_backward: true "
+      "input: 'data' "
+      "input_dim: 2 "
+      "input_dim: 3 "
+      "input_dim: 6 "
+      "input_dim: 6 "
+      "input: 'target' "
+      "input_dim: 2 "
+      "input_dim: 2 "
+      "input_dim: 1 "
+      "input_dim: 1 "
+      "layers: { "
+      "  name: 'conv1' "
+      "  type: CONVOLUTION "
+      "  convolution_param { "
+      "    num_output: 4 "
+      "    kernel_size: 3 "
+      "    weight_filler { type: 'gaussian' } "
+      "    bias_filler { type: 'gaussian' } "
+      "  } "
+      "  bottom: 'data' "
+      "  top: 'conv1' "
+      "} "
+      "layers: { "
+      "  name: 'relu1' "
+      "  type: RELU "
+      "  bottom: 'conv1' "
+      "  top: 'conv1' "
+      "} "
+      "layers: { "
+      "  name: 'conv2' "
+      "  type: CONVOLUTION "
+      "  convolution_param { "
+      "    num_output: 5 "
+      "    kernel_size: 1 "
+      "    weight_filler { type: 'gaussian' } "
+      "  } "
+      "  bottom: 'conv1' "
+      "  top: 'conv2' "
+      "} "
+      "layers: { "
+      "  name: 'relu2' "
+      "  type: RELU "
+      "  bottom: 'conv2' "
+      "  top: 'relu2' "
+      "} "
+      "layers: { "
+      "  name: 'ip1' "
+      "  type: INNER_PRODUCT "
+      "  inner_product_param { "
+      "    num_output: 6 "
+      "    weight_filler { type: 'gaussian' } "
+      "  } "
+      "  bottom: 'relu2' "
+      "  top: 'ip1' "
+      "} "
+      "layers: { "
+      "  name: 'drop' "
+      "  type: DROPOUT "
+      "  bottom: 'ip1' "
+      "  top: 'drop' "
+      "} "
+      "layers: { "
+      "  name: 'ip2' "
+      "  type: INNER_PRODUCT "
+      "  inner_product_param { "
+      "    num_output: 2 "
+      "    weight_filler { type: 'gaussian' } "
+      "  } "
+      "  bottom: 'drop' "
+      "  top: 'ip2' "
+      "} "
+      "layers: { "
+      "  name: 'loss' "
+      "  type: EUCLIDEAN_LOSS "
+      "  bottom: 'ip2' "
+      "  bottom: 'target' "
+      "  top: 'loss' "
+      "} ";
+  Caffe::set_phase(Caffe::TRAIN);
+  this->InitNetFromProtoString(proto);
+  NetParameter trained_param;
+  this->net_->ToProto(&trained_param);
+  // BlobProto stores floats, so round the reference weights the same way.
+  this->net_->CopyTrainedLayersFrom(trained_param);
+  NetParameter param;
+  CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+  param.set_share_diffs(true);
+  Net<Dtype> shared_diffs_net(param);
+  shared_diffs_net.CopyTrainedLayersFrom(trained_param);
+  // Each intermediate diff is only alive with the one before and after it, so
+  // the six of them alternate between two buffers.
+  EXPECT_EQ(2, shared_diffs_net.diff_buffers().size());
+  param.set_share_diffs(false);
+  const char* recomputed[] = { "conv1", "relu1", "conv2", "relu2", "drop" };
+  for (int i = 0; i < param.layers_size(); ++i) {
+    for (int j = 0; j < 5; ++j) {
+      if (param.layers(i).name() == recomputed[j]) {
+        param.mutable_layers(i)->set_recompute(true);
+      }
+    }
+  }
+  Net<Dtype> recompute_net(param);
+  recompute_net.CopyTrainedLayersFrom(trained_param);
+  // conv1, conv2 and relu2 make one segment of three buffers, and drop a
+  // second segment of one, reusing the buffer of conv1.
+  EXPECT_EQ(3, recompute_net.activation_buffers().size());
+  EXPECT_EQ(recompute_net.blob_by_name("conv1")->data()->parent(),
+      recompute_net.blob_by_name("drop")->data()->parent());
+  EXPECT_FALSE(recompute_net.blob_by_name("ip1")->is_view());
+
+  // The nets compute the same loss and gradients, dropping the same inputs.
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->net_->input_blobs()[0]);
+  filler.Fill(this->net_->input_blobs()[1]);
+  Net<Dtype>* nets[] = { this->net_.get(), &shared_diffs_net, &recompute_net };
+  Dtype loss[3];
+  for (int n = 0; n < 3; ++n) {
+    for (int i = 0; i < 2; ++i) {
+      nets[n]->input_blobs()[i]->CopyFrom(*this->net_->input_blobs()[i]);
+    }
+    Caffe::set_random_seed(this->seed_);
+    nets[n]->ForwardPrefilled(&loss[n]);
+    nets[n]->Backward();
+  }
+  for (int n = 1; n < 3; ++n) {
+    EXPECT_NEAR(loss[0], loss[n], 1e-4);
+    const Blob<Dtype>* expected = this->net_->input_blobs()[0];
+    const Blob<Dtype>* output = nets[n]->input_blobs()[0];
+    for (int i = 0; i < expected->count(); ++i) {
+      EXPECT_NEAR(expected->cpu_diff()[i], output->cpu_diff()[i], 1e-4);
+    }
+    ASSERT_EQ(this->net_->params().size(), nets[n]->params().size());
+    for (int j = 0; j < nets[n]->params().size(); ++j) {
+      const Blob<Dtype>* expected_param = this->net_->params()[j].get();
+      const Blob<Dtype>* output_param = nets[n]->params()[j].get();
+      for (int i = 0; i < expected_param->count(); ++i) {
+        EXPECT_NEAR(expected_param->cpu_diff()[i],
+            output_param->cpu_diff()[i], 1e-4);
+      }
+    }
+  }
+}
+
+TYPED_TEST(NetTest, TestRecomputeKeepsUnreplayableLayers) {
+  typedef typename TypeParam::Dtype Dtype;
+  // DUMMY_DATA has no bottoms to run again from, so its tops are kept even
+  // though it asks to be recomputed; the RELU after it still is.
+  const string proto =
+      "name: 'UnreplayableNetwork' "
+      "layers: { "
+      "  name: 'data' "
+      "  type: DUMMY_DATA "
+      "  dummy_data_param { "
+      "    num: 2 channels: 3 height: 1 width: 1 "
+      "    num: 2 channels: 1 height: 1 width: 1 "
+      "    data_filler { type: 'gaussian' } "
+      "  } "
+      "  top: 'data' "
+      "  top: 'target' "
+      "  recompute: true "
+      "} "
+      "layers: { "
+      "  name: 'ip1' "
+      "  type: INNER_PRODUCT "
+      "  inner_product_param { "
+      "    num_output: 4 "
+      "    weight_filler { type: 'gaussian' } "
+      "  } "
+      "  bottom: 'data' "
+      "  top: 'ip1' "
+      "} "
+      "layers: { "
+      "  name: 'relu1' "
+      "  type: RELU "
+      "  bottom: 'ip1' "
+      "  top: 'relu1' "
+      "  recompute: true "
+      "} "
+      "layers: { "
+      "  name: 'ip2' "
+      "  type: INNER_PRODUCT "
+      "  inner_product_param { "
+      "    num_output: 1 "
+      "    weight_filler { type: 'gaussian' } "
+      "  } "
+      "  bottom: 'relu1' "
+      "  top: 'ip2' "
+      "} "
+      "layers: { "
+      "  name: 'loss' "
+      "  type: EUCLIDEAN_LOSS "
+      "  bottom: 'ip2' "
+      "  bottom: 'target' "
+      "  top: 'loss' "
+      "} ";
+  Caffe::set_phase(Caffe::TRAIN);
+  this->InitNetFromProtoString(proto);
+  EXPECT_EQ(1, this->net_->activation_buffers().size());
+  EXPECT_FALSE(this->net_->blob_by_name("data")->is_view());
+  EXPECT_FALSE(this->net_->blob_by_name("target")->is_view());
+  EXPECT_TRUE(this->net_->blob_by_name("relu1")->is_view());
+  this->net_->ForwardPrefilled();
+  this->net_->Backward();
+}
+
+TYPED_TEST(NetTest, TestShareDiffsUnwrittenTop) {
+  typedef typename TypeParam::Dtype Dtype;
+  // 'score' only feeds Accuracy, so Backward never writes its diff, but
+  // Slice reads it: it must stay zero rather than share a buffer.
+  const string proto =
+      "name: 'UnwrittenTopNetwork' "
+      "input: 'data' "
+      "input_dim: 4 "
+      "input_dim: 3 "
+      "input_dim: 1 "
+      "input_dim: 1 "
+      "input: 'label' "
+      "input_dim: 4 "
+      "input_dim: 1 "
+      "input_dim: 1 "
+      "input_dim: 1 "
+      "input: 'target' "
+      "input_dim: 4 "
+      "input_dim: 1 "
+      "input_dim: 1 "
+      "input_dim: 1 "
+      "layers: { "
+      "  name: 'ip1' "
+      "  type: INNER_PRODUCT "
+      "  inner_product_param { "
+      "    num_output: 5 "
+      "    weight_filler { type: 'gaussian' } "
+      "  } "
+      "  bottom: 'data' "
+      "  top: 'ip1' "
+      "} "
+      "layers: { "
+      "  name: 'ip2' "
+      "  type: INNER_PRODUCT "
+      "  inner_product_param { "
+      "    num_output: 3 "
+      "    weight_filler { type: 'gaussian' } "
+      "  } "
+      "  bottom: 'ip1' "
+      "  top: 'ip2' "
+      "} "
+      "layers: { "
+      "  name: 'slice' "
+      "  type: SLICE "
+      "  slice_param { slice_dim: 1 slice_point: 2 } "
+      "  bottom: 'ip2' "
+      "  top: 'score' "
+      "  top: 'regress' "
+      "} "
+      "layers: { "
+      "  name: 'ip3' "
+      "  type: INNER_PRODUCT "
+      "  inner_product_param { "
+      "    num_output: 1 "
+      "    weight_filler { type: 'gaussian' } "
+      "  } "
+      "  bottom: 'regress' "
+      "  top: 'ip3' "
+      "} "
+      "layers: { "
+      "  name: 'loss' "
+      "  type: EUCLIDEAN_LOSS "
+      "  bottom: 'ip3' "
+      "  bottom: 'target' "
+      "  top: 'loss' "
+      "} "
+      "layers: { "
+      "  name: 'accuracy' "
+      "  type: ACCURACY "
+      "  bottom: 'score' "
+      "  bottom: 'label' "
+      "  top: 'accuracy' "
+      "} ";
+  Caffe::set_phase(Caffe::TRAIN);
+  this->InitNetFromProtoString(proto);
+  NetParameter trained_param;
+  this->net_->ToProto(&trained_param);
+  this->net_->CopyTrainedLayersFrom(trained_param);
+  NetParameter param;
+  CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+  param.set_share_diffs(true);
+  Net<Dtype> shared_diffs_net(param);
+  shared_diffs_net.CopyTrainedLayersFrom(trained_param);
+  EXPECT_TRUE(shared_diffs_net.blob_by_name("score")->diff()->parent().get()
+      == NULL);
+
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  Net<Dtype>* nets[] = { this->net_.get(), &shared_diffs_net };
+  for (int iter = 0; iter < 2; ++iter) {
+    filler.Fill(this->net_->input_blobs()[0]);
+    filler.Fill(this->net_->input_blobs()[2]);
+    Dtype* label = this->net_->input_blobs()[1]->mutable_cpu_data();
+    for (int i = 0; i < 4; ++i) {
+      label[i] = i % 2;
+    }
+    for (int n = 0; n < 2; ++n) {
+      for (int i = 0; i < 3; ++i) {
+        nets[n]->input_blobs()[i]->CopyFrom(*this->net_->input_blobs()[i]);
+      }
+      nets[n]->ForwardPrefilled();
+      nets[n]->Backward();
+    }
+    ASSERT_EQ(this->net_->params().size(), shared_diffs_net.params().size());
+    for (int j = 0; j < shared_diffs_net.params().size(); ++j) {
+      const Blob<Dtype>* expected_param = this->net_->params()[j].get();
+      const Blob<Dtype>* output_param = shared_diffs_net.params()[j].get();
+      for (int i = 0; i < expected_param->count(); ++i) {
+        EXPECT_NEAR(expected_param->cpu_diff()[i],
+            output_param->cpu_diff()[i], 1e-4);
+      }
+    }
+  }
+}
+
+TYPED_TEST(NetTest, TestShareBuffersGrowingInput) {
+  typedef typename TypeParam::Dtype Dtype;
+  const string proto =
+      "name: 'GrowingNetwork' "
+      "force_backward: true "
+      "input: 'data' "
+      "input_dim: 1 "
+      "input_dim: 3 "
+      "input_dim: 6 "
+      "input_dim: 6 "
+      "input: 'target' "
+      "input_dim: 1 "
+      "input_dim: 2 "
+      "input_dim: 6 "
+      "input_dim: 6 "
+      "layers: { "
+      "  name: 'conv1' "
+      "  type: CONVOLUTION "
+      "  convolution_param { "
+      "    num_output: 4 "
+      "    kernel_size: 3 "
+      "    pad: 1 "
+      "    weight_filler { type: 'gaussian' } "
+      "    bias_filler { type: 'gaussian' } "
+      "  } "
+      "  bottom: 'data' "
+      "  top: 'conv1' "
+      "} "
+      "layers: { "
+      "  name: 'relu1' "
+      "  type: RELU "
+      "  bottom: 'conv1' "
+      "  top: 'conv1' "
+      "} "
+      "layers: { "
+      "  name: 'conv2' "
+      "  type: CONVOLUTION "
+      "  convolution_param { "
+      "    num_output: 5 "
+      "    kernel_size: 1 "
+      "    weight_filler { type: 'gaussian' } "
+      "  } "
+      "  bottom: 'conv1' "
+      "  top: 'conv2' "
+      "} "
+      "layers: { "
+      "  name: 'conv3' "
+      "  type: CONVOLUTION "
+      "  convolution_param { "
+      "    num_output: 2 "
+      "    kernel_size: 1 "
+      "    weight_filler { type: 'gaussian' } "
+      "  } "
+      "  bottom: 'conv2' "
+      "  top: 'score' "
+      "} "
+      "layers: { "
+      "  name: 'loss' "
+      "  type: EUCLIDEAN_LOSS "
+      "  bottom: 'score' "
+      "  bottom: 'target' "
+      "  top: 'loss' "
+      "} ";
+  Caffe::set_phase(Caffe::TRAIN);
+  this->InitNetFromProtoString(proto);
+  NetParameter trained_param;
+  this->net_->ToProto(&trained_param);
+  this->net_->CopyTrainedLayersFrom(trained_param);
+  NetParameter param;
+  CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+  param.set_share_activations(true);
+  Net<Dtype> shared_activations_net(param);
+  shared_activations_net.CopyTrainedLayersFrom(trained_param);
+  param.set_share_activations(false);
+  param.set_share_diffs(true);
+  Net<Dtype> shared_diffs_net(param);
+  shared_diffs_net.CopyTrainedLayersFrom(trained_param);
+
+  // Inputs larger than the ones the buffers were sized for, without a call to
+  // Reshape: the blobs outgrow their views while the nets run forward.
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  for (int i = 0; i < 2; ++i) {
+    Blob<Dtype>* input = this->net_->input_blobs()[i];
+    input->Reshape(2, input->channels(), 9, 9);
+    filler.Fill(input);
+    shared_activations_net.input_blobs()[i]->ReshapeLike(*input);
+    shared_activations_net.input_blobs()[i]->CopyFrom(*input);
+    shared_diffs_net.input_blobs()[i]->ReshapeLike(*input);
+    shared_diffs_net.input_blobs()[i]->CopyFrom(*input);
+  }
+  Dtype loss, shared_activations_loss, shared_diffs_loss;
+  this->net_->ForwardPrefilled(&loss);
+  this->net_->Backward();
+  shared_activations_net.ForwardPrefilled(&shared_activations_loss);
+  shared_diffs_net.ForwardPrefilled(&shared_diffs_loss);
+  shared_diffs_net.Backward();
+  EXPECT_NEAR(loss, shared_activations_loss, 1e-4);
+  EXPECT_NEAR(loss, shared_diffs_loss, 1e-4);
+  const Blob<Dtype>* expected = this->net_->input_blobs()[0];
+  const Blob<Dtype>* output = shared_diffs_net.input_blobs()[0];
+  ASSERT_EQ(expected->count(), output->count());
+  for (int i = 0; i < expected->count(); ++i) {
+    EXPECT_NEAR(expected->cpu_diff()[i], output->cpu_diff()[i], 1e-4);
+  }
+  // The grown blobs are still views of the buffers, which grew with them.
+  const char* shared[] = { "conv1", "conv2", "score" };
+  for (int n = 0; n < 3; ++n) {
+    const Blob<Dtype>* blob =
+        shared_activations_net.blob_by_name(shared[n]).get();
+    EXPECT_EQ(2 * 9 * 9, blob->num() * blob->height() * blob->width());
+    bool data_shared = false;
+    for (int i = 0; i < shared_activations_net.activation_buffers().size();
+         ++i) {
+      data_shared |= blob->data()->parent()
+          == shared_activations_net.activation_buffers()[i]->data();
+    }
+    EXPECT_TRUE(data_shared) << shared[n];
+    blob = shared_diffs_net.blob_by_name(shared[n]).get();
+    bool diff_shared = false;
+    for (int i = 0; i < shared_diffs_net.diff_buffers().size(); ++i) {
+      diff_shared |= blob->diff()->parent()
+          == shared_diffs_net.diff_buffers()[i]->diff();
+    }
+    EXPECT_TRUE(diff_shared) << shared[n];
+  }
+}
+
+TYPED_TEST(NetTest, TestParallelBranches) {
+  typedef typename TypeParam::Dtype Dtype;
+  const string proto =
+      "name: 'BranchingNetwork' "
+      "force_backward: true "
+      "input: 'data' "
+      "input_dim: 2 "
+      "input_dim: 3 "
+      "input_dim: 5 "
+      "input_dim: 5 "
+      "input: 'target' "
+      "input_dim: 2 "
+      "input_dim: 3 "
+      "input_dim: 1 "
+      "input_dim: 1 "
+      "layers: { "
+      "  name: 'conv_a' "
+      "  type: CONVOLUTION "
+      "  convolution_param { "
+      "    num_output: 4 "
+      "    kernel_size: 3 "
+      "    weight_filler { type: 'gaussian' } "
+      "    bias_filler { type: 'gaussian' } "
+      "  } "
+      "  bottom: 'data' "
+      "  top: 'conv_a' "
+      "} "
+      "layers: { "
+      "  name: 'relu_a' "
+      "  type: RELU "
+      "  bottom: 'conv_a' "
+      "  top: 'conv_a' "
+      "} "
+      "layers: { "
+      "  name: 'conv_b' "
+      "  type: CONVOLUTION "
+      "  convolution_param { "
+      "    num_output: 2 "
+      "    kernel_size: 3 "
+      "    weight_filler { type: 'gaussian' } "
+      "  } "
+      "  bottom: 'data' "
+      "  top: 'conv_b' "
+      "} "
+      "layers: { "
+      "  name: 'drop_b' "
+      "  type: DROPOUT "
+      "  bottom: 'conv_b' "
+      "  top: 'drop_b' "
+      "} "
+      "layers: { "
+      "  name: 'concat' "
+      "  type: CONCAT "
+      "  bottom: 'conv_a' "
+      "  bottom: 'drop_b' "
+      "  top: 'concat' "
+      "} "
+      "layers: { "
+      "  name: 'ip' "
+      "  type: INNER_PRODUCT "
+      "  inner_product_param { "
+      "    num_output: 3 "
+      "    weight_filler { type: 'gaussian' } "
+      "  } "
+      "  bottom: 'concat' "
+      "  top: 'ip' "
+      "} "
+      "layers: { "
+      "  name: 'loss' "
+      "  type: EUCLIDEAN_LOSS "
+      "  bottom: 'ip' "
+      "  bottom: 'target' "
+      "  top: 'loss' "
+      "} ";
+  Caffe::set_phase(Caffe::TRAIN);
+  Caffe::set_random_seed(this->seed_);
+  this->InitNetFromProtoString(proto);
+  NetParameter param;
+  CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+  param.set_parallel_branches(true);
+  Caffe::set_random_seed(this->seed_);
+  Net<Dtype> parallel_net(param);
+  // The split of data, then conv_a with conv_b, and relu_a with drop_b.
+  const vector<vector<int> >& waves = parallel_net.layer_waves();
+  ASSERT_EQ(6, waves.size());
+  EXPECT_EQ(1, waves[0].size());
+  EXPECT_EQ(2, waves[1].size());
+  EXPECT_EQ(2, waves[2].size());
+  EXPECT_TRUE(this->net_->layer_waves().empty());
+
+  // The nets compute the same loss and gradients, dropping the same inputs.
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->net_->input_blobs()[0]);
+  filler.Fill(this->net_->input_blobs()[1]);
+  Net<Dtype>* nets[] = { this->net_.get(), &parallel_net };
+  Dtype loss[2];
+  for (int n = 0; n < 2; ++n) {
+    for (int i = 0; i < 2; ++i) {
+      nets[n]->input_blobs()[i]->CopyFrom(*this->net_->input_blobs()[i]);
+    }
+    Caffe::set_random_seed(this->seed_);
+    nets[n]->ForwardPrefilled(&loss[n]);
+    nets[n]->Backward();
+  }
+  EXPECT_NEAR(loss[0], loss[1], 1e-4);
+  const Blob<Dtype>* expected = this->net_->input_blobs()[0];
+  const Blob<Dtype>* output = parallel_net.input_blobs()[0];
+  for (int i = 0; i < expected->count(); ++i) {
+    EXPECT_NEAR(expected->cpu_diff()[i], output->cpu_diff()[i], 1e-4);
+  }
+  ASSERT_EQ(this->net_->params().size(), parallel_net.params().size());
+  for (int j = 0; j < parallel_net.params().size(); ++j) {
+    const Blob<Dtype>* expected_param = this->net_->params()[j].get();
+    const Blob<Dtype>* output_param = parallel_net.params()[j].get();
+    for (int i = 0; i < expected_param->count(); ++i) {
+      EXPECT_NEAR(expected_param->cpu_data()[i],
+          output_param->cpu_data()[i], 1e-4);
+      EXPECT_NEAR(expected_param->cpu_diff()[i],
+          output_param->cpu_diff()[i], 1e-4);
+    }
+  }
+}
+
+// Runs a net forward from a thread of its own, in the given mode and the
+// TEST phase.
+template <typename Dtype>
+static void ForwardInThread(Net<Dtype>* net, const Caffe::Brew mode) {
+  Caffe::set_mode(mode);
+  Caffe::set_phase(Caffe::TEST);
+  for (int i = 0; i < 10; ++i) {
+    net->ForwardPrefilled();
+  }
+}
+
+TYPED_TEST(NetTest, TestReplica) {
+  typedef typename TypeParam::Dtype Dtype;
+  const string proto =
+      "name: 'ReplicatedNetwork' "
+      "input: 'data' "
+      "input_dim: 2 "
+      "input_dim: 3 "
+      "input_dim: 6 "
+      "input_dim: 6 "
+      "layers: { "
+      "  name: 'conv' "
+      "  type: CONVOLUTION "
+      "  convolution_param { "
+      "    num_output: 4 "
+      "    kernel_size: 3 "
+      "    weight_filler { type: 'gaussian' } "
+      "    bias_filler { type: 'gaussian' } "
+      "  } "
+      "  bottom: 'data' "
+      "  top: 'conv' "
+      "} "
+      "layers: { "
+      "  name: 'relu' "
+      "  type: RELU "
+      "  bottom: 'conv' "
+      "  top: 'conv' "
+      "} "
+      "layers: { "
+      "  name: 'drop' "
+      "  type: DROPOUT "
+      "  bottom: 'conv' "
+      "  top: 'drop' "
+      "} "
+      "layers: { "
+      "  name: 'ip' "
+      "  type: INNER_PRODUCT "
+      "  inner_product_param { "
+      "    num_output: 5 "
+      "    weight_filler { type: 'gaussian' } "
+      "  } "
+      "  bottom: 'drop' "
+      "  top: 'ip' "
+      "} "
+      "layers: { "
+      "  name: 'prob' "
+      "  type: SOFTMAX "
+      "  bottom: 'ip' "
+      "  top: 'prob' "
+      "  include: { phase: TEST } "
+      "} ";
+  Caffe::set_phase(Caffe::TEST);
+  this->InitNetFromProtoString(proto);
+  NetParameter param;
+  CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+  // The replica keeps the phase of the net, not the one of this thread.
+  Caffe::set_phase(Caffe::TRAIN);
+  Net<Dtype> replica(param, this->net_.get());
+  Caffe::set_phase(Caffe::TEST);
+  EXPECT_TRUE(replica.has_layer("prob"));
+  ASSERT_EQ(this->net_->params().size(), replica.params().size());
+  for (int i = 0; i < replica.params().size(); ++i) {
+    EXPECT_EQ(this->net_->params()[i]->cpu_data(),
+        replica.params()[i]->cpu_data());
+  }
+  EXPECT_NE(this->net_->blob_by_name("conv")->cpu_data(),
+      replica.blob_by_name("conv")->cpu_data());
+
+  // Run forward one input at a time, then both at once from two threads.
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  Net<Dtype>* nets[] = { this->net_.get(), &replica };
+  Blob<Dtype> expected[2];
+  for (int n = 0; n < 2; ++n) {
+    filler.Fill(nets[n]->input_blobs()[0]);
+    nets[n]->ForwardPrefilled();
+    expected[n].CopyFrom(*nets[n]->output_blobs()[0], false, true);
+  }
+  boost::thread thread(ForwardInThread<Dtype>, &replica, Caffe::mode());
+  ForwardInThread(this->net_.get(), Caffe::mode());
+  thread.join();
+  for (int n = 0; n < 2; ++n) {
+    const Blob<Dtype>* output = nets[n]->output_blobs()[0];
+    ASSERT_EQ(expected[n].count(), output->count());
+    for (int i = 0; i < output->count(); ++i) {
+      EXPECT_NEAR(expected[n].cpu_data()[i], output->cpu_data()[i], 1e-6);
+    }
+  }
+}
+
+TYPED_TEST(NetTest, TestFeatureCache) {
+  typedef typename TypeParam::Dtype Dtype;
+  // Fine-tunes ip on top of a frozen conv.
+  const string proto =
+      "name: 'FineTuningNetwork' "
+      "input: 'data' "
+      "input_dim: 2 "
+      "input_dim: 3 "
+      "input_dim: 5 "
+      "input_dim: 5 "
+      "input: 'label' "
+      "input_dim: 2 "
+      "input_dim: 1 "
+      "input_dim: 1 "
+      "input_dim: 1 "
+      "layers: { "
+      "  name: 'conv' "
+      "  type: CONVOLUTION "
+      "  convolution_param { "
+      "    num_output: 4 "
+      "    kernel_size: 3 "
+      "    weight_filler { type: 'gaussian' } "
+      "    bias_filler { type: 'gaussian' } "
+      "  } "
+      "  blobs_lr: 0 "
+      "  blobs_lr: 0 "
+      "  bottom: 'data' "
+      "  top: 'conv' "
+      "} "
+      "layers: { "
+      "  name: 'relu' "
+      "  type: RELU "
+      "  bottom: 'conv' "
+      "  top: 'conv' "
+      "} "
+      "layers: { "
+      "  name: 'ip' "
+      "  type: INNER_PRODUCT "
+      "  inner_product_param { "
+      "    num_output: 3 "
+      "    weight_filler { type: 'gaussian' } "
+      "  } "
+      "  bottom: 'conv' "
+      "  top: 'ip' "
+      "} "
+      "layers: { "
+      "  name: 'loss' "
+      "  type: SOFTMAX_LOSS "
+      "  bottom: 'ip' "
+      "  bottom: 'label' "
+      "  top: 'loss' "
+      "} ";
+  Caffe::set_phase(Caffe::TRAIN);
+  Caffe::set_random_seed(this->seed_);
+  this->InitNetFromProtoString(proto);
+  Caffe::set_random_seed(this->seed_);
+  NetParameter param;
+  CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+  Net<Dtype> cached_net(param);
+  EXPECT_EQ(2, cached_net.num_frozen_layers());
+  shared_ptr<FeatureCache<Dtype> > cache(new FeatureCache<Dtype>(1 << 20));
+  cached_net.set_feature_cache(cache);
+
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  Net<Dtype>* nets[] = { this->net_.get(), &cached_net };
+  // The first input twice, then with its items swapped, as a shuffling data
+  // layer would, and then another.
+  for (int iter = 0; iter < 4; ++iter) {
+    Blob<Dtype>* data = this->net_->input_blobs()[0];
+    if (iter == 0 || iter == 3) {
+      filler.Fill(data);
+      for (int n = 0; n < 2; ++n) {
+        this->net_->input_blobs()[1]->mutable_cpu_data()[n] = (iter + n) % 3;
+      }
+    } else if (iter == 2) {
+      const int dim = data->count() / 2;
+      Dtype* data_items = data->mutable_cpu_data();
+      std::swap_ranges(data_items, data_items + dim, data_items + dim);
+    }
+    cached_net.input_blobs()[0]->CopyFrom(*this->net_->input_blobs()[0]);
+    cached_net.input_blobs()[1]->CopyFrom(*this->net_->input_blobs()[1]);
+    Dtype loss[2];
+    for (int n = 0; n < 2; ++n) {
+      for (int i = 0; i < nets[n]->params().size(); ++i) {
+        Blob<Dtype>* param_blob = nets[n]->params()[i].get();
+        caffe_set(param_blob->count(), Dtype(0),
+            param_blob->mutable_cpu_diff());
+      }
+      nets[n]->ForwardPrefilled(&loss[n]);
+      nets[n]->Backward();
+    }
+    EXPECT_NEAR(loss[0], loss[1], 1e-6);
+    const Blob<Dtype>& ip_diff = *this->net_->layer_by_name("ip")->blobs()[0];
+    const Blob<Dtype>& cached_ip_diff =
+        *cached_net.layer_by_name("ip")->blobs()[0];
+    for (int i = 0; i < ip_diff.count(); ++i) {
+      EXPECT_NEAR(ip_diff.cpu_diff()[i], cached_ip_diff.cpu_diff()[i], 1e-6);
+    }
+  }
+  // Items are counted one by one.
+  EXPECT_EQ(4, cache->hits());
+  EXPECT_EQ(4, cache->misses());
+  EXPECT_EQ(4, cache->size());
+  // Frozen layers with the same weights but other parameters miss.
+  param.mutable_layers(1)->mutable_relu_param()->set_negative_slope(0.1);
+  Net<Dtype> changed_net(param);
+  NetParameter trained_param;
+  cached_net.ToProto(&trained_param);
+  changed_net.CopyTrainedLayersFrom(trained_param);
+  changed_net.set_feature_cache(cache);
+  changed_net.input_blobs()[0]->CopyFrom(*this->net_->input_blobs()[0]);
+  changed_net.input_blobs()[1]->CopyFrom(*this->net_->input_blobs()[1]);
+  changed_net.ForwardPrefilled();
+  EXPECT_EQ(4, cache->hits());
+  EXPECT_EQ(6, cache->misses());
+  EXPECT_EQ(6, cache->size());
+}
+
 }  // namespace caffe
@@ -368,6 +368,36 @@ TYPED_TEST(NeuronLayerTest, TestDropoutGradientTest) {
       this->blob_top_vec_);
 }
 
+TYPED_TEST(NeuronLayerTest, TestDropoutChannel) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  Caffe::set_phase(Caffe::TRAIN);
+  DropoutChannelLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  // Every channel is either dropped or scaled as a whole.
+  const int spatial_dim = this->blob_bottom_->height() *
+      this->blob_bottom_->width();
+  const Dtype* bottom_data = this->blob_bottom_->cpu_data();
+  const Dtype* top_data = this->blob_top_->cpu_data();
+  for (int p = 0; p < this->blob_bottom_->count() / spatial_dim; ++p) {
+    const bool kept = top_data[p * spatial_dim] != 0;
+    for (int i = p * spatial_dim; i < (p + 1) * spatial_dim; ++i) {
+      EXPECT_EQ(top_data[i], kept ? bottom_data[i] * 2 : 0);
+    }
+  }
+}
+
+TYPED_TEST(NeuronLayerTest, TestDropoutChannelGradient) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  Caffe::set_phase(Caffe::TRAIN);
+  DropoutChannelLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-2, 1e-3);
+  checker.CheckGradientEltwise(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_);
+}
+
 TYPED_TEST(NeuronLayerTest, TestBNLL) {
   typedef typename TypeParam::Dtype Dtype;
   LayerParameter layer_param;
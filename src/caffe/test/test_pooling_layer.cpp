@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <cfloat>
 #include <cstring>
 #include <vector>
 
@@ -537,6 +539,185 @@ TYPED_TEST(PoolingLayerTest, TestGradientMaxTopMask) {
   }
 }
 
+TYPED_TEST(PoolingLayerTest, TestForwardStride2FastPaths) {
+  typedef typename TypeParam::Dtype Dtype;
+  // Odd sizes so that the last output row and column use clipped windows.
+  this->blob_bottom_->Reshape(2, 3, 7, 9);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  this->blob_top_vec_.push_back(this->blob_top_mask_);
+  for (int kernel = 2; kernel <= 3; ++kernel) {
+    for (int method = 0; method < 2; ++method) {
+      LayerParameter layer_param;
+      PoolingParameter* pooling_param = layer_param.mutable_pooling_param();
+      pooling_param->set_kernel_size(kernel);
+      pooling_param->set_stride(2);
+      const bool is_max = (method == 0);
+      pooling_param->set_pool(is_max ? PoolingParameter_PoolMethod_MAX :
+          PoolingParameter_PoolMethod_AVE);
+      if (!is_max) {
+        this->blob_top_vec_.pop_back();
+      }
+      PoolingLayer<Dtype> layer(layer_param);
+      layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+      layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+      const int height = 7, width = 9;
+      const int pooled_height = this->blob_top_->height();
+      const int pooled_width = this->blob_top_->width();
+      for (int p = 0; p < 2 * 3; ++p) {
+        const Dtype* in = this->blob_bottom_->cpu_data() + p * height * width;
+        for (int ph = 0; ph < pooled_height; ++ph) {
+          for (int pw = 0; pw < pooled_width; ++pw) {
+            const int hend = std::min(ph * 2 + kernel, height);
+            const int wend = std::min(pw * 2 + kernel, width);
+            Dtype expected = is_max ? -FLT_MAX : 0;
+            int expected_index = -1;
+            for (int h = ph * 2; h < hend; ++h) {
+              for (int w = pw * 2; w < wend; ++w) {
+                if (is_max && in[h * width + w] > expected) {
+                  expected = in[h * width + w];
+                  expected_index = h * width + w;
+                } else if (!is_max) {
+                  expected += in[h * width + w];
+                }
+              }
+            }
+            if (!is_max) {
+              expected /= (hend - ph * 2) * (wend - pw * 2);
+            }
+            const int index = (p * pooled_height + ph) * pooled_width + pw;
+            EXPECT_NEAR(this->blob_top_->cpu_data()[index], expected, 1e-6);
+            if (is_max) {
+              EXPECT_EQ(this->blob_top_mask_->cpu_data()[index],
+                  expected_index);
+            }
+          }
+        }
+      }
+      if (!is_max) {
+        this->blob_top_vec_.push_back(this->blob_top_mask_);
+      }
+    }
+  }
+}
+
+TYPED_TEST(PoolingLayerTest, TestGradientMax2x2Stride2) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  PoolingParameter* pooling_param = layer_param.mutable_pooling_param();
+  pooling_param->set_kernel_size(2);
+  pooling_param->set_stride(2);
+  pooling_param->set_pool(PoolingParameter_PoolMethod_MAX);
+  PoolingLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-4, 1e-2);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_);
+}
+
+TYPED_TEST(PoolingLayerTest, TestBackwardMaxTestPhase) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  PoolingParameter* pooling_param = layer_param.mutable_pooling_param();
+  pooling_param->set_kernel_size(3);
+  pooling_param->set_stride(2);
+  pooling_param->set_pool(PoolingParameter_PoolMethod_MAX);
+  vector<bool> propagate_down(1, true);
+  Blob<Dtype> train_diff;
+  // The TEST phase forward skips the internal argmax; backward must still
+  // route the gradient exactly as in the TRAIN phase.
+  for (int phase = 0; phase < 2; ++phase) {
+    Caffe::set_phase(phase == 0 ? Caffe::TRAIN : Caffe::TEST);
+    PoolingLayer<Dtype> layer(layer_param);
+    layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    Dtype* top_diff = this->blob_top_->mutable_cpu_diff();
+    for (int i = 0; i < this->blob_top_->count(); ++i) {
+      top_diff[i] = i % 7;
+    }
+    layer.Backward(this->blob_top_vec_, propagate_down,
+        this->blob_bottom_vec_);
+    if (phase == 0) {
+      train_diff.CopyFrom(*this->blob_bottom_, true, true);
+    } else {
+      for (int i = 0; i < this->blob_bottom_->count(); ++i) {
+        EXPECT_EQ(this->blob_bottom_->cpu_diff()[i], train_diff.cpu_diff()[i]);
+      }
+    }
+  }
+  Caffe::set_phase(Caffe::TRAIN);
+}
+
+// Pooling into COMPACT masks and unpooling from them must give exactly the
+// results of the INDEX format, for 2, 8 and 32 bit switches.
+TYPED_TEST(PoolingLayerTest, TestCompactMaskUnpool) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->blob_bottom_->Reshape(2, 3, 20, 19);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  const int kernels[] = {2, 3, 17};
+  const int strides[] = {2, 2, 3};
+  for (int k = 0; k < 3; ++k) {
+    Blob<Dtype> pooled, mask, unpooled, expected_unpooled, expected_diff,
+        expected_pool_diff;
+    vector<Blob<Dtype>*> pool_top_vec;
+    pool_top_vec.push_back(&pooled);
+    pool_top_vec.push_back(&mask);
+    vector<Blob<Dtype>*> unpool_top_vec(1, &unpooled);
+    vector<bool> propagate_down(2, true);
+    propagate_down[1] = false;
+    for (int format = 0; format < 2; ++format) {
+      const PoolingParameter_MaskFormat mask_format = format == 0 ?
+          PoolingParameter_MaskFormat_INDEX :
+          PoolingParameter_MaskFormat_COMPACT;
+      LayerParameter pool_param;
+      pool_param.mutable_pooling_param()->set_kernel_size(kernels[k]);
+      pool_param.mutable_pooling_param()->set_stride(strides[k]);
+      pool_param.mutable_pooling_param()->set_mask_format(mask_format);
+      PoolingLayer<Dtype> pool_layer(pool_param);
+      pool_layer.SetUp(this->blob_bottom_vec_, pool_top_vec);
+      pool_layer.Forward(this->blob_bottom_vec_, pool_top_vec);
+      LayerParameter unpool_param;
+      UnpoolingParameter* unpooling_param =
+          unpool_param.mutable_unpooling_param();
+      unpooling_param->set_kernel_size(kernels[k]);
+      unpooling_param->set_stride(strides[k]);
+      unpooling_param->set_unpool_h(20);
+      unpooling_param->set_unpool_w(19);
+      unpooling_param->set_mask_format(mask_format);
+      UnpoolingLayer<Dtype> unpool_layer(unpool_param);
+      unpool_layer.SetUp(pool_top_vec, unpool_top_vec);
+      unpool_layer.Forward(pool_top_vec, unpool_top_vec);
+      for (int i = 0; i < unpooled.count(); ++i) {
+        unpooled.mutable_cpu_diff()[i] = i % 11;
+      }
+      unpool_layer.Backward(unpool_top_vec, propagate_down, pool_top_vec);
+      pool_layer.Backward(pool_top_vec, propagate_down,
+          this->blob_bottom_vec_);
+      if (format == 0) {
+        expected_unpooled.CopyFrom(unpooled, false, true);
+        expected_diff.CopyFrom(pooled, true, true);
+        expected_pool_diff.CopyFrom(*this->blob_bottom_, true, true);
+        continue;
+      }
+      if (kernels[k] < 17) {
+        EXPECT_LT(mask.count(), pooled.count());
+      }
+      for (int i = 0; i < unpooled.count(); ++i) {
+        EXPECT_EQ(unpooled.cpu_data()[i], expected_unpooled.cpu_data()[i]);
+      }
+      for (int i = 0; i < pooled.count(); ++i) {
+        EXPECT_EQ(pooled.cpu_diff()[i], expected_diff.cpu_diff()[i]);
+      }
+      for (int i = 0; i < this->blob_bottom_->count(); ++i) {
+        EXPECT_EQ(this->blob_bottom_->cpu_diff()[i],
+            expected_pool_diff.cpu_diff()[i]);
+      }
+    }
+  }
+}
+
 TYPED_TEST(PoolingLayerTest, TestForwardAve) {
   typedef typename TypeParam::Dtype Dtype;
   LayerParameter layer_param;
@@ -65,13 +65,17 @@ class PowerLayerTest : public MultiDeviceTest<TypeParam> {
     layer_param.mutable_power_param()->set_shift(shift);
     PowerLayer<Dtype> layer(layer_param);
     if (power != Dtype(0) && power != Dtype(1) && power != Dtype(2)) {
-      // Avoid NaNs by forcing (shift + scale * x) >= 0
+      // Avoid NaNs by forcing (shift + scale * x) >= 0, and stay clear of
+      // min_value, where the gradient is too steep for finite differences.
       Dtype* bottom_data = this->blob_bottom_->mutable_cpu_data();
       Dtype min_value = -shift / scale;
       for (int i = 0; i < this->blob_bottom_->count(); ++i) {
         if (bottom_data[i] < min_value) {
           bottom_data[i] = min_value + (min_value - bottom_data[i]);
         }
+        if (bottom_data[i] < min_value + 0.1) {
+          bottom_data[i] += 0.1;
+        }
       }
     }
     GradientChecker<Dtype> checker(1e-2, 1e-2, 1701, 0., 0.01);
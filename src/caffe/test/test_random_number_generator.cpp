@@ -6,6 +6,7 @@
 #include "caffe/common.hpp"
 #include "caffe/syncedmem.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/philox.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
 
@@ -396,6 +397,83 @@ TYPED_TEST(RandomNumberGeneratorTest, TestRngBernoulliTimesBernoulli) {
   EXPECT_NEAR(true_mean, sample_p, bound);
 }
 
+TYPED_TEST(RandomNumberGeneratorTest, TestPhiloxKnownAnswer) {
+  // Known answers of Philox4x32-10 from the Random123 distribution.
+  const uint32_t ctr[3][4] = {
+    { 0x00000000, 0x00000000, 0x00000000, 0x00000000 },
+    { 0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff },
+    { 0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344 } };
+  const uint32_t key[3][2] = {
+    { 0x00000000, 0x00000000 },
+    { 0xffffffff, 0xffffffff },
+    { 0xa4093822, 0x299f31d0 } };
+  const uint32_t expected[3][4] = {
+    { 0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8 },
+    { 0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd },
+    { 0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1 } };
+  for (int i = 0; i < 3; ++i) {
+    uint32_t out[4];
+    philox4x32_10(ctr[i], key[i], out);
+    for (int j = 0; j < 4; ++j) {
+      EXPECT_EQ(expected[i][j], out[j]);
+    }
+  }
+}
+
+TYPED_TEST(RandomNumberGeneratorTest, TestPhiloxGaussian) {
+  const TypeParam mu = -2;
+  const TypeParam sigma = 3;
+  TypeParam* gaussian_data =
+      static_cast<TypeParam*>(this->data_->mutable_cpu_data());
+  caffe_philox_gaussian(this->sample_size_, mu, sigma, gaussian_data);
+  this->RngGaussianChecks(mu, sigma, gaussian_data);
+}
+
+TYPED_TEST(RandomNumberGeneratorTest, TestPhiloxUniform) {
+  const TypeParam lower = -7.3;
+  const TypeParam upper = -2.3;
+  TypeParam* uniform_data =
+      static_cast<TypeParam*>(this->data_->mutable_cpu_data());
+  caffe_philox_uniform(this->sample_size_, lower, upper, uniform_data);
+  this->RngUniformChecks(lower, upper, uniform_data);
+}
+
+TYPED_TEST(RandomNumberGeneratorTest, TestPhiloxBernoulli) {
+  const TypeParam p = 0.3;
+  int* bernoulli_data = static_cast<int*>(this->int_data_->mutable_cpu_data());
+  caffe_philox_bernoulli(this->sample_size_, p, bernoulli_data);
+  this->RngBernoulliChecks(p, bernoulli_data);
+}
+
+TYPED_TEST(RandomNumberGeneratorTest, TestPhiloxSplitStream) {
+  // A stream filled in two parts gives the same values as in one fill.
+  const uint64_t seed = this->seed_;
+  const int split = 4 * 1001;
+  TypeParam* data = static_cast<TypeParam*>(this->data_->mutable_cpu_data());
+  TypeParam* data_2 =
+      static_cast<TypeParam*>(this->data_2_->mutable_cpu_data());
+  caffe_philox_gaussian(this->sample_size_, TypeParam(0), TypeParam(1), seed,
+      0, data);
+  caffe_philox_gaussian(split, TypeParam(0), TypeParam(1), seed, 0, data_2);
+  caffe_philox_gaussian(this->sample_size_ - split, TypeParam(0),
+      TypeParam(1), seed, split, data_2 + split);
+  for (int i = 0; i < this->sample_size_; ++i) {
+    EXPECT_EQ(data[i], data_2[i]);
+  }
+  // The global stream hands out consecutive ranges of the stream of its seed.
+  Caffe::set_random_seed(this->seed_);
+  caffe_philox_uniform(split + 1, TypeParam(0), TypeParam(1), data);
+  caffe_philox_uniform(this->sample_size_ - split - 4, TypeParam(0),
+      TypeParam(1), data + split + 4);
+  caffe_philox_uniform(this->sample_size_, TypeParam(0), TypeParam(1), seed,
+      0, data_2);
+  for (int i = 0; i < this->sample_size_; ++i) {
+    if (i <= split || i >= split + 4) {
+      EXPECT_EQ(data[i], data_2[i]);
+    }
+  }
+}
+
 #ifndef CPU_ONLY
 
 TYPED_TEST(RandomNumberGeneratorTest, TestRngGaussianGPU) {
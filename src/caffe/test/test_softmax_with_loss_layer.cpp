@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <cfloat>
 #include <cmath>
 #include <cstdlib>
 #include <cstring>
@@ -61,4 +63,78 @@ TYPED_TEST(SoftmaxWithLossLayerTest, TestGradient) {
       this->blob_top_vec_, 0);
 }
 
+TYPED_TEST(SoftmaxWithLossLayerTest, TestForwardIgnoreLabel) {
+  typedef typename TypeParam::Dtype Dtype;
+  // More spatial positions than one tile of the fused kernel.
+  this->blob_bottom_data_->Reshape(2, 5, 17, 19);
+  this->blob_bottom_label_->Reshape(2, 1, 17, 19);
+  FillerParameter filler_param;
+  filler_param.set_std(10);
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_data_);
+  for (int i = 0; i < this->blob_bottom_label_->count(); ++i) {
+    this->blob_bottom_label_->mutable_cpu_data()[i] = caffe_rng_rand() % 6;
+  }
+  Blob<Dtype> top_prob;
+  this->blob_top_vec_.push_back(&top_prob);
+  LayerParameter layer_param;
+  layer_param.add_loss_weight(1);
+  layer_param.add_loss_weight(0);
+  layer_param.mutable_loss_param()->set_ignore_label(5);
+  SoftmaxWithLossLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  // Compare against the SoftmaxLayer.
+  Blob<Dtype> prob;
+  vector<Blob<Dtype>*> softmax_bottom_vec(1, this->blob_bottom_data_);
+  vector<Blob<Dtype>*> softmax_top_vec(1, &prob);
+  SoftmaxLayer<Dtype> softmax_layer((LayerParameter()));
+  softmax_layer.SetUp(softmax_bottom_vec, softmax_top_vec);
+  softmax_layer.Forward(softmax_bottom_vec, softmax_top_vec);
+  for (int i = 0; i < prob.count(); ++i) {
+    EXPECT_NEAR(prob.cpu_data()[i], top_prob.cpu_data()[i], 1e-4);
+  }
+  Dtype loss = 0;
+  int count = 0;
+  for (int n = 0; n < prob.num(); ++n) {
+    for (int h = 0; h < prob.height(); ++h) {
+      for (int w = 0; w < prob.width(); ++w) {
+        const int label = this->blob_bottom_label_->data_at(n, 0, h, w);
+        if (label == 5) {
+          continue;
+        }
+        loss -= log(std::max(prob.data_at(n, label, h, w), Dtype(FLT_MIN)));
+        ++count;
+      }
+    }
+  }
+  EXPECT_NEAR(loss / count, this->blob_top_loss_->cpu_data()[0],
+      1e-4 * loss / count);
+}
+
+TYPED_TEST(SoftmaxWithLossLayerTest, TestGradientIgnoreLabel) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  layer_param.mutable_loss_param()->set_ignore_label(0);
+  SoftmaxWithLossLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-2, 1e-2, 1701);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_, 0);
+}
+
+TYPED_TEST(SoftmaxWithLossLayerTest, TestRedGradient) {
+  typedef typename TypeParam::Dtype Dtype;
+  // The 5 predicted classes reduce to 2 label classes: {0, 1} and {2, 3, 4}.
+  for (int i = 0; i < this->blob_bottom_label_->count(); ++i) {
+    this->blob_bottom_label_->mutable_cpu_data()[i] = caffe_rng_rand() % 2;
+  }
+  LayerParameter layer_param;
+  layer_param.add_loss_weight(3);
+  layer_param.mutable_red_softmax_loss_param()->set_class_num(2);
+  RedSoftmaxWithLossLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-2, 1e-2, 1701);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_, 0);
+}
+
 }  // namespace caffe
@@ -68,6 +68,64 @@ TEST_F(SyncedMemoryTest, TestCPUWrite) {
   }
 }
 
+TEST_F(SyncedMemoryTest, TestHostMemoryCache) {
+  Caffe::ReleaseHostMemoryCache();
+  const Caffe::HostMemoryStats before = Caffe::host_memory_stats();
+  const void* freed;
+  {
+    SyncedMemory mem(1000);
+    freed = mem.cpu_data();
+    EXPECT_EQ(0, reinterpret_cast<uintptr_t>(freed) % 64);
+    const Caffe::HostMemoryStats live = Caffe::host_memory_stats();
+    // 1000 bytes take the 1024-byte class.
+    EXPECT_EQ(before.live_bytes + 1024, live.live_bytes);
+    EXPECT_GE(live.peak_bytes, live.live_bytes);
+  }
+  // A size of the same class gets the block back, zeroed.
+  SyncedMemory mem(1010);
+  const char* cpu_data = static_cast<const char*>(mem.cpu_data());
+  EXPECT_EQ(freed, cpu_data);
+  for (int i = 0; i < mem.size(); ++i) {
+    EXPECT_EQ(0, cpu_data[i]);
+  }
+  const Caffe::HostMemoryStats after = Caffe::host_memory_stats();
+  EXPECT_EQ(before.allocations + 2, after.allocations);
+  EXPECT_EQ(before.cache_hits + 1, after.cache_hits);
+  EXPECT_EQ(before.live_bytes + 1024, after.live_bytes);
+}
+
+TEST_F(SyncedMemoryTest, TestHostMemoryCacheLimit) {
+  Caffe::set_host_memory_cache_limit(0);
+  EXPECT_EQ(0, Caffe::host_memory_stats().cached_bytes);
+  const Caffe::HostMemoryStats before = Caffe::host_memory_stats();
+  {
+    SyncedMemory mem(1000);
+    mem.cpu_data();
+  }
+  {
+    SyncedMemory mem(1000);
+    mem.cpu_data();
+  }
+  const Caffe::HostMemoryStats after = Caffe::host_memory_stats();
+  EXPECT_EQ(before.cache_hits, after.cache_hits);
+  EXPECT_EQ(0, after.cached_bytes);
+  Caffe::set_host_memory_cache_limit(static_cast<size_t>(1) << 30);
+}
+
+TEST_F(SyncedMemoryTest, TestHostPolicy) {
+  SyncedMemory mem(10000, HOST_INTERLEAVE);
+  EXPECT_EQ(HOST_INTERLEAVE, mem.host_policy());
+  caffe_memset(mem.size(), 3, mem.mutable_cpu_data());
+  // Placing the memory again moves the data.
+  mem.set_host_policy(HOST_BIND, 0);
+  mem.set_host_policy(HOST_LOCAL);
+  EXPECT_EQ(HOST_LOCAL, mem.host_policy());
+  const char* cpu_data = static_cast<const char*>(mem.cpu_data());
+  for (int i = 0; i < mem.size(); ++i) {
+    EXPECT_EQ(3, cpu_data[i]);
+  }
+}
+
 #ifndef CPU_ONLY  // GPU test
 
 TEST_F(SyncedMemoryTest, TestGPURead) {
@@ -0,0 +1,167 @@
+#include <string>
+#include <vector>
+
+#include "google/protobuf/text_format.h"
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/net.hpp"
+#include "caffe/tiled_net.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename TypeParam>
+class TiledNetTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+
+ protected:
+  TiledNetTest() : image_(new Blob<Dtype>(1, 2, 40, 46)) {
+    Caffe::set_random_seed(1701);
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(image_);
+    // A small fully convolutional net that halves the resolution and
+    // restores it: a receptive field of 10 at a scale of 1, aligned to 2.
+    const string proto =
+        "name: 'TiledNetwork' "
+        "input: 'data' "
+        "input_dim: 1 "
+        "input_dim: 2 "
+        "input_dim: 24 "
+        "input_dim: 24 "
+        "layers: { "
+        "  name: 'conv1' "
+        "  type: CONVOLUTION "
+        "  convolution_param { "
+        "    num_output: 4 "
+        "    kernel_size: 3 "
+        "    pad: 1 "
+        "    weight_filler { type: 'gaussian' } "
+        "    bias_filler { type: 'gaussian' } "
+        "  } "
+        "  bottom: 'data' "
+        "  top: 'conv1' "
+        "} "
+        "layers: { "
+        "  name: 'relu1' "
+        "  type: RELU "
+        "  bottom: 'conv1' "
+        "  top: 'conv1' "
+        "} "
+        "layers: { "
+        "  name: 'pool' "
+        "  type: POOLING "
+        "  pooling_param { "
+        "    pool: MAX "
+        "    kernel_size: 2 "
+        "    stride: 2 "
+        "  } "
+        "  bottom: 'conv1' "
+        "  top: 'pool' "
+        "} "
+        "layers: { "
+        "  name: 'conv2' "
+        "  type: CONVOLUTION "
+        "  convolution_param { "
+        "    num_output: 4 "
+        "    kernel_size: 3 "
+        "    pad: 1 "
+        "    weight_filler { type: 'gaussian' } "
+        "    bias_filler { type: 'gaussian' } "
+        "  } "
+        "  bottom: 'pool' "
+        "  top: 'conv2' "
+        "} "
+        "layers: { "
+        "  name: 'deconv' "
+        "  type: DECONVOLUTION "
+        "  convolution_param { "
+        "    num_output: 3 "
+        "    kernel_size: 4 "
+        "    stride: 2 "
+        "    pad: 1 "
+        "    weight_filler { type: 'gaussian' } "
+        "    bias_filler { type: 'gaussian' } "
+        "  } "
+        "  bottom: 'conv2' "
+        "  top: 'score' "
+        "} ";
+    NetParameter param;
+    CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+    net_.reset(new Net<Dtype>(param));
+  }
+
+  virtual ~TiledNetTest() { delete image_; }
+
+  // The output of the net run over the whole image at once.
+  void ForwardWhole(Blob<Dtype>* output) {
+    Blob<Dtype>* input = net_->input_blobs()[0];
+    input->ReshapeLike(*image_);
+    input->CopyFrom(*image_);
+    net_->Reshape();
+    net_->ForwardPrefilled();
+    output->CopyFrom(*net_->output_blobs()[0], false, true);
+  }
+
+  shared_ptr<Net<Dtype> > net_;
+  Blob<Dtype>* const image_;
+};
+
+TYPED_TEST_CASE(TiledNetTest, TestDtypesAndDevices);
+
+TYPED_TEST(TiledNetTest, TestGeometry) {
+  typedef typename TypeParam::Dtype Dtype;
+  TiledNet<Dtype> tiled_net(this->net_.get());
+  for (int axis = 0; axis < 2; ++axis) {
+    EXPECT_EQ(1, tiled_net.scale(axis));
+    EXPECT_EQ(10, tiled_net.receptive_field(axis));
+    EXPECT_EQ(2, tiled_net.alignment(axis));
+  }
+}
+
+TYPED_TEST(TiledNetTest, TestForwardMatchesWhole) {
+  typedef typename TypeParam::Dtype Dtype;
+  Blob<Dtype> whole;
+  this->ForwardWhole(&whole);
+  TiledNet<Dtype> tiled_net(this->net_.get());
+  tiled_net.set_tile_size(24);
+  Blob<Dtype> tiled;
+  tiled_net.Forward(*this->image_, &tiled);
+  EXPECT_EQ(24, tiled_net.tile_size(0));
+  EXPECT_EQ(10, tiled_net.overlap(0));
+  ASSERT_EQ(whole.num(), tiled.num());
+  ASSERT_EQ(whole.channels(), tiled.channels());
+  ASSERT_EQ(whole.height(), tiled.height());
+  ASSERT_EQ(whole.width(), tiled.width());
+  for (int i = 0; i < whole.count(); ++i) {
+    EXPECT_NEAR(whole.cpu_data()[i], tiled.cpu_data()[i], 1e-4);
+  }
+}
+
+TYPED_TEST(TiledNetTest, TestMemoryBudget) {
+  typedef typename TypeParam::Dtype Dtype;
+  TiledNet<Dtype> tiled_net(this->net_.get());
+  Blob<Dtype> tiled;
+  tiled_net.set_memory_budget(1 << 20);
+  tiled_net.Forward(*this->image_, &tiled);
+  // The whole image fits the budget in a single tile.
+  EXPECT_EQ(40, tiled_net.tile_size(0));
+  EXPECT_EQ(46, tiled_net.tile_size(1));
+  // Per input pixel, the blobs take 11 values and the scratch of the layers
+  // about 40: the columns of conv1 (18), conv2 (9) and deconv (12), and the
+  // argmax of pool.
+  tiled_net.set_memory_budget(33 * 33 * 51 * sizeof(Dtype));
+  tiled_net.Forward(*this->image_, &tiled);
+  EXPECT_EQ(32, tiled_net.tile_size(0));
+  EXPECT_EQ(32, tiled_net.tile_size(1));
+  EXPECT_EQ(1, tiled_net.tiles_per_batch());
+  EXPECT_EQ(40, tiled.height());
+  EXPECT_EQ(46, tiled.width());
+}
+
+}  // namespace caffe
@@ -0,0 +1,422 @@
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "caffe/tiled_net.hpp"
+#include "caffe/util/coords.hpp"
+#include "caffe/util/math_functions.hpp"
+
+namespace caffe {
+
+// The kernel and stride of a layer along height (axis 0) or width (axis 1).
+template <typename Param>
+static void KernelAndStride(const Param& param, const int axis, int* kernel,
+    int* stride) {
+  if (axis == 0) {
+    *kernel = param.has_kernel_h() ? param.kernel_h() : param.kernel_size();
+    *stride = param.has_stride_h() ? param.stride_h() : param.stride();
+  } else {
+    *kernel = param.has_kernel_w() ? param.kernel_w() : param.kernel_size();
+    *stride = param.has_stride_w() ? param.stride_w() : param.stride();
+  }
+}
+
+static int RoundUp(const int value, const int multiple) {
+  return (value + multiple - 1) / multiple * multiple;
+}
+
+static int RoundDown(const int value, const int multiple) {
+  return value / multiple * multiple;
+}
+
+// The bytes of the scratch a layer keeps besides its blobs, at most: the
+// column buffer of (de)convolutions, for one image at a time, the argmax of
+// max pooling and eltwise, and the scale or inner blobs of LRN.
+template <typename Dtype>
+static size_t ScratchBytes(const LayerParameter& param,
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  int kernel_h, kernel_w, stride;
+  switch (param.type()) {
+  case LayerParameter_LayerType_CONVOLUTION:
+    KernelAndStride(param.convolution_param(), 0, &kernel_h, &stride);
+    KernelAndStride(param.convolution_param(), 1, &kernel_w, &stride);
+    return sizeof(Dtype) * bottom[0]->channels() * kernel_h * kernel_w
+        * top[0]->height() * top[0]->width();
+  case LayerParameter_LayerType_DECONVOLUTION:
+    KernelAndStride(param.convolution_param(), 0, &kernel_h, &stride);
+    KernelAndStride(param.convolution_param(), 1, &kernel_w, &stride);
+    return sizeof(Dtype) * top[0]->channels() * kernel_h * kernel_w
+        * bottom[0]->height() * bottom[0]->width();
+  case LayerParameter_LayerType_POOLING:
+    return top.size() == 1 && param.pooling_param().pool() !=
+        PoolingParameter_PoolMethod_AVE ? sizeof(int) * top[0]->count() : 0;
+  case LayerParameter_LayerType_ELTWISE:
+    return top.size() == 1 && param.eltwise_param().operation() ==
+        EltwiseParameter_EltwiseOp_MAX ? sizeof(int) * top[0]->count() : 0;
+  case LayerParameter_LayerType_LRN:
+    return sizeof(Dtype) * bottom[0]->count() *
+        (param.lrn_param().norm_region() ==
+         LRNParameter_NormRegion_ACROSS_CHANNELS ? 1 : 4);
+  default:
+    return 0;
+  }
+}
+
+template <typename Dtype>
+TiledNet<Dtype>::TiledNet(Net<Dtype>* net, const string& output)
+    : net_(net), memory_budget_(size_t(1) << 29), tile_size_(0),
+      overlap_(-1), tiles_per_batch_(0) {
+  CHECK_EQ(net_->input_blobs().size(), 1)
+      << "TiledNet needs a net with one input blob.";
+  input_ = net_->input_blobs()[0];
+  if (output.empty()) {
+    CHECK_GT(net_->output_blobs().size(), 0) << "The net has no outputs.";
+    output_ = net_->output_blobs()[0];
+  } else {
+    CHECK(net_->has_blob(output)) << "Unknown blob " << output;
+    output_ = net_->blob_by_name(output).get();
+  }
+  for (int axis = 0; axis < 2; ++axis) {
+    margin_[axis] = 0;
+    tile_[axis] = 0;
+    tile_overlap_[axis] = 0;
+  }
+  InitGeometry();
+}
+
+template <typename Dtype>
+void TiledNet<Dtype>::InitGeometry() {
+  const vector<shared_ptr<Blob<Dtype> > >& blobs = net_->blobs();
+  map<const Blob<Dtype>*, int> blob_ids;
+  for (int i = 0; i < blobs.size(); ++i) {
+    blob_ids[blobs[i].get()] = i;
+  }
+  // For each blob reached from the input, the map from input coordinates to
+  // its coordinates, and the receptive field of its pixels.
+  vector<bool> reached(blobs.size(), false);
+  vector<DiagonalAffineMap<Dtype> > maps(blobs.size(),
+      DiagonalAffineMap<Dtype>::identity(2));
+  vector<vector<Dtype> > fields(blobs.size(), vector<Dtype>(2, Dtype(1)));
+  reached[blob_ids[input_]] = true;
+  for (int i = 0; i < net_->layers().size(); ++i) {
+    const vector<Blob<Dtype>*>& bottom = net_->bottom_vecs()[i];
+    const vector<Blob<Dtype>*>& top = net_->top_vecs()[i];
+    if (bottom.empty() || !reached[blob_ids[bottom[0]]]) {
+      continue;
+    }
+    Layer<Dtype>* layer = net_->layers()[i].get();
+    const LayerParameter& param = layer->layer_param();
+    const int source = blob_ids[bottom[0]];
+    vector<pair<Dtype, Dtype> > coefs = maps[source].coefs();
+    vector<Dtype> field(2);
+    for (int axis = 0; axis < 2; ++axis) {
+      field[axis] = fields[source][axis];
+      for (int b = 1; b < bottom.size(); ++b) {
+        if (reached[blob_ids[bottom[b]]]) {
+          field[axis] = std::max(field[axis],
+              fields[blob_ids[bottom[b]]][axis]);
+        }
+      }
+    }
+    DiagonalAffineMap<Dtype> top_map = maps[source];
+    for (int axis = 0; axis < 2; ++axis) {
+      // Input pixels per pixel of the bottom.
+      const Dtype jump = 1 / coefs[axis].first;
+      int kernel = 1;
+      int stride = 1;
+      switch (param.type()) {
+      case LayerParameter_LayerType_CONVOLUTION:
+        KernelAndStride(param.convolution_param(), axis, &kernel, &stride);
+        field[axis] += (kernel - 1) * jump;
+        break;
+      case LayerParameter_LayerType_POOLING:
+        CHECK(!param.pooling_param().global_pooling())
+            << "TiledNet needs a fully convolutional net, and "
+            << param.name() << " pools globally.";
+        KernelAndStride(param.pooling_param(), axis, &kernel, &stride);
+        field[axis] += (kernel - 1) * jump;
+        break;
+      case LayerParameter_LayerType_DECONVOLUTION:
+        KernelAndStride(param.convolution_param(), axis, &kernel, &stride);
+        field[axis] += ((kernel + stride - 1) / stride - 1) * jump;
+        break;
+      case LayerParameter_LayerType_UNPOOLING:
+        KernelAndStride(param.unpooling_param(), axis, &kernel, &stride);
+        field[axis] += ((kernel + stride - 1) / stride - 1) * jump;
+        break;
+      case LayerParameter_LayerType_LRN:
+        if (param.lrn_param().norm_region() ==
+            LRNParameter_NormRegion_WITHIN_CHANNEL) {
+          field[axis] += (param.lrn_param().local_size() - 1) * jump;
+        }
+        break;
+      case LayerParameter_LayerType_INNER_PRODUCT:
+      case LayerParameter_LayerType_FLATTEN:
+        LOG(FATAL) << "TiledNet needs a fully convolutional net, and "
+            << param.name() << " is not convolutional.";
+        break;
+      default:
+        break;
+      }
+    }
+    switch (param.type()) {
+    case LayerParameter_LayerType_CONVOLUTION:
+    case LayerParameter_LayerType_POOLING:
+    case LayerParameter_LayerType_DECONVOLUTION:
+    case LayerParameter_LayerType_UNPOOLING:
+    case LayerParameter_LayerType_CROP:
+      top_map = layer->coord_map().compose(maps[source]);
+      break;
+    default:
+      break;
+    }
+    for (int t = 0; t < top.size(); ++t) {
+      const int id = blob_ids[top[t]];
+      reached[id] = true;
+      maps[id] = top_map;
+      fields[id] = field;
+    }
+  }
+  const int output_id = blob_ids[output_];
+  CHECK(reached[output_id]) << "The output does not depend on the input.";
+  // Tiles start on the coarsest grid of any blob, so that every blob of a
+  // tile lines up with that of the whole input.
+  Dtype max_jump[2] = { 1, 1 };
+  for (int i = 0; i < blobs.size(); ++i) {
+    if (reached[i]) {
+      const vector<pair<Dtype, Dtype> > blob_coefs = maps[i].coefs();
+      for (int axis = 0; axis < 2; ++axis) {
+        max_jump[axis] = std::max(max_jump[axis], 1 / blob_coefs[axis].first);
+      }
+    }
+  }
+  const vector<pair<Dtype, Dtype> > coefs = maps[output_id].coefs();
+  for (int axis = 0; axis < 2; ++axis) {
+    scale_[axis] = coefs[axis].first;
+    offset_[axis] = coefs[axis].second;
+    field_[axis] = static_cast<int>(std::ceil(fields[output_id][axis] - 1e-3));
+    align_[axis] = std::max(1, static_cast<int>(max_jump[axis] + 0.5));
+  }
+  LOG(INFO) << "Tiling with a receptive field of " << field_[0] << " x "
+      << field_[1] << ", tiles aligned to " << align_[0] << " x "
+      << align_[1] << " input pixels.";
+}
+
+template <typename Dtype>
+size_t TiledNet<Dtype>::ReshapeNet(const int num, const int height,
+    const int width) {
+  input_->Reshape(num, input_->channels(), height, width);
+  net_->Reshape();
+  size_t bytes = 0;
+  for (int i = 0; i < net_->blobs().size(); ++i) {
+    bytes += net_->blobs()[i]->count() * sizeof(Dtype);
+  }
+  for (int i = 0; i < net_->layers().size(); ++i) {
+    bytes += ScratchBytes(net_->layers()[i]->layer_param(),
+        net_->bottom_vecs()[i], net_->top_vecs()[i]);
+  }
+  return bytes;
+}
+
+template <typename Dtype>
+void TiledNet<Dtype>::TileOrigins(const int axis, const int size,
+    vector<int>* origins) {
+  origins->clear();
+  const int padded = RoundUp(size, align_[axis]);
+  const int tile = tile_[axis];
+  if (padded <= tile) {
+    origins->push_back(0);
+    return;
+  }
+  const int step = tile - tile_overlap_[axis];
+  for (int origin = 0; origin + tile < padded; origin += step) {
+    origins->push_back(origin);
+  }
+  origins->push_back(padded - tile);
+}
+
+// The weight of an output t pixels from the edge of a tile, in a band of
+// overlap pixels shared with the next tile: none for the margin pixels that
+// see past the edge, then rising linearly so that the weights of the two
+// tiles add up to one.
+template <typename Dtype>
+static Dtype Feather(const int t, const int overlap, const int margin) {
+  const Dtype skip = std::min(Dtype(margin), Dtype(overlap) / 2);
+  const Dtype ramp = overlap - 2 * skip;
+  if (ramp <= 0) {
+    return t + Dtype(0.5) >= Dtype(overlap) / 2 ? 1 : 0;
+  }
+  return std::min(Dtype(1), std::max(Dtype(0), (t + Dtype(0.5) - skip) / ramp));
+}
+
+template <typename Dtype>
+void TiledNet<Dtype>::FeatherWeights(const int axis,
+    const vector<int>& origins, const int tile, const int tile_output,
+    vector<vector<Dtype> >* weights) {
+  weights->assign(origins.size(), vector<Dtype>(tile_output, Dtype(1)));
+  for (int k = 0; k < origins.size(); ++k) {
+    vector<Dtype>& weight = (*weights)[k];
+    if (k > 0) {
+      const int overlap = static_cast<int>(
+          scale_[axis] * (origins[k - 1] + tile - origins[k]) + 0.5);
+      for (int t = 0; t < std::min(overlap, tile_output); ++t) {
+        weight[t] *= Feather<Dtype>(t, overlap, margin_[axis]);
+      }
+    }
+    if (k + 1 < origins.size()) {
+      const int overlap = static_cast<int>(
+          scale_[axis] * (origins[k] + tile - origins[k + 1]) + 0.5);
+      for (int t = 0; t < std::min(overlap, tile_output); ++t) {
+        weight[tile_output - 1 - t] *= Feather<Dtype>(t, overlap,
+            margin_[axis]);
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void TiledNet<Dtype>::Forward(const Blob<Dtype>& image, Blob<Dtype>* output) {
+  CHECK_EQ(image.num(), 1) << "TiledNet runs one image at a time.";
+  CHECK_EQ(image.channels(), input_->channels());
+  const int size[2] = { image.height(), image.width() };
+  int tile = tile_size_;
+  if (tile <= 0) {
+    // Fit the tiles to the budget from the bytes per input pixel of a tile
+    // large enough to be representative.
+    int probe[2];
+    for (int axis = 0; axis < 2; ++axis) {
+      probe[axis] = RoundUp(std::max(64, 2 * field_[axis]), align_[axis]);
+    }
+    const double bytes_per_pixel =
+        static_cast<double>(ReshapeNet(1, probe[0], probe[1])) /
+        (probe[0] * probe[1]);
+    tile = static_cast<int>(std::sqrt(memory_budget_ / bytes_per_pixel));
+  }
+  for (int axis = 0; axis < 2; ++axis) {
+    tile_[axis] = std::min(RoundDown(tile, align_[axis]),
+        RoundUp(size[axis], align_[axis]));
+    CHECK_GT(tile_[axis], 0) << "The memory budget is too small for a tile.";
+  }
+  const size_t tile_bytes = ReshapeNet(1, tile_[0], tile_[1]);
+  const int tile_output[2] = { output_->height(), output_->width() };
+  const int channels = output_->channels();
+  for (int axis = 0; axis < 2; ++axis) {
+    // The outputs at either edge whose receptive field passes the edge.
+    const Dtype half_field = Dtype(field_[axis] - 1) / 2;
+    const int left = static_cast<int>(std::ceil(
+        offset_[axis] + scale_[axis] * half_field - 1e-3));
+    const int right = tile_output[axis] - 1 - static_cast<int>(std::floor(
+        scale_[axis] * (tile_[axis] - 1 - half_field) + offset_[axis] + 1e-3));
+    margin_[axis] = std::max(0, std::max(left, right));
+    int overlap = overlap_;
+    if (overlap < 0) {
+      overlap = static_cast<int>(std::ceil(2 * margin_[axis] / scale_[axis]));
+    }
+    overlap = RoundUp(overlap, align_[axis]);
+    const int max_overlap = RoundDown(tile_[axis] / 2, align_[axis]);
+    if (overlap > max_overlap) {
+      if (overlap_ < 0 && RoundUp(size[axis], align_[axis]) > tile_[axis]) {
+        LOG(WARNING) << "The receptive field needs an overlap of " << overlap
+            << " pixels, more than half the tile; the result will differ "
+            << "from running the whole input near the seams of the tiles.";
+      }
+      overlap = max_overlap;
+    }
+    tile_overlap_[axis] = overlap;
+  }
+
+  vector<int> origins[2];
+  vector<vector<Dtype> > weights[2];
+  int covered[2];
+  int output_size[2];
+  for (int axis = 0; axis < 2; ++axis) {
+    TileOrigins(axis, size[axis], &origins[axis]);
+    FeatherWeights(axis, origins[axis], tile_[axis], tile_output[axis],
+        &weights[axis]);
+    covered[axis] = static_cast<int>(scale_[axis] * origins[axis].back() + 0.5)
+        + tile_output[axis];
+    // The size of the output of the whole input.
+    output_size[axis] = std::min(covered[axis], tile_output[axis] +
+        static_cast<int>(std::floor(
+            scale_[axis] * (size[axis] - tile_[axis]) + 1e-3)));
+    CHECK_GT(output_size[axis], 0) << "The input is too small for the net.";
+  }
+  const int num_tiles = origins[0].size() * origins[1].size();
+  tiles_per_batch_ = std::min(num_tiles,
+      std::max(1, static_cast<int>(memory_budget_ / tile_bytes)));
+  LOG(INFO) << "Running " << num_tiles << " tiles of " << tile_[0] << " x "
+      << tile_[1] << " overlapping by " << tile_overlap_[0] << " x "
+      << tile_overlap_[1] << ", " << tiles_per_batch_ << " at a time.";
+
+  Blob<Dtype> sums(1, channels, covered[0], covered[1]);
+  caffe_set(sums.count(), Dtype(0), sums.mutable_cpu_data());
+  vector<Dtype> weight_sums(covered[0] * covered[1], Dtype(0));
+  const int input_channels = image.channels();
+  for (int first = 0; first < num_tiles; first += tiles_per_batch_) {
+    const int num = std::min(tiles_per_batch_, num_tiles - first);
+    if (input_->num() != num) {
+      ReshapeNet(num, tile_[0], tile_[1]);
+    }
+    // Copy the tiles, padding past the edges of the image with zeros.
+    Dtype* input_data = input_->mutable_cpu_data();
+    caffe_set(input_->count(), Dtype(0), input_data);
+    for (int n = 0; n < num; ++n) {
+      const int y0 = origins[0][(first + n) / origins[1].size()];
+      const int x0 = origins[1][(first + n) % origins[1].size()];
+      const int rows = std::min(tile_[0], size[0] - y0);
+      const int cols = std::min(tile_[1], size[1] - x0);
+      for (int c = 0; c < input_channels; ++c) {
+        for (int y = 0; y < rows; ++y) {
+          caffe_copy(cols, image.cpu_data() + image.offset(0, c, y0 + y, x0),
+              input_data + input_->offset(n, c, y));
+        }
+      }
+    }
+    net_->ForwardPrefilled();
+    const Dtype* output_data = output_->cpu_data();
+    Dtype* sum_data = sums.mutable_cpu_data();
+    for (int n = 0; n < num; ++n) {
+      const int ty = (first + n) / origins[1].size();
+      const int tx = (first + n) % origins[1].size();
+      const int gy = static_cast<int>(scale_[0] * origins[0][ty] + 0.5);
+      const int gx = static_cast<int>(scale_[1] * origins[1][tx] + 0.5);
+      const vector<Dtype>& weight_y = weights[0][ty];
+      const vector<Dtype>& weight_x = weights[1][tx];
+      for (int y = 0; y < tile_output[0]; ++y) {
+        for (int x = 0; x < tile_output[1]; ++x) {
+          weight_sums[(gy + y) * covered[1] + gx + x] +=
+              weight_y[y] * weight_x[x];
+        }
+      }
+      for (int c = 0; c < channels; ++c) {
+        const Dtype* tile_data = output_data + output_->offset(n, c);
+        for (int y = 0; y < tile_output[0]; ++y) {
+          Dtype* row = sum_data + sums.offset(0, c, gy + y, gx);
+          for (int x = 0; x < tile_output[1]; ++x) {
+            row[x] += weight_y[y] * weight_x[x] *
+                tile_data[y * tile_output[1] + x];
+          }
+        }
+      }
+    }
+  }
+
+  output->Reshape(1, channels, output_size[0], output_size[1]);
+  const Dtype* sum_data = sums.cpu_data();
+  Dtype* output_data = output->mutable_cpu_data();
+  for (int c = 0; c < channels; ++c) {
+    for (int y = 0; y < output_size[0]; ++y) {
+      for (int x = 0; x < output_size[1]; ++x) {
+        const Dtype weight = weight_sums[y * covered[1] + x];
+        output_data[output->offset(0, c, y, x)] = weight > 0 ?
+            sum_data[sums.offset(0, c, y, x)] / weight : Dtype(0);
+      }
+    }
+  }
+}
+
+INSTANTIATE_CLASS(TiledNet);
+
+}  // namespace caffe
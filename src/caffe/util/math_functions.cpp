@@ -1,10 +1,13 @@
 #include <boost/math/special_functions/next.hpp>
 #include <boost/random.hpp>
 
+#include <algorithm>
 #include <limits>
 
 #include "caffe/common.hpp"
+#include "caffe/util/fast_math.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/philox.hpp"
 #include "caffe/util/rng.hpp"
 
 namespace caffe {
@@ -175,6 +178,11 @@ void caffe_div<double>(const int n, const double* a, const double* b,
   vdDiv(n, a, b, y);
 }
 
+// Without MKL the VML functions of mkl_alternate.hpp are plain loops over
+// libm; the elementwise functions below use the kernels of fast_math.hpp
+// instead, in parallel over the elements.
+#ifdef USE_MKL
+
 template <>
 void caffe_powx<float>(const int n, const float* a, const float b,
     float* y) {
@@ -188,23 +196,23 @@ void caffe_powx<double>(const int n, const double* a, const double b,
 }
 
 template <>
-void caffe_sqr<float>(const int n, const float* a, float* y) {
-  vsSqr(n, a, y);
+void caffe_exp<float>(const int n, const float* a, float* y) {
+  vsExp(n, a, y);
 }
 
 template <>
-void caffe_sqr<double>(const int n, const double* a, double* y) {
-  vdSqr(n, a, y);
+void caffe_exp<double>(const int n, const double* a, double* y) {
+  vdExp(n, a, y);
 }
 
 template <>
-void caffe_exp<float>(const int n, const float* a, float* y) {
-  vsExp(n, a, y);
+void caffe_log<float>(const int n, const float* a, float* y) {
+  vsLn(n, a, y);
 }
 
 template <>
-void caffe_exp<double>(const int n, const double* a, double* y) {
-  vdExp(n, a, y);
+void caffe_log<double>(const int n, const double* a, double* y) {
+  vdLn(n, a, y);
 }
 
 template <>
@@ -217,6 +225,166 @@ void caffe_abs<double>(const int n, const double* a, double* y) {
     vdAbs(n, a, y);
 }
 
+#else  // USE_MKL
+
+template <typename Dtype>
+void caffe_powx(const int n, const Dtype* a, const Dtype b, Dtype* y) {
+  // The powers used by the layers exactly and cheaply, and the rest as
+  // exp(b * log(a)) where a > 0.
+  if (b == Dtype(1)) {
+    caffe_copy(n, a, y);
+    return;
+  }
+#ifdef _OPENMP
+  #pragma omp parallel for
+#endif
+  for (int i = 0; i < n; ++i) {
+    if (b == Dtype(2)) {
+      y[i] = a[i] * a[i];
+    } else if (b == Dtype(0.5)) {
+      y[i] = std::sqrt(a[i]);
+    } else {
+      y[i] = a[i] > 0 ? fast_pow(a[i], b) : std::pow(a[i], b);
+    }
+  }
+}
+
+template
+void caffe_powx<float>(const int n, const float* a, const float b, float* y);
+
+template
+void caffe_powx<double>(const int n, const double* a, const double b,
+    double* y);
+
+template <typename Dtype>
+void caffe_exp(const int n, const Dtype* a, Dtype* y) {
+#ifdef _OPENMP
+  #pragma omp parallel for
+#endif
+  for (int i = 0; i < n; ++i) {
+    y[i] = fast_exp(a[i]);
+  }
+}
+
+template
+void caffe_exp<float>(const int n, const float* a, float* y);
+
+template
+void caffe_exp<double>(const int n, const double* a, double* y);
+
+template <typename Dtype>
+void caffe_log(const int n, const Dtype* a, Dtype* y) {
+#ifdef _OPENMP
+  #pragma omp parallel for
+#endif
+  for (int i = 0; i < n; ++i) {
+    y[i] = fast_log(a[i]);
+  }
+}
+
+template
+void caffe_log<float>(const int n, const float* a, float* y);
+
+template
+void caffe_log<double>(const int n, const double* a, double* y);
+
+template <typename Dtype>
+void caffe_abs(const int n, const Dtype* a, Dtype* y) {
+#ifdef _OPENMP
+  #pragma omp parallel for
+#endif
+  for (int i = 0; i < n; ++i) {
+    y[i] = std::fabs(a[i]);
+  }
+}
+
+template
+void caffe_abs<float>(const int n, const float* a, float* y);
+
+template
+void caffe_abs<double>(const int n, const double* a, double* y);
+
+#endif  // USE_MKL
+
+template <>
+void caffe_sqr<float>(const int n, const float* a, float* y) {
+  vsSqr(n, a, y);
+}
+
+template <>
+void caffe_sqr<double>(const int n, const double* a, double* y) {
+  vdSqr(n, a, y);
+}
+
+template <typename Dtype>
+void caffe_tanh(const int n, const Dtype* a, Dtype* y) {
+#ifdef _OPENMP
+  #pragma omp parallel for
+#endif
+  for (int i = 0; i < n; ++i) {
+    y[i] = fast_tanh(a[i]);
+  }
+}
+
+template
+void caffe_tanh<float>(const int n, const float* a, float* y);
+
+template
+void caffe_tanh<double>(const int n, const double* a, double* y);
+
+template <typename Dtype>
+void caffe_sigmoid(const int n, const Dtype* a, Dtype* y) {
+#ifdef _OPENMP
+  #pragma omp parallel for
+#endif
+  for (int i = 0; i < n; ++i) {
+    y[i] = fast_sigmoid(a[i]);
+  }
+}
+
+template
+void caffe_sigmoid<float>(const int n, const float* a, float* y);
+
+template
+void caffe_sigmoid<double>(const int n, const double* a, double* y);
+
+template <typename Dtype>
+void caffe_cpu_relu(const int n, const Dtype negative_slope, Dtype* y) {
+#ifdef _OPENMP
+  #pragma omp parallel for
+#endif
+  for (int i = 0; i < n; ++i) {
+    y[i] = std::max(y[i], Dtype(0))
+        + negative_slope * std::min(y[i], Dtype(0));
+  }
+}
+
+template
+void caffe_cpu_relu<float>(const int n, const float negative_slope, float* y);
+
+template
+void caffe_cpu_relu<double>(const int n, const double negative_slope,
+    double* y);
+
+template <typename Dtype>
+void caffe_cpu_relu_backward(const int n, const Dtype negative_slope,
+    const Dtype* y, Dtype* dy) {
+#ifdef _OPENMP
+  #pragma omp parallel for
+#endif
+  for (int i = 0; i < n; ++i) {
+    dy[i] *= (y[i] > 0) + negative_slope * (y[i] <= 0);
+  }
+}
+
+template
+void caffe_cpu_relu_backward<float>(const int n, const float negative_slope,
+    const float* y, float* dy);
+
+template
+void caffe_cpu_relu_backward<double>(const int n,
+    const double negative_slope, const double* y, double* dy);
+
 unsigned int caffe_rng_rand() {
   return (*caffe_rng())();
 }
@@ -316,6 +484,159 @@ void caffe_rng_bernoulli<double>(const int n, const double p, unsigned int* r);
 template
 void caffe_rng_bernoulli<float>(const int n, const float p, unsigned int* r);
 
+// Fills r with op applied to the Philox stream of seed from offset on, one
+// block of four values at a time. op maps the four values of a block to four
+// outputs.
+template <typename T, typename Op>
+static void philox_fill(const int n, const uint64_t seed,
+    const uint64_t offset, const Op& op, T* r) {
+  CHECK_GE(n, 0);
+  CHECK(r);
+  CHECK_EQ(offset % 4, 0) << "Philox offsets must be multiples of 4.";
+  const uint64_t first_block = offset / 4;
+  const int num_blocks = (n + 3) / 4;
+#ifdef _OPENMP
+  #pragma omp parallel for
+#endif
+  for (int b = 0; b < num_blocks; ++b) {
+    uint32_t x[4];
+    philox_block(seed, first_block + b, x);
+    T y[4];
+    op(x, y);
+    std::copy(y, y + std::min(4, n - 4 * b), r + 4 * b);
+  }
+}
+
+template <typename Dtype>
+struct PhiloxUniformOp {
+  PhiloxUniformOp(const Dtype a, const Dtype b) : a_(a), scale_(b - a) {}
+  void operator()(const uint32_t x[4], Dtype y[4]) const {
+    for (int j = 0; j < 4; ++j) {
+      y[j] = a_ + scale_ * static_cast<Dtype>(philox_to_unit(x[j]));
+    }
+  }
+  const Dtype a_;
+  const Dtype scale_;
+};
+
+template <typename Dtype>
+struct PhiloxGaussianOp {
+  PhiloxGaussianOp(const Dtype mu, const Dtype sigma)
+      : mu_(mu), sigma_(sigma) {}
+  void operator()(const uint32_t x[4], Dtype y[4]) const {
+    for (int j = 0; j < 4; j += 2) {
+      // The first uniform is in (0, 1] so that its log is finite.
+      const double u = 1 - philox_to_unit(x[j]);
+      const double theta = 2 * M_PI * philox_to_unit(x[j + 1]);
+      const double radius = sqrt(-2 * log(u));
+      y[j] = mu_ + sigma_ * static_cast<Dtype>(radius * cos(theta));
+      y[j + 1] = mu_ + sigma_ * static_cast<Dtype>(radius * sin(theta));
+    }
+  }
+  const Dtype mu_;
+  const Dtype sigma_;
+};
+
+template <typename Dtype>
+struct PhiloxBernoulliOp {
+  explicit PhiloxBernoulliOp(const Dtype p) : p_(p) {}
+  void operator()(const uint32_t x[4], int y[4]) const {
+    for (int j = 0; j < 4; ++j) {
+      y[j] = philox_to_unit(x[j]) < p_;
+    }
+  }
+  const double p_;
+};
+
+template <typename Dtype>
+void caffe_philox_uniform(const int n, const Dtype a, const Dtype b,
+    const uint64_t seed, const uint64_t offset, Dtype* r) {
+  CHECK_LE(a, b);
+  philox_fill(n, seed, offset, PhiloxUniformOp<Dtype>(a, b), r);
+}
+
+template
+void caffe_philox_uniform<float>(const int n, const float a, const float b,
+    const uint64_t seed, const uint64_t offset, float* r);
+
+template
+void caffe_philox_uniform<double>(const int n, const double a,
+    const double b, const uint64_t seed, const uint64_t offset, double* r);
+
+template <typename Dtype>
+void caffe_philox_gaussian(const int n, const Dtype mu, const Dtype sigma,
+    const uint64_t seed, const uint64_t offset, Dtype* r) {
+  CHECK_GT(sigma, 0);
+  philox_fill(n, seed, offset, PhiloxGaussianOp<Dtype>(mu, sigma), r);
+}
+
+template
+void caffe_philox_gaussian<float>(const int n, const float mu,
+    const float sigma, const uint64_t seed, const uint64_t offset, float* r);
+
+template
+void caffe_philox_gaussian<double>(const int n, const double mu,
+    const double sigma, const uint64_t seed, const uint64_t offset,
+    double* r);
+
+template <typename Dtype>
+void caffe_philox_bernoulli(const int n, const Dtype p, const uint64_t seed,
+    const uint64_t offset, int* r) {
+  CHECK_GE(p, 0);
+  CHECK_LE(p, 1);
+  philox_fill(n, seed, offset, PhiloxBernoulliOp<Dtype>(p), r);
+}
+
+template
+void caffe_philox_bernoulli<float>(const int n, const float p,
+    const uint64_t seed, const uint64_t offset, int* r);
+
+template
+void caffe_philox_bernoulli<double>(const int n, const double p,
+    const uint64_t seed, const uint64_t offset, int* r);
+
+template <typename Dtype>
+void caffe_philox_uniform(const int n, const Dtype a, const Dtype b,
+    Dtype* r) {
+  caffe_philox_uniform(n, a, b, Caffe::philox_seed(), Caffe::philox_offset(n),
+      r);
+}
+
+template
+void caffe_philox_uniform<float>(const int n, const float a, const float b,
+    float* r);
+
+template
+void caffe_philox_uniform<double>(const int n, const double a,
+    const double b, double* r);
+
+template <typename Dtype>
+void caffe_philox_gaussian(const int n, const Dtype mu, const Dtype sigma,
+    Dtype* r) {
+  caffe_philox_gaussian(n, mu, sigma, Caffe::philox_seed(),
+      Caffe::philox_offset(n), r);
+}
+
+template
+void caffe_philox_gaussian<float>(const int n, const float mu,
+    const float sigma, float* r);
+
+template
+void caffe_philox_gaussian<double>(const int n, const double mu,
+    const double sigma, double* r);
+
+template <typename Dtype>
+void caffe_philox_bernoulli(const int n, const Dtype p, int* r) {
+  caffe_philox_bernoulli(n, p, Caffe::philox_seed(), Caffe::philox_offset(n),
+      r);
+}
+
+template
+void caffe_philox_bernoulli<float>(const int n, const float p, int* r);
+
+template
+void caffe_philox_bernoulli<double>(const int n, const double p, int* r);
+
 template <>
 float caffe_cpu_strided_dot<float>(const int n, const float* x, const int incx,
     const float* y, const int incy) {
@@ -324,6 +324,47 @@ void caffe_gpu_exp<double>(const int N, const double* a, double* y) {
       N, a, y);
 }
 
+template <typename Dtype>
+__global__ void relu_kernel(const int n, const Dtype negative_slope,
+    Dtype* y) {
+  CUDA_KERNEL_LOOP(index, n) {
+    y[index] = y[index] > 0 ? y[index] : y[index] * negative_slope;
+  }
+}
+
+template <typename Dtype>
+void caffe_gpu_relu(const int N, const Dtype negative_slope, Dtype* y) {
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  relu_kernel<Dtype><<<CAFFE_GET_BLOCKS(N), CAFFE_CUDA_NUM_THREADS>>>(
+      N, negative_slope, y);
+}
+
+template void caffe_gpu_relu<float>(const int N, const float negative_slope,
+    float* y);
+template void caffe_gpu_relu<double>(const int N, const double negative_slope,
+    double* y);
+
+template <typename Dtype>
+__global__ void relu_backward_kernel(const int n, const Dtype negative_slope,
+    const Dtype* y, Dtype* dy) {
+  CUDA_KERNEL_LOOP(index, n) {
+    dy[index] *= (y[index] > 0) + (y[index] <= 0) * negative_slope;
+  }
+}
+
+template <typename Dtype>
+void caffe_gpu_relu_backward(const int N, const Dtype negative_slope,
+    const Dtype* y, Dtype* dy) {
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  relu_backward_kernel<Dtype><<<CAFFE_GET_BLOCKS(N), CAFFE_CUDA_NUM_THREADS>>>(
+      N, negative_slope, y, dy);
+}
+
+template void caffe_gpu_relu_backward<float>(const int N,
+    const float negative_slope, const float* y, float* dy);
+template void caffe_gpu_relu_backward<double>(const int N,
+    const double negative_slope, const double* y, double* dy);
+
 template <typename Dtype>
 __global__ void powx_kernel(const int n, const Dtype* a,
     const Dtype alpha, Dtype* y) {
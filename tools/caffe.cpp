@@ -6,11 +6,13 @@
 #include <vector>
 
 #include "caffe/caffe.hpp"
+#include "caffe/util/upgrade_proto.hpp"
 
 using caffe::Blob;
 using caffe::Caffe;
 using caffe::Net;
 using caffe::Layer;
+using caffe::NetParameter;
 using caffe::shared_ptr;
 using caffe::Timer;
 using caffe::vector;
@@ -29,6 +31,15 @@ DEFINE_string(weights, "",
     "Cannot be set simultaneously with snapshot.");
 DEFINE_int32(iterations, 50,
     "The number of iterations to run.");
+DEFINE_bool(fuse, false,
+    "Optional; also time the model with fold_batch_norm and fuse_relu set, "
+    "and compare each fused layer with the layers it replaced.");
+DEFINE_string(compute_cpus, "",
+    "Optional; pin the compute threads to the given CPUs, e.g. '0-11,24-35', "
+    "ideally those of one NUMA node.");
+DEFINE_string(prefetch_cpus, "",
+    "Optional; pin the prefetch threads of the data layers to the given "
+    "CPUs, e.g. those of the node of the compute threads.");
 
 // A simple registry for caffe commands.
 typedef int (*BrewFunction)();
@@ -143,6 +154,9 @@ int test() {
   Net<float> caffe_net(FLAGS_model);
   caffe_net.CopyTrainedLayersFrom(FLAGS_weights);
   LOG(INFO) << "Running for " << FLAGS_iterations << " iterations.";
+  for (int i = 0; i < caffe_net.layers().size(); ++i) {
+    caffe_net.layers()[i]->ResetState();
+  }
 
   vector<Blob<float>* > bottom_vec;
   vector<int> test_score_output_id;
@@ -185,45 +199,36 @@ int test() {
     }
     LOG(INFO) << output_name << " = " << mean_score << loss_msg_stream.str();
   }
+  for (int i = 0; i < caffe_net.layers().size(); ++i) {
+    caffe_net.layers()[i]->ReportState();
+  }
 
   return 0;
 }
 RegisterBrewFunction(test);
 
 
-// Time: benchmark the execution time of a model.
-int time() {
-  CHECK_GT(FLAGS_model.size(), 0) << "Need a model definition to time.";
-
-  // Set device id and mode
-  if (FLAGS_gpu >= 0) {
-    LOG(INFO) << "Use GPU with device ID " << FLAGS_gpu;
-    Caffe::SetDevice(FLAGS_gpu);
-    Caffe::set_mode(Caffe::GPU);
-  } else {
-    LOG(INFO) << "Use CPU.";
-    Caffe::set_mode(Caffe::CPU);
-  }
-  // Instantiate the caffe net.
-  Caffe::set_phase(Caffe::TRAIN);
-  Net<float> caffe_net(FLAGS_model);
-
+// Time FLAGS_iterations forward-backward passes of a net, and return the
+// average forward and backward time of each layer in ms.
+static void TimeNet(Net<float>* caffe_net,
+    vector<double>* forward_time_per_layer,
+    vector<double>* backward_time_per_layer) {
   // Do a clean forward and backward pass, so that memory allocation are done
   // and future iterations will be more stable.
   LOG(INFO) << "Performing Forward";
   // Note that for the speed benchmark, we will assume that the network does
   // not take any input blobs.
   float initial_loss;
-  caffe_net.Forward(vector<Blob<float>*>(), &initial_loss);
+  caffe_net->Forward(vector<Blob<float>*>(), &initial_loss);
   LOG(INFO) << "Initial loss: " << initial_loss;
   LOG(INFO) << "Performing Backward";
-  caffe_net.Backward();
+  caffe_net->Backward();
 
-  const vector<shared_ptr<Layer<float> > >& layers = caffe_net.layers();
-  vector<vector<Blob<float>*> >& bottom_vecs = caffe_net.bottom_vecs();
-  vector<vector<Blob<float>*> >& top_vecs = caffe_net.top_vecs();
+  const vector<shared_ptr<Layer<float> > >& layers = caffe_net->layers();
+  vector<vector<Blob<float>*> >& bottom_vecs = caffe_net->bottom_vecs();
+  vector<vector<Blob<float>*> >& top_vecs = caffe_net->top_vecs();
   const vector<vector<bool> >& bottom_need_backward =
-      caffe_net.bottom_need_backward();
+      caffe_net->bottom_need_backward();
   LOG(INFO) << "*** Benchmark begins ***";
   LOG(INFO) << "Testing for " << FLAGS_iterations << " iterations.";
   Timer total_timer;
@@ -231,29 +236,37 @@ int time() {
   Timer forward_timer;
   Timer backward_timer;
   Timer timer;
-  std::vector<double> forward_time_per_layer(layers.size(), 0.0);
-  std::vector<double> backward_time_per_layer(layers.size(), 0.0);
+  forward_time_per_layer->assign(layers.size(), 0.0);
+  backward_time_per_layer->assign(layers.size(), 0.0);
+  vector<double> reshape_time_per_layer(layers.size(), 0.0);
+  double reshape_time = 0.0;
   double forward_time = 0.0;
   double backward_time = 0.0;
   for (int j = 0; j < FLAGS_iterations; ++j) {
     Timer iter_timer;
     iter_timer.Start();
     forward_timer.Start();
+    double iter_reshape_time = 0.0;
     for (int i = 0; i < layers.size(); ++i) {
+      // Reshape is timed on its own: Net::Forward only pays for it when the
+      // shapes of the layer's blobs change, as with variable-size inputs.
       timer.Start();
-      // Although Reshape should be essentially free, we include it here
-      // so that we will notice Reshape performance bugs.
       layers[i]->Reshape(bottom_vecs[i], top_vecs[i]);
+      const double layer_reshape_time = timer.MicroSeconds();
+      reshape_time_per_layer[i] += layer_reshape_time;
+      iter_reshape_time += layer_reshape_time;
+      timer.Start();
       layers[i]->Forward(bottom_vecs[i], top_vecs[i]);
-      forward_time_per_layer[i] += timer.MicroSeconds();
+      (*forward_time_per_layer)[i] += timer.MicroSeconds();
     }
-    forward_time += forward_timer.MicroSeconds();
+    forward_time += forward_timer.MicroSeconds() - iter_reshape_time;
+    reshape_time += iter_reshape_time;
     backward_timer.Start();
     for (int i = layers.size() - 1; i >= 0; --i) {
       timer.Start();
       layers[i]->Backward(top_vecs[i], bottom_need_backward[i],
                           bottom_vecs[i]);
-      backward_time_per_layer[i] += timer.MicroSeconds();
+      (*backward_time_per_layer)[i] += timer.MicroSeconds();
     }
     backward_time += backward_timer.MicroSeconds();
     LOG(INFO) << "Iteration: " << j + 1 << " forward-backward time: "
@@ -261,15 +274,20 @@ int time() {
   }
   LOG(INFO) << "Average time per layer: ";
   for (int i = 0; i < layers.size(); ++i) {
+    (*forward_time_per_layer)[i] /= 1000 * FLAGS_iterations;
+    (*backward_time_per_layer)[i] /= 1000 * FLAGS_iterations;
+    reshape_time_per_layer[i] /= 1000 * FLAGS_iterations;
     const caffe::string& layername = layers[i]->layer_param().name();
     LOG(INFO) << std::setfill(' ') << std::setw(10) << layername <<
-      "\tforward: " << forward_time_per_layer[i] / 1000 /
-      FLAGS_iterations << " ms.";
+      "\treshape: " << reshape_time_per_layer[i] << " ms.";
+    LOG(INFO) << std::setfill(' ') << std::setw(10) << layername <<
+      "\tforward: " << (*forward_time_per_layer)[i] << " ms.";
     LOG(INFO) << std::setfill(' ') << std::setw(10) << layername  <<
-      "\tbackward: " << backward_time_per_layer[i] / 1000 /
-      FLAGS_iterations << " ms.";
+      "\tbackward: " << (*backward_time_per_layer)[i] << " ms.";
   }
   total_timer.Stop();
+  LOG(INFO) << "Average Reshape: " << reshape_time / 1000 /
+    FLAGS_iterations << " ms.";
   LOG(INFO) << "Average Forward pass: " << forward_time / 1000 /
     FLAGS_iterations << " ms.";
   LOG(INFO) << "Average Backward pass: " << backward_time / 1000 /
@@ -278,6 +296,70 @@ int time() {
     FLAGS_iterations << " ms.";
   LOG(INFO) << "Total Time: " << total_timer.MilliSeconds() << " ms.";
   LOG(INFO) << "*** Benchmark ends ***";
+}
+
+// Time: benchmark the execution time of a model.
+int time() {
+  CHECK_GT(FLAGS_model.size(), 0) << "Need a model definition to time.";
+
+  // Set device id and mode
+  if (FLAGS_gpu >= 0) {
+    LOG(INFO) << "Use GPU with device ID " << FLAGS_gpu;
+    Caffe::SetDevice(FLAGS_gpu);
+    Caffe::set_mode(Caffe::GPU);
+  } else {
+    LOG(INFO) << "Use CPU.";
+    Caffe::set_mode(Caffe::CPU);
+  }
+  // Instantiate the caffe net.
+  Caffe::set_phase(Caffe::TRAIN);
+  Net<float> caffe_net(FLAGS_model);
+  vector<double> forward_time_per_layer;
+  vector<double> backward_time_per_layer;
+  TimeNet(&caffe_net, &forward_time_per_layer, &backward_time_per_layer);
+  if (!FLAGS_fuse) {
+    return 0;
+  }
+
+  // Time the net again with its layers fused, and compare every fused layer
+  // with the layers it replaced.
+  NetParameter fused_param;
+  caffe::ReadNetParamsFromTextFileOrDie(FLAGS_model, &fused_param);
+  fused_param.set_fold_batch_norm(true);
+  fused_param.set_fuse_relu(true);
+  Net<float> fused_net(fused_param);
+  vector<double> fused_forward_time_per_layer;
+  vector<double> fused_backward_time_per_layer;
+  TimeNet(&fused_net, &fused_forward_time_per_layer,
+      &fused_backward_time_per_layer);
+  std::map<caffe::string, caffe::string> merged_into =
+      fused_net.folded_bn_layers();
+  merged_into.insert(fused_net.fused_relu_layers().begin(),
+      fused_net.fused_relu_layers().end());
+  std::map<caffe::string, double> forward_time_before;
+  std::map<caffe::string, double> backward_time_before;
+  for (int i = 0; i < caffe_net.layers().size(); ++i) {
+    caffe::string name = caffe_net.layer_names()[i];
+    if (merged_into.count(name)) {
+      name = merged_into[name];
+    }
+    forward_time_before[name] += forward_time_per_layer[i];
+    backward_time_before[name] += backward_time_per_layer[i];
+  }
+  LOG(INFO) << "Average time per layer, fused vs. unfused: ";
+  for (int i = 0; i < fused_net.layers().size(); ++i) {
+    const caffe::string& layername = fused_net.layer_names()[i];
+    LOG(INFO) << std::setfill(' ') << std::setw(10) << layername <<
+      "\tforward: " << fused_forward_time_per_layer[i] << " ms vs. " <<
+      forward_time_before[layername] << " ms.";
+    LOG(INFO) << std::setfill(' ') << std::setw(10) << layername <<
+      "\tbackward: " << fused_backward_time_per_layer[i] << " ms vs. " <<
+      backward_time_before[layername] << " ms.";
+  }
+  for (std::map<caffe::string, caffe::string>::const_iterator it =
+       merged_into.begin(); it != merged_into.end(); ++it) {
+    LOG(INFO) << "Fused " << it->first << " into " << it->second;
+  }
   return 0;
 }
 RegisterBrewFunction(time);
@@ -295,6 +377,14 @@ int main(int argc, char** argv) {
       "  time            benchmark model execution time");
   // Run tool or show usage.
   caffe::GlobalInit(&argc, &argv);
+  // Pin before any OpenMP threads start, so that they inherit the CPUs.
+  if (FLAGS_compute_cpus.size()) {
+    CHECK(Caffe::PinThread(caffe::ParseIdList(FLAGS_compute_cpus)))
+        << "Could not pin the compute threads to " << FLAGS_compute_cpus;
+  }
+  if (FLAGS_prefetch_cpus.size()) {
+    Caffe::set_prefetch_cpus(caffe::ParseIdList(FLAGS_prefetch_cpus));
+  }
   if (argc == 2) {
     return GetBrewFunction(caffe::string(argv[1]))();
   } else {
@@ -0,0 +1,67 @@
+// This program folds the INFERENCE mode BN layers of a deploy net into the
+// convolution or inner product layers that feed them, and writes the net
+// without the BN layers along with the folded weights.
+// Usage:
+//    fold_batch_norm net_proto_file_in trained_weights_in
+//        net_proto_file_out trained_weights_out
+
+#include <map>
+#include <string>
+
+#include "caffe/caffe.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/util/upgrade_proto.hpp"
+
+using std::map;
+using std::string;
+
+using namespace caffe;  // NOLINT(build/namespaces)
+
+int main(int argc, char** argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  if (argc != 5) {
+    LOG(ERROR) << "Usage: fold_batch_norm net_proto_file_in "
+        << "trained_weights_in net_proto_file_out trained_weights_out";
+    return 1;
+  }
+
+  NetParameter net_param;
+  ReadNetParamsFromTextFileOrDie(argv[1], &net_param);
+  NetParameter trained_param;
+  ReadNetParamsFromBinaryFileOrDie(argv[2], &trained_param);
+  // Attach the trained weights to the deploy layers of the same name.
+  map<string, const LayerParameter*> trained_layers;
+  for (int i = 0; i < trained_param.layers_size(); ++i) {
+    trained_layers[trained_param.layers(i).name()] = &trained_param.layers(i);
+  }
+  for (int i = 0; i < net_param.layers_size(); ++i) {
+    LayerParameter* layer_param = net_param.mutable_layers(i);
+    map<string, const LayerParameter*>::const_iterator trained =
+        trained_layers.find(layer_param->name());
+    if (trained != trained_layers.end()) {
+      layer_param->mutable_blobs()->CopyFrom(trained->second->blobs());
+    }
+  }
+
+  NetParameter folded_param;
+  map<string, string> folded_layers;
+  Net<float>::FoldBatchNorm(net_param, &folded_param, &folded_layers);
+  for (map<string, string>::const_iterator it = folded_layers.begin();
+       it != folded_layers.end(); ++it) {
+    LOG(INFO) << "Folded " << it->first << " into " << it->second;
+  }
+  folded_param.clear_fold_batch_norm();
+  WriteProtoToBinaryFile(folded_param, argv[4]);
+
+  // The net definition goes without the weights.
+  for (int i = 0; i < folded_param.layers_size(); ++i) {
+    folded_param.mutable_layers(i)->clear_blobs();
+  }
+  NetParameterPrettyPrint net_param_pretty;
+  NetParameterToPrettyPrint(folded_param, &net_param_pretty);
+  WriteProtoToTextFile(net_param_pretty, argv[3]);
+
+  LOG(ERROR) << "Folded " << folded_layers.size() << " BN layers into "
+      << argv[3] << " and " << argv[4];
+  return 0;
+}
@@ -0,0 +1,492 @@
+// This program serves a deploy net over a local socket, running the requests
+// that arrive together as one batch.
+// Usage:
+//    serve_net -model deploy.prototxt -weights net.caffemodel
+//        (-socket /path/to/socket | -port 5000) [-max_batch 32]
+//        [-max_wait_ms 5] [-replicas 1] [-gpu 0]
+//
+// A request is a BlobProtoVector with a BlobProto for each input blob of the
+// net, holding any number of items (num) of the shape of the input. The reply
+// is a BlobProtoVector with a BlobProto for each output blob, holding the
+// outputs for those items, or no blobs if the request was malformed. Each
+// message is preceded by its size in bytes, a 4 byte unsigned integer in
+// network byte order. A connection carries one request at a time: clients
+// send requests at the same time over several connections.
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "boost/thread.hpp"
+#include "google/protobuf/io/coded_stream.h"
+
+#include "caffe/caffe.hpp"
+#include "caffe/util/upgrade_proto.hpp"
+
+using boost::posix_time::microseconds;
+using boost::system_time;
+using google::protobuf::io::CodedInputStream;
+
+using namespace caffe;  // NOLINT(build/namespaces)
+
+DEFINE_string(model, "",
+    "The deploy net definition protocol buffer text file.");
+DEFINE_string(weights, "",
+    "The trained weights of the net.");
+DEFINE_int32(gpu, -1,
+    "Run in GPU mode on given device ID.");
+DEFINE_string(socket, "",
+    "The path of the UNIX socket to listen on.");
+DEFINE_int32(port, 0,
+    "Listen on this TCP port of localhost instead of a UNIX socket.");
+DEFINE_int32(max_batch, 32,
+    "The most items to run in one batch.");
+DEFINE_double(max_wait_ms, 5,
+    "How long the first request of a batch waits for more to join it.");
+DEFINE_int32(replicas, 1,
+    "The number of copies of the net running batches at the same time; they "
+    "share one copy of the weights.");
+DEFINE_bool(any_size, false,
+    "Accept inputs of any height and width, as fully convolutional nets do; "
+    "otherwise they have to be the size of the net inputs.");
+DEFINE_int32(report_every, 1000,
+    "Log the latency percentiles every this many requests.");
+
+// A request, and its reply once it is done.
+struct Request {
+  BlobProtoVector inputs;
+  BlobProtoVector outputs;
+  int num;
+  // The largest count of one item of an input.
+  int64_t item_count;
+  system_time arrival;
+  bool done;
+};
+
+// Whether two requests can run in one batch.
+static bool SameShape(const Request& a, const Request& b) {
+  for (int i = 0; i < a.inputs.blobs_size(); ++i) {
+    if (a.inputs.blobs(i).height() != b.inputs.blobs(i).height() ||
+        a.inputs.blobs(i).width() != b.inputs.blobs(i).width()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// The requests waiting to run, which the replicas take in batches.
+class BatchQueue {
+ public:
+  BatchQueue(const int max_batch, const double max_wait_ms)
+      : max_batch_(max_batch),
+        max_wait_(microseconds(static_cast<int64_t>(max_wait_ms * 1000))) {}
+
+  // Queues a request and waits until it is done.
+  void Run(Request* request) {
+    boost::mutex::scoped_lock lock(mutex_);
+    request->arrival = boost::get_system_time();
+    request->done = false;
+    requests_.push_back(request);
+    pushed_.notify_one();
+    while (!request->done) {
+      done_.wait(lock);
+    }
+  }
+
+  // Takes the next batch: the first request, and the requests of its shape
+  // behind it, once they make max_batch items or the first request has
+  // waited max_wait_ms.
+  void Pop(vector<Request*>* batch) {
+    boost::mutex::scoped_lock lock(mutex_);
+    for (;;) {
+      while (requests_.empty()) {
+        pushed_.wait(lock);
+      }
+      const system_time deadline = requests_.front()->arrival + max_wait_;
+      if (BatchableItems() >= max_batch_ ||
+          boost::get_system_time() >= deadline) {
+        break;
+      }
+      pushed_.timed_wait(lock, deadline);
+    }
+    batch->clear();
+    const Request* first = requests_.front();
+    int items = 0;
+    for (std::deque<Request*>::iterator it = requests_.begin();
+         it != requests_.end();) {
+      // The batch has to fit the count of a blob, too.
+      const int64_t total = static_cast<int64_t>(items) + (*it)->num;
+      const bool fits = total <= max_batch_ &&
+          total * first->item_count <= INT_MAX;
+      if (SameShape(**it, *first) && (items == 0 || fits)) {
+        items += (*it)->num;
+        batch->push_back(*it);
+        it = requests_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    // Let another replica take what is left.
+    if (!requests_.empty()) {
+      pushed_.notify_one();
+    }
+  }
+
+  // Hands the replies of a batch back to the requests.
+  void Done(const vector<Request*>& batch) {
+    boost::mutex::scoped_lock lock(mutex_);
+    for (int i = 0; i < batch.size(); ++i) {
+      batch[i]->done = true;
+    }
+    done_.notify_all();
+  }
+
+ private:
+  // The items of the requests that can join a batch with the first.
+  int BatchableItems() const {
+    int items = 0;
+    for (int i = 0; i < requests_.size(); ++i) {
+      if (SameShape(*requests_[i], *requests_.front())) {
+        items += requests_[i]->num;
+      }
+    }
+    return items;
+  }
+
+  const int max_batch_;
+  const boost::posix_time::time_duration max_wait_;
+  boost::mutex mutex_;
+  boost::condition_variable pushed_;
+  boost::condition_variable done_;
+  std::deque<Request*> requests_;
+};
+
+// Collects the latencies of the requests, and logs their percentiles.
+class LatencyReport {
+ public:
+  explicit LatencyReport(const int report_every)
+      : report_every_(report_every), batches_(0) {}
+
+  void Add(const vector<Request*>& batch) {
+    const system_time now = boost::get_system_time();
+    boost::mutex::scoped_lock lock(mutex_);
+    if (latencies_ms_.empty()) {
+      start_ = batch[0]->arrival;
+    }
+    for (int i = 0; i < batch.size(); ++i) {
+      latencies_ms_.push_back(
+          (now - batch[i]->arrival).total_microseconds() / 1000.);
+    }
+    ++batches_;
+    if (latencies_ms_.size() >= report_every_) {
+      Report();
+    }
+  }
+
+ private:
+  void Report() {
+    std::sort(latencies_ms_.begin(), latencies_ms_.end());
+    const int count = latencies_ms_.size();
+    const double seconds =
+        (boost::get_system_time() - start_).total_microseconds() / 1e6;
+    LOG(INFO) << count << " requests in " << batches_ << " batches, "
+        << count / seconds << " requests/s; latency p50 "
+        << latencies_ms_[count / 2] << " ms, p90 "
+        << latencies_ms_[count * 9 / 10] << " ms, p99 "
+        << latencies_ms_[count * 99 / 100] << " ms, max "
+        << latencies_ms_.back() << " ms.";
+    latencies_ms_.clear();
+    batches_ = 0;
+  }
+
+  const int report_every_;
+  boost::mutex mutex_;
+  vector<double> latencies_ms_;
+  int batches_;
+  // The arrival of the first request of the report.
+  system_time start_;
+};
+
+// Runs a batch through the net, and splits the outputs into the replies.
+static void RunBatch(Net<float>* net, const vector<Request*>& batch) {
+  int num = 0;
+  for (int i = 0; i < batch.size(); ++i) {
+    num += batch[i]->num;
+  }
+  const vector<Blob<float>*>& inputs = net->input_blobs();
+  for (int k = 0; k < inputs.size(); ++k) {
+    const BlobProto& shape = batch[0]->inputs.blobs(k);
+    inputs[k]->Reshape(num, shape.channels(), shape.height(), shape.width());
+    float* data = inputs[k]->mutable_cpu_data();
+    for (int i = 0; i < batch.size(); ++i) {
+      const BlobProto& input = batch[i]->inputs.blobs(k);
+      std::copy(input.data().begin(), input.data().end(), data);
+      data += input.data_size();
+    }
+  }
+  net->Reshape();
+  const vector<Blob<float>*>& outputs = net->ForwardPrefilled();
+  for (int i = 0; i < batch.size(); ++i) {
+    batch[i]->outputs.Clear();
+  }
+  for (int j = 0; j < outputs.size(); ++j) {
+    const Blob<float>* output = outputs[j];
+    if (output->num() != num) {
+      // Not an output per item (as a loss): every request gets all of it.
+      for (int i = 0; i < batch.size(); ++i) {
+        output->ToProto(batch[i]->outputs.add_blobs());
+      }
+      continue;
+    }
+    const float* data = output->cpu_data();
+    for (int i = 0; i < batch.size(); ++i) {
+      BlobProto* proto = batch[i]->outputs.add_blobs();
+      proto->set_num(batch[i]->num);
+      proto->set_channels(output->channels());
+      proto->set_height(output->height());
+      proto->set_width(output->width());
+      const int count = batch[i]->num * output->offset(1);
+      for (int c = 0; c < count; ++c) {
+        proto->add_data(data[c]);
+      }
+      data += count;
+    }
+  }
+}
+
+// The loop of a replica, taking batches from the queue.
+static void ServeBatches(Net<float>* net, BatchQueue* queue,
+    LatencyReport* report) {
+  if (FLAGS_gpu >= 0) {
+    Caffe::SetDevice(FLAGS_gpu);
+    Caffe::set_mode(Caffe::GPU);
+  } else {
+    Caffe::set_mode(Caffe::CPU);
+  }
+  Caffe::set_phase(Caffe::TEST);
+  vector<Request*> batch;
+  for (;;) {
+    queue->Pop(&batch);
+    RunBatch(net, batch);
+    // Before Done, which lets the connections free the requests.
+    report->Add(batch);
+    queue->Done(batch);
+  }
+}
+
+static bool ReadFully(const int fd, char* data, size_t size) {
+  while (size) {
+    const ssize_t got = recv(fd, data, size, 0);
+    if (got <= 0) {
+      return false;
+    }
+    data += got;
+    size -= got;
+  }
+  return true;
+}
+
+static bool WriteFully(const int fd, const char* data, size_t size) {
+  while (size) {
+    const ssize_t sent = send(fd, data, size, MSG_NOSIGNAL);
+    if (sent <= 0) {
+      return false;
+    }
+    data += sent;
+    size -= sent;
+  }
+  return true;
+}
+
+static bool ReadMessage(const int fd, string* message) {
+  uint32_t size;
+  if (!ReadFully(fd, reinterpret_cast<char*>(&size), sizeof(size))) {
+    return false;
+  }
+  size = ntohl(size);
+  if (size > INT_MAX) {
+    LOG(WARNING) << "Message of " << size << " bytes is too large.";
+    return false;
+  }
+  message->resize(size);
+  return size == 0 || ReadFully(fd, &(*message)[0], size);
+}
+
+static bool WriteMessage(const int fd, const string& message) {
+  const uint32_t size = htonl(message.size());
+  return WriteFully(fd, reinterpret_cast<const char*>(&size), sizeof(size)) &&
+      WriteFully(fd, message.data(), message.size());
+}
+
+// Parses a request and checks it against the inputs of the net.
+static bool ParseRequest(const string& message,
+    const vector<Blob<float>*>& net_inputs, Request* request) {
+  CodedInputStream coded_input(
+      reinterpret_cast<const uint8_t*>(message.data()), message.size());
+  coded_input.SetTotalBytesLimit(INT_MAX, 1073741824);
+  if (!request->inputs.ParseFromCodedStream(&coded_input)) {
+    LOG(WARNING) << "Could not parse a request.";
+    return false;
+  }
+  if (request->inputs.blobs_size() != net_inputs.size()) {
+    LOG(WARNING) << "A request has " << request->inputs.blobs_size()
+        << " inputs, the net " << net_inputs.size() << ".";
+    return false;
+  }
+  request->num = request->inputs.blobs(0).num();
+  if (request->num <= 0) {
+    LOG(WARNING) << "A request has no items.";
+    return false;
+  }
+  request->item_count = 0;
+  for (int k = 0; k < net_inputs.size(); ++k) {
+    const BlobProto& input = request->inputs.blobs(k);
+    const bool size_ok = FLAGS_any_size ||
+        (input.height() == net_inputs[k]->height() &&
+         input.width() == net_inputs[k]->width());
+    // In 64 bits, as the sizes come from the client.
+    const int64_t item_count = static_cast<int64_t>(input.channels()) *
+        input.height() * input.width();
+    const int64_t count = item_count * input.num();
+    if (input.num() != request->num ||
+        input.channels() != net_inputs[k]->channels() || !size_ok ||
+        input.height() <= 0 || input.width() <= 0 ||
+        count > INT_MAX || input.data_size() != count) {
+      LOG(WARNING) << "Input " << k << " of a request has the wrong shape.";
+      return false;
+    }
+    request->item_count = std::max(request->item_count, item_count);
+  }
+  return true;
+}
+
+// The loop of a connection: one request, then its reply.
+static void ServeConnection(const int fd, BatchQueue* queue,
+    const vector<Blob<float>*>* net_inputs) {
+  string message;
+  while (ReadMessage(fd, &message)) {
+    Request request;
+    if (ParseRequest(message, *net_inputs, &request)) {
+      queue->Run(&request);
+    }
+    request.outputs.SerializeToString(&message);
+    if (!WriteMessage(fd, message)) {
+      break;
+    }
+  }
+  close(fd);
+}
+
+static int Listen() {
+  int fd;
+  if (FLAGS_port > 0) {
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    CHECK_GE(fd, 0) << "Could not create a socket.";
+    const int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(FLAGS_port);
+    CHECK_EQ(bind(fd, reinterpret_cast<sockaddr*>(&address),
+        sizeof(address)), 0) << "Could not bind port " << FLAGS_port;
+    LOG(INFO) << "Listening on localhost:" << FLAGS_port;
+  } else {
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    CHECK_GE(fd, 0) << "Could not create a socket.";
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    CHECK_LT(FLAGS_socket.size(), sizeof(address.sun_path))
+        << "Socket path too long.";
+    strncpy(address.sun_path, FLAGS_socket.c_str(),
+        sizeof(address.sun_path) - 1);
+    unlink(FLAGS_socket.c_str());
+    CHECK_EQ(bind(fd, reinterpret_cast<sockaddr*>(&address),
+        sizeof(address)), 0) << "Could not bind " << FLAGS_socket;
+    LOG(INFO) << "Listening on " << FLAGS_socket;
+  }
+  CHECK_EQ(listen(fd, SOMAXCONN), 0) << "Could not listen.";
+  return fd;
+}
+
+int main(int argc, char** argv) {
+  // Print output to stderr (while still logging).
+  FLAGS_alsologtostderr = 1;
+  gflags::SetUsageMessage("serve a deploy net over a local socket\n"
+      "usage: serve_net -model deploy.prototxt -weights net.caffemodel "
+      "(-socket path | -port port)");
+  caffe::GlobalInit(&argc, &argv);
+  CHECK_GT(FLAGS_model.size(), 0) << "Need a model definition to serve.";
+  CHECK_GT(FLAGS_weights.size(), 0) << "Need model weights to serve.";
+  CHECK(FLAGS_socket.size() || FLAGS_port > 0)
+      << "Need a socket path or a port to listen on.";
+  CHECK_GT(FLAGS_max_batch, 0);
+  CHECK_GT(FLAGS_replicas, 0);
+  CHECK_GT(FLAGS_report_every, 0);
+
+  if (FLAGS_gpu >= 0) {
+    LOG(INFO) << "Use GPU with device ID " << FLAGS_gpu;
+    Caffe::SetDevice(FLAGS_gpu);
+    Caffe::set_mode(Caffe::GPU);
+  } else {
+    LOG(INFO) << "Use CPU.";
+    Caffe::set_mode(Caffe::CPU);
+  }
+  Caffe::set_phase(Caffe::TEST);
+  NetParameter param;
+  ReadNetParamsFromTextFileOrDie(FLAGS_model, &param);
+  vector<shared_ptr<Net<float> > > nets;
+  nets.push_back(shared_ptr<Net<float> >(new Net<float>(param)));
+  nets[0]->CopyTrainedLayersFrom(FLAGS_weights);
+  CHECK_GT(nets[0]->input_blobs().size(), 0)
+      << "The net needs input blobs to take the requests.";
+  for (int i = 1; i < FLAGS_replicas; ++i) {
+    nets.push_back(shared_ptr<Net<float> >(
+        new Net<float>(param, nets[0].get())));
+  }
+  // The shapes the requests are checked against, which the replicas do not
+  // change.
+  vector<shared_ptr<Blob<float> > > input_shapes;
+  vector<Blob<float>*> net_inputs;
+  for (int k = 0; k < nets[0]->input_blobs().size(); ++k) {
+    const Blob<float>* input = nets[0]->input_blobs()[k];
+    input_shapes.push_back(shared_ptr<Blob<float> >(new Blob<float>(
+        input->num(), input->channels(), input->height(), input->width())));
+    net_inputs.push_back(input_shapes.back().get());
+  }
+
+  BatchQueue queue(FLAGS_max_batch, FLAGS_max_wait_ms);
+  LatencyReport report(FLAGS_report_every);
+  boost::thread_group replicas;
+  for (int i = 0; i < nets.size(); ++i) {
+    replicas.create_thread(boost::bind(&ServeBatches, nets[i].get(), &queue,
+        &report));
+  }
+  const int listen_fd = Listen();
+  for (;;) {
+    const int fd = accept(listen_fd, NULL, NULL);
+    if (fd < 0) {
+      LOG(WARNING) << "Could not accept a connection: " << strerror(errno);
+      continue;
+    }
+    if (FLAGS_port > 0) {
+      const int on = 1;
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    }
+    boost::thread(&ServeConnection, fd, &queue, &net_inputs).detach();
+  }
+  return 0;
+}